@@ -20,6 +20,25 @@ class FaasmConfig
 
     std::string wasmVm;
 
+    int moduleCacheMaxMb;
+    std::string resetMode;
+
+    int warmPoolMaxSize;
+    int warmPoolWindowMs;
+
+    std::string tieredCompilation;
+
+    std::string hugePages;
+    std::string guardMode;
+    std::string snapshotMode;
+    std::string restoreMode;
+    std::string shareZygoteMemory;
+    std::string ompLocalFork;
+
+    int functionMemoryLimitMb;
+    int userMemoryLimitMb;
+    int memorySoftLimitPercent;
+
     std::string functionDir;
     std::string objectFileDir;
     std::string runtimeFilesDir;
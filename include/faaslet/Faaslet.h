@@ -27,6 +27,12 @@ class Faaslet final : public faabric::scheduler::Executor
 
     faabric::util::SnapshotData snapshot() override;
 
+    // Isolation resources can be claimed ahead of execution (e.g. when
+    // pre-warming), but threads can only join them once executing
+    void prepareIsolation();
+
+    void releaseIsolation();
+
   protected:
     void postFinish() override;
 
@@ -35,6 +41,13 @@ class Faaslet final : public faabric::scheduler::Executor
   private:
     bool isIsolated = false;
 
+    // Running on the baseline tier until the optimised module is ready
+    bool isBaselineTier = false;
+
+    bool bindBaselineTier(faabric::Message& msg);
+
+    void bindOptimisedTier(faabric::Message& msg);
+
     std::shared_ptr<isolation::NetworkNamespace> ns;
 };
 
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <faaslet/Faaslet.h>
+
+#include <faabric/proto/faabric.pb.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#define WARM_POOL_INTERVAL_MS 100
+
+namespace faaslet {
+
+/**
+ * Keeps a number of bound Faaslets ready to be handed out for each function
+ * that has been called recently. The number kept for a function tracks the
+ * number of calls to it seen in the last WARM_POOL_WINDOW_MS, capped at
+ * WARM_POOL_MAX_SIZE. Warm Faaslets are created on a background thread.
+ */
+class FaasletPool
+{
+  public:
+    ~FaasletPool();
+
+    void start();
+
+    void shutdown();
+
+    // Records the call and returns a warm Faaslet for it if one is ready,
+    // or nullptr otherwise
+    std::shared_ptr<Faaslet> take(faabric::Message& msg);
+
+    // Brings the pool for each function in line with its target size
+    void warm();
+
+    void clear();
+
+    // Discards the user's warm Faaslets to give back their memory, e.g. when
+    // the user nears its memory limit
+    void reclaim(const std::string& user);
+
+    // Has the warmer thread reclaim for the user. Used for memory quota
+    // reclaims, which come from a module growing its memory with its memory
+    // lock held, where tearing down other Faaslets isn't safe.
+    void requestReclaim(const std::string& user);
+
+    size_t getWarmCount(const std::string& funcStr);
+
+    int getTargetSize(const std::string& funcStr);
+
+  private:
+    struct FunctionPool
+    {
+        faabric::Message templateMsg;
+        std::deque<std::chrono::steady_clock::time_point> arrivals;
+        std::vector<std::shared_ptr<Faaslet>> warm;
+        int pending = 0;
+    };
+
+    std::mutex mx;
+    std::condition_variable cv;
+    std::unordered_map<std::string, FunctionPool> pools;
+
+    std::thread warmerThread;
+    bool running = false;
+    bool warmRequested = false;
+    std::unordered_set<std::string> reclaimRequests;
+
+    int doGetTargetSize(FunctionPool& pool);
+};
+
+FaasletPool& getFaasletPool();
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <faabric/proto/faabric.pb.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace faaslet {
+
+/**
+ * Tiered compilation for WAVM functions. When a function has no object code,
+ * rather than blocking its first call on a full compile, Faaslets start on a
+ * baseline tier: a WAMR module compiled with optimisations turned off. The
+ * fully optimised WAVM module is compiled in the background and put in the
+ * IR module cache, after which new Faaslets use it, and baseline Faaslets
+ * switch to it when they're next reset.
+ */
+class TieredCompiler
+{
+  public:
+    ~TieredCompiler();
+
+    // Whether a Faaslet for this call should start on the baseline tier
+    bool shouldUseBaseline(const faabric::Message& msg);
+
+    // Returns the baseline object code, compiling it if need be
+    std::vector<uint8_t> getBaselineObject(const faabric::Message& msg);
+
+    // Compiles the optimised module in the background, unless already
+    // underway
+    void startOptimising(const faabric::Message& msg);
+
+    bool isOptimised(const faabric::Message& msg);
+
+    void waitForOptimisations();
+
+    void clear();
+
+    size_t getOptimisingCount();
+
+  private:
+    std::mutex mx;
+
+    // Whether WAMR can link all of a function's imports
+    std::unordered_map<std::string, bool> baselineSupported;
+
+    bool canRunOnBaseline(const faabric::Message& msg);
+
+    std::unordered_map<std::string, std::vector<uint8_t>> baselineObjects;
+    std::unordered_map<std::string, std::shared_ptr<std::mutex>>
+      baselineMutexes;
+
+    std::unordered_set<std::string> optimising;
+    std::unordered_set<std::string> optimised;
+    std::vector<std::thread> optimiseThreads;
+};
+
+TieredCompiler& getTieredCompiler();
+}
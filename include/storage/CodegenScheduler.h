@@ -0,0 +1,77 @@
+#pragma once
+
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace storage {
+
+struct CodegenTask
+{
+    std::string user;
+    std::string function;
+    size_t wasmBytes = 0;
+};
+
+struct CodegenResult
+{
+    std::string user;
+    std::string function;
+    size_t wasmBytes = 0;
+
+    // Object was already up to date
+    bool skipped = false;
+
+    // Object code reused from another function with identical wasm
+    bool deduplicated = false;
+
+    bool failed = false;
+
+    long compileMillis = 0;
+
+    // High-water mark of the whole process once this module was done
+    long peakRssKb = 0;
+};
+
+/**
+ * Runs codegen for many functions in parallel. Tasks are dealt out largest
+ * first to per-thread queues, and idle threads steal from the others. Object
+ * code is generated once per distinct wasm hash and reused for any other
+ * functions with identical wasm.
+ */
+class CodegenScheduler
+{
+  public:
+    explicit CodegenScheduler(int nThreadsIn);
+
+    void addFunction(const std::string& user, const std::string& function);
+
+    void addUser(const std::string& user);
+
+    void addAllUsers();
+
+    size_t getTaskCount();
+
+    std::vector<CodegenResult> run();
+
+  private:
+    int nThreads;
+
+    std::vector<CodegenTask> tasks;
+
+    std::vector<std::deque<CodegenTask>> queues;
+    std::vector<std::unique_ptr<std::mutex>> queueMutexes;
+
+    std::mutex dedupMx;
+    std::unordered_map<std::string, std::shared_future<std::vector<uint8_t>>>
+      objectsByHash;
+
+    bool nextTask(int threadIdx, CodegenTask& task);
+
+    CodegenResult doCodegen(const CodegenTask& task);
+};
+}
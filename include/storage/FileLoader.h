@@ -86,13 +86,20 @@ class FileLoader
 
     void codegenForSharedObject(const std::string& inputPath);
 
-  protected:
     std::vector<uint8_t> doCodegen(std::vector<uint8_t>& bytes,
                                    const std::string& fileName,
                                    bool isSgx = false);
 
-    std::vector<uint8_t> hashBytes(const std::vector<uint8_t>& bytes);
+    static std::vector<uint8_t> hashBytes(const std::vector<uint8_t>& bytes);
+
+    // Hash and upload of codegen output for the configured wasm VM
+    std::vector<uint8_t> loadFunctionCodegenHash(const faabric::Message& msg);
 
+    void uploadFunctionCodegen(const faabric::Message& msg,
+                               const std::vector<uint8_t>& objBytes,
+                               const std::vector<uint8_t>& hash);
+
+  protected:
     std::string getHashFilePath(const std::string& path);
 };
 
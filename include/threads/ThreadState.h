@@ -1,17 +1,264 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <thread>
 #include <vector>
 
 #include <faabric/proto/faabric.pb.h>
 #include <faabric/util/environment.h>
 #include <faabric/util/locks.h>
 
+// Keeps hot atomics used for spinning on separate cache lines
+#define CACHE_LINE_BYTES 64
+
+// Threads of the team in another host's memory never arrive at a barrier in
+// this one, so waiting fails after this long, as with faabric's latches
+#define BARRIER_TIMEOUT_MS 10000
+
 namespace threads {
 
 void clearThreadState();
 
+/*
+ * Set once a thread of a level fails, so that the others stop waiting for it.
+ * Every primitive a thread of the level can block in checks the same flag.
+ */
+class AbortFlag
+{
+  public:
+    void set();
+
+    bool isSet() const;
+
+    // Throws if the level has been aborted
+    void check() const;
+
+  private:
+    std::atomic<bool> flag = false;
+};
+
+/*
+ * Sense-reversing barrier for the threads of a level in the same memory. The
+ * last thread to arrive resets the count and flips the generation, which the
+ * others spin on. The count and generation live on separate cache lines, so
+ * arrivals don't keep invalidating the line the waiters are reading.
+ */
+class Barrier
+{
+  public:
+    Barrier(int numThreadsIn,
+            const AbortFlag& abortedIn,
+            int timeoutMsIn = BARRIER_TIMEOUT_MS);
+
+    // Throws if the level is aborted, for when a thread of the team will
+    // never arrive, or if the team doesn't arrive in time
+    void wait();
+
+  private:
+    const int numThreads;
+
+    const int timeoutMs;
+
+    const AbortFlag& aborted;
+
+    alignas(CACHE_LINE_BYTES) std::atomic<int> count = 0;
+
+    alignas(CACHE_LINE_BYTES) std::atomic<uint32_t> generation = 0;
+};
+
+/*
+ * FIFO spinlock for critical sections. Threads take a ticket and back off in
+ * proportion to their distance from the front of the queue. Critical sections
+ * can be nested, so the owner may lock again.
+ */
+class TicketLock
+{
+  public:
+    explicit TicketLock(const AbortFlag& abortedIn);
+
+    // Throws if the level is aborted while waiting, as the owner may have
+    // failed inside the critical section
+    void lock();
+
+    void unlock();
+
+  private:
+    const AbortFlag& aborted;
+
+    alignas(CACHE_LINE_BYTES) std::atomic<uint32_t> nextTicket = 0;
+
+    alignas(CACHE_LINE_BYTES) std::atomic<uint32_t> nowServing = 0;
+
+    std::atomic<std::thread::id> owner;
+
+    int depth = 0;
+};
+
+/*
+ * Counts the unfinished tasks that a taskwait or taskgroup is waiting on
+ */
+class TaskCounter
+{
+  public:
+    std::atomic<int> count = 0;
+};
+
+/*
+ * An explicit OpenMP task. The task itself lives in the wasm memory shared by
+ * the threads of the level, so we only keep a pointer to it, along with the
+ * counters to decrement once it has run.
+ */
+class ExplicitTask
+{
+  public:
+    int32_t taskPtr = 0;
+
+    // Children of the task that created this one, for taskwait
+    std::shared_ptr<TaskCounter> siblings = nullptr;
+
+    // Innermost taskgroup this one was created in, if any
+    std::shared_ptr<TaskCounter> group = nullptr;
+
+    // Whether the task that created this one is final
+    bool parentFinal = false;
+};
+
+/*
+ * Work-stealing deques of the explicit tasks of a level, one per thread.
+ * Threads push and pop their own tasks at the back, and steal from the front
+ * of the others' once theirs is empty, i.e. take the oldest tasks, which are
+ * usually the largest in divide-and-conquer code.
+ */
+class TaskPool
+{
+  public:
+    explicit TaskPool(int numThreadsIn);
+
+    // Returns false if the thread already has too many tasks queued, in which
+    // case it should run the task itself
+    bool push(int threadNum, const ExplicitTask& task);
+
+    bool pop(int threadNum, ExplicitTask& task);
+
+    // Called once a popped task has run
+    void finish(const ExplicitTask& task);
+
+    // Number of tasks queued or running
+    int getOutstanding();
+
+  private:
+    struct alignas(CACHE_LINE_BYTES) TaskDeque
+    {
+        std::mutex mx;
+        std::deque<ExplicitTask> tasks;
+
+        // Lets thieves skip empty deques without locking them
+        std::atomic<int> size = 0;
+    };
+
+    const int numThreads;
+
+    std::vector<TaskDeque> deques;
+
+    alignas(CACHE_LINE_BYTES) std::atomic<int> outstanding = 0;
+};
+
+// Synchronisation objects created once per level, rather than per use
+class LevelSync
+{
+  public:
+    explicit LevelSync(int numThreads);
+
+    // Shared with the level's reduction, which outlives these
+    std::shared_ptr<AbortFlag> aborted = std::make_shared<AbortFlag>();
+
+    Barrier barrier;
+
+    TicketLock critical;
+
+    TaskPool tasks;
+};
+
+/*
+ * Synchronisation for the reductions of a level between the threads sharing
+ * the master's memory. These combine their data in a tree, so that rank 0 (the
+ * master) ends up with the result. Each reduction in a parallel region is a
+ * separate round, as threads can run ahead after a nowait reduction.
+ */
+class Reduction
+{
+  public:
+    explicit Reduction(std::shared_ptr<AbortFlag> abortedIn);
+
+    // Wakes up threads waiting on the reduction once the level is aborted,
+    // which then throw
+    void notifyAborted();
+
+    // Sets the threads sharing the master's memory, which must include the
+    // master. Threads wait for this before taking part in a reduction.
+    void setLocalThreads(const std::vector<int>& localThreadNumsIn);
+
+    std::vector<int> getLocalThreads();
+
+    // Threads of the level not in the master's memory
+    std::vector<int> getRemoteThreads(int numThreads);
+
+    int getRank(int localThreadNum);
+
+    // Makes a rank's data available to its parent in the tree
+    void arrive(int round, int rank, int32_t reduceData);
+
+    int32_t awaitArrival(int round, int rank);
+
+    void markConsumed(int round, int rank);
+
+    void awaitConsumed(int round, int rank);
+
+    void release(int round);
+
+    void awaitRelease(int round);
+
+    // Called by each rank once done with the round
+    void finish(int round);
+
+  private:
+    struct Round
+    {
+        std::map<int, int32_t> arrived;
+        std::map<int, bool> consumed;
+        bool released = false;
+        int nFinished = 0;
+    };
+
+    std::shared_ptr<AbortFlag> aborted;
+
+    std::mutex mx;
+    std::condition_variable cv;
+
+    bool placed = false;
+    std::vector<int> localThreadNums;
+
+    std::map<int, Round> rounds;
+
+    void awaitPlaced(std::unique_lock<std::mutex>& lock);
+};
+
+/*
+ * Iterations of a dynamically scheduled loop, shared by the threads of a level
+ * in the same memory. Threads claim chunks by advancing the counter.
+ */
+class SharedLoop
+{
+  public:
+    std::atomic<uint64_t> next = 0;
+    std::atomic<int> nFinished = 0;
+};
+
 // A Level is a layer of threads in an OpenMP application.
 // Note, defaults are set to replicate the behaviour as of Clang 9.0.1
 class Level
@@ -64,15 +311,53 @@ class Level
 
     void waitOnBarrier();
 
+    // Called when a thread of the level fails, releasing the others from
+    // barriers, critical sections, reductions and task waits
+    void abort();
+
+    // Throws if the level has been aborted
+    void checkAborted();
+
     void lockCritical();
 
     void unlockCritical();
 
+    // Explicit tasks can only be shared by threads in the same memory
+    std::shared_ptr<TaskPool> getTaskPool();
+
+    // Drops the barrier, lock and tasks once all threads of the level have
+    // finished
+    void clearSync();
+
+    // Track the threads of the level running in another host's memory than
+    // the master's, the last to finish dropping the level's sync objects
+    void startRemoteThread();
+
+    void finishRemoteThread();
+
+    // Reductions are only set up in the master's process, so threads in
+    // another host's memory get a null pointer
+    void prepareReduction();
+
+    std::shared_ptr<Reduction> getReduction();
+
+    void clearReduction();
+
+    // Each dynamically scheduled loop in a parallel region gets its own index
+    std::shared_ptr<SharedLoop> getSharedLoop(int loopIdx);
+
+    // Called by each thread once it's run out of iterations, the last one
+    // removes the loop
+    void finishSharedLoop(int loopIdx);
+
     int getLocalThreadNum(faabric::Message* msg);
 
     int getGlobalThreadNum(int localThreadNum);
 
     int getGlobalThreadNum(faabric::Message* msg);
+
+  private:
+    std::shared_ptr<LevelSync> getSync();
 };
 
 class PthreadTask
@@ -3,23 +3,77 @@
 #include <wasm/WasmModule.h>
 #include <wasm_runtime_common.h>
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
 #define ERROR_BUFFER_SIZE 256
 #define STACK_SIZE_KB 8192
 #define HEAP_SIZE_KB 8192
 
+#define WAMR_OPT_LEVEL 3
+#define WAMR_BASELINE_OPT_LEVEL 0
+
 namespace wasm {
 
 #if (WAMR_EXECUTION_MODE_INTERP)
 // We can't support WAMR codegen in interpreter mode
 #else
-std::vector<uint8_t> wamrCodegen(std::vector<uint8_t>& wasmBytes, bool isSgx);
+std::vector<uint8_t> wamrCodegen(std::vector<uint8_t>& wasmBytes,
+                                 bool isSgx,
+                                 int optLevel = WAMR_OPT_LEVEL);
 #endif
 
+// WAMR may refer back to the bytes a module was loaded from, so they must
+// outlive the loaded module
+std::vector<uint8_t> loadWAMRModuleBytes(const faabric::Message& msg);
+
+WASMModuleCommon* loadWAMRModule(std::vector<uint8_t>& moduleBytes);
+
+/*
+ * A loaded WAMR module, shared by all instances of the function
+ */
+struct WAMRCachedModule
+{
+    std::vector<uint8_t> moduleBytes;
+    WASMModuleCommon* wasmModule = nullptr;
+
+    // Image of a freshly instantiated instance's memory, written by the first
+    // instance to bind and mapped privately by the rest
+    std::mutex zygoteMx;
+    int zygoteMemoryFd = -1;
+    size_t zygoteMemoryBytes = 0;
+
+    ~WAMRCachedModule();
+};
+
+class WAMRModuleCache
+{
+  public:
+    std::shared_ptr<WAMRCachedModule> getCachedModule(
+      const faabric::Message& msg);
+
+    void clear();
+
+    size_t getTotalCachedModuleCount();
+
+  private:
+    std::shared_mutex mx;
+    std::unordered_map<std::string, std::shared_ptr<WAMRCachedModule>>
+      cachedModuleMap;
+};
+
+WAMRModuleCache& getWAMRModuleCache();
+
 class WAMRWasmModule final : public WasmModule
 {
   public:
     static void initialiseWAMRGlobally();
 
+    static void clearCaches();
+
     WAMRWasmModule();
 
     explicit WAMRWasmModule(int threadPoolSizeIn);
@@ -29,8 +83,31 @@ class WAMRWasmModule final : public WasmModule
     // ----- Module lifecycle -----
     void doBindToFunction(faabric::Message& msg, bool cache) override;
 
+    void reset(faabric::Message& msg) override;
+
+    // Binds to the given object code rather than loading the function's AOT
+    // file, e.g. when running a baseline compile of the function
+    void setObjectBytes(const std::vector<uint8_t>& objectBytesIn);
+
     int32_t executeFunction(faabric::Message& msg) override;
 
+    // ----- Threading -----
+    int32_t executeOMPThread(int threadPoolIdx,
+                             uint32_t stackTop,
+                             faabric::Message& msg) override;
+
+    int32_t executePthread(int threadPoolIdx,
+                           uint32_t stackTop,
+                           faabric::Message& msg) override;
+
+    std::unordered_map<int32_t, uint32_t> chainedThreads;
+
+    std::atomic<int> pthreadCounter = 0;
+
+    // Returns the instance that runs threads from the given pool index,
+    // creating it on first use
+    WASMModuleInstanceCommon* getThreadInstance(int threadPoolIdx);
+
     // ----- Memory management -----
     uint32_t growMemory(uint32_t nBytes) override;
 
@@ -38,21 +115,65 @@ class WAMRWasmModule final : public WasmModule
 
     uint32_t mmapMemory(uint32_t nBytes) override;
 
-    uint32_t mmapFile(uint32_t fp, uint32_t length) override;
-
     uint8_t* wasmPointerToNative(int32_t wasmPtr) override;
 
     size_t getMemorySizeBytes() override;
 
+    // Handles guest memory.grow instructions from any of this module's
+    // instances, returning false if the memory can't be grown
+    bool enlargeGuestMemory(uint32_t nPages);
+
+  protected:
+    uint8_t* getMemoryBase() override;
+
   private:
     char errorBuffer[ERROR_BUFFER_SIZE];
 
-#if (WAMR_EXECUTION_MODE_INTERP)
-    std::vector<uint8_t> wasmBytes;
-#endif
+    // Set when this module loaded its own bytes rather than sharing a cached
+    // module
+    std::vector<uint8_t> moduleBytes;
+    bool ownsWasmModule = false;
+    std::shared_ptr<WAMRCachedModule> cachedModule = nullptr;
+
+    WASMModuleCommon* wasmModule = nullptr;
+    WASMModuleInstanceCommon* moduleInstance = nullptr;
+
+    // Memory, break and globals of the freshly instantiated module, which are
+    // restored on reset in place of instantiating again
+    int zygoteMemoryFd = -1;
+    bool ownsZygoteMemoryFd = false;
+    size_t zygoteMemoryBytes = 0;
+    uint32_t zygoteBrk = 0;
+    std::vector<uint8_t> zygoteGlobals;
 
-    WASMModuleCommon* wasmModule;
-    WASMModuleInstanceCommon* moduleInstance;
+    void instantiateModule();
+
+    void takeZygote();
+
+    int writeZygoteMemory();
+
+    void restoreZygote();
+
+    void remapZygoteMemory(size_t offset, size_t length);
+
+    bool enlargeMemory(uint32_t nPages);
+
+    // WAMR keeps globals (including the stack pointer) per instance, so each
+    // thread gets its own instance of the module, pointed at this instance's
+    // linear memory. The thread instances' own memory structs are kept so
+    // they can be put back before deinstantiating.
+    std::mutex threadInstancesMx;
+    std::vector<WASMModuleInstanceCommon*> threadInstances;
+    std::vector<std::vector<uint8_t>> threadInstanceMemories;
+
+    void shareMemoryWithThreads();
+
+    void destroyThreadInstances();
+
+    bool executeThreadFunction(int threadPoolIdx,
+                               uint32_t stackTop,
+                               int wasmFuncPtr,
+                               std::vector<uint32_t>& argv);
 
     int executeWasmFunction(const std::string& funcName);
 
@@ -60,4 +181,6 @@ class WAMRWasmModule final : public WasmModule
 };
 
 void tearDownWAMRGlobally();
+
+WAMRWasmModule* getExecutingWAMRModule();
 }
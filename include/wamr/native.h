@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include <lib_export.h>
+#include <string>
 
 #define REG_NATIVE_FUNC(func_name, signature)                                  \
     {                                                                          \
@@ -31,6 +32,10 @@
 namespace wasm {
 void initialiseWAMRNatives();
 
+// Whether WAMR can resolve the given import, i.e. it's one of the natives
+// registered above or part of WAMR's built-in WASI
+bool isWAMRNativeSymbol(const std::string& moduleName, const std::string& name);
+
 uint32_t getFaasmDynlinkApi(NativeSymbol** nativeSymbols);
 
 uint32_t getFaasmFilesystemApi(NativeSymbol** nativeSymbols);
@@ -39,6 +44,8 @@ uint32_t getFaasmFunctionsApi(NativeSymbol** nativeSymbols);
 
 uint32_t getFaasmMemoryApi(NativeSymbol** nativeSymbols);
 
+uint32_t getFaasmOpenMPApi(NativeSymbol** nativeSymbols);
+
 uint32_t getFaasmPthreadApi(NativeSymbol** nativeSymbols);
 
 uint32_t getFaasmStateApi(NativeSymbol** nativeSymbols);
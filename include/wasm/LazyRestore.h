@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace wasm {
+
+/*
+ * Restores a snapshot into memory on demand using userfaultfd. The memory is
+ * replaced with missing pages, each of which is copied from the snapshot's fd
+ * when first touched. Pages touched while restoring a function are recorded,
+ * and prefetched in the background the next time it's restored.
+ *
+ * Stopping leaves any pages not yet copied as zeroes, so must only happen
+ * once the memory is about to be replaced or freed.
+ */
+class LazyRestore
+{
+  public:
+    LazyRestore(const std::string& hotPagesKeyIn,
+                uint8_t* memoryIn,
+                int snapshotFdIn,
+                size_t nBytesIn);
+
+    ~LazyRestore();
+
+    // Throws if userfaultfd isn't available, leaving the memory untouched
+    void start();
+
+    void stop();
+
+    size_t getFaultCount();
+
+    size_t getPrefetchCount();
+
+  private:
+    std::string hotPagesKey;
+    uint8_t* memory = nullptr;
+    int snapshotFd = -1;
+    size_t nBytes = 0;
+    size_t pageSize = 0;
+
+    uint8_t* source = nullptr;
+    int uffd = -1;
+    int stopFd = -1;
+    bool started = false;
+
+    std::atomic<bool> stopping = false;
+    std::atomic<size_t> faultCount = 0;
+    std::atomic<size_t> prefetchCount = 0;
+
+    std::thread handlerThread;
+    std::thread prefetchThread;
+
+    // Only touched by the handler thread until it's joined
+    std::vector<uint32_t> faultedPages;
+
+    bool copyPage(uint32_t pageIdx);
+
+    void handleFaults();
+
+    void prefetch(std::vector<uint32_t> pages);
+
+    void cleanUp();
+};
+
+// Pages recorded as touched when restoring the given key
+std::vector<uint32_t> getHotPages(const std::string& key);
+
+void clearHotPages();
+}
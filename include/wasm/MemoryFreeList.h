@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+
+namespace wasm {
+
+/*
+ * Page-granular record of the unmapped regions below the break of a module's
+ * linear memory, so that they can be handed out again by later mmaps. Adjacent
+ * regions are coalesced. Not thread-safe, callers must hold the module's
+ * memory lock.
+ */
+class MemoryFreeList
+{
+  public:
+    // Claims the lowest free region big enough for the given bytes, returning
+    // false if there isn't one
+    bool allocate(uint32_t nBytes, uint32_t& offset);
+
+    void free(uint32_t offset, uint32_t nBytes);
+
+    // Removes a free region ending at the given break, returning the new
+    // (lower) break if there was one
+    uint32_t trimTop(uint32_t brk);
+
+    // Drops any free memory at or above the given break
+    void removeAbove(uint32_t brk);
+
+    void clear();
+
+    size_t getFreeBytes();
+
+    size_t getRegionCount();
+
+  private:
+    // Offset -> length
+    std::map<uint32_t, uint32_t> regions;
+};
+}
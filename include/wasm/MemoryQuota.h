@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace wasm {
+
+enum MemoryQuotaResult
+{
+    QUOTA_OK = 0,
+    QUOTA_SOFT_LIMIT = 1,
+    QUOTA_HARD_LIMIT = 2,
+};
+
+/*
+ * Accounts the linear memory committed by modules on this host against the
+ * per-function and per-user limits in the Faasm config. Growth past a hard
+ * limit is refused, while growth past a soft limit is allowed but should be
+ * followed by a call to reclaim, which hands the offending user to the
+ * registered reclaimer (e.g. to drop idle warm modules). Reclaim is called
+ * while growing memory, so the reclaimer mustn't release modules itself, but
+ * should leave that to another thread.
+ */
+class MemoryQuota
+{
+  public:
+    // Charges the bytes to the function and its user unless that would take
+    // either over its hard limit, or regardless if not enforcing
+    MemoryQuotaResult charge(const std::string& user,
+                             const std::string& function,
+                             size_t nBytes,
+                             bool enforce = true);
+
+    void release(const std::string& user,
+                 const std::string& function,
+                 size_t nBytes);
+
+    void reclaim(const std::string& user, const std::string& function);
+
+    void setReclaimer(
+      std::function<void(const std::string&, const std::string&)> func);
+
+    size_t getFunctionBytes(const std::string& user,
+                            const std::string& function);
+
+    size_t getUserBytes(const std::string& user);
+
+    size_t getHostBytes();
+
+    void clear();
+
+  private:
+    std::mutex mx;
+
+    std::unordered_map<std::string, size_t> functionBytes;
+    std::unordered_map<std::string, size_t> userBytes;
+    size_t hostBytes = 0;
+
+    std::function<void(const std::string&, const std::string&)> reclaimer;
+};
+
+MemoryQuota& getMemoryQuota();
+}
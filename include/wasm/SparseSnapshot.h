@@ -0,0 +1,68 @@
+#pragma once
+
+#include <faabric/util/snapshot.h>
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define SPARSE_SNAPSHOT_MAGIC 0x53505253
+#define SPARSE_SNAPSHOT_KEY_PREFIX "sparse:"
+
+namespace wasm {
+
+/*
+ * A sparse snapshot holds only the pages of a module's memory that differ
+ * from a base, normally the function's zygote, so restoring it means resetting
+ * to the base and writing the pages back. It's serialised as this header,
+ * followed by a table of (offset, length) regions, followed by their bytes.
+ */
+struct SparseSnapshotHeader
+{
+    uint32_t magic = SPARSE_SNAPSHOT_MAGIC;
+
+    // Size of the memory snapshotted, i.e. its break
+    uint32_t memorySize = 0;
+
+    // Size of the base the regions differ from, zero if the base is empty
+    // (all zeroes)
+    uint32_t baseSize = 0;
+
+    uint32_t nRegions = 0;
+};
+
+// Host pages of the memory differing from the base, which is zero beyond its
+// size. Ranges to skip (e.g. guard regions) are taken to be unchanged.
+std::vector<std::pair<uint32_t, uint32_t>> getChangedRegions(
+  const uint8_t* memory,
+  uint32_t memorySize,
+  const uint8_t* base,
+  uint32_t baseSize,
+  const std::vector<std::pair<uint32_t, uint32_t>>& skipRegions);
+
+std::vector<uint8_t> serialiseSparseSnapshot(
+  const uint8_t* memory,
+  uint32_t memorySize,
+  uint32_t baseSize,
+  const std::vector<std::pair<uint32_t, uint32_t>>& regions);
+
+SparseSnapshotHeader readSparseSnapshotHeader(const uint8_t* data,
+                                              size_t size);
+
+// Writes the snapshot's regions into memory already reset to its base
+void applySparseSnapshot(const uint8_t* data, size_t size, uint8_t* memory);
+
+// ----- Local storage -----
+
+bool isSparseSnapshotKey(const std::string& key);
+
+// Keeps the serialised snapshot alive while the registry refers to it
+faabric::util::SnapshotData storeSparseSnapshot(const std::string& key,
+                                                std::vector<uint8_t> data);
+
+// Frees the serialised snapshot once it's deleted from the registry
+void releaseSparseSnapshot(const std::string& key);
+
+size_t getStoredSparseSnapshotCount();
+}
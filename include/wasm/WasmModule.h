@@ -1,5 +1,7 @@
 #pragma once
 
+#include "LazyRestore.h"
+#include "MemoryFreeList.h"
 #include "WasmEnvironment.h"
 
 #include <faabric/proto/faabric.pb.h>
@@ -10,7 +12,11 @@
 #include <threads/MutexManager.h>
 #include <threads/ThreadState.h>
 
+#include <atomic>
+#include <cstdint>
 #include <exception>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <sys/uio.h>
@@ -23,6 +29,10 @@
 
 #define WASM_BYTES_PER_PAGE 65536
 
+// Returned in place of an offset when memory can't be grown within the
+// memory limits, which the guest sees as -1
+#define MEMORY_GROW_FAILED UINT32_MAX
+
 // Note: this is *not* controlling the size provisioned by the linker, that is
 // hard-coded in the build. This variable is just here for reference and must be
 // updated to match the value in the build.
@@ -66,6 +76,10 @@ class WasmModule
     // ----- Module lifecycle -----
     virtual void reset(faabric::Message& msg);
 
+    // Resets to the zygote that sparse snapshots are taken against, which
+    // unlike a normal reset needn't follow the reset mode
+    virtual void resetToSnapshotBase(faabric::Message& msg);
+
     void bindToFunction(faabric::Message& msg, bool cache = true);
 
     int32_t executeTask(int threadPoolIdx,
@@ -82,6 +96,9 @@ class WasmModule
                                    uint32_t stackTop,
                                    faabric::Message& msg);
 
+    // Top of the thread stack the given stack pointer is in
+    uint32_t getThreadStackTop(uint32_t stackPointer);
+
     bool isBound();
 
     std::string getBoundUser();
@@ -118,18 +135,32 @@ class WasmModule
     // ----- Memory management -----
     uint32_t getCurrentBrk();
 
+    // Growing and mapping return MEMORY_GROW_FAILED if the memory limits
+    // don't allow the growth
     virtual uint32_t growMemory(uint32_t nBytes);
 
     virtual uint32_t shrinkMemory(uint32_t nBytes);
 
     virtual uint32_t mmapMemory(uint32_t nBytes);
 
-    virtual uint32_t mmapFile(uint32_t fp, uint32_t length);
+    // Maps a window of the file at the given (host page aligned) offset into
+    // newly allocated memory, or returns MEMORY_GROW_FAILED as above
+    uint32_t mmapFile(uint32_t fd,
+                      uint32_t length,
+                      int prot,
+                      int flags,
+                      uint64_t offset);
 
     virtual void unmapMemory(uint32_t offset, uint32_t nBytes);
 
+    // Honours the guest's madvise, giving up the pages for MADV_DONTNEED and
+    // MADV_FREE. Guard regions are left alone.
+    void adviseMemory(uint32_t offset, uint32_t nBytes, int advice);
+
     uint32_t createMemoryGuardRegion(uint32_t wasmOffset);
 
+    std::map<uint32_t, uint32_t> getGuardRegions();
+
     virtual uint32_t mapSharedStateMemory(
       const std::shared_ptr<faabric::state::StateKeyValue>& kv,
       long offset,
@@ -139,13 +170,27 @@ class WasmModule
 
     virtual size_t getMemorySizeBytes();
 
+    // Bytes of linear memory backed by physical memory, as opposed to the
+    // committed bytes from getMemorySizeBytes
+    size_t getResidentMemoryBytes();
+
     // ----- Snapshot/ restore -----
     faabric::util::SnapshotData getSnapshotData();
 
+    std::vector<std::pair<uint32_t, uint32_t>> getDirtyRegions();
+
     std::string snapshot(bool locallyRestorable = true);
 
     void restore(const std::string& snapshotKey);
 
+    // Whether memory is still being filled in from a lazily restored snapshot
+    bool isRestoringLazily();
+
+    // The module this one is reset to, whose memory is the base of sparse
+    // snapshots. Must be held while its memory is read. Null if there's no
+    // zygote to hand.
+    virtual std::shared_ptr<WasmModule> getZygote();
+
     // ----- Debugging -----
     virtual void printDebugInfo();
 
@@ -166,6 +211,10 @@ class WasmModule
     ssize_t stdoutSize = 0;
 
     int threadPoolSize = 0;
+
+    // Thread stacks are only created once the module runs threads, so that
+    // single-threaded functions don't carry them in snapshots and clones
+    std::mutex threadStacksMutex;
     std::vector<uint32_t> threadStacks;
 
     threads::MutexManager mutexes;
@@ -173,6 +222,82 @@ class WasmModule
     std::shared_mutex moduleMemoryMutex;
     std::mutex moduleStateMutex;
 
+    // Set when the linear memory is a private file mapping of the zygote's
+    // memory, in which case pages written since are those no longer backed by
+    // the file (see getDirtyRegions)
+    bool zygoteMemoryMapped = false;
+
+    // How much of the linear memory is backed by the zygote's file when
+    // mapped, beyond which the mapping is anonymous
+    size_t zygoteMappedBytes = 0;
+
+    // Regions unmapped below the break, to be reused by later mmaps. Guarded
+    // by the memory mutex, as are the helpers below.
+    MemoryFreeList freeList;
+
+    // Gives the pages of a region back to the OS, leaving it zeroed
+    void discardMemory(uint32_t offset, uint32_t nBytes);
+
+    // Guard regions in the memory (offset -> length), which have to be
+    // protected again whenever the memory is mapped afresh
+    std::map<uint32_t, uint32_t> guardRegions;
+
+    // Set while no-access guard regions are readable for the memory to be
+    // copied, until the module next executes
+    std::atomic<bool> guardRegionsExposed = false;
+
+    void protectGuardRegion(uint32_t offset, uint32_t nBytes);
+
+    void applyGuardRegions();
+
+    void exposeGuardRegions();
+
+    // Makes any guard regions in the range ordinary memory again
+    void removeGuardRegions(uint32_t offset, uint32_t nBytes);
+
+    // Regions mapped from files with mmapFile (offset -> length), whose pages
+    // read back the file's contents when dropped
+    std::map<uint32_t, uint32_t> fileMappings;
+
+    // Forgets file mappings in the range once it's no longer backed by them
+    void removeFileMappings(uint32_t offset, uint32_t nBytes);
+
+    std::string takeSparseSnapshot(const std::string& snapKey,
+                                   bool locallyRestorable);
+
+    void restoreSparse(const std::string& snapshotKey,
+                       const faabric::util::SnapshotData& data);
+
+    std::unique_ptr<LazyRestore> lazyRestore;
+
+    bool startLazyRestore(const faabric::util::SnapshotData& data);
+
+    // Must be called before the memory is replaced or freed
+    void stopLazyRestore();
+
+    // Asks for huge pages to back the region when enabled. Needed again
+    // whenever part of the memory is mapped afresh. Regions mapped from
+    // shared memory (e.g. snapshots) only get them with shmem THP enabled.
+    // Returns whether huge pages can back the region.
+    bool adviseHugePages(uint32_t offset,
+                         size_t nBytes,
+                         bool sharedMemory = false);
+
+    // Memory size charged to the function and user quotas
+    size_t quotaBytes = 0;
+
+    // Charges growth of the memory to the given size, returning false if it
+    // would exceed the hard limit. Over the soft limit, a reclaim is requested
+    // (see MemoryQuota).
+    bool chargeMemoryQuota(size_t newBytes);
+
+    // Brings the charge in line with the current memory size
+    void syncMemoryQuota();
+
+    bool claimFreeMemory(uint32_t nBytes, uint32_t& offset);
+
+    void releaseFreeMemory(uint32_t offset, uint32_t nBytes);
+
     // Argc/argv
     unsigned int argc;
     std::vector<std::string> argv;
@@ -192,6 +317,10 @@ class WasmModule
 
     // Threads
     void createThreadStacks();
+
+    uint32_t getThreadStack(int threadPoolIdx);
+
+    void clearThreadStacks();
 };
 
 // Convenience functions
@@ -201,6 +330,26 @@ uint32_t roundUpToWasmPageAligned(uint32_t nBytes);
 
 size_t getPagesForGuardRegion();
 
+std::vector<std::pair<uint32_t, uint32_t>> getPrivatelyWrittenRegions(
+  uint8_t* ptr,
+  size_t nBytes);
+
+size_t getResidentBytes(uint8_t* ptr, size_t nBytes);
+
+// Sums the given /proc/self/smaps field (e.g. AnonHugePages) in bytes over the
+// mappings overlapping the range
+size_t getMappedStatBytes(uint8_t* ptr,
+                          size_t nBytes,
+                          const std::string& field);
+
+// Whether shared memory mappings can be backed by transparent huge pages, i.e.
+// shmem_enabled is "advise" or stronger
+bool isShmemHugePagesEnabled();
+
+// Throws if a grow of memory was refused, for host code with no way to pass
+// the failure on to the guest
+uint32_t checkMemoryGrow(uint32_t wasmPtr);
+
 /*
  * Exception thrown when wasm module terminates
  */
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <faabric/util/logging.h>
+
+#include <threads/ThreadState.h>
+#include <wasm/WasmExecutionContext.h>
+
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+
+/*
+ * OpenMP runtime logic shared by the WAVM and WAMR intrinsics, which only
+ * differ in how they get at the wasm memory.
+ */
+
+namespace wasm {
+
+// -------------------------------------------------------
+// FOR LOOP STATIC INIT
+// -------------------------------------------------------
+
+enum sched_type : int
+{
+    sch_lower = 32, /**< lower bound for unordered values */
+    sch_static_chunked = 33,
+    sch_static = 34, /**< static unspecialized */
+    sch_dynamic_chunked = 35,
+    sch_guided_chunked = 36,
+    sch_runtime = 37,
+    sch_auto = 38,
+    sch_guided_iterative_chunked = 42,
+    sch_guided_analytical_chunked = 43,
+};
+
+// Monotonic and nonmonotonic modifiers are set in the top bits of the schedule
+#define SCHEDULE_MODIFIER_MASK ((1 << 29) | (1 << 30))
+
+template<typename T>
+void for_static_init(int32_t schedule,
+                     int32_t* lastIter,
+                     T* lower,
+                     T* upper,
+                     T* stride,
+                     T incr,
+                     T chunk)
+{
+    // Unsigned version of the given template parameter
+    typedef typename std::make_unsigned<T>::type UT;
+
+    faabric::Message* msg = getExecutingCall();
+    std::shared_ptr<threads::Level> level = threads::getCurrentOpenMPLevel();
+    int localThreadNum = level->getLocalThreadNum(msg);
+
+    if (level->numThreads == 1) {
+        *lastIter = true;
+
+        if (incr > 0) {
+            *stride = *upper - *lower + 1;
+        } else {
+            *stride = -(*lower - *upper + 1);
+        }
+
+        return;
+    }
+
+    UT tripCount;
+    if (incr == 1) {
+        tripCount = *upper - *lower + 1;
+
+    } else if (incr == -1) {
+        tripCount = *lower - *upper + 1;
+
+    } else if (incr > 0) {
+        // Upper-lower can exceed the limit of signed type
+        tripCount = (int)(*upper - *lower) / incr + 1;
+
+    } else {
+        tripCount = (int)(*lower - *upper) / (-incr) + 1;
+    }
+
+    switch (schedule) {
+        case sch_static_chunked: {
+            int span;
+
+            if (chunk < 1) {
+                chunk = 1;
+            }
+
+            span = chunk * incr;
+
+            *stride = span * level->numThreads;
+            *lower = *lower + (span * localThreadNum);
+            *upper = *lower + span - incr;
+
+            *lastIter =
+              (localThreadNum ==
+               ((tripCount - 1) / (unsigned int)chunk) % level->numThreads);
+
+            break;
+        }
+
+        case sch_static: { // (chunk not given)
+            // If we have fewer trip_counts than threads
+            if (tripCount < level->numThreads) {
+                // Warning for future use, not tested at scale
+                SPDLOG_WARN("Small for loop trip count {} {}",
+                            tripCount,
+                            level->numThreads);
+
+                if (localThreadNum < tripCount) {
+                    *upper = *lower = *lower + localThreadNum * incr;
+                } else {
+                    *lower = *upper + incr;
+                }
+
+                *lastIter = (localThreadNum == tripCount - 1);
+
+            } else {
+                // TODO: We only implement below kmp_sch_static_balanced, not
+                // kmp_sch_static_greedy Those are set through KMP_SCHEDULE so
+                // we would need to look out for real code setting this
+                uint32_t small_chunk = tripCount / level->numThreads;
+                uint32_t extras = tripCount % level->numThreads;
+
+                *lower +=
+                  incr * (localThreadNum * small_chunk +
+                          (localThreadNum < extras ? localThreadNum : extras));
+
+                *upper = *lower + small_chunk * incr -
+                         (localThreadNum < extras ? 0 : incr);
+
+                *lastIter = (localThreadNum == level->numThreads - 1);
+            }
+
+            *stride = tripCount;
+            break;
+        }
+        default: {
+            throw std::runtime_error(
+              fmt::format("Unimplemented scheduler {}", schedule));
+        }
+    }
+}
+}
@@ -4,6 +4,12 @@
 #include <WAVM/Runtime/Intrinsics.h>
 
 #include <faabric/util/config.h>
+
+#include <atomic>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <shared_mutex>
 
 // Note that page size in wasm is 64kiB
@@ -19,14 +25,55 @@
 using namespace WAVM;
 
 namespace wasm {
+
+/*
+ * Counters exposed by the module caches
+ */
+struct ModuleCacheStats
+{
+    long hits = 0;
+    long misses = 0;
+    long evictions = 0;
+    size_t entries = 0;
+    size_t bytes = 0;
+};
+
+/*
+ * Tracks the recency of use of cache keys, so that the module caches can evict
+ * the least recently used entries first.
+ */
+class CacheKeyLRU
+{
+  public:
+    void touch(const std::string& key);
+
+    void remove(const std::string& key);
+
+    std::vector<std::string> getKeysOldestFirst();
+
+    void clear();
+
+  private:
+    std::mutex mx;
+    std::list<std::string> keys;
+    std::unordered_map<std::string, std::list<std::string>::iterator>
+      positions;
+};
+
+/*
+ * Returns the byte budget shared by the IR module cache and the WAVM module
+ * cache. Zero means the caches are unbounded.
+ */
+size_t getModuleCacheMaxBytes();
+
 class IRModuleCache
 {
   public:
     IRModuleCache();
 
-    IR::Module& getModule(const std::string& user,
-                          const std::string& func,
-                          const std::string& path);
+    std::shared_ptr<IR::Module> getModule(const std::string& user,
+                                          const std::string& func,
+                                          const std::string& path);
 
     Runtime::ModuleRef getCompiledModule(const std::string& user,
                                          const std::string& func,
@@ -48,25 +95,72 @@ class IRModuleCache
                                 const std::string& func,
                                 const std::string& path);
 
+    // Whether the main module can be had without compiling it, i.e. it's
+    // already compiled or there's valid object code for it
+    bool isObjectCodeAvailable(const std::string& user,
+                               const std::string& func);
+
     void clear();
 
+    size_t getTotalBytes();
+
+    // Evicts unreferenced modules, oldest first, until both caches fit the
+    // budget. Also called by the WAVM module cache once it's evicted zygotes,
+    // which keep their compiled modules referenced.
+    void evictToBudget(const std::string& keepKey);
+
+    ModuleCacheStats getStats();
+
+    // Called with each key as it starts loading, while holding that key's
+    // lock. Lets tests check that loads of different keys overlap.
+    void setLoadCallback(std::function<void(const std::string&)> callback);
+
   private:
+    // The cache-wide mutex only guards access to the maps themselves. Loading
+    // and compiling happen under a per-key mutex so that different functions
+    // can be loaded in parallel, while concurrent requests for the same key
+    // wait on a single load.
     std::shared_mutex mx;
-    std::unordered_map<std::string, IR::Module> moduleMap;
+    std::unordered_map<std::string, std::shared_ptr<IR::Module>> moduleMap;
     std::unordered_map<std::string, Runtime::ModuleRef> compiledModuleMap;
     std::unordered_map<std::string, int> originalTableSizes;
 
+    // Hashes of the wasm each IR module was loaded from, used to validate
+    // object files and key the local object cache
+    std::unordered_map<std::string, std::vector<uint8_t>> wasmHashes;
+
+    // Memory accounting and eviction. Entries are evicted per key, and only
+    // when neither the IR nor the compiled module is referenced outside the
+    // cache.
+    std::unordered_map<std::string, size_t> moduleBytes;
+    std::unordered_map<std::string, size_t> compiledModuleBytes;
+    std::atomic<size_t> totalBytes = 0;
+    CacheKeyLRU lru;
+
+    std::atomic<long> hits = 0;
+    std::atomic<long> misses = 0;
+    std::atomic<long> evictions = 0;
+
+    std::unordered_map<std::string, std::shared_ptr<std::mutex>> moduleMutexes;
+    std::unordered_map<std::string, std::shared_ptr<std::mutex>>
+      compiledModuleMutexes;
+
     faabric::util::SystemConfig& conf;
 
+    std::function<void(const std::string&)> loadCallback;
+
+    void notifyLoad(const std::string& key);
+
     int getModuleCount(const std::string& key);
 
     int getCompiledModuleCount(const std::string& key);
 
-    IR::Module& getMainModule(const std::string& user, const std::string& func);
+    std::shared_ptr<IR::Module> getMainModule(const std::string& user,
+                                              const std::string& func);
 
-    IR::Module& getSharedModule(const std::string& user,
-                                const std::string& func,
-                                const std::string& path);
+    std::shared_ptr<IR::Module> getSharedModule(const std::string& user,
+                                                const std::string& func,
+                                                const std::string& path);
 
     Runtime::ModuleRef getCompiledMainModule(const std::string& user,
                                              const std::string& func);
@@ -75,7 +169,30 @@ class IRModuleCache
                                                const std::string& func,
                                                const std::string& path);
 
-    IR::Module& getModuleFromMap(const std::string& key);
+    std::shared_ptr<IR::Module> findModule(const std::string& key);
+
+    Runtime::ModuleRef findCompiledModule(const std::string& key);
+
+    void insertModule(const std::string& key,
+                      std::shared_ptr<IR::Module> module,
+                      const std::vector<uint8_t>& wasmBytes);
+
+    Runtime::ModuleRef loadCompiledModule(
+      const std::string& key,
+      IR::Module& module,
+      const std::function<std::vector<uint8_t>()>& loadObjectFile,
+      const std::function<std::vector<uint8_t>()>& loadObjectHash,
+      size_t& objectBytes);
+
+    void insertCompiledModule(const std::string& key,
+                              Runtime::ModuleRef module,
+                              size_t nBytes);
+
+    bool isKeyEvictable(const std::string& key);
+
+    std::shared_ptr<std::mutex> getKeyMutex(
+      std::unordered_map<std::string, std::shared_ptr<std::mutex>>& mutexMap,
+      const std::string& key);
 };
 
 IRModuleCache& getIRModuleCache();
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <WAVM/IR/Module.h>
+
+#include <string>
+#include <vector>
+
+#define OBJECT_CACHE_EXT ".o"
+
+namespace wasm {
+
+std::string getWAVMBuildId();
+
+/**
+ * Local on-disk cache of WAVM object code. Entries are keyed on the hash of
+ * the wasm they were compiled from, the features and limits of the IR module,
+ * and the WAVM/ LLVM build doing the compiling, so a stale or incompatible
+ * object is never loaded. Each object is stored alongside a hash of its
+ * contents, which is checked on load.
+ */
+class WAVMObjectCache
+{
+  public:
+    std::string getKey(const std::vector<uint8_t>& wasmHash,
+                       const WAVM::IR::Module& module);
+
+    std::vector<uint8_t> load(const std::string& key);
+
+    bool exists(const std::string& key);
+
+    void store(const std::string& key, const std::vector<uint8_t>& objBytes);
+
+    void clear();
+
+    std::string getCacheDir();
+
+  private:
+    std::string getObjectPath(const std::string& key);
+};
+
+WAVMObjectCache& getWAVMObjectCache();
+}
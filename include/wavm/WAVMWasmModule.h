@@ -3,6 +3,7 @@
 #include <threads/ThreadState.h>
 #include <wasm/WasmExecutionContext.h>
 #include <wasm/WasmModule.h>
+#include <wavm/IRModuleCache.h>
 #include <wavm/LoadedDynamicModule.h>
 
 #include <WAVM/Runtime/Intrinsics.h>
@@ -42,6 +43,12 @@ class WAVMWasmModule final
 
     void reset(faabric::Message& msg) override;
 
+    void resetToSnapshotBase(faabric::Message& msg) override;
+
+    void resetFromZygote(WAVMWasmModule& zygote);
+
+    void resetFromZygote(WAVMWasmModule& zygote, bool copyOnWrite);
+
     // ----- Memory management -----
     uint32_t growMemory(uint32_t nBytes) override;
 
@@ -49,8 +56,6 @@ class WAVMWasmModule final
 
     uint32_t mmapMemory(uint32_t nBytes) override;
 
-    uint32_t mmapFile(uint32_t fd, uint32_t length) override;
-
     void unmapMemory(uint32_t offset, uint32_t nBytes) override;
 
     uint8_t* wasmPointerToNative(int32_t wasmPtr) override;
@@ -59,6 +64,8 @@ class WAVMWasmModule final
 
     uint8_t* getMemoryBase() override;
 
+    std::shared_ptr<WasmModule> getZygote() override;
+
     // ----- Environment variables
     void writeWasmEnvToMemory(uint32_t envPointers,
                               uint32_t envBuffer) override;
@@ -153,6 +160,20 @@ class WAVMWasmModule final
                            uint32_t stackTop,
                            faabric::Message& msg) override;
 
+    // ----- Local OpenMP threads -----
+    // Teams that fit on this host run their non-master threads on host
+    // threads sharing this module's memory, rather than as THREADS requests
+    // from a snapshot. Thread N runs in thread pool slot N, slot 0 being left
+    // to the master.
+    int getMaxLocalOpenMPThreads();
+
+    void startLocalOpenMPThreads(faabric::Message* parentCall,
+                                 std::shared_ptr<threads::Level> level,
+                                 int32_t microtaskPtr);
+
+    // Returns the first non-zero return value of the awaited threads
+    int32_t awaitLocalOpenMPThreads(int nThreads);
+
   private:
     WAVM::Runtime::GCPointer<WAVM::Runtime::Instance> envModule;
     WAVM::Runtime::GCPointer<WAVM::Runtime::Instance> wasiModule;
@@ -172,6 +193,18 @@ class WAVMWasmModule final
     // OpenMP
     std::vector<WAVM::Runtime::Context*> openMPContexts;
 
+    // Host threads and their task queues, indexed by thread pool slot. These
+    // are created lazily, and only ever driven by one master at a time, as
+    // only top-level teams run on them.
+    std::vector<std::thread> localOpenMPThreads;
+    std::vector<std::unique_ptr<faabric::util::Queue<threads::OpenMPTask>>>
+      localOpenMPQueues;
+    faabric::util::Queue<int32_t> localOpenMPResults;
+
+    void runLocalOpenMPThread(int threadPoolIdx);
+
+    void shutdownLocalOpenMPThreads();
+
     static WAVM::Runtime::Instance* getEnvModule();
 
     static WAVM::Runtime::Instance* getWasiModule();
@@ -186,6 +219,29 @@ class WAVMWasmModule final
 
     void clone(const WAVMWasmModule& other);
 
+    void cloneModuleState(const WAVMWasmModule& other);
+
+    // Copy-on-write reset. The zygote's memory is written once to a memfd,
+    // which is then mapped privately over the memory of each reset module.
+    int zygoteMemoryFd = -1;
+    size_t zygoteMemoryBytes = 0;
+    std::mutex zygoteMemoryMx;
+
+    int getZygoteMemoryFd();
+
+    void remapZygoteMemory(int fd,
+                           size_t zygoteBytes,
+                           size_t offset,
+                           size_t length);
+
+    // Replaces all of memory with a private mapping of the zygote's file.
+    // Caller must hold the memory lock.
+    void mapZygoteMemory(int fd, size_t zygoteBytes, size_t currentBytes);
+
+    void shareZygoteMemory(WAVMWasmModule& zygote);
+
+    bool copyOnWriteReset(WAVMWasmModule& zygote);
+
     void addModuleToGOT(WAVM::IR::Module& mod, bool isMainModule);
 
     void executeZygoteFunction();
@@ -211,22 +267,47 @@ class WAVMWasmModule final
 class WAVMModuleCache
 {
   public:
-    wasm::WAVMWasmModule& getCachedModule(faabric::Message& msg);
+    std::shared_ptr<wasm::WAVMWasmModule> getCachedModule(
+      faabric::Message& msg);
 
-    void initialiseCachedModule(faabric::Message& msg);
+    // Returns the cached module if there is one, without creating it
+    std::shared_ptr<wasm::WAVMWasmModule> findCachedModule(
+      const faabric::Message& msg);
 
     void clear();
 
     size_t getTotalCachedModuleCount();
 
+    size_t getTotalBytes();
+
+    ModuleCacheStats getStats();
+
   private:
     std::shared_mutex mx;
-    std::unordered_map<std::string, wasm::WAVMWasmModule> cachedModuleMap;
+    std::unordered_map<std::string, std::shared_ptr<wasm::WAVMWasmModule>>
+      cachedModuleMap;
+
+    // Memory accounting and eviction. Zygotes still referenced outside the
+    // cache (i.e. being cloned from) are never evicted.
+    std::unordered_map<std::string, size_t> cachedModuleBytes;
+    std::atomic<size_t> totalBytes = 0;
+    CacheKeyLRU lru;
 
-    int getCachedModuleCount(const std::string& key);
+    std::atomic<long> hits = 0;
+    std::atomic<long> misses = 0;
+    std::atomic<long> evictions = 0;
+
+    // Returns whether anything was evicted
+    bool evictToBudget(const std::string& keepKey);
 };
 
 WAVMModuleCache& getWAVMModuleCache();
 
 WAVMWasmModule* getExecutingWAVMModule();
+
+// Runs the current OpenMP level's queued tasks until there are none left
+void finishOpenMPTasks(WAVM::Runtime::Context* ctx);
+
+// Releases this thread's tasks in the current OpenMP level as it leaves it
+void leaveOpenMPTasks(WAVMWasmModule* module);
 }
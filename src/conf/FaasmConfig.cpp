@@ -31,6 +31,53 @@ void FaasmConfig::initialise()
     wasmVm = getEnvVar("WASM_VM", "wavm");
     chainedCallTimeout = this->getIntParam("CHAINED_CALL_TIMEOUT", "300000");
 
+    // Zero means the module caches are unbounded
+    moduleCacheMaxMb = this->getIntParam("MODULE_CACHE_MAX_MB", "0");
+
+    // Either "clone" (copy the zygote) or "cow" (copy-on-write zygote memory)
+    resetMode = getEnvVar("RESET_MODE", "clone");
+
+    // Zero disables the pool of pre-warmed Faaslets
+    warmPoolMaxSize = this->getIntParam("WARM_POOL_MAX_SIZE", "0");
+    warmPoolWindowMs = this->getIntParam("WARM_POOL_WINDOW_MS", "1000");
+
+    // When on, functions with no object code start on a quickly compiled
+    // baseline tier while the optimised module is compiled in the background
+    tieredCompilation = getEnvVar("TIERED_COMPILATION", "off");
+
+    // When on, linear memory is backed by transparent huge pages where the
+    // kernel can align them
+    hugePages = getEnvVar("HUGE_PAGES", "off");
+
+    // Either "readonly" (guard regions are read-only memory) or "noaccess"
+    // (guard regions are inaccessible and not backed by memory)
+    guardMode = getEnvVar("GUARD_MODE", "readonly");
+
+    // Either "full" (snapshots copy all memory) or "sparse" (snapshots hold
+    // only the pages that differ from the zygote). Sparse restores reset with
+    // copy-on-write whatever the reset mode.
+    snapshotMode = getEnvVar("SNAPSHOT_MODE", "full");
+
+    // Either "eager" (snapshots are mapped before execution) or "lazy"
+    // (pages are copied in on first touch with userfaultfd)
+    restoreMode = getEnvVar("RESTORE_MODE", "eager");
+
+    // When on, instances of the same function map the zygote's memory
+    // privately from a single shared image, so untouched pages aren't copied
+    shareZygoteMemory = getEnvVar("SHARE_ZYGOTE_MEMORY", "off");
+
+    // When on, OpenMP teams that fit on this host run on local threads sharing
+    // the parent's memory, rather than being scheduled from a snapshot. Off by
+    // default until it's seen more use.
+    ompLocalFork = getEnvVar("OMP_LOCAL_FORK", "off");
+
+    // Caps on the linear memory committed on this host by each function and
+    // by all of a user's functions, zero meaning unlimited. Growth beyond the
+    // soft limit (a percentage of each) triggers reclamation.
+    functionMemoryLimitMb = this->getIntParam("FUNCTION_MEMORY_LIMIT_MB", "0");
+    userMemoryLimitMb = this->getIntParam("USER_MEMORY_LIMIT_MB", "0");
+    memorySoftLimitPercent = this->getIntParam("MEMORY_SOFT_LIMIT_PCT", "80");
+
     std::string faasmLocalDir =
       getEnvVar("FAASM_LOCAL_DIR", "/usr/local/faasm");
     functionDir = fmt::format("{}/{}", faasmLocalDir, "wasm");
@@ -64,6 +111,20 @@ void FaasmConfig::print()
     SPDLOG_INFO("Chained call timeout: {}", chainedCallTimeout);
     SPDLOG_INFO("Python preload:       {}", pythonPreload);
     SPDLOG_INFO("Wasm VM:              {}", wasmVm);
+    SPDLOG_INFO("Module cache max MB:  {}", moduleCacheMaxMb);
+    SPDLOG_INFO("Reset mode:           {}", resetMode);
+    SPDLOG_INFO("Warm pool max size:   {}", warmPoolMaxSize);
+    SPDLOG_INFO("Warm pool window ms:  {}", warmPoolWindowMs);
+    SPDLOG_INFO("Tiered compilation:   {}", tieredCompilation);
+    SPDLOG_INFO("Huge pages:           {}", hugePages);
+    SPDLOG_INFO("Guard mode:           {}", guardMode);
+    SPDLOG_INFO("Snapshot mode:        {}", snapshotMode);
+    SPDLOG_INFO("Restore mode:         {}", restoreMode);
+    SPDLOG_INFO("Share zygote memory:  {}", shareZygoteMemory);
+    SPDLOG_INFO("OpenMP local fork:    {}", ompLocalFork);
+    SPDLOG_INFO("Function memory MB:   {}", functionMemoryLimitMb);
+    SPDLOG_INFO("User memory MB:       {}", userMemoryLimitMb);
+    SPDLOG_INFO("Memory soft limit %:  {}", memorySoftLimitPercent);
 
     SPDLOG_INFO("--- STORAGE ---");
     SPDLOG_INFO("Fileserver:           {}", fileserverUrl);
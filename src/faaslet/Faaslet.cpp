@@ -1,4 +1,6 @@
 #include <faaslet/Faaslet.h>
+#include <faaslet/FaasletPool.h>
+#include <faaslet/TieredCompiler.h>
 
 #include <conf/FaasmConfig.h>
 #include <conf/function_utils.h>
@@ -69,6 +71,11 @@ Faaslet::Faaslet(faabric::Message& msg)
         module = std::make_unique<wasm::WAMRWasmModule>(threadPoolSize);
 #endif
     } else if (conf.wasmVm == "wavm") {
+        if (getTieredCompiler().shouldUseBaseline(msg) &&
+            bindBaselineTier(msg)) {
+            return;
+        }
+
         module = std::make_unique<wasm::WAVMWasmModule>(threadPoolSize);
     } else {
 
@@ -93,7 +100,7 @@ int32_t Faaslet::executeTask(int threadPoolIdx,
         cgroup.addCurrentThread();
 
         // Set up network namespace
-        ns = claimNetworkNamespace();
+        prepareIsolation();
         ns->addCurrentThread();
 
         isIsolated = true;
@@ -104,19 +111,76 @@ int32_t Faaslet::executeTask(int threadPoolIdx,
     return returnValue;
 }
 
+bool Faaslet::bindBaselineTier(faabric::Message& msg)
+{
+    TieredCompiler& compiler = getTieredCompiler();
+    compiler.startOptimising(msg);
+
+    try {
+        auto wamrModule =
+          std::make_unique<wasm::WAMRWasmModule>(threadPoolSize);
+        wamrModule->setObjectBytes(compiler.getBaselineObject(msg));
+        wamrModule->bindToFunction(msg);
+
+        module = std::move(wamrModule);
+    } catch (std::exception& e) {
+        // Not all functions can run on WAMR, in which case we wait for the
+        // optimised module as usual
+        SPDLOG_WARN("Failed to bind {} to baseline tier: {}",
+                    faabric::util::funcToString(msg, false),
+                    e.what());
+        return false;
+    }
+
+    isBaselineTier = true;
+    return true;
+}
+
+void Faaslet::bindOptimisedTier(faabric::Message& msg)
+{
+    SPDLOG_DEBUG("Switching {} to optimised tier",
+                 faabric::util::funcToString(msg, false));
+
+    module = std::make_unique<wasm::WAVMWasmModule>(threadPoolSize);
+    module->bindToFunction(msg);
+    isBaselineTier = false;
+}
+
 void Faaslet::reset(faabric::Message& msg)
 {
+    // Switch to the optimised module once it's ready
+    if (isBaselineTier && getTieredCompiler().isOptimised(msg)) {
+        bindOptimisedTier(msg);
+        return;
+    }
+
     module->reset(msg);
 }
 
-void Faaslet::postFinish()
+void Faaslet::prepareIsolation()
+{
+    if (ns == nullptr) {
+        ns = claimNetworkNamespace();
+    }
+}
+
+void Faaslet::releaseIsolation()
 {
     if (ns != nullptr) {
-        ns->removeCurrentThread();
+        if (isIsolated) {
+            ns->removeCurrentThread();
+        }
+
         returnNetworkNamespace(ns);
+        ns = nullptr;
     }
 }
 
+void Faaslet::postFinish()
+{
+    releaseIsolation();
+}
+
 faabric::util::SnapshotData Faaslet::snapshot()
 {
     return module->getSnapshotData();
@@ -127,8 +191,14 @@ void Faaslet::restore(faabric::Message& msg)
     conf::FaasmConfig& conf = conf::getFaasmConfig();
     const std::string snapshotKey = msg.snapshotkey();
 
+    // Snapshots can only be restored into the optimised tier, so we have to
+    // wait for it
+    if (isBaselineTier && !snapshotKey.empty()) {
+        bindOptimisedTier(msg);
+    }
+
     // Restore from snapshot if necessary
-    if (conf.wasmVm == "wavm") {
+    if (conf.wasmVm == "wavm" || conf.wasmVm == "wamr") {
         if (!snapshotKey.empty() && !msg.issgx()) {
             PROF_START(snapshotOverride)
 
@@ -148,11 +218,28 @@ FaasletFactory::~FaasletFactory() {}
 std::shared_ptr<faabric::scheduler::Executor> FaasletFactory::createExecutor(
   faabric::Message& msg)
 {
+    conf::FaasmConfig& conf = conf::getFaasmConfig();
+    if (conf.warmPoolMaxSize > 0 && !msg.issgx()) {
+        FaasletPool& pool = getFaasletPool();
+        pool.start();
+
+        std::shared_ptr<Faaslet> faaslet = pool.take(msg);
+        if (faaslet != nullptr) {
+            return faaslet;
+        }
+    }
+
     return std::make_shared<Faaslet>(msg);
 }
 
 void FaasletFactory::flushHost()
 {
+    // Drop warm Faaslets bound to the old code
+    getFaasletPool().clear();
+
+    // Drop baseline code, waiting for any background compiles
+    getTieredCompiler().clear();
+
     // Clear cached shared files
     storage::FileSystem::clearSharedFiles();
 
@@ -160,10 +247,12 @@ void FaasletFactory::flushHost()
     storage::FileLoader& fileLoader = storage::getFileLoader();
     fileLoader.flushFunctionFiles();
 
-    // WAVM-specific flushing
+    // Runtime-specific flushing
     const conf::FaasmConfig& conf = conf::getFaasmConfig();
     if (conf.wasmVm == "wavm") {
         wasm::WAVMWasmModule::clearCaches();
+    } else if (conf.wasmVm == "wamr") {
+        wasm::WAMRWasmModule::clearCaches();
     }
 }
 }
@@ -0,0 +1,272 @@
+#include <faaslet/FaasletPool.h>
+
+#include <conf/FaasmConfig.h>
+#include <wasm/MemoryQuota.h>
+
+#include <faabric/util/func.h>
+#include <faabric/util/locks.h>
+#include <faabric/util/logging.h>
+
+#include <algorithm>
+
+namespace faaslet {
+FaasletPool& getFaasletPool()
+{
+    static FaasletPool pool;
+    return pool;
+}
+
+FaasletPool::~FaasletPool()
+{
+    shutdown();
+}
+
+void FaasletPool::start()
+{
+    faabric::util::UniqueLock lock(mx);
+    if (running) {
+        return;
+    }
+
+    SPDLOG_DEBUG("Starting Faaslet warm pool");
+    running = true;
+
+    wasm::getMemoryQuota().setReclaimer(
+      [this](const std::string& user, const std::string&) {
+          requestReclaim(user);
+      });
+
+    warmerThread = std::thread([this] {
+        faabric::util::UniqueLock lock(mx);
+        while (running) {
+            std::vector<std::string> users(reclaimRequests.begin(),
+                                           reclaimRequests.end());
+            reclaimRequests.clear();
+
+            lock.unlock();
+            for (const auto& user : users) {
+                reclaim(user);
+            }
+            warm();
+            lock.lock();
+
+            cv.wait_for(lock,
+                        std::chrono::milliseconds(WARM_POOL_INTERVAL_MS),
+                        [this] {
+                            return !running || warmRequested ||
+                                   !reclaimRequests.empty();
+                        });
+            warmRequested = false;
+        }
+    });
+}
+
+void FaasletPool::shutdown()
+{
+    {
+        faabric::util::UniqueLock lock(mx);
+        if (!running) {
+            return;
+        }
+
+        running = false;
+    }
+
+    wasm::getMemoryQuota().setReclaimer(nullptr);
+
+    cv.notify_all();
+    if (warmerThread.joinable()) {
+        warmerThread.join();
+    }
+
+    clear();
+}
+
+std::shared_ptr<Faaslet> FaasletPool::take(faabric::Message& msg)
+{
+    std::string funcStr = faabric::util::funcToString(msg, false);
+    std::shared_ptr<Faaslet> faaslet = nullptr;
+
+    {
+        faabric::util::UniqueLock lock(mx);
+
+        FunctionPool& pool = pools[funcStr];
+        pool.templateMsg = msg;
+        pool.arrivals.push_back(std::chrono::steady_clock::now());
+
+        if (!pool.warm.empty()) {
+            faaslet = pool.warm.back();
+            pool.warm.pop_back();
+        }
+
+        warmRequested = true;
+    }
+
+    cv.notify_one();
+
+    if (faaslet != nullptr) {
+        SPDLOG_DEBUG("Using warm Faaslet for {}", funcStr);
+    }
+
+    return faaslet;
+}
+
+int FaasletPool::doGetTargetSize(FunctionPool& pool)
+{
+    // Note - must be called with the lock held
+    conf::FaasmConfig& conf = conf::getFaasmConfig();
+
+    auto windowStart = std::chrono::steady_clock::now() -
+                       std::chrono::milliseconds(conf.warmPoolWindowMs);
+    while (!pool.arrivals.empty() && pool.arrivals.front() < windowStart) {
+        pool.arrivals.pop_front();
+    }
+
+    return std::min<int>(conf.warmPoolMaxSize, pool.arrivals.size());
+}
+
+void FaasletPool::warm()
+{
+    std::vector<std::pair<std::string, faabric::Message>> toCreate;
+    std::vector<std::shared_ptr<Faaslet>> toDiscard;
+
+    {
+        faabric::util::UniqueLock lock(mx);
+
+        for (auto it = pools.begin(); it != pools.end();) {
+            FunctionPool& pool = it->second;
+            int targetSize = doGetTargetSize(pool);
+
+            while ((int)pool.warm.size() > targetSize) {
+                toDiscard.emplace_back(pool.warm.back());
+                pool.warm.pop_back();
+            }
+
+            int nMissing = targetSize - (int)pool.warm.size() - pool.pending;
+            for (int i = 0; i < nMissing; i++) {
+                toCreate.emplace_back(it->first, pool.templateMsg);
+            }
+            pool.pending += std::max(nMissing, 0);
+
+            // Forget functions that haven't been called recently
+            if (pool.arrivals.empty() && pool.warm.empty() &&
+                pool.pending == 0) {
+                it = pools.erase(it);
+            } else {
+                it++;
+            }
+        }
+    }
+
+    for (auto& f : toDiscard) {
+        f->releaseIsolation();
+    }
+
+    // Binding can be slow so must be done outside the lock
+    for (auto& [funcStr, msg] : toCreate) {
+        std::shared_ptr<Faaslet> faaslet = nullptr;
+        try {
+            faaslet = std::make_shared<Faaslet>(msg);
+            faaslet->prepareIsolation();
+        } catch (std::exception& e) {
+            SPDLOG_ERROR(
+              "Failed to warm Faaslet for {}: {}", funcStr, e.what());
+        }
+
+        faabric::util::UniqueLock lock(mx);
+        auto it = pools.find(funcStr);
+        if (it == pools.end()) {
+            if (faaslet != nullptr) {
+                faaslet->releaseIsolation();
+            }
+            continue;
+        }
+
+        it->second.pending--;
+        if (faaslet != nullptr) {
+            SPDLOG_DEBUG("Warmed Faaslet for {}", funcStr);
+            it->second.warm.emplace_back(faaslet);
+        }
+    }
+}
+
+void FaasletPool::clear()
+{
+    std::vector<std::shared_ptr<Faaslet>> toDiscard;
+
+    {
+        faabric::util::UniqueLock lock(mx);
+        for (auto& p : pools) {
+            toDiscard.insert(
+              toDiscard.end(), p.second.warm.begin(), p.second.warm.end());
+        }
+
+        pools.clear();
+    }
+
+    for (auto& f : toDiscard) {
+        f->releaseIsolation();
+    }
+}
+
+void FaasletPool::requestReclaim(const std::string& user)
+{
+    {
+        faabric::util::UniqueLock lock(mx);
+        reclaimRequests.insert(user);
+    }
+
+    cv.notify_one();
+}
+
+void FaasletPool::reclaim(const std::string& user)
+{
+    std::vector<std::shared_ptr<Faaslet>> toDiscard;
+
+    {
+        faabric::util::UniqueLock lock(mx);
+        for (auto& p : pools) {
+            if (p.second.templateMsg.user() != user) {
+                continue;
+            }
+
+            toDiscard.insert(
+              toDiscard.end(), p.second.warm.begin(), p.second.warm.end());
+            p.second.warm.clear();
+        }
+    }
+
+    if (!toDiscard.empty()) {
+        SPDLOG_DEBUG(
+          "Discarding {} warm Faaslets for {}", toDiscard.size(), user);
+    }
+
+    for (auto& f : toDiscard) {
+        f->releaseIsolation();
+    }
+}
+
+size_t FaasletPool::getWarmCount(const std::string& funcStr)
+{
+    faabric::util::UniqueLock lock(mx);
+
+    auto it = pools.find(funcStr);
+    if (it == pools.end()) {
+        return 0;
+    }
+
+    return it->second.warm.size();
+}
+
+int FaasletPool::getTargetSize(const std::string& funcStr)
+{
+    faabric::util::UniqueLock lock(mx);
+
+    auto it = pools.find(funcStr);
+    if (it == pools.end()) {
+        return 0;
+    }
+
+    return doGetTargetSize(it->second);
+}
+}
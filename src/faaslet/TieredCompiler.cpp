@@ -0,0 +1,228 @@
+#include <faaslet/TieredCompiler.h>
+
+#include <conf/FaasmConfig.h>
+#include <storage/FileLoader.h>
+#include <wamr/WAMRWasmModule.h>
+#include <wamr/native.h>
+#include <wavm/IRModuleCache.h>
+
+#include <faabric/util/func.h>
+#include <faabric/util/locks.h>
+#include <faabric/util/logging.h>
+#include <faabric/util/timing.h>
+
+namespace faaslet {
+TieredCompiler& getTieredCompiler()
+{
+    static TieredCompiler compiler;
+    return compiler;
+}
+
+TieredCompiler::~TieredCompiler()
+{
+    waitForOptimisations();
+}
+
+bool TieredCompiler::shouldUseBaseline(const faabric::Message& msg)
+{
+#if (WAMR_EXECUTION_MODE_INTERP)
+    // The baseline tier is a WAMR AOT compile
+    return false;
+#else
+    conf::FaasmConfig& conf = conf::getFaasmConfig();
+    if (conf.tieredCompilation != "on" || conf.wasmVm != "wavm") {
+        return false;
+    }
+
+    // Calls relying on WAVM-only features (restoring snapshots, SGX, the
+    // Python runtime and MPI) always go straight to the optimised tier
+    if (msg.issgx() || msg.ispython() || msg.ismpi() ||
+        !msg.snapshotkey().empty()) {
+        return false;
+    }
+
+    if (wasm::getIRModuleCache().isObjectCodeAvailable(msg.user(),
+                                                       msg.function())) {
+        return false;
+    }
+
+    return canRunOnBaseline(msg);
+#endif
+}
+
+bool TieredCompiler::canRunOnBaseline(const faabric::Message& msg)
+{
+    std::string funcStr = faabric::util::funcToString(msg, false);
+    {
+        faabric::util::UniqueLock lock(mx);
+        auto it = baselineSupported.find(funcStr);
+        if (it != baselineSupported.end()) {
+            return it->second;
+        }
+    }
+
+    // WAMR only warns about imports it can't link, then fails when one is
+    // called, so we only use the baseline if it has every import
+    std::shared_ptr<IR::Module> module =
+      wasm::getIRModuleCache().getModule(msg.user(), msg.function(), "");
+
+    bool supported = module->memories.imports.empty() &&
+                     module->tables.imports.empty() &&
+                     module->globals.imports.empty();
+
+    for (const auto& import : module->functions.imports) {
+        if (!supported) {
+            break;
+        }
+
+        if (!wasm::isWAMRNativeSymbol(import.moduleName, import.exportName)) {
+            SPDLOG_DEBUG("Baseline tier can't run {}, missing {}.{}",
+                         funcStr,
+                         import.moduleName,
+                         import.exportName);
+            supported = false;
+        }
+    }
+
+    faabric::util::UniqueLock lock(mx);
+    baselineSupported[funcStr] = supported;
+
+    return supported;
+}
+
+std::vector<uint8_t> TieredCompiler::getBaselineObject(
+  const faabric::Message& msg)
+{
+#if (WAMR_EXECUTION_MODE_INTERP)
+    throw std::runtime_error("No baseline tier in WAMR interpreter mode");
+#else
+    std::string funcStr = faabric::util::funcToString(msg, false);
+
+    std::shared_ptr<std::mutex> funcMx;
+    {
+        faabric::util::UniqueLock lock(mx);
+        auto it = baselineObjects.find(funcStr);
+        if (it != baselineObjects.end()) {
+            return it->second;
+        }
+
+        if (baselineMutexes.find(funcStr) == baselineMutexes.end()) {
+            baselineMutexes[funcStr] = std::make_shared<std::mutex>();
+        }
+        funcMx = baselineMutexes[funcStr];
+    }
+
+    // Only compile once for concurrent calls to the same function
+    faabric::util::UniqueLock funcLock(*funcMx);
+    {
+        faabric::util::UniqueLock lock(mx);
+        auto it = baselineObjects.find(funcStr);
+        if (it != baselineObjects.end()) {
+            return it->second;
+        }
+    }
+
+    SPDLOG_DEBUG("Compiling baseline tier for {}", funcStr);
+
+    PROF_START(baselineCompile)
+    storage::FileLoader& loader = storage::getFileLoader();
+    std::vector<uint8_t> wasmBytes = loader.loadFunctionWasm(msg);
+    std::vector<uint8_t> objBytes =
+      wasm::wamrCodegen(wasmBytes, false, WAMR_BASELINE_OPT_LEVEL);
+    PROF_END(baselineCompile)
+
+    faabric::util::UniqueLock lock(mx);
+    baselineObjects[funcStr] = objBytes;
+
+    return objBytes;
+#endif
+}
+
+void TieredCompiler::startOptimising(const faabric::Message& msg)
+{
+    std::string funcStr = faabric::util::funcToString(msg, false);
+    std::string user = msg.user();
+    std::string function = msg.function();
+
+    faabric::util::UniqueLock lock(mx);
+    if (optimising.find(funcStr) != optimising.end()) {
+        return;
+    }
+
+    optimising.insert(funcStr);
+
+    SPDLOG_DEBUG("Compiling optimised tier for {} in background", funcStr);
+    optimiseThreads.emplace_back([this, funcStr, user, function] {
+        try {
+            // Compiling puts the module in the IR module cache, and its object
+            // code in the local object cache
+            wasm::getIRModuleCache().getCompiledModule(user, function, "");
+            SPDLOG_DEBUG("Optimised tier ready for {}", funcStr);
+
+            faabric::util::UniqueLock lock(mx);
+            optimised.insert(funcStr);
+        } catch (std::exception& e) {
+            SPDLOG_ERROR(
+              "Failed to compile optimised tier for {}: {}", funcStr, e.what());
+        }
+
+        faabric::util::UniqueLock lock(mx);
+        optimising.erase(funcStr);
+
+        // Subsequent Faaslets will find the object code
+        baselineObjects.erase(funcStr);
+    });
+}
+
+bool TieredCompiler::isOptimised(const faabric::Message& msg)
+{
+    std::string funcStr = faabric::util::funcToString(msg, false);
+    {
+        faabric::util::UniqueLock lock(mx);
+        if (optimised.find(funcStr) != optimised.end()) {
+            return true;
+        }
+
+        if (optimising.find(funcStr) != optimising.end()) {
+            return false;
+        }
+    }
+
+    // The compiled module may since have been evicted from the cache, but the
+    // object code outlives it
+    return wasm::getIRModuleCache().isObjectCodeAvailable(msg.user(),
+                                                          msg.function());
+}
+
+void TieredCompiler::waitForOptimisations()
+{
+    std::vector<std::thread> toJoin;
+    {
+        faabric::util::UniqueLock lock(mx);
+        toJoin.swap(optimiseThreads);
+    }
+
+    for (auto& t : toJoin) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+}
+
+void TieredCompiler::clear()
+{
+    waitForOptimisations();
+
+    faabric::util::UniqueLock lock(mx);
+    baselineObjects.clear();
+    baselineMutexes.clear();
+    baselineSupported.clear();
+    optimised.clear();
+}
+
+size_t TieredCompiler::getOptimisingCount()
+{
+    faabric::util::UniqueLock lock(mx);
+    return optimising.size();
+}
+}
@@ -0,0 +1,100 @@
+#include <threads/ThreadState.h>
+
+#include <faabric/util/logging.h>
+#include <faabric/util/timing.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+/**
+ * Measures the latency of level barriers and critical sections for teams of
+ * 2-64 threads. Each thread gets its own copy of the level, as it would when
+ * deserialised from an OpenMP fork, so this also covers the sync lookup.
+ */
+static void runThreads(int nThreads,
+                       int nIterations,
+                       long& barrierNanos,
+                       long& criticalNanos)
+{
+    threads::Level lvl(nThreads);
+    std::vector<uint8_t> serialised = lvl.serialise();
+    const auto* lvlPtr =
+      reinterpret_cast<const threads::Level*>(serialised.data());
+
+    std::vector<long> barrierTimes(nThreads);
+    std::vector<long> criticalTimes(nThreads);
+    std::vector<std::thread> workers;
+    long counter = 0;
+
+    for (int t = 0; t < nThreads; t++) {
+        workers.emplace_back([&, t] {
+            threads::Level threadLvl(nThreads);
+            threadLvl.deserialise(lvlPtr);
+
+            // Warm up
+            threadLvl.waitOnBarrier();
+
+            faabric::util::TimePoint start = faabric::util::startTimer();
+            for (int i = 0; i < nIterations; i++) {
+                threadLvl.waitOnBarrier();
+            }
+            barrierTimes[t] = faabric::util::getTimeDiffNanos(start);
+
+            threadLvl.waitOnBarrier();
+
+            start = faabric::util::startTimer();
+            for (int i = 0; i < nIterations; i++) {
+                threadLvl.lockCritical();
+                counter++;
+                threadLvl.unlockCritical();
+            }
+            criticalTimes[t] = faabric::util::getTimeDiffNanos(start);
+        });
+    }
+
+    for (auto& t : workers) {
+        t.join();
+    }
+
+    if (counter != (long)nThreads * nIterations) {
+        SPDLOG_ERROR("Critical section counter wrong: {}", counter);
+        throw std::runtime_error("Critical section counter wrong");
+    }
+
+    // Report the slowest thread, as that's what a team waits for
+    barrierNanos =
+      *std::max_element(barrierTimes.begin(), barrierTimes.end()) /
+      nIterations;
+    criticalNanos =
+      *std::max_element(criticalTimes.begin(), criticalTimes.end()) /
+      nIterations;
+}
+
+int main(int argc, char* argv[])
+{
+    faabric::util::initLogging();
+
+    int nIterations = argc > 1 ? std::stoi(argv[1]) : 10000;
+
+    std::vector<int> threadCounts = { 2, 4, 8, 16, 32, 64 };
+
+    SPDLOG_INFO("Level sync latency ({} iterations, {} cores)",
+                nIterations,
+                std::thread::hardware_concurrency());
+    SPDLOG_INFO("{:>8} {:>12} {:>12}", "threads", "barrier ns", "critical ns");
+
+    for (int nThreads : threadCounts) {
+        long barrierNanos = 0;
+        long criticalNanos = 0;
+        runThreads(nThreads, nIterations, barrierNanos, criticalNanos);
+
+        SPDLOG_INFO(
+          "{:>8} {:>12} {:>12}", nThreads, barrierNanos, criticalNanos);
+    }
+
+    threads::clearThreadState();
+
+    return 0;
+}
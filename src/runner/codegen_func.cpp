@@ -7,6 +7,7 @@
 
 #include <conf/FaasmConfig.h>
 #include <conf/function_utils.h>
+#include <storage/CodegenScheduler.h>
 #include <storage/FileLoader.h>
 
 using namespace boost::filesystem;
@@ -32,6 +33,45 @@ void codegenForFunc(const std::string& user,
     loader.codegenForFunction(msg);
 }
 
+void printResults(const std::vector<storage::CodegenResult>& results)
+{
+    int nCompiled = 0;
+    int nSkipped = 0;
+    int nDeduplicated = 0;
+    int nFailed = 0;
+
+    for (const auto& r : results) {
+        std::string status = "compiled";
+        if (r.failed) {
+            status = "failed";
+            nFailed++;
+        } else if (r.skipped) {
+            status = "skipped";
+            nSkipped++;
+        } else if (r.deduplicated) {
+            status = "deduplicated";
+            nDeduplicated++;
+        } else {
+            nCompiled++;
+        }
+
+        SPDLOG_INFO("{}/{}: {} ({} bytes wasm, {}ms, peak RSS {}MB)",
+                    r.user,
+                    r.function,
+                    status,
+                    r.wasmBytes,
+                    r.compileMillis,
+                    r.peakRssKb / 1024);
+    }
+
+    SPDLOG_INFO("Codegen done: {} compiled, {} skipped, {} deduplicated, "
+                "{} failed",
+                nCompiled,
+                nSkipped,
+                nDeduplicated,
+                nFailed);
+}
+
 int main(int argc, char* argv[])
 {
     faabric::util::initLogging();
@@ -43,61 +83,22 @@ int main(int argc, char* argv[])
         SPDLOG_INFO("Running codegen for function {}/{}", user, func);
         codegenForFunc(user, func);
     } else if (argc == 2) {
-        std::string user = argv[1];
-
         conf::FaasmConfig& conf = conf::getFaasmConfig();
-        SPDLOG_INFO(
-          "Running codegen for user {} on dir {}", user, conf.functionDir);
+        storage::CodegenScheduler scheduler(faabric::util::getUsableCores());
 
-        boost::filesystem::path path(conf.functionDir);
-        path.append(user);
-
-        if (!boost::filesystem::is_directory(path)) {
-            SPDLOG_ERROR("Expected {} to be a directory", path.string());
-            return 1;
-        }
-
-        boost::filesystem::directory_iterator iter(path), end;
-        std::mutex mx;
-
-        unsigned int nThreads = faabric::util::getUsableCores();
-        std::vector<std::thread> threads;
-
-        for (unsigned int i = 0; i < nThreads; i++) {
-            threads.emplace_back([&iter, &mx, &end, &user] {
-                SPDLOG_INFO("Spawning codegen thread");
-
-                while (true) {
-                    std::string thisPath;
-
-                    {
-                        // Get lock
-                        faabric::util::UniqueLock lock(mx);
-
-                        // Check if we've got more to do
-                        if (iter == end) {
-                            SPDLOG_INFO("Codegen thread finished");
-                            break;
-                        }
-
-                        // Get path and increment
-                        thisPath = iter->path().string();
-                        iter++;
-                    }
-
-                    directory_entry subPath(thisPath);
-                    std::string functionName =
-                      subPath.path().filename().string();
-                    codegenForFunc(user, functionName);
-                }
-            });
+        std::string user = argv[1];
+        if (user == "--all") {
+            SPDLOG_INFO("Running codegen for all users on dir {}",
+                        conf.functionDir);
+            scheduler.addAllUsers();
+        } else {
+            SPDLOG_INFO(
+              "Running codegen for user {} on dir {}", user, conf.functionDir);
+            scheduler.addUser(user);
         }
 
-        for (auto& t : threads) {
-            if (t.joinable()) {
-                t.join();
-            }
-        }
+        std::vector<storage::CodegenResult> results = scheduler.run();
+        printResults(results);
     } else if (argc == 4 && std::string(argv[3]) == "--sgx") {
         std::string user = argv[1];
         std::string func = argv[2];
@@ -105,7 +106,8 @@ int main(int argc, char* argv[])
         SPDLOG_INFO("Running SGX codegen for function {}/{}", user, func);
         codegenForFunc(user, func, true);
     } else {
-        SPDLOG_ERROR("Must provide function user and optional function name");
+        SPDLOG_ERROR("Must provide function user (or --all) and optional "
+                     "function name");
         return 0;
     }
 }
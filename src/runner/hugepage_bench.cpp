@@ -0,0 +1,116 @@
+#include <conf/FaasmConfig.h>
+#include <wasm/WasmModule.h>
+#include <wavm/WAVMWasmModule.h>
+
+#include <faabric/util/func.h>
+#include <faabric/util/logging.h>
+#include <faabric/util/timing.h>
+
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * Compares running a memory-heavy function (e.g. a dense matmul) with and
+ * without huge pages backing its linear memory. Reports the data TLB read
+ * misses and the time per execution, so the function should do enough work
+ * for the setup to be negligible. The bytes of the memory on huge pages
+ * (AnonHugePages) show whether the advice took effect.
+ */
+static int openTlbMissCounter()
+{
+    struct perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                  (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd < 0) {
+        SPDLOG_WARN("Unable to count TLB misses: {}", std::strerror(errno));
+    }
+
+    return fd;
+}
+
+static void runFunction(faabric::Message& msg,
+                        const std::string& mode,
+                        int nIterations)
+{
+    conf::getFaasmConfig().hugePages = mode;
+
+    // Bind afresh so that the memory is advised (or not) from the start
+    wasm::WAVMWasmModule module;
+    module.bindToFunction(msg, false);
+
+    int fd = openTlbMissCounter();
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    faabric::util::TimePoint start = faabric::util::startTimer();
+    for (int i = 0; i < nIterations; i++) {
+        int returnValue = module.executeFunction(msg);
+        if (returnValue != 0) {
+            SPDLOG_ERROR("Function failed with {}", returnValue);
+            throw std::runtime_error("Function failed");
+        }
+    }
+    long micros = faabric::util::getTimeDiffMicros(start) / nIterations;
+
+    long long misses = -1;
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &misses, sizeof(misses)) != sizeof(misses)) {
+            misses = -1;
+        }
+        close(fd);
+    }
+
+    size_t hugeBytes = wasm::getMappedStatBytes(
+      module.getMemoryBase(), module.getMemorySizeBytes(), "AnonHugePages");
+
+    SPDLOG_INFO("{:>6} {:>14} {:>12} {:>14} {:>14}",
+                mode,
+                misses < 0 ? -1 : misses / nIterations,
+                micros,
+                module.getResidentMemoryBytes(),
+                hugeBytes);
+}
+
+int main(int argc, char* argv[])
+{
+    faabric::util::initLogging();
+
+    if (argc < 3) {
+        SPDLOG_ERROR("Usage: hugepage_bench <user> <function> [iterations]");
+        return 1;
+    }
+
+    std::string user = argv[1];
+    std::string function = argv[2];
+    int nIterations = argc > 3 ? std::stoi(argv[3]) : 10;
+
+    faabric::Message msg = faabric::util::messageFactory(user, function);
+
+    SPDLOG_INFO("Running {}/{} ({} iterations)", user, function, nIterations);
+    SPDLOG_INFO("{:>6} {:>14} {:>12} {:>14} {:>14}",
+                "huge",
+                "dTLB misses",
+                "exec us",
+                "resident B",
+                "huge page B");
+
+    runFunction(msg, "off", nIterations);
+    runFunction(msg, "on", nIterations);
+
+    return 0;
+}
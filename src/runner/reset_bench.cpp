@@ -0,0 +1,80 @@
+#include <conf/FaasmConfig.h>
+#include <wasm/WasmModule.h>
+#include <wavm/WAVMWasmModule.h>
+
+#include <faabric/util/func.h>
+#include <faabric/util/logging.h>
+#include <faabric/util/timing.h>
+
+#include <cstring>
+
+#define DIRTY_BYTES (ONE_MB_BYTES)
+
+/**
+ * Compares the cost of resetting a module from its zygote by cloning the
+ * compartment versus remapping the zygote's memory copy-on-write. Each
+ * iteration dirties a fixed amount of memory before resetting, so the
+ * copy-on-write reset should stay flat as the heap grows.
+ */
+long timeResets(wasm::WAVMWasmModule& zygote,
+                wasm::WAVMWasmModule& module,
+                const std::string& mode,
+                int nIterations)
+{
+    conf::getFaasmConfig().resetMode = mode;
+
+    // Warm up, e.g. to create the zygote memfd
+    module.resetFromZygote(zygote);
+
+    faabric::util::TimePoint start = faabric::util::startTimer();
+    for (int i = 0; i < nIterations; i++) {
+        std::memset(module.getMemoryBase(), i, DIRTY_BYTES);
+        module.resetFromZygote(zygote);
+    }
+
+    return faabric::util::getTimeDiffMicros(start) / nIterations;
+}
+
+int main(int argc, char* argv[])
+{
+    faabric::util::initLogging();
+
+    if (argc < 3) {
+        SPDLOG_ERROR("Usage: reset_bench <user> <function> [iterations]");
+        return 1;
+    }
+
+    std::string user = argv[1];
+    std::string function = argv[2];
+    int nIterations = argc > 3 ? std::stoi(argv[3]) : 100;
+
+    faabric::Message msg = faabric::util::messageFactory(user, function);
+
+    std::vector<int> heapSizesMb = { 16, 64, 256, 1024 };
+
+    SPDLOG_INFO("Resetting {}/{} ({} iterations, {} bytes dirtied)",
+                user,
+                function,
+                nIterations,
+                DIRTY_BYTES);
+    SPDLOG_INFO("{:>10} {:>12} {:>12}", "heap MB", "clone us", "cow us");
+
+    for (int heapMb : heapSizesMb) {
+        // Build a zygote with a resident heap of the given size
+        wasm::WAVMWasmModule zygote;
+        zygote.bindToFunction(msg, false);
+
+        uint32_t heapBytes = heapMb * ONE_MB_BYTES;
+        uint32_t heapOffset = zygote.growMemory(heapBytes);
+        std::memset(zygote.wasmPointerToNative(heapOffset), 1, heapBytes);
+
+        wasm::WAVMWasmModule module(zygote);
+
+        long cloneMicros = timeResets(zygote, module, "clone", nIterations);
+        long cowMicros = timeResets(zygote, module, "cow", nIterations);
+
+        SPDLOG_INFO("{:>10} {:>12} {:>12}", heapMb, cloneMicros, cowMicros);
+    }
+
+    return 0;
+}
@@ -85,9 +85,9 @@ void SGXWAMRWasmModule::doBindToFunction(faabric::Message& msg, bool cache)
     }
 
     // Set up the thread stacks
-    // 28/06/2021 - Threading is not supported in SGX-WAMR. However, the Faasm
-    // runtime expects (asserts) this vector to be non-empty. Change when
-    // in-SGX threading is supported.
+    // 28/06/2021 - Threading is not supported in SGX-WAMR. A placeholder stack
+    // stops the Faasm runtime trying to create them in memory it can't
+    // access. Change when in-SGX threading is supported.
     threadStacks.push_back(-1);
 }
 
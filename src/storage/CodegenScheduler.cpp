@@ -0,0 +1,236 @@
+#include <storage/CodegenScheduler.h>
+
+#include <conf/FaasmConfig.h>
+#include <conf/function_utils.h>
+#include <storage/FileLoader.h>
+
+#include <faabric/util/func.h>
+#include <faabric/util/locks.h>
+#include <faabric/util/logging.h>
+#include <faabric/util/timing.h>
+
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include <sys/resource.h>
+#include <thread>
+
+namespace storage {
+
+CodegenScheduler::CodegenScheduler(int nThreadsIn)
+  : nThreads(std::max(nThreadsIn, 1))
+{}
+
+void CodegenScheduler::addFunction(const std::string& user,
+                                   const std::string& function)
+{
+    faabric::Message msg = faabric::util::messageFactory(user, function);
+    if (!conf::isValidFunction(msg)) {
+        SPDLOG_WARN("Invalid function: {}/{}", user, function);
+        return;
+    }
+
+    CodegenTask task;
+    task.user = user;
+    task.function = function;
+    task.wasmBytes = boost::filesystem::file_size(conf::getFunctionFile(msg));
+
+    tasks.emplace_back(task);
+}
+
+void CodegenScheduler::addUser(const std::string& user)
+{
+    conf::FaasmConfig& conf = conf::getFaasmConfig();
+    boost::filesystem::path path(conf.functionDir);
+    path.append(user);
+
+    if (!boost::filesystem::is_directory(path)) {
+        SPDLOG_ERROR("Expected {} to be a directory", path.string());
+        throw std::runtime_error("User function directory not found");
+    }
+
+    boost::filesystem::directory_iterator iter(path), end;
+    for (; iter != end; iter++) {
+        if (boost::filesystem::is_directory(iter->path())) {
+            addFunction(user, iter->path().filename().string());
+        }
+    }
+}
+
+void CodegenScheduler::addAllUsers()
+{
+    conf::FaasmConfig& conf = conf::getFaasmConfig();
+    boost::filesystem::path path(conf.functionDir);
+
+    boost::filesystem::directory_iterator iter(path), end;
+    for (; iter != end; iter++) {
+        if (boost::filesystem::is_directory(iter->path())) {
+            addUser(iter->path().filename().string());
+        }
+    }
+}
+
+size_t CodegenScheduler::getTaskCount()
+{
+    return tasks.size();
+}
+
+std::vector<CodegenResult> CodegenScheduler::run()
+{
+    // Deal out the largest modules first, so that the longest compiles don't
+    // end up running on their own at the end
+    std::sort(tasks.begin(),
+              tasks.end(),
+              [](const CodegenTask& a, const CodegenTask& b) {
+                  return a.wasmBytes > b.wasmBytes;
+              });
+
+    queues = std::vector<std::deque<CodegenTask>>(nThreads);
+    queueMutexes.clear();
+    for (int i = 0; i < nThreads; i++) {
+        queueMutexes.emplace_back(std::make_unique<std::mutex>());
+    }
+
+    for (size_t i = 0; i < tasks.size(); i++) {
+        queues.at(i % nThreads).push_back(tasks.at(i));
+    }
+
+    SPDLOG_INFO(
+      "Running codegen for {} functions on {} threads", tasks.size(), nThreads);
+
+    std::mutex resultsMx;
+    std::vector<CodegenResult> results;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nThreads; i++) {
+        threads.emplace_back([this, i, &resultsMx, &results] {
+            CodegenTask task;
+            while (nextTask(i, task)) {
+                CodegenResult result = doCodegen(task);
+
+                faabric::util::UniqueLock lock(resultsMx);
+                results.emplace_back(result);
+            }
+        });
+    }
+
+    for (auto& t : threads) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+
+    tasks.clear();
+    objectsByHash.clear();
+
+    return results;
+}
+
+bool CodegenScheduler::nextTask(int threadIdx, CodegenTask& task)
+{
+    // Take the largest task from our own queue
+    {
+        faabric::util::UniqueLock lock(*queueMutexes.at(threadIdx));
+        std::deque<CodegenTask>& queue = queues.at(threadIdx);
+        if (!queue.empty()) {
+            task = queue.front();
+            queue.pop_front();
+            return true;
+        }
+    }
+
+    // Steal from the back of another thread's queue
+    for (int offset = 1; offset < nThreads; offset++) {
+        int victimIdx = (threadIdx + offset) % nThreads;
+
+        faabric::util::UniqueLock lock(*queueMutexes.at(victimIdx));
+        std::deque<CodegenTask>& queue = queues.at(victimIdx);
+        if (!queue.empty()) {
+            task = queue.back();
+            queue.pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+CodegenResult CodegenScheduler::doCodegen(const CodegenTask& task)
+{
+    CodegenResult result;
+    result.user = task.user;
+    result.function = task.function;
+    result.wasmBytes = task.wasmBytes;
+
+    faabric::Message msg =
+      faabric::util::messageFactory(task.user, task.function);
+    std::string funcStr = faabric::util::funcToString(msg, false);
+
+    FileLoader& loader = getFileLoader();
+    faabric::util::TimePoint start = faabric::util::startTimer();
+
+    try {
+        std::vector<uint8_t> wasmBytes = loader.loadFunctionWasm(msg);
+        if (wasmBytes.empty()) {
+            throw std::runtime_error("Loaded empty bytes for " + funcStr);
+        }
+
+        std::vector<uint8_t> hash = loader.hashBytes(wasmBytes);
+        std::vector<uint8_t> oldHash = loader.loadFunctionCodegenHash(msg);
+
+        if (!oldHash.empty() && oldHash == hash) {
+            SPDLOG_DEBUG("Skipping codegen for {}", funcStr);
+            result.skipped = true;
+        } else {
+            // The first function seen with this wasm compiles it, any others
+            // wait for its result
+            std::string hashKey(hash.begin(), hash.end());
+            std::promise<std::vector<uint8_t>> objPromise;
+            std::shared_future<std::vector<uint8_t>> objFuture;
+            bool isOwner = false;
+            {
+                faabric::util::UniqueLock lock(dedupMx);
+                auto it = objectsByHash.find(hashKey);
+                if (it == objectsByHash.end()) {
+                    objFuture = objPromise.get_future().share();
+                    objectsByHash[hashKey] = objFuture;
+                    isOwner = true;
+                } else {
+                    objFuture = it->second;
+                }
+            }
+
+            std::vector<uint8_t> objBytes;
+            if (isOwner) {
+                SPDLOG_INFO("Generating machine code for {}", funcStr);
+                try {
+                    objBytes = loader.doCodegen(wasmBytes, funcStr);
+                } catch (std::exception& e) {
+                    objPromise.set_value({});
+                    throw;
+                }
+                objPromise.set_value(objBytes);
+            } else {
+                SPDLOG_INFO("Reusing machine code for identical {}", funcStr);
+                objBytes = objFuture.get();
+                if (objBytes.empty()) {
+                    throw std::runtime_error("Codegen failed for same wasm");
+                }
+                result.deduplicated = true;
+            }
+
+            loader.uploadFunctionCodegen(msg, objBytes, hash);
+        }
+    } catch (std::exception& e) {
+        SPDLOG_ERROR("Codegen failed for {}: {}", funcStr, e.what());
+        result.failed = true;
+    }
+
+    result.compileMillis = faabric::util::getTimeDiffMicros(start) / 1000;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    result.peakRssKb = usage.ru_maxrss;
+
+    return result;
+}
+}
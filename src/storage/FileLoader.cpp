@@ -67,16 +67,7 @@ void FileLoader::codegenForFunction(faabric::Message& msg)
 
     // Compare hashes
     std::vector<uint8_t> newHash = hashBytes(bytes);
-    std::vector<uint8_t> oldHash;
-    conf::FaasmConfig& conf = conf::getFaasmConfig();
-    if (conf.wasmVm == "wamr") {
-        oldHash = loadFunctionWamrAotHash(msg);
-    } else if (conf.wasmVm == "wavm" && msg.issgx()) {
-        SPDLOG_ERROR("Can't run SGX codegen for WAVM. Only WAMR is supported.");
-        throw std::runtime_error("SGX codegen for WAVM");
-    } else {
-        oldHash = loadFunctionObjectHash(msg);
-    }
+    std::vector<uint8_t> oldHash = loadFunctionCodegenHash(msg);
 
     if ((!oldHash.empty()) && newHash == oldHash) {
         SPDLOG_DEBUG("Skipping codegen for {}", funcStr);
@@ -97,12 +88,36 @@ void FileLoader::codegenForFunction(faabric::Message& msg)
     }
 
     // Upload the file contents and the hash
+    uploadFunctionCodegen(msg, objBytes, newHash);
+}
+
+std::vector<uint8_t> FileLoader::loadFunctionCodegenHash(
+  const faabric::Message& msg)
+{
+    conf::FaasmConfig& conf = conf::getFaasmConfig();
+    if (conf.wasmVm == "wamr") {
+        return loadFunctionWamrAotHash(msg);
+    }
+
+    if (conf.wasmVm == "wavm" && msg.issgx()) {
+        SPDLOG_ERROR("Can't run SGX codegen for WAVM. Only WAMR is supported.");
+        throw std::runtime_error("SGX codegen for WAVM");
+    }
+
+    return loadFunctionObjectHash(msg);
+}
+
+void FileLoader::uploadFunctionCodegen(const faabric::Message& msg,
+                                       const std::vector<uint8_t>& objBytes,
+                                       const std::vector<uint8_t>& hash)
+{
+    conf::FaasmConfig& conf = conf::getFaasmConfig();
     if (conf.wasmVm == "wamr") {
         uploadFunctionAotFile(msg, objBytes);
-        uploadFunctionWamrAotHash(msg, newHash);
+        uploadFunctionWamrAotHash(msg, hash);
     } else {
         uploadFunctionObjectFile(msg, objBytes);
-        uploadFunctionObjectHash(msg, newHash);
+        uploadFunctionObjectHash(msg, hash);
     }
 }
 
@@ -1,7 +1,6 @@
 #include <faabric/scheduler/Scheduler.h>
 #include <faabric/util/config.h>
 #include <faabric/util/gids.h>
-#include <faabric/util/latch.h>
 #include <faabric/util/locks.h>
 #include <faabric/util/logging.h>
 #include <faabric/util/macros.h>
@@ -9,6 +8,10 @@
 
 #include <threads/ThreadState.h>
 
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
 using namespace faabric::util;
 
 #define FROM_MAP(varName, T, m, ...)                                           \
@@ -28,25 +31,40 @@ static thread_local std::shared_ptr<Level> currentLevel = nullptr;
 
 std::mutex sharedMutex;
 
-std::unordered_map<uint32_t, std::shared_ptr<faabric::util::Latch>> latches;
+// Threads cache the sync objects of their current level, so barriers and
+// critical sections don't have to take the shared mutex
+std::unordered_map<uint32_t, std::shared_ptr<LevelSync>> levelSyncs;
+static thread_local uint32_t cachedSyncId = 0;
+static thread_local std::shared_ptr<LevelSync> cachedSync = nullptr;
 
-std::unordered_map<uint32_t, std::shared_ptr<std::recursive_mutex>>
-  levelMutexes;
+// Threads of each level running in another host's memory than the master's,
+// where there's no end of the fork to clear up the level
+std::unordered_map<uint32_t, int> remoteThreadCounts;
 
 std::unordered_map<uint32_t, std::shared_ptr<std::mutex>> nowaitMutexes;
 std::unordered_map<uint32_t, std::shared_ptr<std::atomic<int>>> nowaitCounts;
 std::unordered_map<uint32_t, std::shared_ptr<std::condition_variable>>
   nowaitCvs;
 
+std::unordered_map<uint32_t, std::shared_ptr<Reduction>> reductions;
+
+std::unordered_map<uint32_t, std::map<int, std::shared_ptr<SharedLoop>>>
+  sharedLoops;
+
 void clearThreadState()
 {
-    latches.clear();
-
-    levelMutexes.clear();
+    levelSyncs.clear();
+    cachedSyncId = 0;
+    cachedSync = nullptr;
+    remoteThreadCounts.clear();
 
     nowaitMutexes.clear();
     nowaitCounts.clear();
     nowaitCvs.clear();
+
+    reductions.clear();
+
+    sharedLoops.clear();
 }
 
 void setCurrentOpenMPLevel(const std::shared_ptr<Level>& level)
@@ -202,6 +220,24 @@ void Level::deserialise(const Level* other)
                 nSharedVarOffsets * sizeof(uint32_t));
 }
 
+std::shared_ptr<LevelSync> Level::getSync()
+{
+    if (cachedSync != nullptr && cachedSyncId == id) {
+        return cachedSync;
+    }
+
+    faabric::util::UniqueLock lock(sharedMutex);
+    std::shared_ptr<LevelSync>& sync = levelSyncs[id];
+    if (sync == nullptr) {
+        sync = std::make_shared<LevelSync>(numThreads);
+    }
+
+    cachedSyncId = id;
+    cachedSync = sync;
+
+    return sync;
+}
+
 void Level::waitOnBarrier()
 {
     // Ignore if single threaded
@@ -209,35 +245,488 @@ void Level::waitOnBarrier()
         return;
     }
 
-    // Create if necessary
-    if (latches.find(id) == latches.end()) {
+    getSync()->barrier.wait();
+}
+
+void Level::abort()
+{
+    getSync()->aborted->set();
+
+    std::shared_ptr<Reduction> reduction = getReduction();
+    if (reduction != nullptr) {
+        reduction->notifyAborted();
+    }
+}
+
+void Level::checkAborted()
+{
+    getSync()->aborted->check();
+}
+
+void Level::lockCritical()
+{
+    getSync()->critical.lock();
+}
+
+void Level::unlockCritical()
+{
+    getSync()->critical.unlock();
+}
+
+std::shared_ptr<TaskPool> Level::getTaskPool()
+{
+    std::shared_ptr<LevelSync> sync = getSync();
+    return std::shared_ptr<TaskPool>(sync, &sync->tasks);
+}
+
+void Level::clearSync()
+{
+    faabric::util::UniqueLock lock(sharedMutex);
+    levelSyncs.erase(id);
+
+    if (cachedSyncId == id) {
+        cachedSyncId = 0;
+        cachedSync = nullptr;
+    }
+}
+
+void Level::startRemoteThread()
+{
+    faabric::util::UniqueLock lock(sharedMutex);
+    remoteThreadCounts[id]++;
+}
+
+void Level::finishRemoteThread()
+{
+    {
         faabric::util::UniqueLock lock(sharedMutex);
-        if (latches.find(id) == latches.end()) {
-            latches[id] = Latch::create(numThreads);
+        if (--remoteThreadCounts[id] > 0) {
+            return;
         }
+
+        remoteThreadCounts.erase(id);
     }
 
-    latches[id]->wait();
+    // A thread of the level starting after this can't share a barrier with
+    // the ones that have finished, so can start from fresh sync objects
+    clearSync();
+}
 
-    // Remove the used latch from the map
-    if (latches.find(id) != latches.end()) {
-        faabric::util::UniqueLock lock(sharedMutex);
-        if (latches.find(id) != latches.end()) {
-            latches.erase(id);
+void Level::prepareReduction()
+{
+    std::shared_ptr<LevelSync> sync = getSync();
+
+    faabric::util::UniqueLock lock(sharedMutex);
+    reductions[id] = std::make_shared<Reduction>(sync->aborted);
+}
+
+std::shared_ptr<Reduction> Level::getReduction()
+{
+    faabric::util::UniqueLock lock(sharedMutex);
+    auto it = reductions.find(id);
+    if (it == reductions.end()) {
+        return nullptr;
+    }
+
+    return it->second;
+}
+
+void Level::clearReduction()
+{
+    faabric::util::UniqueLock lock(sharedMutex);
+    reductions.erase(id);
+}
+
+std::shared_ptr<SharedLoop> Level::getSharedLoop(int loopIdx)
+{
+    faabric::util::UniqueLock lock(sharedMutex);
+    std::shared_ptr<SharedLoop>& loop = sharedLoops[id][loopIdx];
+    if (loop == nullptr) {
+        loop = std::make_shared<SharedLoop>();
+    }
+
+    return loop;
+}
+
+void Level::finishSharedLoop(int loopIdx)
+{
+    faabric::util::UniqueLock lock(sharedMutex);
+    auto levelIt = sharedLoops.find(id);
+    if (levelIt == sharedLoops.end()) {
+        return;
+    }
+
+    auto loopIt = levelIt->second.find(loopIdx);
+    if (loopIt == levelIt->second.end()) {
+        return;
+    }
+
+    int nFinished = loopIt->second->nFinished.fetch_add(1) + 1;
+    if (nFinished < numThreads) {
+        return;
+    }
+
+    levelIt->second.erase(loopIt);
+    if (levelIt->second.empty()) {
+        sharedLoops.erase(levelIt);
+    }
+}
+
+// Spins for a while before yielding, as there may be more threads than cores
+#define SPIN_BEFORE_YIELD 1024
+
+// Barriers only read the clock every so many spins
+#define SPINS_PER_TIMEOUT_CHECK 1024
+
+static inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+static inline void backoff(int& nSpins, int nPauses)
+{
+    if (nSpins < SPIN_BEFORE_YIELD) {
+        nSpins += nPauses;
+        for (int i = 0; i < nPauses; i++) {
+            cpuRelax();
         }
+    } else {
+        std::this_thread::yield();
     }
 }
 
-void Level::lockCritical()
+void AbortFlag::set()
 {
-    FROM_MAP(mx, std::recursive_mutex, levelMutexes);
-    mx->lock();
+    flag.store(true, std::memory_order_release);
 }
 
-void Level::unlockCritical()
+bool AbortFlag::isSet() const
+{
+    return flag.load(std::memory_order_acquire);
+}
+
+void AbortFlag::check() const
+{
+    if (isSet()) {
+        throw std::runtime_error("OpenMP level aborted");
+    }
+}
+
+Barrier::Barrier(int numThreadsIn, const AbortFlag& abortedIn, int timeoutMsIn)
+  : numThreads(numThreadsIn)
+  , timeoutMs(timeoutMsIn)
+  , aborted(abortedIn)
+{}
+
+void Barrier::wait()
+{
+    aborted.check();
+
+    // Read the generation before arriving, otherwise the last thread could
+    // flip it before we look
+    uint32_t gen = generation.load(std::memory_order_acquire);
+
+    if (count.fetch_add(1, std::memory_order_acq_rel) == numThreads - 1) {
+        count.store(0, std::memory_order_relaxed);
+        generation.store(gen + 1, std::memory_order_release);
+        return;
+    }
+
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(timeoutMs);
+
+    int nSpins = 0;
+    int nChecks = 0;
+    while (generation.load(std::memory_order_acquire) == gen) {
+        aborted.check();
+
+        if (++nChecks == SPINS_PER_TIMEOUT_CHECK) {
+            nChecks = 0;
+            if (std::chrono::steady_clock::now() > deadline) {
+                SPDLOG_ERROR("Timed out waiting on OpenMP barrier");
+                throw std::runtime_error("OpenMP barrier timed out");
+            }
+        }
+
+        backoff(nSpins, 1);
+    }
+}
+
+TicketLock::TicketLock(const AbortFlag& abortedIn)
+  : aborted(abortedIn)
+{}
+
+void TicketLock::lock()
+{
+    std::thread::id thisThread = std::this_thread::get_id();
+    if (owner.load(std::memory_order_relaxed) == thisThread) {
+        depth++;
+        return;
+    }
+
+    uint32_t ticket = nextTicket.fetch_add(1, std::memory_order_relaxed);
+
+    int nSpins = 0;
+    while (true) {
+        uint32_t serving = nowServing.load(std::memory_order_acquire);
+        if (serving == ticket) {
+            break;
+        }
+
+        aborted.check();
+        backoff(nSpins, (int)(ticket - serving));
+    }
+
+    owner.store(thisThread, std::memory_order_relaxed);
+    depth = 1;
+}
+
+void TicketLock::unlock()
+{
+    if (owner.load(std::memory_order_relaxed) != std::this_thread::get_id()) {
+        SPDLOG_ERROR("Unlocking critical section not held by this thread");
+        throw std::runtime_error("Unlocking critical section not held");
+    }
+
+    if (--depth > 0) {
+        return;
+    }
+
+    owner.store(std::thread::id(), std::memory_order_relaxed);
+    nowServing.store(nowServing.load(std::memory_order_relaxed) + 1,
+                     std::memory_order_release);
+}
+
+// Beyond this many queued tasks a thread runs new tasks straight away, which
+// bounds the memory held by queued tasks
+#define MAX_QUEUED_TASKS 256
+
+TaskPool::TaskPool(int numThreadsIn)
+  : numThreads(numThreadsIn)
+  , deques(numThreadsIn)
+{}
+
+bool TaskPool::push(int threadNum, const ExplicitTask& task)
+{
+    TaskDeque& deque = deques.at(threadNum);
+    if (deque.size.load(std::memory_order_relaxed) >= MAX_QUEUED_TASKS) {
+        return false;
+    }
+
+    // Count the task before it can be seen, so waiters can't miss it
+    outstanding.fetch_add(1, std::memory_order_relaxed);
+    if (task.siblings != nullptr) {
+        task.siblings->count.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (task.group != nullptr) {
+        task.group->count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::unique_lock<std::mutex> lock(deque.mx);
+    deque.tasks.push_back(task);
+    deque.size.store(deque.tasks.size(), std::memory_order_relaxed);
+
+    return true;
+}
+
+bool TaskPool::pop(int threadNum, ExplicitTask& task)
+{
+    // Take the newest of our own tasks
+    TaskDeque& own = deques.at(threadNum);
+    if (own.size.load(std::memory_order_relaxed) > 0) {
+        std::unique_lock<std::mutex> lock(own.mx);
+        if (!own.tasks.empty()) {
+            task = own.tasks.back();
+            own.tasks.pop_back();
+            own.size.store(own.tasks.size(), std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    // Steal the oldest of another thread's, starting with our neighbour
+    for (int i = 1; i < numThreads; i++) {
+        TaskDeque& victim = deques.at((threadNum + i) % numThreads);
+        if (victim.size.load(std::memory_order_relaxed) == 0) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(victim.mx);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            victim.size.store(victim.tasks.size(), std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void TaskPool::finish(const ExplicitTask& task)
+{
+    if (task.siblings != nullptr) {
+        task.siblings->count.fetch_sub(1, std::memory_order_acq_rel);
+    }
+    if (task.group != nullptr) {
+        task.group->count.fetch_sub(1, std::memory_order_acq_rel);
+    }
+    outstanding.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+int TaskPool::getOutstanding()
+{
+    return outstanding.load(std::memory_order_acquire);
+}
+
+LevelSync::LevelSync(int numThreads)
+  : barrier(numThreads, *aborted)
+  , critical(*aborted)
+  , tasks(numThreads)
+{}
+
+Reduction::Reduction(std::shared_ptr<AbortFlag> abortedIn)
+  : aborted(std::move(abortedIn))
+{}
+
+void Reduction::notifyAborted()
 {
-    FROM_MAP(mx, std::recursive_mutex, levelMutexes);
-    mx->unlock();
+    // Take the lock so waiters can't miss the flag between checking it and
+    // starting to wait
+    {
+        std::unique_lock<std::mutex> lock(mx);
+    }
+
+    cv.notify_all();
+}
+
+void Reduction::setLocalThreads(const std::vector<int>& localThreadNumsIn)
+{
+    {
+        std::unique_lock<std::mutex> lock(mx);
+        localThreadNums = localThreadNumsIn;
+        std::sort(localThreadNums.begin(), localThreadNums.end());
+        placed = true;
+    }
+
+    cv.notify_all();
+}
+
+void Reduction::awaitPlaced(std::unique_lock<std::mutex>& lock)
+{
+    cv.wait(lock, [this] { return placed || aborted->isSet(); });
+    aborted->check();
+}
+
+std::vector<int> Reduction::getLocalThreads()
+{
+    std::unique_lock<std::mutex> lock(mx);
+    awaitPlaced(lock);
+    return localThreadNums;
+}
+
+std::vector<int> Reduction::getRemoteThreads(int numThreads)
+{
+    std::unique_lock<std::mutex> lock(mx);
+    awaitPlaced(lock);
+
+    std::vector<int> remoteThreadNums;
+    for (int i = 0; i < numThreads; i++) {
+        if (!std::binary_search(
+              localThreadNums.begin(), localThreadNums.end(), i)) {
+            remoteThreadNums.push_back(i);
+        }
+    }
+
+    return remoteThreadNums;
+}
+
+int Reduction::getRank(int localThreadNum)
+{
+    std::unique_lock<std::mutex> lock(mx);
+    awaitPlaced(lock);
+
+    auto it = std::lower_bound(
+      localThreadNums.begin(), localThreadNums.end(), localThreadNum);
+    if (it == localThreadNums.end() || *it != localThreadNum) {
+        SPDLOG_ERROR("Thread {} not local to reduction", localThreadNum);
+        throw std::runtime_error("Thread not local to reduction");
+    }
+
+    return it - localThreadNums.begin();
+}
+
+void Reduction::arrive(int round, int rank, int32_t reduceData)
+{
+    {
+        std::unique_lock<std::mutex> lock(mx);
+        rounds[round].arrived[rank] = reduceData;
+    }
+
+    cv.notify_all();
+}
+
+int32_t Reduction::awaitArrival(int round, int rank)
+{
+    std::unique_lock<std::mutex> lock(mx);
+    cv.wait(lock, [this, round, rank] {
+        return rounds[round].arrived.count(rank) > 0 || aborted->isSet();
+    });
+    aborted->check();
+
+    return rounds[round].arrived[rank];
+}
+
+void Reduction::markConsumed(int round, int rank)
+{
+    {
+        std::unique_lock<std::mutex> lock(mx);
+        rounds[round].consumed[rank] = true;
+    }
+
+    cv.notify_all();
+}
+
+void Reduction::awaitConsumed(int round, int rank)
+{
+    std::unique_lock<std::mutex> lock(mx);
+    cv.wait(lock, [this, round, rank] {
+        return rounds[round].consumed[rank] || aborted->isSet();
+    });
+    aborted->check();
+}
+
+void Reduction::release(int round)
+{
+    {
+        std::unique_lock<std::mutex> lock(mx);
+        rounds[round].released = true;
+    }
+
+    cv.notify_all();
+}
+
+void Reduction::awaitRelease(int round)
+{
+    std::unique_lock<std::mutex> lock(mx);
+    cv.wait(lock, [this, round] {
+        return rounds[round].released || aborted->isSet();
+    });
+    aborted->check();
+}
+
+void Reduction::finish(int round)
+{
+    std::unique_lock<std::mutex> lock(mx);
+
+    Round& r = rounds[round];
+    r.nFinished++;
+    if (r.nFinished == (int)localThreadNums.size()) {
+        rounds.erase(round);
+    }
 }
 
 // Note that we need be able to translate between local and global thread
@@ -0,0 +1,75 @@
+#include <wamr/WAMRWasmModule.h>
+
+#include <faabric/util/func.h>
+#include <faabric/util/locks.h>
+#include <faabric/util/logging.h>
+
+#include <wasm_export.h>
+
+#include <unistd.h>
+
+namespace wasm {
+WAMRModuleCache& getWAMRModuleCache()
+{
+    static WAMRModuleCache r;
+    return r;
+}
+
+WAMRCachedModule::~WAMRCachedModule()
+{
+    if (wasmModule != nullptr) {
+        wasm_runtime_unload(wasmModule);
+    }
+
+    if (zygoteMemoryFd >= 0) {
+        close(zygoteMemoryFd);
+    }
+}
+
+std::shared_ptr<WAMRCachedModule> WAMRModuleCache::getCachedModule(
+  const faabric::Message& msg)
+{
+    std::string key = faabric::util::funcToString(msg, false);
+
+    {
+        faabric::util::SharedLock lock(mx);
+        auto it = cachedModuleMap.find(key);
+        if (it != cachedModuleMap.end()) {
+            return it->second;
+        }
+    }
+
+    faabric::util::FullLock lock(mx);
+
+    // Re-check condition
+    auto it = cachedModuleMap.find(key);
+    if (it != cachedModuleMap.end()) {
+        return it->second;
+    }
+
+    SPDLOG_DEBUG("WAMR module cache loading {}", key);
+
+    WAMRWasmModule::initialiseWAMRGlobally();
+
+    auto cachedModule = std::make_shared<WAMRCachedModule>();
+    cachedModule->moduleBytes = loadWAMRModuleBytes(msg);
+    cachedModule->wasmModule = loadWAMRModule(cachedModule->moduleBytes);
+
+    cachedModuleMap[key] = cachedModule;
+
+    return cachedModule;
+}
+
+void WAMRModuleCache::clear()
+{
+    // Modules still in use are unloaded once their last instance is gone
+    faabric::util::FullLock lock(mx);
+    cachedModuleMap.clear();
+}
+
+size_t WAMRModuleCache::getTotalCachedModuleCount()
+{
+    faabric::util::SharedLock lock(mx);
+    return cachedModuleMap.size();
+}
+}
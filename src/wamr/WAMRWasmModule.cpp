@@ -4,14 +4,21 @@
 #include "wasm_exec_env.h"
 #include "wasm_runtime.h"
 
+#include <conf/FaasmConfig.h>
+#include <faabric/util/func.h>
 #include <faabric/util/locks.h>
 #include <faabric/util/logging.h>
+#include <faabric/util/timing.h>
+#include <threads/ThreadState.h>
 #include <wamr/native.h>
 #include <wasm/WasmExecutionContext.h>
 #include <wasm/WasmModule.h>
 
 #include <cstdint>
+#include <cstring>
 #include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
 #include <storage/FileLoader.h>
 #include <wasm_export.h>
 
@@ -19,6 +26,10 @@
 #include <wasm_runtime.h>
 #else
 #include <aot_runtime.h>
+
+// The unwrapped WAMR function, see __wrap_aot_enlarge_memory below
+extern "C" bool __real_aot_enlarge_memory(AOTModuleInstance* instance,
+                                          uint32_t incPageCount);
 #endif
 
 namespace wasm {
@@ -46,14 +57,46 @@ void WAMRWasmModule::initialiseWAMRGlobally()
 
         // Initialise native functions
         initialiseWAMRNatives();
+
+        wamrInitialised = true;
     }
 }
 
+void WAMRWasmModule::clearCaches()
+{
+    getWAMRModuleCache().clear();
+}
+
 void tearDownWAMRGlobally()
 {
     wasm_runtime_destroy();
 }
 
+std::vector<uint8_t> loadWAMRModuleBytes(const faabric::Message& msg)
+{
+    storage::FileLoader& functionLoader = storage::getFileLoader();
+#if (WAMR_EXECUTION_MODE_INTERP)
+    return functionLoader.loadFunctionWasm(msg);
+#else
+    return functionLoader.loadFunctionWamrAotFile(msg);
+#endif
+}
+
+WASMModuleCommon* loadWAMRModule(std::vector<uint8_t>& moduleBytes)
+{
+    char errorBuffer[ERROR_BUFFER_SIZE];
+    WASMModuleCommon* wasmModule = wasm_runtime_load(
+      moduleBytes.data(), moduleBytes.size(), errorBuffer, ERROR_BUFFER_SIZE);
+
+    if (wasmModule == nullptr) {
+        std::string errorMsg = std::string(errorBuffer);
+        SPDLOG_ERROR("Failed to load WAMR module: \n{}", errorMsg);
+        throw std::runtime_error("Failed to load WAMR module");
+    }
+
+    return wasmModule;
+}
+
 WAMRWasmModule::WAMRWasmModule()
 {
     initialiseWAMRGlobally();
@@ -67,8 +110,21 @@ WAMRWasmModule::WAMRWasmModule(int threadPoolSizeIn)
 
 WAMRWasmModule::~WAMRWasmModule()
 {
-    wasm_runtime_deinstantiate(moduleInstance);
-    wasm_runtime_unload(wasmModule);
+    destroyThreadInstances();
+
+    if (moduleInstance != nullptr) {
+        wasm_runtime_deinstantiate(moduleInstance);
+    }
+
+    // Cached modules are unloaded by the cache
+    if (ownsWasmModule && wasmModule != nullptr) {
+        wasm_runtime_unload(wasmModule);
+    }
+
+    // Shared zygote images are closed by the cache
+    if (ownsZygoteMemoryFd && zygoteMemoryFd >= 0) {
+        close(zygoteMemoryFd);
+    }
 }
 
 // ----- Module lifecycle -----
@@ -78,26 +134,35 @@ void WAMRWasmModule::doBindToFunction(faabric::Message& msg, bool cache)
     // Prepare the filesystem
     filesystem.prepareFilesystem();
 
-    // Load the wasm file
-    storage::FileLoader& functionLoader = storage::getFileLoader();
-#if (WAMR_EXECUTION_MODE_INTERP)
-    wasmBytes = functionLoader.loadFunctionWasm(msg);
-#else
-    std::vector<uint8_t> wasmBytes =
-      functionLoader.loadFunctionWamrAotFile(msg);
+    // Load the module, sharing the cached one unless we've been given our own
+    // bytes
+    if (moduleBytes.empty() && cache) {
+        cachedModule = getWAMRModuleCache().getCachedModule(msg);
+        wasmModule = cachedModule->wasmModule;
+    } else {
+        if (moduleBytes.empty()) {
+            moduleBytes = loadWAMRModuleBytes(msg);
+        }
+
+        wasmModule = loadWAMRModule(moduleBytes);
+        ownsWasmModule = true;
+    }
+
+    instantiateModule();
+
+#if !(WAMR_EXECUTION_MODE_INTERP)
+    takeZygote();
 #endif
 
-    // Load wasm module
-    wasmModule = wasm_runtime_load(
-      wasmBytes.data(), wasmBytes.size(), errorBuffer, ERROR_BUFFER_SIZE);
+    // Thread instances are created lazily when threads first execute
+    threadInstances.resize(threadPoolSize, nullptr);
+    threadInstanceMemories.resize(threadPoolSize);
 
-    if (wasmModule == nullptr) {
-        std::string errorMsg = std::string(errorBuffer);
-        SPDLOG_ERROR("Failed to load WAMR module: \n{}", errorMsg);
-        throw std::runtime_error("Failed to load WAMR module");
-    }
+    syncMemoryQuota();
+}
 
-    // Instantiate module
+void WAMRWasmModule::instantiateModule()
+{
     moduleInstance = wasm_runtime_instantiate(
       wasmModule, STACK_SIZE_KB, HEAP_SIZE_KB, errorBuffer, ERROR_BUFFER_SIZE);
 
@@ -109,8 +174,210 @@ void WAMRWasmModule::doBindToFunction(faabric::Message& msg, bool cache)
 
     currentBrk = getMemorySizeBytes();
 
-    // Set up thread stacks
-    createThreadStacks();
+    // Thread stacks are created again when needed
+    clearThreadStacks();
+}
+
+void WAMRWasmModule::reset(faabric::Message& msg)
+{
+    if (!_isBound) {
+        return;
+    }
+
+    std::string funcStr = faabric::util::funcToString(msg, true);
+    SPDLOG_DEBUG("WAMR resetting after {}", funcStr);
+
+    stopLazyRestore();
+
+#if (WAMR_EXECUTION_MODE_INTERP)
+    // Without access to the globals we have to instantiate again, although
+    // the loaded module is still reused
+    wasm_runtime_deinstantiate(moduleInstance);
+    moduleInstance = nullptr;
+    instantiateModule();
+    syncMemoryQuota();
+#else
+    restoreZygote();
+#endif
+}
+
+void WAMRWasmModule::takeZygote()
+{
+    PROF_START(wamrZygote)
+
+    zygoteMemoryBytes = getMemorySizeBytes();
+    zygoteBrk = currentBrk;
+
+    // Instantiation is deterministic, so instances of the same function can
+    // all map one image of the zygote's memory. Pages only read (e.g. data
+    // segments) are then shared, and copied on first write.
+    if (cachedModule != nullptr &&
+        conf::getFaasmConfig().shareZygoteMemory == "on") {
+        faabric::util::UniqueLock lock(cachedModule->zygoteMx);
+        if (cachedModule->zygoteMemoryFd < 0) {
+            cachedModule->zygoteMemoryFd = writeZygoteMemory();
+            cachedModule->zygoteMemoryBytes = zygoteMemoryBytes;
+        }
+
+        if (cachedModule->zygoteMemoryBytes == zygoteMemoryBytes) {
+            zygoteMemoryFd = cachedModule->zygoteMemoryFd;
+
+            faabric::util::FullLock memLock(moduleMemoryMutex);
+            remapZygoteMemory(0, zygoteMemoryBytes);
+            zygoteMappedBytes = zygoteMemoryBytes;
+            zygoteMemoryMapped = true;
+        }
+    }
+
+    if (zygoteMemoryFd < 0) {
+        zygoteMemoryFd = writeZygoteMemory();
+        ownsZygoteMemoryFd = true;
+    }
+
+    // Globals (e.g. the stack pointer) live outside linear memory
+    auto aotModule = reinterpret_cast<AOTModuleInstance*>(moduleInstance);
+    uint8_t* globalData = (uint8_t*)aotModule->global_data.ptr;
+    zygoteGlobals.assign(globalData, globalData + aotModule->global_data_size);
+
+    PROF_END(wamrZygote)
+}
+
+int WAMRWasmModule::writeZygoteMemory()
+{
+    std::string fdName = boundUser + "_" + boundFunction + "_zygote";
+
+    int fd = memfd_create(fdName.c_str(), 0);
+    if (fd < 0) {
+        SPDLOG_ERROR("Failed to create zygote memfd for {}: {}",
+                     fdName,
+                     std::strerror(errno));
+        throw std::runtime_error("Failed to create zygote memfd");
+    }
+
+    if (ftruncate(fd, zygoteMemoryBytes) != 0) {
+        SPDLOG_ERROR("Failed to size zygote memfd for {} to {}: {}",
+                     fdName,
+                     zygoteMemoryBytes,
+                     std::strerror(errno));
+        close(fd);
+        throw std::runtime_error("Failed to size zygote memfd");
+    }
+
+    // Most of a fresh module's memory is zeroes, which we can leave as holes
+    // in the file
+    uint8_t* memBase = getMemoryBase();
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    std::vector<uint8_t> zeroPage(pageSize, 0);
+    for (size_t offset = 0; offset < zygoteMemoryBytes; offset += pageSize) {
+        if (std::memcmp(memBase + offset, zeroPage.data(), pageSize) == 0) {
+            continue;
+        }
+
+        ssize_t written = pwrite(fd, memBase + offset, pageSize, offset);
+        if (written != (ssize_t)pageSize) {
+            SPDLOG_ERROR("Failed to write zygote memory for {}: {}",
+                         fdName,
+                         std::strerror(errno));
+            close(fd);
+            throw std::runtime_error("Failed to write zygote memory");
+        }
+    }
+
+    return fd;
+}
+
+void WAMRWasmModule::restoreZygote()
+{
+    PROF_START(wamrZygoteRestore)
+
+    size_t currentBytes = getMemorySizeBytes();
+
+    {
+        faabric::util::FullLock lock(moduleMemoryMutex);
+
+        // Guards are only created after the zygote, and remapping removes
+        // their protection
+        removeGuardRegions(0, currentBytes);
+        removeFileMappings(0, currentBytes);
+
+        if (zygoteMemoryMapped) {
+            // Only pages written since the last reset need restoring
+            std::vector<std::pair<uint32_t, uint32_t>> dirtyRegions =
+              getPrivatelyWrittenRegions(getMemoryBase(), currentBytes);
+
+            for (const auto& r : dirtyRegions) {
+                remapZygoteMemory(r.first, r.second);
+            }
+        } else {
+            remapZygoteMemory(0, currentBytes);
+            zygoteMappedBytes = zygoteMemoryBytes;
+            zygoteMemoryMapped = true;
+        }
+
+        // WAMR can't shrink memory, so any growth is kept but zeroed, and
+        // handed out again from the zygote's break
+        currentBrk = zygoteBrk;
+    }
+
+    // Any thread stacks were created after the zygote, so have gone too
+    clearThreadStacks();
+
+    auto aotModule = reinterpret_cast<AOTModuleInstance*>(moduleInstance);
+    std::memcpy(
+      aotModule->global_data.ptr, zygoteGlobals.data(), zygoteGlobals.size());
+
+    wasm_runtime_clear_exception(moduleInstance);
+
+    PROF_END(wamrZygoteRestore)
+}
+
+void WAMRWasmModule::remapZygoteMemory(size_t offset, size_t length)
+{
+    uint8_t* memBase = getMemoryBase();
+
+    // Map the zygote's memory privately, so that untouched pages are shared
+    // with the zygote and only pages written are copied
+    if (offset < zygoteMemoryBytes) {
+        size_t fileLength = std::min(length, zygoteMemoryBytes - offset);
+        void* res = mmap(memBase + offset,
+                         fileLength,
+                         PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_FIXED,
+                         zygoteMemoryFd,
+                         offset);
+        if (res == MAP_FAILED) {
+            SPDLOG_ERROR("Failed to map zygote memory for {}/{}: {}",
+                         boundUser,
+                         boundFunction,
+                         std::strerror(errno));
+            throw std::runtime_error("Failed to map zygote memory");
+        }
+
+        offset += fileLength;
+        length -= fileLength;
+    }
+
+    // Memory grown beyond the zygote is replaced with fresh zero pages
+    if (length > 0) {
+        void* res = mmap(memBase + offset,
+                         length,
+                         PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+                         -1,
+                         0);
+        if (res == MAP_FAILED) {
+            SPDLOG_ERROR("Failed to clear grown memory for {}/{}: {}",
+                         boundUser,
+                         boundFunction,
+                         std::strerror(errno));
+            throw std::runtime_error("Failed to clear grown memory");
+        }
+    }
+}
+
+void WAMRWasmModule::setObjectBytes(const std::vector<uint8_t>& objectBytesIn)
+{
+    moduleBytes = objectBytesIn;
 }
 
 int32_t WAMRWasmModule::executeFunction(faabric::Message& msg)
@@ -135,6 +402,192 @@ int32_t WAMRWasmModule::executeFunction(faabric::Message& msg)
     return 0;
 }
 
+// ----- Threading -----
+static AOTMemoryInstance* getAOTMemoryInstance(
+  WASMModuleInstanceCommon* instance)
+{
+    auto aotModule = reinterpret_cast<AOTModuleInstance*>(instance);
+    return ((AOTMemoryInstance**)aotModule->memories.ptr)[0];
+}
+
+int32_t WAMRWasmModule::executePthread(int threadPoolIdx,
+                                       uint32_t stackTop,
+                                       faabric::Message& msg)
+{
+    std::string funcStr = faabric::util::funcToString(msg, false);
+    SPDLOG_DEBUG("Executing pthread {} for {}", threadPoolIdx, funcStr);
+
+    // The pthread entrypoint takes a single pointer argument, and its return
+    // value is written back to the start of argv
+    int argsPtr = std::stoi(msg.inputdata());
+    std::vector<uint32_t> argv = { (uint32_t)argsPtr };
+
+    bool success =
+      executeThreadFunction(threadPoolIdx, stackTop, msg.funcptr(), argv);
+    if (!success) {
+        msg.set_returnvalue(1);
+        return 1;
+    }
+
+    int32_t returnValue = (int32_t)argv.at(0);
+    msg.set_returnvalue(returnValue);
+
+    return returnValue;
+}
+
+int32_t WAMRWasmModule::executeOMPThread(int threadPoolIdx,
+                                         uint32_t stackTop,
+                                         faabric::Message& msg)
+{
+    std::string funcStr = faabric::util::funcToString(msg, false);
+    SPDLOG_DEBUG("Executing OpenMP thread {} for {}", threadPoolIdx, funcStr);
+
+    // Set up function args
+    std::shared_ptr<threads::Level> ompLevel = threads::getCurrentOpenMPLevel();
+    int argc = ompLevel->nSharedVarOffsets;
+    std::vector<uint32_t> argv = { (uint32_t)msg.appindex(), (uint32_t)argc };
+    for (int argIdx = 0; argIdx < argc; argIdx++) {
+        argv.emplace_back(ompLevel->sharedVarOffsets[argIdx]);
+    }
+
+    // Microtasks don't return anything, so argv is left untouched
+    bool success = executeThreadFunction(
+      threadPoolIdx, stackTop, msg.funcptr(), argv);
+    int32_t returnValue = success ? 0 : 1;
+    msg.set_returnvalue(returnValue);
+
+    return returnValue;
+}
+
+bool WAMRWasmModule::executeThreadFunction(int threadPoolIdx,
+                                           uint32_t stackTop,
+                                           int wasmFuncPtr,
+                                           std::vector<uint32_t>& argv)
+{
+    WASMModuleInstanceCommon* threadInstance = getThreadInstance(threadPoolIdx);
+
+    // Point the thread's stack pointer at its stack in the shared memory
+    auto aotThread = reinterpret_cast<AOTModuleInstance*>(threadInstance);
+    auto aotModule = reinterpret_cast<AOTModule*>(aotThread->aot_module.ptr);
+    uint32_t stackGlobalIdx =
+      aotModule->aux_stack_top_global_index - aotModule->import_global_count;
+    uint8_t* stackGlobal = (uint8_t*)aotThread->global_data.ptr +
+                           aotModule->globals[stackGlobalIdx].data_offset;
+    *(uint32_t*)stackGlobal = stackTop;
+
+    WASMExecEnv* execEnv = wasm_exec_env_create(threadInstance, STACK_SIZE_KB);
+    if (execEnv == nullptr) {
+        SPDLOG_ERROR("Failed to create exec env for thread {}", threadPoolIdx);
+        throw std::runtime_error("Failed to create WAMR exec env");
+    }
+
+    wasm_exec_env_set_thread_info(execEnv);
+
+    // WAMR writes any return value to the start of argv, so it can't be empty
+    uint32_t argc = argv.size();
+    if (argv.empty()) {
+        argv.push_back(0);
+    }
+
+    bool success =
+      wasm_runtime_call_indirect(execEnv, wasmFuncPtr, argc, argv.data());
+
+    wasm_exec_env_destroy(execEnv);
+
+    if (!success) {
+        std::string errorMessage(aotThread->cur_exception);
+        SPDLOG_ERROR("Thread {} failed executing function pointer {}: {}",
+                     threadPoolIdx,
+                     wasmFuncPtr,
+                     errorMessage);
+        wasm_runtime_clear_exception(threadInstance);
+    }
+
+    return success;
+}
+
+WASMModuleInstanceCommon* WAMRWasmModule::getThreadInstance(int threadPoolIdx)
+{
+#if (WAMR_EXECUTION_MODE_INTERP)
+    throw std::runtime_error("WAMR threads not supported in interpreter mode");
+#else
+    // Memory lock first, as growing memory syncs the thread instances
+    faabric::util::SharedLock memLock(moduleMemoryMutex);
+    faabric::util::UniqueLock lock(threadInstancesMx);
+
+    WASMModuleInstanceCommon* threadInstance =
+      threadInstances.at(threadPoolIdx);
+    if (threadInstance != nullptr) {
+        return threadInstance;
+    }
+
+    SPDLOG_DEBUG("Instantiating WAMR thread {} for {}/{}",
+                 threadPoolIdx,
+                 boundUser,
+                 boundFunction);
+
+    threadInstance = wasm_runtime_instantiate(
+      wasmModule, STACK_SIZE_KB, HEAP_SIZE_KB, errorBuffer, ERROR_BUFFER_SIZE);
+    if (threadInstance == nullptr) {
+        std::string errorMsg = std::string(errorBuffer);
+        SPDLOG_ERROR("Failed to instantiate WAMR thread: \n{}", errorMsg);
+        throw std::runtime_error("Failed to instantiate WAMR thread");
+    }
+
+    // Keep the thread instance's own memory struct, then share ours
+    AOTMemoryInstance* threadMem = getAOTMemoryInstance(threadInstance);
+    uint8_t* threadMemBytes = (uint8_t*)threadMem;
+    threadInstanceMemories.at(threadPoolIdx)
+      .assign(threadMemBytes, threadMemBytes + sizeof(AOTMemoryInstance));
+
+    std::memcpy(threadMem,
+                getAOTMemoryInstance(moduleInstance),
+                sizeof(AOTMemoryInstance));
+
+    threadInstances.at(threadPoolIdx) = threadInstance;
+
+    return threadInstance;
+#endif
+}
+
+void WAMRWasmModule::shareMemoryWithThreads()
+{
+    // Called with the memory lock held after every enlarge, including guest
+    // grows from thread instances. Note that this relies on the memory not
+    // moving when grown (as with WAMR's hardware bounds checks), as running
+    // threads will only see the change on their next access
+    faabric::util::UniqueLock lock(threadInstancesMx);
+    AOTMemoryInstance* mainMem = getAOTMemoryInstance(moduleInstance);
+    for (auto* threadInstance : threadInstances) {
+        if (threadInstance != nullptr) {
+            std::memcpy(getAOTMemoryInstance(threadInstance),
+                        mainMem,
+                        sizeof(AOTMemoryInstance));
+        }
+    }
+}
+
+void WAMRWasmModule::destroyThreadInstances()
+{
+    faabric::util::UniqueLock lock(threadInstancesMx);
+    for (size_t i = 0; i < threadInstances.size(); i++) {
+        WASMModuleInstanceCommon* threadInstance = threadInstances.at(i);
+        if (threadInstance == nullptr) {
+            continue;
+        }
+
+        // Put back the thread's own memory so that WAMR frees that rather
+        // than ours
+        std::vector<uint8_t>& threadMem = threadInstanceMemories.at(i);
+        std::memcpy(getAOTMemoryInstance(threadInstance),
+                    threadMem.data(),
+                    threadMem.size());
+
+        wasm_runtime_deinstantiate(threadInstance);
+        threadInstances.at(i) = nullptr;
+    }
+}
+
 int WAMRWasmModule::executeWasmFunctionFromPointer(int wasmFuncPtr)
 {
 
@@ -221,23 +674,86 @@ uint32_t WAMRWasmModule::growMemory(uint32_t nBytes)
 
     SPDLOG_DEBUG("WAMR growing memory by {}", nBytes);
 
-    uint32_t memBase = currentBrk;
+    faabric::util::FullLock lock(moduleMemoryMutex);
 
+    uint32_t memBase = currentBrk;
     uint32_t nPages = getNumberOfWasmPagesForBytes(nBytes);
+    uint32_t newBrk = memBase + (nPages * WASM_BYTES_PER_PAGE);
+
+    // Memory below the top (e.g. kept after a reset) is reused before growing
+    size_t oldBytes = getMemorySizeBytes();
+    if (newBrk > oldBytes) {
+        uint32_t extraPages =
+          getNumberOfWasmPagesForBytes(newBrk - (uint32_t)oldBytes);
+        if (!enlargeMemory(extraPages)) {
+            SPDLOG_ERROR("Failed to grow WAMR memory by {} pages", extraPages);
+            return MEMORY_GROW_FAILED;
+        }
+    }
+
+    currentBrk = newBrk;
+    return memBase;
+}
+
+bool WAMRWasmModule::enlargeMemory(uint32_t nPages)
+{
+    // Called with the memory lock held
+    size_t oldBytes = getMemorySizeBytes();
+    if (!chargeMemoryQuota(oldBytes + nPages * WASM_BYTES_PER_PAGE)) {
+        return false;
+    }
+
+#if (WAMR_EXECUTION_MODE_INTERP)
     bool success = wasm_runtime_enlarge_memory(moduleInstance, nPages);
+#else
+    bool success = __real_aot_enlarge_memory(
+      reinterpret_cast<AOTModuleInstance*>(moduleInstance), nPages);
+#endif
     if (!success) {
-        throw std::runtime_error("Failed to grow WAMR memory");
+        syncMemoryQuota();
+        return false;
     }
 
-    currentBrk = memBase + (nPages * WASM_BYTES_PER_PAGE);
-    return memBase;
+    shareMemoryWithThreads();
+    return true;
+}
+
+bool WAMRWasmModule::enlargeGuestMemory(uint32_t nPages)
+{
+    SPDLOG_DEBUG("WAMR guest growing memory by {} pages", nPages);
+
+    faabric::util::FullLock lock(moduleMemoryMutex);
+
+    // This is called from within WAMR, so mustn't throw
+    try {
+        return enlargeMemory(nPages);
+    } catch (std::exception& e) {
+        SPDLOG_ERROR("Failed guest memory grow: {}", e.what());
+        return false;
+    }
 }
 
 uint32_t WAMRWasmModule::shrinkMemory(uint32_t nBytes)
 {
+    if (!isWasmPageAligned(nBytes)) {
+        SPDLOG_ERROR("Shrink size not page aligned {}", nBytes);
+        throw std::runtime_error("New break not page aligned");
+    }
 
-    SPDLOG_WARN("WAMR ignoring shrink memory");
-    return 0;
+    faabric::util::FullLock lock(moduleMemoryMutex);
+
+    if (nBytes > currentBrk) {
+        SPDLOG_ERROR(
+          "Shrinking by more than current brk ({} > {})", nBytes, currentBrk);
+        throw std::runtime_error("Shrinking by more than current brk");
+    }
+
+    // WAMR can't shrink memory, but the pages can go back to the OS
+    uint32_t oldBrk = currentBrk;
+    currentBrk -= nBytes;
+    discardMemory(currentBrk, nBytes);
+
+    return oldBrk;
 }
 
 uint32_t WAMRWasmModule::mmapMemory(uint32_t nBytes)
@@ -266,9 +782,42 @@ size_t WAMRWasmModule::getMemorySizeBytes()
 #endif
 }
 
-uint32_t WAMRWasmModule::mmapFile(uint32_t fp, uint32_t length)
+uint8_t* WAMRWasmModule::getMemoryBase()
 {
-    // TODO - implement
-    return 0;
+#if (WAMR_EXECUTION_MODE_INTERP)
+    auto interpModule = reinterpret_cast<WASMModuleInstance*>(moduleInstance);
+    WASMMemoryInstance* interpMem =
+      ((WASMMemoryInstance**)interpModule->memories)[0];
+    return interpMem->memory_data;
+#else
+    auto aotModule = reinterpret_cast<AOTModuleInstance*>(moduleInstance);
+    AOTMemoryInstance* aotMem =
+      ((AOTMemoryInstance**)aotModule->memories.ptr)[0];
+    return (uint8_t*)aotMem->memory_data.ptr;
+#endif
+}
+
+WAMRWasmModule* getExecutingWAMRModule()
+{
+    return reinterpret_cast<WAMRWasmModule*>(getExecutingModule());
 }
 }
+
+#if !(WAMR_EXECUTION_MODE_INTERP)
+// Thread instances each have their own copy of the memory struct, so a guest
+// memory.grow run on a thread would only enlarge that copy. WAMR's enlarge
+// function is wrapped at link time (see src/wamr/CMakeLists.txt) so that all
+// guest grows go through the main instance, which is then shared with the
+// threads.
+extern "C" bool __wrap_aot_enlarge_memory(AOTModuleInstance* instance,
+                                          uint32_t incPageCount)
+{
+    auto* module = dynamic_cast<wasm::WAMRWasmModule*>(
+      wasm::getExecutingModule());
+    if (module == nullptr) {
+        return __real_aot_enlarge_memory(instance, incPageCount);
+    }
+
+    return module->enlargeGuestMemory(incPageCount);
+}
+#endif
@@ -10,7 +10,9 @@
 #include <boost/filesystem.hpp>
 
 namespace wasm {
-std::vector<uint8_t> wamrCodegen(std::vector<uint8_t>& wasmBytes, bool isSgx)
+std::vector<uint8_t> wamrCodegen(std::vector<uint8_t>& wasmBytes,
+                                 bool isSgx,
+                                 int optLevel)
 {
 
     // Make sure WAMR is initialised
@@ -37,7 +39,7 @@ std::vector<uint8_t> wamrCodegen(std::vector<uint8_t>& wasmBytes, bool isSgx)
     }
 
     AOTCompOption option = { 0 };
-    option.opt_level = 3;
+    option.opt_level = optLevel;
     option.size_level = 3;
     option.output_format = AOT_FORMAT_FILE;
     option.bounds_checks = 2;
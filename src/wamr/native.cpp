@@ -2,7 +2,18 @@
 #include <wasm_export.h>
 #include <wasm_native.h>
 
+#include <unordered_set>
+
+// Defined in WAMR's built-in libc-wasi
+extern "C" uint32_t get_libc_wasi_export_apis(NativeSymbol** nativeSymbols);
+
 namespace wasm {
+static uint32_t (*const faasmApis[])(NativeSymbol** ns) = {
+    getFaasmDynlinkApi, getFaasmFilesystemApi, getFaasmFunctionsApi,
+    getFaasmMemoryApi,  getFaasmOpenMPApi,     getFaasmPthreadApi,
+    getFaasmStateApi,   getFaasmStubs,
+};
+
 void doSymbolRegistration(uint32_t (*f)(NativeSymbol** ns))
 {
     NativeSymbol* symbols;
@@ -12,12 +23,54 @@ void doSymbolRegistration(uint32_t (*f)(NativeSymbol** ns))
 
 void initialiseWAMRNatives()
 {
-    doSymbolRegistration(getFaasmDynlinkApi);
-    doSymbolRegistration(getFaasmFilesystemApi);
-    doSymbolRegistration(getFaasmFunctionsApi);
-    doSymbolRegistration(getFaasmMemoryApi);
-    doSymbolRegistration(getFaasmPthreadApi);
-    doSymbolRegistration(getFaasmStateApi);
-    doSymbolRegistration(getFaasmStubs);
+    for (auto f : faasmApis) {
+        doSymbolRegistration(f);
+    }
+}
+
+static void addSymbolNames(std::unordered_set<std::string>& names,
+                           uint32_t (*f)(NativeSymbol** ns))
+{
+    NativeSymbol* symbols;
+    uint32_t nSymbols = f(&symbols);
+    for (uint32_t i = 0; i < nSymbols; i++) {
+        names.insert(symbols[i].symbol);
+    }
+}
+
+bool isWAMRNativeSymbol(const std::string& moduleName, const std::string& name)
+{
+    static const std::unordered_set<std::string> envNames = [] {
+        std::unordered_set<std::string> names;
+        for (auto f : faasmApis) {
+            addSymbolNames(names, f);
+        }
+        return names;
+    }();
+
+    static const std::unordered_set<std::string> wasiNames = [] {
+        std::unordered_set<std::string> names;
+        addSymbolNames(names, get_libc_wasi_export_apis);
+        return names;
+    }();
+
+    const std::unordered_set<std::string>* names;
+    if (moduleName == "env") {
+        names = &envNames;
+    } else if (moduleName == "wasi_snapshot_preview1" ||
+               moduleName == "wasi_unstable") {
+        names = &wasiNames;
+    } else {
+        return false;
+    }
+
+    if (names->count(name) > 0) {
+        return true;
+    }
+
+    // Like WAMR's own lookup, fall back to the name without a leading
+    // underscore
+    return name.size() > 1 && name[0] == '_' &&
+           names->count(name.substr(1)) > 0;
 }
 }
@@ -0,0 +1,531 @@
+#include <wamr/WAMRWasmModule.h>
+#include <wamr/native.h>
+#include <wasm/SparseSnapshot.h>
+#include <wasm/WasmExecutionContext.h>
+#include <wasm/WasmModule.h>
+#include <wasm/openmp.h>
+#include <wasm_export.h>
+
+#include <faabric/scheduler/Scheduler.h>
+#include <faabric/snapshot/SnapshotRegistry.h>
+#include <faabric/util/func.h>
+#include <faabric/util/logging.h>
+#include <faabric/util/macros.h>
+#include <faabric/util/timing.h>
+
+#include <threads/ThreadState.h>
+
+#include <numeric>
+
+/*
+ * The core of the OpenMP runtime for WAMR, i.e. forking, thread numbers,
+ * barriers, critical sections, static loops and reductions. Dynamically
+ * scheduled loops and tasks are only provided for WAVM.
+ *
+ * Unlike WAVM, the whole team always runs on this host, in threads sharing
+ * the master's memory, so reductions are done in place, one thread at a time.
+ */
+
+namespace wasm {
+
+#define OMP_FUNC_ARGS(formatStr, ...)                                          \
+    std::shared_ptr<threads::Level> level = threads::getCurrentOpenMPLevel();  \
+    faabric::Message* msg = getExecutingCall();                                \
+    int localThreadNum = level->getLocalThreadNum(msg);                        \
+    int globalThreadNum = level->getGlobalThreadNum(msg);                      \
+    UNUSED(level);                                                             \
+    UNUSED(msg);                                                               \
+    UNUSED(localThreadNum);                                                    \
+    UNUSED(globalThreadNum);                                                   \
+    SPDLOG_TRACE("OMP {} ({}): " formatStr,                                    \
+                 localThreadNum,                                               \
+                 globalThreadNum,                                              \
+                 __VA_ARGS__);
+
+// ------------------------------------------------
+// THREAD NUMS AND LEVELS
+// ------------------------------------------------
+
+static int32_t omp_get_thread_num_wrapper(wasm_exec_env_t exec_env)
+{
+    OMP_FUNC_ARGS("omp_get_thread_num{}", "");
+    return localThreadNum;
+}
+
+static int32_t omp_get_num_threads_wrapper(wasm_exec_env_t exec_env)
+{
+    OMP_FUNC_ARGS("omp_get_num_threads{}", "");
+    return level->numThreads;
+}
+
+static int32_t omp_get_max_threads_wrapper(wasm_exec_env_t exec_env)
+{
+    OMP_FUNC_ARGS("omp_get_max_threads{}", "");
+    return level->getMaxThreadsAtNextLevel();
+}
+
+static int32_t omp_get_level_wrapper(wasm_exec_env_t exec_env)
+{
+    OMP_FUNC_ARGS("omp_get_level{}", "");
+    return level->depth;
+}
+
+static int32_t omp_get_max_active_levels_wrapper(wasm_exec_env_t exec_env)
+{
+    OMP_FUNC_ARGS("omp_get_max_active_levels{}", "");
+    return level->maxActiveLevels;
+}
+
+static void omp_set_max_active_levels_wrapper(wasm_exec_env_t exec_env,
+                                              int32_t maxLevels)
+{
+    OMP_FUNC_ARGS("omp_set_max_active_levels {}", maxLevels);
+
+    if (maxLevels < 0) {
+        SPDLOG_WARN("Trying to set active level with a negative number {}",
+                    maxLevels);
+    } else {
+        level->maxActiveLevels = maxLevels;
+    }
+}
+
+static void __kmpc_push_num_threads_wrapper(wasm_exec_env_t exec_env,
+                                            int32_t loc,
+                                            int32_t globalTid,
+                                            int32_t numThreads)
+{
+    OMP_FUNC_ARGS(
+      "__kmpc_push_num_threads {} {} {}", loc, globalTid, numThreads);
+
+    if (numThreads > 0) {
+        level->pushedThreads = numThreads;
+    }
+}
+
+static void omp_set_num_threads_wrapper(wasm_exec_env_t exec_env,
+                                        int32_t numThreads)
+{
+    OMP_FUNC_ARGS("omp_set_num_threads {}", numThreads);
+
+    if (numThreads > 0) {
+        level->wantedThreads = numThreads;
+    }
+}
+
+static int32_t __kmpc_global_thread_num_wrapper(wasm_exec_env_t exec_env,
+                                                int32_t loc)
+{
+    OMP_FUNC_ARGS("__kmpc_global_thread_num {}", loc);
+    return globalThreadNum;
+}
+
+static double omp_get_wtime_wrapper(wasm_exec_env_t exec_env)
+{
+    OMP_FUNC_ARGS("omp_get_wtime{}", "");
+
+    faabric::util::Clock& clock = faabric::util::getGlobalClock();
+    long millis = clock.epochMillis();
+
+    return ((double)millis) / 1000;
+}
+
+// ------------------------------------------------
+// BARRIER, CRITICAL, MASTER AND SINGLE
+// ------------------------------------------------
+
+static void __kmpc_barrier_wrapper(wasm_exec_env_t exec_env,
+                                   int32_t loc,
+                                   int32_t globalTid)
+{
+    OMP_FUNC_ARGS("__kmpc_barrier {} {}", loc, globalTid);
+    level->waitOnBarrier();
+}
+
+static void __kmpc_critical_wrapper(wasm_exec_env_t exec_env,
+                                    int32_t loc,
+                                    int32_t globalTid,
+                                    int32_t crit)
+{
+    OMP_FUNC_ARGS("__kmpc_critical {} {} {}", loc, globalTid, crit);
+
+    if (level->numThreads > 1) {
+        level->lockCritical();
+    }
+}
+
+static void __kmpc_end_critical_wrapper(wasm_exec_env_t exec_env,
+                                        int32_t loc,
+                                        int32_t globalTid,
+                                        int32_t crit)
+{
+    OMP_FUNC_ARGS("__kmpc_end_critical {} {} {}", loc, globalTid, crit);
+
+    if (level->numThreads > 1) {
+        level->unlockCritical();
+    }
+}
+
+static void __kmpc_flush_wrapper(wasm_exec_env_t exec_env, int32_t loc)
+{
+    OMP_FUNC_ARGS("__kmpc_flush {}", loc);
+    __sync_synchronize();
+}
+
+static int32_t __kmpc_master_wrapper(wasm_exec_env_t exec_env,
+                                     int32_t loc,
+                                     int32_t globalTid)
+{
+    OMP_FUNC_ARGS("__kmpc_master {} {}", loc, globalTid);
+    return localThreadNum == 0;
+}
+
+static void __kmpc_end_master_wrapper(wasm_exec_env_t exec_env,
+                                      int32_t loc,
+                                      int32_t globalTid)
+{
+    OMP_FUNC_ARGS("__kmpc_end_master {} {}", loc, globalTid);
+
+    if (localThreadNum != 0) {
+        throw std::runtime_error("Calling _kmpc_end_master from non-master");
+    }
+}
+
+static int32_t __kmpc_single_wrapper(wasm_exec_env_t exec_env,
+                                     int32_t loc,
+                                     int32_t globalTid)
+{
+    OMP_FUNC_ARGS("__kmpc_single {} {}", loc, globalTid);
+    return localThreadNum == 0;
+}
+
+static void __kmpc_end_single_wrapper(wasm_exec_env_t exec_env,
+                                      int32_t loc,
+                                      int32_t globalTid)
+{
+    OMP_FUNC_ARGS("__kmpc_end_single {} {}", loc, globalTid);
+
+    if (localThreadNum != 0) {
+        throw std::runtime_error("Calling _kmpc_end_single from non-master");
+    }
+}
+
+// ----------------------------------------------------
+// FORKING
+// ----------------------------------------------------
+
+/**
+ * See the WAVM __kmpc_fork_call. The other threads of the team are scheduled
+ * from a snapshot, as with pthreads, but always on this host, where they run
+ * in the master's module and share its memory. The master runs the microtask
+ * itself on its own stack.
+ */
+static void __kmpc_fork_call_wrapper(wasm_exec_env_t exec_env,
+                                     int32_t locPtr,
+                                     int32_t argc,
+                                     int32_t microtaskPtr,
+                                     int32_t argsPtr)
+{
+    OMP_FUNC_ARGS(
+      "__kmpc_fork_call {} {} {} {}", locPtr, argc, microtaskPtr, argsPtr);
+
+    auto& sch = faabric::scheduler::getScheduler();
+
+    WAMRWasmModule* parentModule = getExecutingWAMRModule();
+    faabric::Message* parentCall = getExecutingCall();
+
+    // Set up the next level
+    std::shared_ptr<threads::Level> parentLevel = level;
+    auto nextLevel =
+      std::make_shared<threads::Level>(parentLevel->getMaxThreadsAtNextLevel());
+    nextLevel->fromParentLevel(parentLevel);
+
+    bool isSingleThread = nextLevel->numThreads == 1;
+    int nOtherThreads = nextLevel->numThreads - 1;
+
+    // The microtask takes the thread number, the number of shared variables,
+    // then a pointer to each of them
+    std::vector<uint32_t> mainArgv = { 0, (uint32_t)argc };
+    if (argc > 0) {
+        uint32_t* sharedVarsPtr =
+          (uint32_t*)parentModule->wasmPointerToNative(argsPtr);
+        nextLevel->setSharedVarOffsets(sharedVarsPtr, argc);
+        mainArgv.insert(mainArgv.end(), sharedVarsPtr, sharedVarsPtr + argc);
+    }
+
+    std::string snapshotKey;
+    std::shared_ptr<faabric::BatchExecuteRequest> req = nullptr;
+    if (!isSingleThread) {
+        snapshotKey = parentModule->snapshot(false);
+        SPDLOG_DEBUG("Created OpenMP snapshot: {}", snapshotKey);
+
+        // All threads share this memory, so all take part in reductions
+        nextLevel->prepareReduction();
+        std::vector<int> localThreadNums(nextLevel->numThreads);
+        std::iota(localThreadNums.begin(), localThreadNums.end(), 0);
+        nextLevel->getReduction()->setLocalThreads(localThreadNums);
+
+        req = faabric::util::batchExecFactory(
+          parentCall->user(), parentCall->function(), nOtherThreads);
+        req->set_type(faabric::BatchExecuteRequest::THREADS);
+        req->set_subtype(ThreadRequestType::OPENMP);
+
+        std::vector<uint8_t> serialisedLevel = nextLevel->serialise();
+        req->set_contextdata(serialisedLevel.data(), serialisedLevel.size());
+
+        for (int i = 0; i < req->messages_size(); i++) {
+            faabric::Message& call = req->mutable_messages()->at(i);
+            call.set_snapshotkey(snapshotKey);
+            call.set_funcptr(microtaskPtr);
+            call.set_appindex(nextLevel->getGlobalThreadNum(i + 1));
+        }
+
+        // Force the team onto this host
+        sch.callFunctions(req, true);
+    }
+
+    // Execute the master's part of the region
+    faabric::Message masterMsg = faabric::util::messageFactory(
+      parentCall->user(), parentCall->function());
+    masterMsg.set_appindex(nextLevel->getGlobalThreadNum(0));
+
+    threads::setCurrentOpenMPLevel(nextLevel);
+    bool success;
+    {
+        WasmExecutionContext ctx(parentModule, &masterMsg);
+        success = wasm_runtime_call_indirect(
+          exec_env, microtaskPtr, mainArgv.size(), mainArgv.data());
+    }
+    threads::setCurrentOpenMPLevel(parentLevel);
+
+    // The rest of the team mustn't wait for a master that's trapped
+    if (!success) {
+        nextLevel->abort();
+    }
+
+    bool threadFailed = false;
+    if (!isSingleThread) {
+        for (int i = 0; i < req->messages_size(); i++) {
+            if (sch.awaitThreadResult(req->messages().at(i).id()) != 0) {
+                threadFailed = true;
+            }
+        }
+
+        sch.broadcastSnapshotDelete(*parentCall, snapshotKey);
+        faabric::snapshot::getSnapshotRegistry().deleteSnapshot(snapshotKey);
+        releaseSparseSnapshot(snapshotKey);
+
+        nextLevel->clearReduction();
+        nextLevel->clearSync();
+    }
+
+    // Reset parent level for next setting of threads
+    parentLevel->pushedThreads = -1;
+
+    // A trapped master leaves its exception set, which unwinds the caller
+    if (success && threadFailed) {
+        wasm_runtime_set_exception(wasm_runtime_get_module_inst(exec_env),
+                                   "OpenMP thread failed");
+    }
+}
+
+// -------------------------------------------------------
+// FOR LOOP STATIC INIT
+// -------------------------------------------------------
+
+/**
+ * See the WAVM __kmpc_for_static_init_4
+ */
+static void __kmpc_for_static_init_4_wrapper(wasm_exec_env_t exec_env,
+                                             int32_t loc,
+                                             int32_t gtid,
+                                             int32_t schedule,
+                                             int32_t lastIterPtr,
+                                             int32_t lowerPtr,
+                                             int32_t upperPtr,
+                                             int32_t stridePtr,
+                                             int32_t incr,
+                                             int32_t chunk)
+{
+    OMP_FUNC_ARGS("__kmpc_for_static_init_4 {} {} {} {} {} {} {} {} {}",
+                  loc,
+                  gtid,
+                  schedule,
+                  lastIterPtr,
+                  lowerPtr,
+                  upperPtr,
+                  stridePtr,
+                  incr,
+                  chunk);
+
+    WAMRWasmModule* module = getExecutingWAMRModule();
+    auto* lastIter = (int32_t*)module->wasmPointerToNative(lastIterPtr);
+    auto* lower = (int32_t*)module->wasmPointerToNative(lowerPtr);
+    auto* upper = (int32_t*)module->wasmPointerToNative(upperPtr);
+    auto* stride = (int32_t*)module->wasmPointerToNative(stridePtr);
+
+    for_static_init<int32_t>(
+      schedule, lastIter, lower, upper, stride, incr, chunk);
+}
+
+static void __kmpc_for_static_init_8_wrapper(wasm_exec_env_t exec_env,
+                                             int32_t loc,
+                                             int32_t gtid,
+                                             int32_t schedule,
+                                             int32_t lastIterPtr,
+                                             int32_t lowerPtr,
+                                             int32_t upperPtr,
+                                             int32_t stridePtr,
+                                             int64_t incr,
+                                             int64_t chunk)
+{
+    OMP_FUNC_ARGS("__kmpc_for_static_init_8 {} {} {} {} {} {} {} {} {}",
+                  loc,
+                  gtid,
+                  schedule,
+                  lastIterPtr,
+                  lowerPtr,
+                  upperPtr,
+                  stridePtr,
+                  incr,
+                  chunk);
+
+    WAMRWasmModule* module = getExecutingWAMRModule();
+    auto* lastIter = (int32_t*)module->wasmPointerToNative(lastIterPtr);
+    auto* lower = (int64_t*)module->wasmPointerToNative(lowerPtr);
+    auto* upper = (int64_t*)module->wasmPointerToNative(upperPtr);
+    auto* stride = (int64_t*)module->wasmPointerToNative(stridePtr);
+
+    for_static_init<int64_t>(
+      schedule, lastIter, lower, upper, stride, incr, chunk);
+}
+
+static void __kmpc_for_static_fini_wrapper(wasm_exec_env_t exec_env,
+                                           int32_t loc,
+                                           int32_t gtid)
+{
+    OMP_FUNC_ARGS("__kmpc_for_static_fini {} {}", loc, gtid);
+}
+
+// ---------------------------------------------------
+// REDUCTIONS
+// ---------------------------------------------------
+
+/**
+ * Returning 1 tells the thread to combine its own data into the shared
+ * variables, then call __kmpc_end_reduce. As the team shares one memory,
+ * threads do so in turn inside the level's critical section, i.e. libomp's
+ * critical reduction method.
+ */
+static int32_t __kmpc_reduce_wrapper(wasm_exec_env_t exec_env,
+                                     int32_t loc,
+                                     int32_t gtid,
+                                     int32_t numVars,
+                                     int32_t reduceSize,
+                                     int32_t reduceData,
+                                     int32_t reduceFunc,
+                                     int32_t lockPtr)
+{
+    OMP_FUNC_ARGS("__kmpc_reduce {} {} {} {} {} {} {}",
+                  loc,
+                  gtid,
+                  numVars,
+                  reduceSize,
+                  reduceData,
+                  reduceFunc,
+                  lockPtr);
+
+    if (level->numThreads > 1) {
+        level->lockCritical();
+    }
+
+    return 1;
+}
+
+static int32_t __kmpc_reduce_nowait_wrapper(wasm_exec_env_t exec_env,
+                                            int32_t loc,
+                                            int32_t gtid,
+                                            int32_t numVars,
+                                            int32_t reduceSize,
+                                            int32_t reduceData,
+                                            int32_t reduceFunc,
+                                            int32_t lockPtr)
+{
+    OMP_FUNC_ARGS("__kmpc_reduce_nowait {} {} {} {} {} {} {}",
+                  loc,
+                  gtid,
+                  numVars,
+                  reduceSize,
+                  reduceData,
+                  reduceFunc,
+                  lockPtr);
+
+    if (level->numThreads > 1) {
+        level->lockCritical();
+    }
+
+    return 1;
+}
+
+/**
+ * Blocking reductions wait for the whole team to have combined its data
+ */
+static void __kmpc_end_reduce_wrapper(wasm_exec_env_t exec_env,
+                                      int32_t loc,
+                                      int32_t gtid,
+                                      int32_t lck)
+{
+    OMP_FUNC_ARGS("__kmpc_end_reduce {} {} {}", loc, gtid, lck);
+
+    if (level->numThreads > 1) {
+        level->unlockCritical();
+        level->waitOnBarrier();
+    }
+}
+
+static void __kmpc_end_reduce_nowait_wrapper(wasm_exec_env_t exec_env,
+                                             int32_t loc,
+                                             int32_t gtid,
+                                             int32_t lck)
+{
+    OMP_FUNC_ARGS("__kmpc_end_reduce_nowait {} {} {}", loc, gtid, lck);
+
+    if (level->numThreads > 1) {
+        level->unlockCritical();
+    }
+}
+
+static NativeSymbol ns[] = {
+    REG_NATIVE_FUNC(omp_get_thread_num, "()i"),
+    REG_NATIVE_FUNC(omp_get_num_threads, "()i"),
+    REG_NATIVE_FUNC(omp_get_max_threads, "()i"),
+    REG_NATIVE_FUNC(omp_get_level, "()i"),
+    REG_NATIVE_FUNC(omp_get_max_active_levels, "()i"),
+    REG_NATIVE_FUNC(omp_set_max_active_levels, "(i)"),
+    REG_NATIVE_FUNC(__kmpc_push_num_threads, "(iii)"),
+    REG_NATIVE_FUNC(omp_set_num_threads, "(i)"),
+    REG_NATIVE_FUNC(__kmpc_global_thread_num, "(i)i"),
+    REG_NATIVE_FUNC(omp_get_wtime, "()F"),
+    REG_NATIVE_FUNC(__kmpc_barrier, "(ii)"),
+    REG_NATIVE_FUNC(__kmpc_critical, "(iii)"),
+    REG_NATIVE_FUNC(__kmpc_end_critical, "(iii)"),
+    REG_NATIVE_FUNC(__kmpc_flush, "(i)"),
+    REG_NATIVE_FUNC(__kmpc_master, "(ii)i"),
+    REG_NATIVE_FUNC(__kmpc_end_master, "(ii)"),
+    REG_NATIVE_FUNC(__kmpc_single, "(ii)i"),
+    REG_NATIVE_FUNC(__kmpc_end_single, "(ii)"),
+    REG_NATIVE_FUNC(__kmpc_fork_call, "(iiii)"),
+    REG_NATIVE_FUNC(__kmpc_for_static_init_4, "(iiiiiiiii)"),
+    REG_NATIVE_FUNC(__kmpc_for_static_init_8, "(iiiiiiiII)"),
+    REG_NATIVE_FUNC(__kmpc_for_static_fini, "(ii)"),
+    REG_NATIVE_FUNC(__kmpc_reduce, "(iiiiiii)i"),
+    REG_NATIVE_FUNC(__kmpc_reduce_nowait, "(iiiiiii)i"),
+    REG_NATIVE_FUNC(__kmpc_end_reduce, "(iii)"),
+    REG_NATIVE_FUNC(__kmpc_end_reduce_nowait, "(iii)"),
+};
+
+uint32_t getFaasmOpenMPApi(NativeSymbol** nativeSymbols)
+{
+    *nativeSymbols = ns;
+    return sizeof(ns) / sizeof(NativeSymbol);
+}
+}
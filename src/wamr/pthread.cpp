@@ -1,56 +1,194 @@
+#include <wamr/WAMRWasmModule.h>
 #include <wamr/native.h>
+#include <wasm/SparseSnapshot.h>
+#include <wasm/WasmExecutionContext.h>
+#include <wasm/WasmModule.h>
 #include <wasm_export.h>
 
+#include <faabric/scheduler/Scheduler.h>
+#include <faabric/snapshot/SnapshotRegistry.h>
+#include <faabric/util/func.h>
 #include <faabric/util/logging.h>
 
+#include <cerrno>
+
 namespace wasm {
 
-// -------------------------------------------
-// 14/04/21 - WAMR threading not implemented
-// All of these functions are stubbed as threading with WAMR isn't yet
-// implemented. Once it is, we will need to implement the function here,
-// exepctially the locking which is used to manage thread-safe memory
-// provisioning.
-// -------------------------------------------
+// Record of whether this thread has already got a snapshot being used to spawn
+// other threads.
+static thread_local std::string currentSnapshotKey;
+
+/**
+ * As with WAVM, we intercept the pthread API at a high level and spawn
+ * threads as THREADS batch requests from a snapshot of the module. The int
+ * value of the pthread pointer acts as its ID.
+ */
+static int32_t pthread_create_wrapper(wasm_exec_env_t exec_env,
+                                      int32_t pthreadPtr,
+                                      int32_t attrPtr,
+                                      int32_t entryFunc,
+                                      int32_t argsPtr)
+{
+    SPDLOG_DEBUG("S - pthread_create - {} {} {} {}",
+                 pthreadPtr,
+                 attrPtr,
+                 entryFunc,
+                 argsPtr);
+
+    faabric::Message* originalCall = getExecutingCall();
+    std::string funcStr = faabric::util::funcToString(*originalCall, true);
+    faabric::scheduler::Scheduler& sch = faabric::scheduler::getScheduler();
+
+    // Set the self pointer (the first field of the pthread struct), which is
+    // needed for inter-operation with existing C code
+    WAMRWasmModule* thisModule = getExecutingWAMRModule();
+    int32_t* selfPtr = (int32_t*)thisModule->wasmPointerToNative(pthreadPtr);
+    *selfPtr = pthreadPtr;
+
+    // Create a new snapshot if one isn't already active
+    if (currentSnapshotKey.empty()) {
+        currentSnapshotKey = thisModule->snapshot(false);
+
+        SPDLOG_DEBUG(
+          "Setting pthread snapshot for {} ({})", funcStr, currentSnapshotKey);
+    }
+
+    std::shared_ptr<faabric::BatchExecuteRequest> req =
+      faabric::util::batchExecFactory(
+        originalCall->user(), originalCall->function(), 1);
+
+    req->set_type(faabric::BatchExecuteRequest::THREADS);
+    req->set_subtype(wasm::ThreadRequestType::PTHREAD);
+
+    faabric::Message& threadCall = req->mutable_messages()->at(0);
+    threadCall.set_snapshotkey(currentSnapshotKey);
+
+    // The single pointer argument is passed as the input data
+    threadCall.set_funcptr(entryFunc);
+    threadCall.set_inputdata(std::to_string(argsPtr));
+
+    // Our pthread IDs start at 1
+    threadCall.set_appindex(thisModule->pthreadCounter.fetch_add(1) + 1);
+
+    sch.callFunctions(req);
+
+    thisModule->chainedThreads.insert({ pthreadPtr, threadCall.id() });
+
+    return 0;
+}
+
+static int32_t pthread_join_wrapper(wasm_exec_env_t exec_env,
+                                    int32_t pthreadPtr,
+                                    int32_t resPtrPtr)
+{
+    SPDLOG_DEBUG("S - pthread_join - {} {}", pthreadPtr, resPtrPtr);
+
+    WAMRWasmModule* thisModule = getExecutingWAMRModule();
+    unsigned int callId = thisModule->chainedThreads[pthreadPtr];
+    SPDLOG_DEBUG("Awaiting pthread: {} ({})", pthreadPtr, callId);
+
+    auto& sch = faabric::scheduler::getScheduler();
+    int returnValue = sch.awaitThreadResult(callId);
+
+    thisModule->chainedThreads.erase(pthreadPtr);
+
+    // If we're done with executing threads, remove the snapshot
+    if (thisModule->chainedThreads.empty()) {
+        SPDLOG_DEBUG("Finished with snapshot: {}", currentSnapshotKey);
+
+        // Sparse snapshots are kept alive here until deleted, including on
+        // the hosts they were pushed to
+        if (isSparseSnapshotKey(currentSnapshotKey)) {
+            sch.broadcastSnapshotDelete(*getExecutingCall(),
+                                        currentSnapshotKey);
+            faabric::snapshot::getSnapshotRegistry().deleteSnapshot(
+              currentSnapshotKey);
+            releaseSparseSnapshot(currentSnapshotKey);
+        }
+
+        currentSnapshotKey = "";
+    }
+
+    // The result pointer may be null if the caller doesn't want the result
+    if (resPtrPtr != 0) {
+        int32_t* resPtr = (int32_t*)thisModule->wasmPointerToNative(resPtrPtr);
+        *resPtr = returnValue;
+    }
+
+    return 0;
+}
+
+static void pthread_exit_wrapper(wasm_exec_env_t exec_env, int32_t code)
+{
+    SPDLOG_DEBUG("S - pthread_exit - {}", code);
+}
 
 static int32_t pthread_mutex_init_wrapper(wasm_exec_env_t exec_env,
-                                          int32_t a,
-                                          int32_t b)
+                                          int32_t mx,
+                                          int32_t attr)
+{
+    SPDLOG_TRACE("S - pthread_mutex_init {} {}", mx, attr);
+    getExecutingModule()->getMutexes().createMutex(mx);
+    return 0;
+}
+
+static int32_t pthread_mutex_lock_wrapper(wasm_exec_env_t exec_env, int32_t mx)
 {
-    SPDLOG_DEBUG("S - pthread_mutex_init {} {}", a, b);
+    SPDLOG_TRACE("S - pthread_mutex_lock {}", mx);
+    getExecutingModule()->getMutexes().lockMutex(mx);
     return 0;
 }
 
-static int32_t pthread_mutex_lock_wrapper(wasm_exec_env_t exec_env, int32_t a)
+static int32_t pthread_mutex_trylock_wrapper(wasm_exec_env_t exec_env,
+                                             int32_t mx)
 {
-    SPDLOG_DEBUG("S - pthread_mutex_lock {}", a);
+    SPDLOG_TRACE("S - pthread_mutex_trylock {}", mx);
+    bool success = getExecutingModule()->getMutexes().tryLockMutex(mx);
+    if (success) {
+        return 0;
+    } else {
+        return EBUSY;
+    }
+}
+
+static int32_t pthread_mutex_unlock_wrapper(wasm_exec_env_t exec_env,
+                                            int32_t mx)
+{
+    SPDLOG_TRACE("S - pthread_mutex_unlock {}", mx);
+    getExecutingModule()->getMutexes().unlockMutex(mx);
     return 0;
 }
 
-static int32_t pthread_mutex_unlock_wrapper(wasm_exec_env_t exec_env, int32_t a)
+static int32_t pthread_mutex_destroy_wrapper(wasm_exec_env_t exec_env,
+                                             int32_t mx)
 {
-    SPDLOG_DEBUG("S - pthread_mutex_unlock {}", a);
+    SPDLOG_TRACE("S - pthread_mutex_destroy {}", mx);
+    getExecutingModule()->getMutexes().destroyMutex(mx);
     return 0;
 }
 
+// --------------------------
+// STUBBED PTHREADS - We can safely ignore the following functions
+// --------------------------
+
 static int32_t pthread_cond_broadcast_wrapper(wasm_exec_env_t exec_env,
                                               int32_t a)
 {
-    SPDLOG_DEBUG("S - pthread_cond_broadcast_wrapper {}", a);
+    SPDLOG_TRACE("S - pthread_cond_broadcast {}", a);
     return 0;
 }
 
 static int32_t pthread_mutexattr_init_wrapper(wasm_exec_env_t exec_env,
                                               int32_t a)
 {
-    SPDLOG_DEBUG("S - pthread_mutexattr_init {}", a);
+    SPDLOG_TRACE("S - pthread_mutexattr_init {}", a);
     return 0;
 }
 
 static int32_t pthread_mutexattr_destroy_wrapper(wasm_exec_env_t exec_env,
                                                  int32_t a)
 {
-    SPDLOG_DEBUG("S - pthread_mutexattr_destroy {}", a);
+    SPDLOG_TRACE("S - pthread_mutexattr_destroy {}", a);
     return 0;
 }
 
@@ -63,9 +201,14 @@ static int32_t pthread_equal_wrapper(wasm_exec_env_t exec_env,
 }
 
 static NativeSymbol ns[] = {
+    REG_NATIVE_FUNC(pthread_create, "(iiii)i"),
+    REG_NATIVE_FUNC(pthread_join, "(ii)i"),
+    REG_NATIVE_FUNC(pthread_exit, "(i)"),
     REG_NATIVE_FUNC(pthread_mutex_init, "(ii)i"),
     REG_NATIVE_FUNC(pthread_mutex_lock, "(i)i"),
+    REG_NATIVE_FUNC(pthread_mutex_trylock, "(i)i"),
     REG_NATIVE_FUNC(pthread_mutex_unlock, "(i)i"),
+    REG_NATIVE_FUNC(pthread_mutex_destroy, "(i)i"),
     REG_NATIVE_FUNC(pthread_cond_broadcast, "(i)i"),
     REG_NATIVE_FUNC(pthread_mutexattr_init, "(i)i"),
     REG_NATIVE_FUNC(pthread_mutexattr_destroy, "(i)i"),
@@ -0,0 +1,303 @@
+#include <wasm/LazyRestore.h>
+
+#include <faabric/util/locks.h>
+#include <faabric/util/logging.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/userfaultfd.h>
+#include <map>
+#include <mutex>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace wasm {
+
+static std::mutex hotPagesMx;
+static std::map<std::string, std::vector<uint32_t>> hotPages;
+
+std::vector<uint32_t> getHotPages(const std::string& key)
+{
+    faabric::util::UniqueLock lock(hotPagesMx);
+    auto it = hotPages.find(key);
+    if (it == hotPages.end()) {
+        return {};
+    }
+
+    return it->second;
+}
+
+void clearHotPages()
+{
+    faabric::util::UniqueLock lock(hotPagesMx);
+    hotPages.clear();
+}
+
+static void recordHotPages(const std::string& key,
+                           const std::vector<uint32_t>& pages)
+{
+    faabric::util::UniqueLock lock(hotPagesMx);
+
+    // Prefetched pages don't fault, so the record is added to rather than
+    // replaced
+    std::vector<uint32_t>& existing = hotPages[key];
+    std::vector<uint32_t> merged;
+    std::vector<uint32_t> sortedPages = pages;
+    std::sort(sortedPages.begin(), sortedPages.end());
+
+    std::set_union(existing.begin(),
+                   existing.end(),
+                   sortedPages.begin(),
+                   sortedPages.end(),
+                   std::back_inserter(merged));
+
+    existing = std::move(merged);
+}
+
+LazyRestore::LazyRestore(const std::string& hotPagesKeyIn,
+                         uint8_t* memoryIn,
+                         int snapshotFdIn,
+                         size_t nBytesIn)
+  : hotPagesKey(hotPagesKeyIn)
+  , memory(memoryIn)
+  , snapshotFd(snapshotFdIn)
+  , nBytes(nBytesIn)
+  , pageSize(sysconf(_SC_PAGESIZE))
+{}
+
+LazyRestore::~LazyRestore()
+{
+    stop();
+}
+
+void LazyRestore::start()
+{
+    if (started) {
+        return;
+    }
+
+    uffd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+    if (uffd < 0) {
+        SPDLOG_DEBUG("Failed to create userfaultfd: {}", std::strerror(errno));
+        throw std::runtime_error("userfaultfd not available");
+    }
+
+    struct uffdio_api api;
+    std::memset(&api, 0, sizeof(api));
+    api.api = UFFD_API;
+    if (ioctl(uffd, UFFDIO_API, &api) != 0) {
+        SPDLOG_DEBUG("userfaultfd API handshake failed: {}",
+                     std::strerror(errno));
+        cleanUp();
+        throw std::runtime_error("userfaultfd not available");
+    }
+
+    // Pages are copied from a view of the snapshot's fd, which doesn't change
+    // under us like the memory it was taken from may
+    void* sourcePtr =
+      mmap(nullptr, nBytes, PROT_READ, MAP_SHARED, snapshotFd, 0);
+    if (sourcePtr == MAP_FAILED) {
+        SPDLOG_ERROR("Failed to map snapshot for lazy restore: {}",
+                     std::strerror(errno));
+        cleanUp();
+        throw std::runtime_error("Failed to map snapshot");
+    }
+    source = (uint8_t*)sourcePtr;
+
+    stopFd = eventfd(0, EFD_CLOEXEC);
+    if (stopFd < 0) {
+        SPDLOG_ERROR("Failed to create eventfd: {}", std::strerror(errno));
+        cleanUp();
+        throw std::runtime_error("Failed to create eventfd");
+    }
+
+    // Replace the memory with missing pages and take over filling them
+    void* res = mmap(memory,
+                     nBytes,
+                     PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+                     -1,
+                     0);
+    if (res == MAP_FAILED) {
+        SPDLOG_ERROR("Failed to clear memory for lazy restore: {}",
+                     std::strerror(errno));
+        cleanUp();
+        throw std::runtime_error("Failed to clear memory");
+    }
+
+    struct uffdio_register reg;
+    std::memset(&reg, 0, sizeof(reg));
+    reg.range.start = (uintptr_t)memory;
+    reg.range.len = nBytes;
+    reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+    if (ioctl(uffd, UFFDIO_REGISTER, &reg) != 0) {
+        SPDLOG_DEBUG("Failed to register with userfaultfd: {}",
+                     std::strerror(errno));
+        cleanUp();
+        throw std::runtime_error("userfaultfd not available");
+    }
+
+    started = true;
+    handlerThread = std::thread(&LazyRestore::handleFaults, this);
+
+    std::vector<uint32_t> pages = getHotPages(hotPagesKey);
+    if (!pages.empty()) {
+        SPDLOG_DEBUG("Prefetching {} hot pages for {}",
+                     pages.size(),
+                     hotPagesKey);
+        prefetchThread =
+          std::thread(&LazyRestore::prefetch, this, std::move(pages));
+    }
+}
+
+void LazyRestore::stop()
+{
+    if (!started) {
+        return;
+    }
+
+    stopping = true;
+    uint64_t signal = 1;
+    if (write(stopFd, &signal, sizeof(signal)) != sizeof(signal)) {
+        SPDLOG_ERROR("Failed to signal lazy restore to stop: {}",
+                     std::strerror(errno));
+    }
+
+    if (prefetchThread.joinable()) {
+        prefetchThread.join();
+    }
+
+    if (handlerThread.joinable()) {
+        handlerThread.join();
+    }
+
+    // The memory may already have been freed, so failure is expected here
+    struct uffdio_range range;
+    range.start = (uintptr_t)memory;
+    range.len = nBytes;
+    ioctl(uffd, UFFDIO_UNREGISTER, &range);
+
+    SPDLOG_DEBUG("Lazy restore for {} served {} faults, prefetched {} pages",
+                 hotPagesKey,
+                 faultCount.load(),
+                 prefetchCount.load());
+
+    recordHotPages(hotPagesKey, faultedPages);
+
+    cleanUp();
+    started = false;
+}
+
+void LazyRestore::cleanUp()
+{
+    if (source != nullptr) {
+        munmap(source, nBytes);
+        source = nullptr;
+    }
+
+    if (stopFd >= 0) {
+        close(stopFd);
+        stopFd = -1;
+    }
+
+    if (uffd >= 0) {
+        close(uffd);
+        uffd = -1;
+    }
+}
+
+bool LazyRestore::copyPage(uint32_t pageIdx)
+{
+    size_t offset = ((size_t)pageIdx) * pageSize;
+    if (offset >= nBytes) {
+        return false;
+    }
+
+    struct uffdio_copy copy;
+    std::memset(&copy, 0, sizeof(copy));
+    copy.dst = (uintptr_t)(memory + offset);
+    copy.src = (uintptr_t)(source + offset);
+    copy.len = std::min(pageSize, nBytes - offset);
+
+    // Pages already filled (e.g. by prefetching) give EEXIST
+    if (ioctl(uffd, UFFDIO_COPY, &copy) != 0) {
+        if (errno != EEXIST) {
+            SPDLOG_ERROR("Failed to copy page {} for {}: {}",
+                         pageIdx,
+                         hotPagesKey,
+                         std::strerror(errno));
+        }
+
+        return false;
+    }
+
+    return true;
+}
+
+void LazyRestore::handleFaults()
+{
+    struct pollfd fds[2];
+    fds[0].fd = uffd;
+    fds[0].events = POLLIN;
+    fds[1].fd = stopFd;
+    fds[1].events = POLLIN;
+
+    while (!stopping) {
+        int res = poll(fds, 2, -1);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            SPDLOG_ERROR("Polling userfaultfd failed: {}",
+                         std::strerror(errno));
+            break;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            break;
+        }
+
+        struct uffd_msg msg;
+        ssize_t nRead = read(uffd, &msg, sizeof(msg));
+        if (nRead != sizeof(msg) || msg.event != UFFD_EVENT_PAGEFAULT) {
+            continue;
+        }
+
+        uintptr_t address = msg.arg.pagefault.address;
+        uint32_t pageIdx = (address - (uintptr_t)memory) / pageSize;
+
+        faultCount++;
+        copyPage(pageIdx);
+        faultedPages.push_back(pageIdx);
+    }
+}
+
+void LazyRestore::prefetch(std::vector<uint32_t> pages)
+{
+    for (uint32_t pageIdx : pages) {
+        if (stopping) {
+            break;
+        }
+
+        if (copyPage(pageIdx)) {
+            prefetchCount++;
+        }
+    }
+}
+
+size_t LazyRestore::getFaultCount()
+{
+    return faultCount.load();
+}
+
+size_t LazyRestore::getPrefetchCount()
+{
+    return prefetchCount.load();
+}
+}
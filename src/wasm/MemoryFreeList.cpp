@@ -0,0 +1,111 @@
+#include <wasm/MemoryFreeList.h>
+
+#include <algorithm>
+#include <iterator>
+
+namespace wasm {
+
+bool MemoryFreeList::allocate(uint32_t nBytes, uint32_t& offset)
+{
+    // First fit keeps allocations low, leaving free memory at the top to be
+    // given back to the break
+    for (auto it = regions.begin(); it != regions.end(); ++it) {
+        if (it->second < nBytes) {
+            continue;
+        }
+
+        offset = it->first;
+        uint32_t remainder = it->second - nBytes;
+        regions.erase(it);
+
+        if (remainder > 0) {
+            regions[offset + nBytes] = remainder;
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+void MemoryFreeList::free(uint32_t offset, uint32_t nBytes)
+{
+    if (nBytes == 0) {
+        return;
+    }
+
+    uint64_t start = offset;
+    uint64_t end = (uint64_t)offset + nBytes;
+
+    // Merge with a region that ends at or overlaps the start
+    auto it = regions.upper_bound(offset);
+    if (it != regions.begin()) {
+        auto prev = std::prev(it);
+        uint64_t prevEnd = (uint64_t)prev->first + prev->second;
+        if (prevEnd >= start) {
+            start = prev->first;
+            end = std::max(end, prevEnd);
+            regions.erase(prev);
+        }
+    }
+
+    // Merge with any regions starting within or at the end
+    while (it != regions.end() && it->first <= end) {
+        end = std::max(end, (uint64_t)it->first + it->second);
+        it = regions.erase(it);
+    }
+
+    regions[(uint32_t)start] = (uint32_t)(end - start);
+}
+
+uint32_t MemoryFreeList::trimTop(uint32_t brk)
+{
+    if (regions.empty()) {
+        return brk;
+    }
+
+    auto last = std::prev(regions.end());
+    if (last->first + last->second != brk) {
+        return brk;
+    }
+
+    uint32_t newBrk = last->first;
+    regions.erase(last);
+
+    return newBrk;
+}
+
+void MemoryFreeList::removeAbove(uint32_t brk)
+{
+    auto it = regions.lower_bound(brk);
+    regions.erase(it, regions.end());
+
+    // Truncate a region straddling the break
+    if (!regions.empty()) {
+        auto last = std::prev(regions.end());
+        if (last->first + last->second > brk) {
+            last->second = brk - last->first;
+        }
+    }
+}
+
+void MemoryFreeList::clear()
+{
+    regions.clear();
+}
+
+size_t MemoryFreeList::getFreeBytes()
+{
+    size_t total = 0;
+    for (const auto& r : regions) {
+        total += r.second;
+    }
+
+    return total;
+}
+
+size_t MemoryFreeList::getRegionCount()
+{
+    return regions.size();
+}
+}
@@ -0,0 +1,161 @@
+#include <wasm/MemoryQuota.h>
+
+#include <conf/FaasmConfig.h>
+#include <wasm/WasmModule.h>
+
+#include <faabric/util/locks.h>
+#include <faabric/util/logging.h>
+
+#include <algorithm>
+
+namespace wasm {
+MemoryQuota& getMemoryQuota()
+{
+    static MemoryQuota q;
+    return q;
+}
+
+static std::string getFunctionKey(const std::string& user,
+                                  const std::string& function)
+{
+    return user + "/" + function;
+}
+
+static MemoryQuotaResult checkLimit(size_t currentBytes,
+                                    size_t nBytes,
+                                    int limitMb,
+                                    int softPercent)
+{
+    if (limitMb <= 0) {
+        return QUOTA_OK;
+    }
+
+    size_t hardBytes = ((size_t)limitMb) * ONE_MB_BYTES;
+    size_t softBytes = (hardBytes / 100) * softPercent;
+
+    if (currentBytes + nBytes > hardBytes) {
+        return QUOTA_HARD_LIMIT;
+    }
+
+    if (currentBytes + nBytes > softBytes) {
+        return QUOTA_SOFT_LIMIT;
+    }
+
+    return QUOTA_OK;
+}
+
+MemoryQuotaResult MemoryQuota::charge(const std::string& user,
+                                      const std::string& function,
+                                      size_t nBytes,
+                                      bool enforce)
+{
+    conf::FaasmConfig& conf = conf::getFaasmConfig();
+    std::string funcKey = getFunctionKey(user, function);
+
+    faabric::util::UniqueLock lock(mx);
+
+    size_t& funcTotal = functionBytes[funcKey];
+    size_t& userTotal = userBytes[user];
+
+    MemoryQuotaResult funcResult = checkLimit(funcTotal,
+                                              nBytes,
+                                              conf.functionMemoryLimitMb,
+                                              conf.memorySoftLimitPercent);
+    MemoryQuotaResult userResult = checkLimit(userTotal,
+                                              nBytes,
+                                              conf.userMemoryLimitMb,
+                                              conf.memorySoftLimitPercent);
+
+    MemoryQuotaResult result = std::max(funcResult, userResult);
+    if (result == QUOTA_HARD_LIMIT && enforce) {
+        SPDLOG_WARN("Memory limit reached for {} ({}B, user {}B, +{}B)",
+                    funcKey,
+                    funcTotal,
+                    userTotal,
+                    nBytes);
+        return result;
+    }
+
+    funcTotal += nBytes;
+    userTotal += nBytes;
+    hostBytes += nBytes;
+
+    return result;
+}
+
+void MemoryQuota::release(const std::string& user,
+                          const std::string& function,
+                          size_t nBytes)
+{
+    std::string funcKey = getFunctionKey(user, function);
+
+    faabric::util::UniqueLock lock(mx);
+
+    size_t& funcTotal = functionBytes[funcKey];
+    size_t& userTotal = userBytes[user];
+
+    // Clamp, as the accounting may have been cleared since the charge
+    funcTotal -= std::min(funcTotal, nBytes);
+    userTotal -= std::min(userTotal, nBytes);
+    hostBytes -= std::min(hostBytes, nBytes);
+
+    if (funcTotal == 0) {
+        functionBytes.erase(funcKey);
+    }
+
+    if (userTotal == 0) {
+        userBytes.erase(user);
+    }
+}
+
+void MemoryQuota::reclaim(const std::string& user, const std::string& function)
+{
+    std::function<void(const std::string&, const std::string&)> func;
+    {
+        faabric::util::UniqueLock lock(mx);
+        func = reclaimer;
+    }
+
+    // The reclaimer releases memory, so must be called without the lock
+    if (func) {
+        SPDLOG_DEBUG("Reclaiming memory for {}/{}", user, function);
+        func(user, function);
+    }
+}
+
+void MemoryQuota::setReclaimer(
+  std::function<void(const std::string&, const std::string&)> func)
+{
+    faabric::util::UniqueLock lock(mx);
+    reclaimer = func;
+}
+
+size_t MemoryQuota::getFunctionBytes(const std::string& user,
+                                     const std::string& function)
+{
+    faabric::util::UniqueLock lock(mx);
+    auto it = functionBytes.find(getFunctionKey(user, function));
+    return it == functionBytes.end() ? 0 : it->second;
+}
+
+size_t MemoryQuota::getUserBytes(const std::string& user)
+{
+    faabric::util::UniqueLock lock(mx);
+    auto it = userBytes.find(user);
+    return it == userBytes.end() ? 0 : it->second;
+}
+
+size_t MemoryQuota::getHostBytes()
+{
+    faabric::util::UniqueLock lock(mx);
+    return hostBytes;
+}
+
+void MemoryQuota::clear()
+{
+    faabric::util::UniqueLock lock(mx);
+    functionBytes.clear();
+    userBytes.clear();
+    hostBytes = 0;
+}
+}
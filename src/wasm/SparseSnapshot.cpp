@@ -0,0 +1,194 @@
+#include <wasm/SparseSnapshot.h>
+
+#include <faabric/util/locks.h>
+#include <faabric/util/logging.h>
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace wasm {
+
+static std::mutex storeMx;
+static std::unordered_map<std::string, std::vector<uint8_t>> storedSnapshots;
+
+static bool isZero(const uint8_t* ptr, size_t nBytes)
+{
+    return ptr[0] == 0 && std::memcmp(ptr, ptr + 1, nBytes - 1) == 0;
+}
+
+std::vector<std::pair<uint32_t, uint32_t>> getChangedRegions(
+  const uint8_t* memory,
+  uint32_t memorySize,
+  const uint8_t* base,
+  uint32_t baseSize,
+  const std::vector<std::pair<uint32_t, uint32_t>>& skipRegions)
+{
+    uint32_t pageSize = sysconf(_SC_PAGESIZE);
+
+    std::vector<std::pair<uint32_t, uint32_t>> regions;
+    auto skipIt = skipRegions.begin();
+
+    for (uint32_t offset = 0; offset < memorySize; offset += pageSize) {
+        uint32_t nBytes = std::min(pageSize, memorySize - offset);
+
+        // Skip regions are sorted, so we only need to move forward
+        while (skipIt != skipRegions.end() &&
+               skipIt->first + skipIt->second <= offset) {
+            skipIt++;
+        }
+
+        if (skipIt != skipRegions.end() && skipIt->first <= offset &&
+            offset + nBytes <= skipIt->first + skipIt->second) {
+            continue;
+        }
+
+        bool changed;
+        if (offset + nBytes <= baseSize) {
+            changed = std::memcmp(memory + offset, base + offset, nBytes) != 0;
+        } else if (offset < baseSize) {
+            uint32_t inBase = baseSize - offset;
+            changed =
+              std::memcmp(memory + offset, base + offset, inBase) != 0 ||
+              !isZero(memory + baseSize, nBytes - inBase);
+        } else {
+            changed = !isZero(memory + offset, nBytes);
+        }
+
+        if (!changed) {
+            continue;
+        }
+
+        if (!regions.empty() &&
+            regions.back().first + regions.back().second == offset) {
+            regions.back().second += nBytes;
+        } else {
+            regions.emplace_back(offset, nBytes);
+        }
+    }
+
+    return regions;
+}
+
+std::vector<uint8_t> serialiseSparseSnapshot(
+  const uint8_t* memory,
+  uint32_t memorySize,
+  uint32_t baseSize,
+  const std::vector<std::pair<uint32_t, uint32_t>>& regions)
+{
+    SparseSnapshotHeader header;
+    header.memorySize = memorySize;
+    header.baseSize = baseSize;
+    header.nRegions = regions.size();
+
+    size_t tableBytes = regions.size() * 2 * sizeof(uint32_t);
+    size_t dataBytes = 0;
+    for (const auto& r : regions) {
+        dataBytes += r.second;
+    }
+
+    std::vector<uint8_t> buffer(sizeof(header) + tableBytes + dataBytes);
+    uint8_t* ptr = buffer.data();
+
+    std::memcpy(ptr, &header, sizeof(header));
+    ptr += sizeof(header);
+
+    for (const auto& r : regions) {
+        uint32_t entry[2] = { r.first, r.second };
+        std::memcpy(ptr, entry, sizeof(entry));
+        ptr += sizeof(entry);
+    }
+
+    for (const auto& r : regions) {
+        std::memcpy(ptr, memory + r.first, r.second);
+        ptr += r.second;
+    }
+
+    return buffer;
+}
+
+SparseSnapshotHeader readSparseSnapshotHeader(const uint8_t* data,
+                                              size_t size)
+{
+    SparseSnapshotHeader header;
+    if (size < sizeof(header)) {
+        SPDLOG_ERROR("Sparse snapshot too small ({} bytes)", size);
+        throw std::runtime_error("Invalid sparse snapshot");
+    }
+
+    std::memcpy(&header, data, sizeof(header));
+    if (header.magic != SPARSE_SNAPSHOT_MAGIC) {
+        SPDLOG_ERROR("Sparse snapshot has bad magic {:x}", header.magic);
+        throw std::runtime_error("Invalid sparse snapshot");
+    }
+
+    size_t tableBytes = ((size_t)header.nRegions) * 2 * sizeof(uint32_t);
+    if (size < sizeof(header) + tableBytes) {
+        SPDLOG_ERROR("Sparse snapshot truncated ({} regions in {} bytes)",
+                     header.nRegions,
+                     size);
+        throw std::runtime_error("Invalid sparse snapshot");
+    }
+
+    return header;
+}
+
+void applySparseSnapshot(const uint8_t* data, size_t size, uint8_t* memory)
+{
+    SparseSnapshotHeader header = readSparseSnapshotHeader(data, size);
+
+    const uint8_t* tablePtr = data + sizeof(header);
+    const uint8_t* dataPtr =
+      tablePtr + ((size_t)header.nRegions) * 2 * sizeof(uint32_t);
+    const uint8_t* dataEnd = data + size;
+
+    for (uint32_t i = 0; i < header.nRegions; i++) {
+        uint32_t entry[2];
+        std::memcpy(entry, tablePtr + i * sizeof(entry), sizeof(entry));
+
+        uint64_t regionEnd = (uint64_t)entry[0] + entry[1];
+        if (regionEnd > header.memorySize || dataPtr + entry[1] > dataEnd) {
+            SPDLOG_ERROR("Sparse snapshot region {}-{} out of bounds",
+                         entry[0],
+                         regionEnd);
+            throw std::runtime_error("Invalid sparse snapshot");
+        }
+
+        std::memcpy(memory + entry[0], dataPtr, entry[1]);
+        dataPtr += entry[1];
+    }
+}
+
+bool isSparseSnapshotKey(const std::string& key)
+{
+    return key.rfind(SPARSE_SNAPSHOT_KEY_PREFIX, 0) == 0;
+}
+
+faabric::util::SnapshotData storeSparseSnapshot(const std::string& key,
+                                                std::vector<uint8_t> data)
+{
+    faabric::util::UniqueLock lock(storeMx);
+    std::vector<uint8_t>& stored = storedSnapshots[key];
+    stored = std::move(data);
+
+    faabric::util::SnapshotData snapData;
+    snapData.data = stored.data();
+    snapData.size = stored.size();
+
+    return snapData;
+}
+
+void releaseSparseSnapshot(const std::string& key)
+{
+    faabric::util::UniqueLock lock(storeMx);
+    storedSnapshots.erase(key);
+}
+
+size_t getStoredSparseSnapshotCount()
+{
+    faabric::util::UniqueLock lock(storeMx);
+    return storedSnapshots.size();
+}
+}
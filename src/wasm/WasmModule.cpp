@@ -1,6 +1,8 @@
 #include "wasm/WasmModule.h"
 
 #include <conf/FaasmConfig.h>
+#include <wasm/MemoryQuota.h>
+#include <wasm/SparseSnapshot.h>
 #include <threads/ThreadState.h>
 #include <wasm/WasmExecutionContext.h>
 
@@ -16,10 +18,20 @@
 #include <faabric/util/memory.h>
 #include <faabric/util/timing.h>
 
+#include <algorithm>
 #include <boost/filesystem.hpp>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
 #include <sstream>
 #include <sys/mman.h>
 #include <sys/uio.h>
+#include <unistd.h>
+
+// Flags in /proc/self/pagemap entries
+#define PAGEMAP_PRESENT (1ULL << 63)
+#define PAGEMAP_SWAPPED (1ULL << 62)
+#define PAGEMAP_FILE (1ULL << 61)
 
 namespace wasm {
 
@@ -54,6 +66,155 @@ size_t getPagesForGuardRegion()
     return nWasmPages;
 }
 
+static std::vector<uint64_t> readPagemapEntries(uint8_t* ptr, size_t nBytes)
+{
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t nPages = nBytes / pageSize;
+
+    std::vector<uint64_t> entries(nPages);
+    int fd = open("/proc/self/pagemap", O_RDONLY);
+    if (fd < 0) {
+        SPDLOG_ERROR("Failed to open pagemap: {}", std::strerror(errno));
+        throw std::runtime_error("Failed to open pagemap");
+    }
+
+    size_t readBytes = 0;
+    size_t totalBytes = nPages * sizeof(uint64_t);
+    off_t fileOffset = ((uintptr_t)ptr / pageSize) * sizeof(uint64_t);
+    while (readBytes < totalBytes) {
+        ssize_t res = pread(fd,
+                            ((uint8_t*)entries.data()) + readBytes,
+                            totalBytes - readBytes,
+                            fileOffset + readBytes);
+        if (res <= 0) {
+            SPDLOG_ERROR("Failed to read pagemap: {}", std::strerror(errno));
+            close(fd);
+            throw std::runtime_error("Failed to read pagemap");
+        }
+
+        readBytes += res;
+    }
+
+    close(fd);
+
+    return entries;
+}
+
+std::vector<std::pair<uint32_t, uint32_t>> getPrivatelyWrittenRegions(
+  uint8_t* ptr,
+  size_t nBytes)
+{
+    // Pages of a private file mapping are backed by the file until they are
+    // written, at which point the kernel gives the process its own anonymous
+    // copy. The page tables therefore tell us which pages have been written,
+    // without needing to clear any process-wide tracking state.
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    std::vector<uint64_t> entries = readPagemapEntries(ptr, nBytes);
+
+    // Merge contiguous written pages into regions
+    std::vector<std::pair<uint32_t, uint32_t>> regions;
+    for (size_t i = 0; i < entries.size(); i++) {
+        uint64_t entry = entries[i];
+        bool written = (entry & PAGEMAP_SWAPPED) ||
+                       ((entry & PAGEMAP_PRESENT) && !(entry & PAGEMAP_FILE));
+        if (!written) {
+            continue;
+        }
+
+        uint32_t offset = i * pageSize;
+        if (!regions.empty() &&
+            regions.back().first + regions.back().second == offset) {
+            regions.back().second += pageSize;
+        } else {
+            regions.emplace_back(offset, pageSize);
+        }
+    }
+
+    return regions;
+}
+
+size_t getResidentBytes(uint8_t* ptr, size_t nBytes)
+{
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    std::vector<uint64_t> entries = readPagemapEntries(ptr, nBytes);
+
+    size_t nResident = 0;
+    for (uint64_t entry : entries) {
+        if (entry & PAGEMAP_PRESENT) {
+            nResident++;
+        }
+    }
+
+    return nResident * pageSize;
+}
+
+size_t getMappedStatBytes(uint8_t* ptr, size_t nBytes, const std::string& field)
+{
+    std::ifstream smaps("/proc/self/smaps");
+    if (!smaps.is_open()) {
+        SPDLOG_ERROR("Failed to open smaps");
+        throw std::runtime_error("Failed to open smaps");
+    }
+
+    uintptr_t rangeStart = (uintptr_t)ptr;
+    uintptr_t rangeEnd = rangeStart + nBytes;
+    std::string fieldName = field + ":";
+
+    // Each mapping starts with its address range (e.g. "7f00-7f80 rw-p ..."),
+    // followed by a line per field (e.g. "AnonHugePages:  2048 kB")
+    bool inRange = false;
+    size_t totalKb = 0;
+    std::string line;
+    while (std::getline(smaps, line)) {
+        std::istringstream lineStream(line);
+        std::string first;
+        lineStream >> first;
+        if (first.empty()) {
+            continue;
+        }
+
+        if (first.back() != ':') {
+            size_t dash = first.find('-');
+            uintptr_t start = std::stoull(first.substr(0, dash), nullptr, 16);
+            uintptr_t end = std::stoull(first.substr(dash + 1), nullptr, 16);
+            inRange = start < rangeEnd && end > rangeStart;
+        } else if (inRange && first == fieldName) {
+            size_t kb = 0;
+            lineStream >> kb;
+            totalKb += kb;
+        }
+    }
+
+    return totalKb * 1024;
+}
+
+bool isShmemHugePagesEnabled()
+{
+    // The setting in use is bracketed, e.g. "always within_size [advise] ..."
+    std::ifstream file("/sys/kernel/mm/transparent_hugepage/shmem_enabled");
+    std::string contents((std::istreambuf_iterator<char>(file)),
+                         std::istreambuf_iterator<char>());
+
+    size_t start = contents.find('[');
+    size_t end = contents.find(']', start);
+    if (start == std::string::npos || end == std::string::npos) {
+        return false;
+    }
+
+    std::string setting = contents.substr(start + 1, end - start - 1);
+    return setting != "never" && setting != "deny";
+}
+
+uint32_t checkMemoryGrow(uint32_t wasmPtr)
+{
+    if (wasmPtr == MEMORY_GROW_FAILED) {
+        SPDLOG_ERROR("Growing memory exceeds the memory limit");
+        throw std::runtime_error("Memory limit exceeded");
+    }
+
+    return wasmPtr;
+}
+
 WasmModule::WasmModule()
   : WasmModule(faabric::util::getUsableCores())
 {}
@@ -62,7 +223,12 @@ WasmModule::WasmModule(int threadPoolSizeIn)
   : threadPoolSize(threadPoolSizeIn)
 {}
 
-WasmModule::~WasmModule() {}
+WasmModule::~WasmModule()
+{
+    if (quotaBytes > 0) {
+        getMemoryQuota().release(boundUser, boundFunction, quotaBytes);
+    }
+}
 
 void WasmModule::flush() {}
 
@@ -78,6 +244,8 @@ wasm::WasmEnvironment& WasmModule::getWasmEnvironment()
 
 faabric::util::SnapshotData WasmModule::getSnapshotData()
 {
+    exposeGuardRegions();
+
     // Note - we only want to take the snapshot to the current brk, not the top
     // of the allocated memory
     faabric::util::SnapshotData data;
@@ -87,6 +255,24 @@ faabric::util::SnapshotData WasmModule::getSnapshotData()
     return data;
 }
 
+std::vector<std::pair<uint32_t, uint32_t>> WasmModule::getDirtyRegions()
+{
+    if (!zygoteMemoryMapped) {
+        SPDLOG_ERROR("Dirty regions for {}/{} not tracked",
+                     boundUser,
+                     boundFunction);
+        throw std::runtime_error("Dirty regions not tracked");
+    }
+
+    return getPrivatelyWrittenRegions(getMemoryBase(), getMemorySizeBytes());
+}
+
+size_t WasmModule::getResidentMemoryBytes()
+{
+    faabric::util::SharedLock lock(moduleMemoryMutex);
+    return getResidentBytes(getMemoryBase(), getMemorySizeBytes());
+}
+
 std::string WasmModule::snapshot(bool locallyRestorable)
 {
     PROF_START(wasmSnapshot)
@@ -96,6 +282,12 @@ std::string WasmModule::snapshot(bool locallyRestorable)
     std::string snapKey =
       this->boundUser + "_" + this->boundFunction + "_" + std::to_string(gid);
 
+    if (conf::getFaasmConfig().snapshotMode == "sparse") {
+        snapKey = takeSparseSnapshot(snapKey, locallyRestorable);
+        PROF_END(wasmSnapshot)
+        return snapKey;
+    }
+
     faabric::util::SnapshotData data = getSnapshotData();
 
     faabric::snapshot::SnapshotRegistry& reg =
@@ -107,6 +299,148 @@ std::string WasmModule::snapshot(bool locallyRestorable)
     return snapKey;
 }
 
+std::string WasmModule::takeSparseSnapshot(const std::string& snapKey,
+                                           bool locallyRestorable)
+{
+    std::string sparseKey = SPARSE_SNAPSHOT_KEY_PREFIX + snapKey;
+
+    // Guard regions are zeroes by definition, so needn't be read
+    exposeGuardRegions();
+
+    // Without a zygote the snapshot is taken against an empty base
+    std::shared_ptr<WasmModule> zygote = nullptr;
+    faabric::util::SnapshotData base;
+    if (!zygoteMemoryMapped) {
+        zygote = getZygote();
+    }
+
+    if (zygote != nullptr) {
+        base.data = zygote->getMemoryBase();
+        base.size = zygote->getMemorySizeBytes();
+    }
+
+    std::vector<uint8_t> sparseData;
+    {
+        faabric::util::SharedLock lock(moduleMemoryMutex);
+
+        uint8_t* memory = getMemoryBase();
+        uint32_t memorySize = currentBrk;
+
+        // With the zygote's memory mapped, the page tables tell us what's
+        // been written since. Otherwise we compare with the zygote's memory.
+        std::vector<std::pair<uint32_t, uint32_t>> regions;
+        uint32_t baseSize;
+        if (zygoteMemoryMapped) {
+            regions = getPrivatelyWrittenRegions(memory, memorySize);
+            baseSize = zygoteMappedBytes;
+        } else {
+            std::vector<std::pair<uint32_t, uint32_t>> skipRegions(
+              guardRegions.begin(), guardRegions.end());
+            regions = getChangedRegions(
+              memory, memorySize, base.data, base.size, skipRegions);
+            baseSize = base.size;
+        }
+
+        sparseData =
+          serialiseSparseSnapshot(memory, memorySize, baseSize, regions);
+
+        SPDLOG_DEBUG("Sparse snapshot {} has {} regions ({}/{} bytes)",
+                     sparseKey,
+                     regions.size(),
+                     sparseData.size(),
+                     memorySize);
+    }
+
+    faabric::util::SnapshotData data =
+      storeSparseSnapshot(sparseKey, std::move(sparseData));
+
+    faabric::snapshot::SnapshotRegistry& reg =
+      faabric::snapshot::getSnapshotRegistry();
+    reg.takeSnapshot(sparseKey, data, locallyRestorable);
+
+    return sparseKey;
+}
+
+void WasmModule::restoreSparse(const std::string& snapshotKey,
+                               const faabric::util::SnapshotData& data)
+{
+    SparseSnapshotHeader header =
+      readSparseSnapshotHeader(data.data, data.size);
+
+    SPDLOG_DEBUG("Restoring sparse snapshot {} ({} regions)",
+                 snapshotKey,
+                 header.nRegions);
+
+    // Start from the base the snapshot was taken against
+    if (header.baseSize > 0) {
+        faabric::Message msg =
+          faabric::util::messageFactory(boundUser, boundFunction);
+        resetToSnapshotBase(msg);
+    } else {
+        {
+            faabric::util::FullLock lock(moduleMemoryMutex);
+            if (currentBrk > 0) {
+                discardMemory(0, currentBrk);
+            }
+            freeList.clear();
+        }
+
+        clearThreadStacks();
+    }
+
+    uint32_t memSize = getCurrentBrk();
+    if (header.memorySize > memSize) {
+        checkMemoryGrow(this->growMemory(header.memorySize - memSize));
+    } else if (header.memorySize < memSize) {
+        this->shrinkMemory(memSize - header.memorySize);
+    }
+
+    applySparseSnapshot(data.data, data.size, getMemoryBase());
+}
+
+bool WasmModule::startLazyRestore(const faabric::util::SnapshotData& data)
+{
+    // Pages are copied from the snapshot's fd, so it must be locally
+    // restorable
+    if (data.fd <= 0 || data.size == 0) {
+        return false;
+    }
+
+    std::string funcStr = boundUser + "/" + boundFunction;
+    auto restorer = std::make_unique<LazyRestore>(
+      funcStr, getMemoryBase(), data.fd, data.size);
+
+    try {
+        restorer->start();
+    } catch (std::runtime_error& e) {
+        SPDLOG_WARN("Falling back to eager restore for {}: {}",
+                    funcStr,
+                    e.what());
+        return false;
+    }
+
+    lazyRestore = std::move(restorer);
+    return true;
+}
+
+void WasmModule::stopLazyRestore()
+{
+    if (lazyRestore != nullptr) {
+        lazyRestore->stop();
+        lazyRestore = nullptr;
+    }
+}
+
+bool WasmModule::isRestoringLazily()
+{
+    return lazyRestore != nullptr;
+}
+
+std::shared_ptr<WasmModule> WasmModule::getZygote()
+{
+    return nullptr;
+}
+
 void WasmModule::restore(const std::string& snapshotKey)
 {
     PROF_START(wasmSnapshotRestore)
@@ -120,23 +454,55 @@ void WasmModule::restore(const std::string& snapshotKey)
     faabric::snapshot::SnapshotRegistry& reg =
       faabric::snapshot::getSnapshotRegistry();
 
+    // Any previous lazy restore is replaced
+    stopLazyRestore();
+
     // Expand memory if necessary
     faabric::util::SnapshotData data = reg.getSnapshot(snapshotKey);
+
+    if (isSparseSnapshotKey(snapshotKey)) {
+        restoreSparse(snapshotKey, data);
+        PROF_END(wasmSnapshotRestore)
+        return;
+    }
+
     uint32_t memSize = getCurrentBrk();
 
     if (data.size > memSize) {
         SPDLOG_DEBUG("Growing memory to fit snapshot");
         size_t bytesRequired = data.size - memSize;
-        this->growMemory(bytesRequired);
+        checkMemoryGrow(this->growMemory(bytesRequired));
     } else {
         SPDLOG_DEBUG("Shrinking memory to fit snapshot");
         size_t shrinkBy = memSize - data.size;
         this->shrinkMemory(shrinkBy);
     }
 
-    // Map the snapshot into memory
-    uint8_t* memoryBase = getMemoryBase();
-    reg.mapSnapshot(snapshotKey, memoryBase);
+    // Stacks created above the snapshot's memory aren't there any more
+    {
+        faabric::util::UniqueLock lock(threadStacksMutex);
+        if (!threadStacks.empty() && threadStacks.back() >= data.size) {
+            threadStacks.clear();
+        }
+    }
+
+    // Map the snapshot into memory, unless it's to be filled in lazily
+    bool isLazy =
+      conf::getFaasmConfig().restoreMode == "lazy" && startLazyRestore(data);
+    if (!isLazy) {
+        uint8_t* memoryBase = getMemoryBase();
+        reg.mapSnapshot(snapshotKey, memoryBase);
+    }
+    zygoteMemoryMapped = false;
+    adviseHugePages(0, data.size, !isLazy);
+
+    // The snapshot's memory is all in use as far as we know, and the mapping
+    // has replaced the guard regions
+    {
+        faabric::util::FullLock lock(moduleMemoryMutex);
+        freeList.clear();
+        applyGuardRegions();
+    }
 
     PROF_END(wasmSnapshotRestore)
 }
@@ -295,7 +661,7 @@ uint32_t WasmModule::mapSharedStateMemory(
             // already).
             // We need to round the allocation up to a wasm page boundary
             uint32_t allocSize = roundUpToWasmPageAligned(chunk.nBytesLength);
-            uint32_t wasmBasePtr = this->growMemory(allocSize);
+            uint32_t wasmBasePtr = checkMemoryGrow(this->growMemory(allocSize));
             uint32_t wasmOffsetPtr = wasmBasePtr + chunk.offsetRemainder;
 
             // Map the shared memory
@@ -337,19 +703,48 @@ int32_t WasmModule::executeTask(
     // Set up context for this task
     WasmExecutionContext ctx(this, &msg);
 
-    // Modules must have provisioned their own thread stacks
-    assert(!threadStacks.empty());
-    uint32_t stackTop = threadStacks.at(threadPoolIdx);
+    // Guard regions exposed for a snapshot are protected again
+    if (guardRegionsExposed) {
+        faabric::util::FullLock lock(moduleMemoryMutex);
+        if (guardRegionsExposed) {
+            applyGuardRegions();
+        }
+    }
 
     // Perform the appropriate type of execution
     int returnValue;
     if (req->type() == faabric::BatchExecuteRequest::THREADS) {
+        uint32_t stackTop = getThreadStack(threadPoolIdx);
+
         // Pthreads or openmp
         if (req->subtype() == ThreadRequestType::PTHREAD) {
             returnValue = executePthread(threadPoolIdx, stackTop, msg);
         } else if (req->subtype() == ThreadRequestType::OPENMP) {
             threads::setCurrentOpenMPLevel(req);
-            returnValue = executeOMPThread(threadPoolIdx, stackTop, msg);
+
+            // Only the master's process sets up (and clears) the reduction
+            std::shared_ptr<threads::Level> level =
+              threads::getCurrentOpenMPLevel();
+            bool isRemote = level->getReduction() == nullptr;
+            if (isRemote) {
+                level->startRemoteThread();
+            }
+
+            try {
+                returnValue = executeOMPThread(threadPoolIdx, stackTop, msg);
+            } catch (...) {
+                // Other threads of the level in this process mustn't wait
+                // for this one
+                level->abort();
+                if (isRemote) {
+                    level->finishRemoteThread();
+                }
+                throw;
+            }
+
+            if (isRemote) {
+                level->finishRemoteThread();
+            }
         } else {
             throw std::runtime_error("Unrecognised thread type");
         }
@@ -380,17 +775,12 @@ int32_t WasmModule::executeTask(
 
 uint32_t WasmModule::createMemoryGuardRegion(uint32_t wasmOffset)
 {
-
     uint32_t regionSize = GUARD_REGION_SIZE;
-    uint8_t* nativePtr = wasmPointerToNative(wasmOffset);
 
-    // NOTE: we want to protect these regions from _writes_, but we don't
-    // want to stop them being read, otherwise snapshotting will fail.
-    // Therefore we make them read-only
-    int res = mprotect(nativePtr, regionSize, PROT_READ);
-    if (res != 0) {
-        SPDLOG_ERROR("Failed to create memory guard: {}", std::strerror(errno));
-        throw std::runtime_error("Failed to create memory guard");
+    {
+        faabric::util::FullLock lock(moduleMemoryMutex);
+        protectGuardRegion(wasmOffset, regionSize);
+        guardRegions[wasmOffset] = regionSize;
     }
 
     SPDLOG_TRACE(
@@ -399,6 +789,118 @@ uint32_t WasmModule::createMemoryGuardRegion(uint32_t wasmOffset)
     return wasmOffset + regionSize;
 }
 
+std::map<uint32_t, uint32_t> WasmModule::getGuardRegions()
+{
+    faabric::util::SharedLock lock(moduleMemoryMutex);
+    return guardRegions;
+}
+
+void WasmModule::protectGuardRegion(uint32_t offset, uint32_t nBytes)
+{
+    uint8_t* nativePtr = getMemoryBase() + offset;
+
+    // NOTE: read-only guards protect the region from _writes_, but can still
+    // be read when snapshotting. No-access guards aren't backed by memory, so
+    // have to be exposed while the memory is copied (see exposeGuardRegions)
+    int prot = PROT_READ;
+    if (conf::getFaasmConfig().guardMode == "noaccess") {
+        prot = PROT_NONE;
+
+        if (madvise(nativePtr, nBytes, MADV_DONTNEED) != 0) {
+            SPDLOG_ERROR("Failed to release memory guard: {}",
+                         std::strerror(errno));
+            throw std::runtime_error("Failed to create memory guard");
+        }
+    }
+
+    int res = mprotect(nativePtr, nBytes, prot);
+    if (res != 0) {
+        SPDLOG_ERROR("Failed to create memory guard: {}", std::strerror(errno));
+        throw std::runtime_error("Failed to create memory guard");
+    }
+}
+
+void WasmModule::applyGuardRegions()
+{
+    for (const auto& [offset, nBytes] : guardRegions) {
+        protectGuardRegion(offset, nBytes);
+    }
+
+    guardRegionsExposed = false;
+}
+
+void WasmModule::exposeGuardRegions()
+{
+    if (conf::getFaasmConfig().guardMode != "noaccess") {
+        return;
+    }
+
+    faabric::util::FullLock lock(moduleMemoryMutex);
+    if (guardRegionsExposed || guardRegions.empty()) {
+        return;
+    }
+
+    // Reading them maps the shared zero page, so they still take no memory
+    for (const auto& [offset, nBytes] : guardRegions) {
+        if (mprotect(getMemoryBase() + offset, nBytes, PROT_READ) != 0) {
+            SPDLOG_ERROR("Failed to expose memory guard: {}",
+                         std::strerror(errno));
+            throw std::runtime_error("Failed to expose memory guard");
+        }
+    }
+
+    guardRegionsExposed = true;
+}
+
+void WasmModule::removeGuardRegions(uint32_t offset, uint32_t nBytes)
+{
+    uint64_t end = (uint64_t)offset + nBytes;
+
+    auto it = guardRegions.begin();
+    while (it != guardRegions.end()) {
+        uint64_t regionEnd = (uint64_t)it->first + it->second;
+        if (it->first >= end || regionEnd <= offset) {
+            it++;
+            continue;
+        }
+
+        uint8_t* nativePtr = getMemoryBase() + it->first;
+        if (mprotect(nativePtr, it->second, PROT_READ | PROT_WRITE) != 0) {
+            SPDLOG_ERROR("Failed to remove memory guard: {}",
+                         std::strerror(errno));
+            throw std::runtime_error("Failed to remove memory guard");
+        }
+
+        it = guardRegions.erase(it);
+    }
+}
+
+void WasmModule::removeFileMappings(uint32_t offset, uint32_t nBytes)
+{
+    uint64_t end = (uint64_t)offset + nBytes;
+
+    auto it = fileMappings.begin();
+    while (it != fileMappings.end()) {
+        uint64_t regionEnd = (uint64_t)it->first + it->second;
+        if (it->first >= end || regionEnd <= offset) {
+            it++;
+            continue;
+        }
+
+        // Whatever's left of a partly covered mapping is still file-backed
+        uint32_t regionStart = it->first;
+        it = fileMappings.erase(it);
+
+        if (regionStart < offset) {
+            fileMappings[regionStart] = offset - regionStart;
+        }
+
+        if (regionEnd > end) {
+            fileMappings[(uint32_t)end] = regionEnd - end;
+        }
+    }
+}
+
 void WasmModule::createThreadStacks()
 {
 
@@ -407,7 +909,7 @@ void WasmModule::createThreadStacks()
     for (int i = 0; i < threadPoolSize; i++) {
         // Allocate thread and guard pages
         uint32_t memSize = THREAD_STACK_SIZE + (2 * GUARD_REGION_SIZE);
-        uint32_t memBase = growMemory(memSize);
+        uint32_t memBase = checkMemoryGrow(growMemory(memSize));
 
         // Note that wasm stacks grow downwards, so we have to store the stack
         // top, which is the offset one below the guard region above the stack
@@ -420,6 +922,38 @@ void WasmModule::createThreadStacks()
     }
 }
 
+uint32_t WasmModule::getThreadStack(int threadPoolIdx)
+{
+    faabric::util::UniqueLock lock(threadStacksMutex);
+
+    if (threadStacks.empty()) {
+        createThreadStacks();
+    }
+
+    return threadStacks.at(threadPoolIdx);
+}
+
+uint32_t WasmModule::getThreadStackTop(uint32_t stackPointer)
+{
+    faabric::util::UniqueLock lock(threadStacksMutex);
+    for (uint32_t stackTop : threadStacks) {
+        if (stackPointer <= stackTop &&
+            stackPointer > stackTop - THREAD_STACK_SIZE) {
+            return stackTop;
+        }
+    }
+
+    SPDLOG_ERROR("Stack pointer {} not in a thread stack", stackPointer);
+    throw std::runtime_error("Stack pointer not in a thread stack");
+}
+
+void WasmModule::clearThreadStacks()
+{
+    // The memory is left as is, new stacks are created when next needed
+    faabric::util::UniqueLock lock(threadStacksMutex);
+    threadStacks.clear();
+}
+
 threads::MutexManager& WasmModule::getMutexes()
 {
     return mutexes;
@@ -439,6 +973,11 @@ void WasmModule::reset(faabric::Message& msg)
     SPDLOG_WARN("Using default reset of wasm module");
 }
 
+void WasmModule::resetToSnapshotBase(faabric::Message& msg)
+{
+    reset(msg);
+}
+
 void WasmModule::doBindToFunction(faabric::Message& msg, bool cache)
 {
     throw std::runtime_error("doBindToFunction not implemented");
@@ -470,9 +1009,54 @@ uint32_t WasmModule::mmapMemory(uint32_t nBytes)
     throw std::runtime_error("mmapMemory not implemented");
 }
 
-uint32_t WasmModule::mmapFile(uint32_t fp, uint32_t length)
+uint32_t WasmModule::mmapFile(uint32_t fd,
+                              uint32_t length,
+                              int prot,
+                              int flags,
+                              uint64_t offset)
 {
-    throw std::runtime_error("mmapFile not implemented");
+    size_t hostPageSize = sysconf(_SC_PAGESIZE);
+    if (offset % hostPageSize != 0) {
+        SPDLOG_ERROR("Non-page aligned mmap offset {}", offset);
+        throw std::runtime_error("Non-page aligned mmap offset");
+    }
+
+    // Code is never executed from linear memory, and the mapping always goes
+    // into memory we've allocated
+    int mapProt = prot & (PROT_READ | PROT_WRITE);
+    int mapFlags = (flags & MAP_TYPE) == MAP_PRIVATE ? MAP_PRIVATE : MAP_SHARED;
+
+    // Create a new memory region
+    uint32_t wasmPtr = mmapMemory(length);
+    if (wasmPtr == MEMORY_GROW_FAILED) {
+        return MEMORY_GROW_FAILED;
+    }
+
+    uint8_t* targetPtr = getMemoryBase() + wasmPtr;
+
+    // Map the file over it
+    void* mmappedPtr =
+      mmap(targetPtr, length, mapProt, mapFlags | MAP_FIXED, fd, offset);
+    if (mmappedPtr == MAP_FAILED) {
+        SPDLOG_ERROR("Failed mmapping file descriptor {} at {} ({} - {})",
+                     fd,
+                     offset,
+                     errno,
+                     strerror(errno));
+        throw std::runtime_error("Unable to map file");
+    }
+
+    {
+        faabric::util::FullLock lock(moduleMemoryMutex);
+
+        // File-backed pages would look untouched to dirty page tracking
+        zygoteMemoryMapped = false;
+
+        // Tracked in whole wasm pages, as the memory is handed out in them
+        fileMappings[wasmPtr] = roundUpToWasmPageAligned(length);
+    }
+
+    return wasmPtr;
 }
 
 void WasmModule::unmapMemory(uint32_t offset, uint32_t nBytes)
@@ -480,6 +1064,207 @@ void WasmModule::unmapMemory(uint32_t offset, uint32_t nBytes)
     throw std::runtime_error("unmapMemory not implemented");
 }
 
+void WasmModule::adviseMemory(uint32_t offset, uint32_t nBytes, int advice)
+{
+    if (advice != MADV_DONTNEED && advice != MADV_FREE) {
+        return;
+    }
+
+    // Only whole wasm pages within the range can be given up
+    uint64_t start = roundUpToWasmPageAligned(offset);
+    uint64_t end = ((uint64_t)offset + nBytes) / WASM_BYTES_PER_PAGE *
+                   WASM_BYTES_PER_PAGE;
+
+    // Discarding changes the memory's mappings, so needs the full lock
+    faabric::util::FullLock lock(moduleMemoryMutex);
+    end = std::min<uint64_t>(end, getMemorySizeBytes());
+    if (start >= end) {
+        return;
+    }
+
+    // Guard regions are skipped. Pages mapped from a file go to the kernel's
+    // own madvise, as dropping them has to read back the file's contents
+    // (which MADV_FREE doesn't support).
+    std::map<uint32_t, std::pair<uint32_t, bool>> skipped;
+    for (const auto& [regionStart, regionBytes] : guardRegions) {
+        skipped[regionStart] = { regionBytes, false };
+    }
+    for (const auto& [regionStart, regionBytes] : fileMappings) {
+        skipped[regionStart] = { regionBytes, true };
+    }
+
+    uint64_t pos = start;
+    for (const auto& [regionStart, region] : skipped) {
+        uint64_t regionEnd = (uint64_t)regionStart + region.first;
+        if (regionEnd <= pos) {
+            continue;
+        }
+
+        if (regionStart >= end) {
+            break;
+        }
+
+        if (regionStart > pos) {
+            discardMemory(pos, regionStart - pos);
+        }
+
+        uint64_t overlapStart = std::max<uint64_t>(pos, regionStart);
+        uint64_t overlapEnd = std::min<uint64_t>(end, regionEnd);
+        bool isFile = region.second;
+        if (isFile && advice == MADV_DONTNEED) {
+            uint8_t* nativePtr = getMemoryBase() + overlapStart;
+            if (madvise(nativePtr, overlapEnd - overlapStart, advice) != 0) {
+                SPDLOG_ERROR("Failed to advise file mapping at {}: {}",
+                             overlapStart,
+                             std::strerror(errno));
+                throw std::runtime_error("Failed to advise memory");
+            }
+        }
+
+        pos = std::max<uint64_t>(pos, overlapEnd);
+    }
+
+    if (pos < end) {
+        discardMemory(pos, end - pos);
+    }
+}
+
+void WasmModule::discardMemory(uint32_t offset, uint32_t nBytes)
+{
+    uint8_t* nativePtr = getMemoryBase() + offset;
+    removeGuardRegions(offset, nBytes);
+    removeFileMappings(offset, nBytes);
+
+    if (!zygoteMemoryMapped) {
+        // The region may be backed by a snapshot or a mapped file, so is
+        // replaced with fresh zero pages
+        void* res = mmap(nativePtr,
+                         nBytes,
+                         PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+                         -1,
+                         0);
+        if (res == MAP_FAILED) {
+            SPDLOG_ERROR("Failed to discard memory at {} ({} bytes): {}",
+                         offset,
+                         nBytes,
+                         std::strerror(errno));
+            throw std::runtime_error("Failed to discard memory");
+        }
+
+        adviseHugePages(offset, nBytes);
+        return;
+    }
+
+    // Dropped pages of the zygote's file would go back to the zygote's
+    // contents, so these are zeroed instead, and stay tracked for reset
+    uint64_t end = (uint64_t)offset + nBytes;
+    uint64_t fileEnd = std::min<uint64_t>(end, zygoteMappedBytes);
+    if (offset < fileEnd) {
+        std::memset(nativePtr, 0, fileEnd - offset);
+    }
+
+    // Memory beyond it is anonymous, so dropped pages read back as zeroes
+    uint64_t anonStart = std::max<uint64_t>(offset, zygoteMappedBytes);
+    if (anonStart < end) {
+        uint8_t* anonPtr = getMemoryBase() + anonStart;
+        if (madvise(anonPtr, end - anonStart, MADV_DONTNEED) != 0) {
+            SPDLOG_ERROR("Failed to discard memory at {} ({} bytes): {}",
+                         anonStart,
+                         end - anonStart,
+                         std::strerror(errno));
+            throw std::runtime_error("Failed to discard memory");
+        }
+    }
+}
+
+bool WasmModule::adviseHugePages(uint32_t offset,
+                                 size_t nBytes,
+                                 bool sharedMemory)
+{
+    if (conf::getFaasmConfig().hugePages != "on" || nBytes == 0) {
+        return false;
+    }
+
+    // The kernel only uses huge pages for aligned 2 MiB ranges within the
+    // region, the rest stays on normal pages. The wasm page size is
+    // unaffected. Failing here (e.g. with THP disabled) isn't fatal.
+    uint8_t* nativePtr = getMemoryBase() + offset;
+    if (madvise(nativePtr, nBytes, MADV_HUGEPAGE) != 0) {
+        SPDLOG_WARN("Failed to advise huge pages for {}/{}: {}",
+                    boundUser,
+                    boundFunction,
+                    std::strerror(errno));
+        return false;
+    }
+
+    // The advice is accepted for shared memory mappings, but has no effect
+    // unless shmem THP is enabled
+    if (sharedMemory && !isShmemHugePagesEnabled()) {
+        SPDLOG_DEBUG("No huge pages for shared memory of {}/{} as shmem THP "
+                     "is disabled (see shmem_enabled)",
+                     boundUser,
+                     boundFunction);
+        return false;
+    }
+
+    return true;
+}
+
+bool WasmModule::chargeMemoryQuota(size_t newBytes)
+{
+    if (newBytes <= quotaBytes) {
+        return true;
+    }
+
+    size_t nBytes = newBytes - quotaBytes;
+    MemoryQuota& quota = getMemoryQuota();
+    MemoryQuotaResult result = quota.charge(boundUser, boundFunction, nBytes);
+
+    if (result == QUOTA_HARD_LIMIT) {
+        SPDLOG_ERROR("Growing memory of {}/{} to {} exceeds its memory limit",
+                     boundUser,
+                     boundFunction,
+                     newBytes);
+        return false;
+    }
+
+    quotaBytes = newBytes;
+
+    if (result == QUOTA_SOFT_LIMIT) {
+        quota.reclaim(boundUser, boundFunction);
+    }
+
+    return true;
+}
+
+void WasmModule::syncMemoryQuota()
+{
+    size_t memBytes = getMemorySizeBytes();
+    MemoryQuota& quota = getMemoryQuota();
+
+    // Memory the module already has is charged even over the limit
+    if (memBytes > quotaBytes) {
+        quota.charge(boundUser, boundFunction, memBytes - quotaBytes, false);
+    } else if (memBytes < quotaBytes) {
+        quota.release(boundUser, boundFunction, quotaBytes - memBytes);
+    }
+
+    quotaBytes = memBytes;
+}
+
+bool WasmModule::claimFreeMemory(uint32_t nBytes, uint32_t& offset)
+{
+    // Free memory has already been discarded, so is zeroed
+    return freeList.allocate(nBytes, offset);
+}
+
+void WasmModule::releaseFreeMemory(uint32_t offset, uint32_t nBytes)
+{
+    discardMemory(offset, nBytes);
+    freeList.free(offset, nBytes);
+}
+
 uint8_t* WasmModule::wasmPointerToNative(int32_t wasmPtr)
 {
     throw std::runtime_error("wasmPointerToNative not implemented");
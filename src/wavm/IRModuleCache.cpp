@@ -1,17 +1,72 @@
 #include <faabric/util/locks.h>
 #include <faabric/util/logging.h>
+#include <faabric/util/timing.h>
 
 #include <WAVM/IR/Module.h>
 #include <WAVM/IR/Types.h>
 #include <WAVM/WASM/WASM.h>
 #include <WAVM/WASTParse/WASTParse.h>
 
+#include <conf/FaasmConfig.h>
 #include <faabric/util/files.h>
 #include <faabric/util/func.h>
 #include <storage/FileLoader.h>
 #include <wavm/IRModuleCache.h>
+#include <wavm/ObjectCache.h>
+#include <wavm/WAVMWasmModule.h>
 
 namespace wasm {
+
+// ------------------------------------
+// LRU tracking
+// ------------------------------------
+
+void CacheKeyLRU::touch(const std::string& key)
+{
+    faabric::util::UniqueLock lock(mx);
+
+    auto it = positions.find(key);
+    if (it != positions.end()) {
+        keys.splice(keys.end(), keys, it->second);
+    } else {
+        positions[key] = keys.insert(keys.end(), key);
+    }
+}
+
+void CacheKeyLRU::remove(const std::string& key)
+{
+    faabric::util::UniqueLock lock(mx);
+
+    auto it = positions.find(key);
+    if (it != positions.end()) {
+        keys.erase(it->second);
+        positions.erase(it);
+    }
+}
+
+std::vector<std::string> CacheKeyLRU::getKeysOldestFirst()
+{
+    faabric::util::UniqueLock lock(mx);
+    return std::vector<std::string>(keys.begin(), keys.end());
+}
+
+void CacheKeyLRU::clear()
+{
+    faabric::util::UniqueLock lock(mx);
+    keys.clear();
+    positions.clear();
+}
+
+size_t getModuleCacheMaxBytes()
+{
+    conf::FaasmConfig& conf = conf::getFaasmConfig();
+    return ((size_t)conf.moduleCacheMaxMb) * ONE_MB_BYTES;
+}
+
+// ------------------------------------
+// IR module cache
+// ------------------------------------
+
 IRModuleCache::IRModuleCache()
   : conf(faabric::util::getSystemConfig())
 {}
@@ -22,13 +77,80 @@ IRModuleCache& getIRModuleCache()
     return r;
 }
 
-IR::Module& IRModuleCache::getModuleFromMap(const std::string& key)
+std::shared_ptr<IR::Module> IRModuleCache::findModule(const std::string& key)
 {
-    // Here we switch on module features that must always be used.
-    // TODO avoid doing this every time and set on construction
-    IR::Module& module = moduleMap[key];
-    module.featureSpec.simd = true;
-    return module;
+    faabric::util::SharedLock lock(mx);
+
+    auto it = moduleMap.find(key);
+    if (it == moduleMap.end()) {
+        return nullptr;
+    }
+
+    lru.touch(key);
+    return it->second;
+}
+
+Runtime::ModuleRef IRModuleCache::findCompiledModule(const std::string& key)
+{
+    faabric::util::SharedLock lock(mx);
+
+    auto it = compiledModuleMap.find(key);
+    if (it == compiledModuleMap.end()) {
+        return nullptr;
+    }
+
+    lru.touch(key);
+    return it->second;
+}
+
+void IRModuleCache::insertModule(const std::string& key,
+                                 std::shared_ptr<IR::Module> module,
+                                 const std::vector<uint8_t>& wasmBytes)
+{
+    // We account for the IR using the size of the wasm it was loaded from
+    size_t nBytes = wasmBytes.size();
+    std::vector<uint8_t> wasmHash = storage::FileLoader::hashBytes(wasmBytes);
+
+    {
+        faabric::util::FullLock lock(mx);
+        moduleMap[key] = std::move(module);
+        wasmHashes[key] = std::move(wasmHash);
+        totalBytes -= moduleBytes[key];
+        totalBytes += nBytes;
+        moduleBytes[key] = nBytes;
+        lru.touch(key);
+    }
+
+    evictToBudget(key);
+}
+
+void IRModuleCache::insertCompiledModule(const std::string& key,
+                                         Runtime::ModuleRef module,
+                                         size_t nBytes)
+{
+    {
+        faabric::util::FullLock lock(mx);
+        compiledModuleMap[key] = std::move(module);
+        totalBytes -= compiledModuleBytes[key];
+        totalBytes += nBytes;
+        compiledModuleBytes[key] = nBytes;
+        lru.touch(key);
+    }
+
+    evictToBudget(key);
+}
+
+std::shared_ptr<std::mutex> IRModuleCache::getKeyMutex(
+  std::unordered_map<std::string, std::shared_ptr<std::mutex>>& mutexMap,
+  const std::string& key)
+{
+    faabric::util::FullLock lock(mx);
+    std::shared_ptr<std::mutex>& keyMx = mutexMap[key];
+    if (keyMx == nullptr) {
+        keyMx = std::make_shared<std::mutex>();
+    }
+
+    return keyMx;
 }
 
 std::string getModuleKey(const std::string& user,
@@ -51,9 +173,9 @@ int IRModuleCache::getCompiledModuleCount(const std::string& key)
     return compiledModuleMap.count(key);
 }
 
-IR::Module& IRModuleCache::getModule(const std::string& user,
-                                     const std::string& func,
-                                     const std::string& path)
+std::shared_ptr<IR::Module> IRModuleCache::getModule(const std::string& user,
+                                                     const std::string& func,
+                                                     const std::string& path)
 {
     /*
      * Note that shared modules are currently only shared in memory across
@@ -90,16 +212,19 @@ U64 IRModuleCache::getSharedModuleTableSize(const std::string& user,
                                             const std::string& path)
 {
     const std::string key = getModuleKey(user, func, path);
-    return originalTableSizes[key];
+
+    faabric::util::SharedLock lock(mx);
+    return originalTableSizes.at(key);
 }
 
 size_t IRModuleCache::getSharedModuleDataSize(const std::string& user,
                                               const std::string& func,
                                               const std::string& path)
 {
-    IR::Module& irModule = IRModuleCache::getModule(user, func, path);
+    std::shared_ptr<IR::Module> irModule =
+      IRModuleCache::getModule(user, func, path);
     size_t dataSize = 0;
-    for (auto ds : irModule.dataSegments) {
+    for (auto ds : irModule->dataSegments) {
         dataSize += ds.data->size();
     }
 
@@ -109,31 +234,45 @@ size_t IRModuleCache::getSharedModuleDataSize(const std::string& user,
 Runtime::ModuleRef IRModuleCache::getCompiledMainModule(const std::string& user,
                                                         const std::string& func)
 {
-
     const std::string key = getModuleKey(user, func, "");
 
-    if (getCompiledModuleCount(key) == 0) {
-        faabric::util::FullLock registryLock(mx);
-        if (compiledModuleMap.count(key) == 0) {
-            IR::Module& module = getModuleFromMap(key);
-
-            storage::FileLoader& functionLoader = storage::getFileLoader();
-            faabric::Message msg = faabric::util::messageFactory(user, func);
-            std::vector<uint8_t> objectFileBytes =
-              functionLoader.loadFunctionObjectFile(msg);
-
-            if (!objectFileBytes.empty()) {
-                compiledModuleMap[key] =
-                  Runtime::loadPrecompiledModule(module, objectFileBytes);
-            } else {
-                compiledModuleMap[key] = Runtime::compileModule(module);
-            }
-        }
-    } else {
+    Runtime::ModuleRef compiledModule = findCompiledModule(key);
+    if (compiledModule != nullptr) {
         SPDLOG_DEBUG("Using cached compiled main module {}/{}", user, func);
+        hits++;
+        return compiledModule;
+    }
+
+    // Make sure the IR module is loaded before taking the key lock
+    std::shared_ptr<IR::Module> module = getMainModule(user, func);
+
+    std::shared_ptr<std::mutex> keyMx = getKeyMutex(compiledModuleMutexes, key);
+    faabric::util::UniqueLock keyLock(*keyMx);
+
+    // Another thread may have loaded the module while we were waiting
+    compiledModule = findCompiledModule(key);
+    if (compiledModule != nullptr) {
+        hits++;
+        return compiledModule;
     }
 
-    return compiledModuleMap[key];
+    misses++;
+    SPDLOG_DEBUG("Loading compiled main module {}/{}", user, func);
+
+    storage::FileLoader& functionLoader = storage::getFileLoader();
+    faabric::Message msg = faabric::util::messageFactory(user, func);
+
+    size_t objectBytes;
+    compiledModule = loadCompiledModule(
+      key,
+      *module,
+      [&] { return functionLoader.loadFunctionObjectFile(msg); },
+      [&] { return functionLoader.loadFunctionObjectHash(msg); },
+      objectBytes);
+
+    insertCompiledModule(key, compiledModule, objectBytes);
+
+    return compiledModule;
 }
 
 Runtime::ModuleRef IRModuleCache::getCompiledSharedModule(
@@ -143,143 +282,228 @@ Runtime::ModuleRef IRModuleCache::getCompiledSharedModule(
 {
     std::string key = getModuleKey(user, func, path);
 
-    if (getCompiledModuleCount(key) == 0) {
-        faabric::util::FullLock registryLock(mx);
-        if (compiledModuleMap.count(key) == 0) {
-            SPDLOG_DEBUG(
-              "Loading compiled shared module {}/{} - {}", user, func, path);
-
-            IR::Module& module = getModuleFromMap(key);
-
-            storage::FileLoader& functionLoader = storage::getFileLoader();
-            std::vector<uint8_t> objectBytes =
-              functionLoader.loadSharedObjectObjectFile(path);
-            compiledModuleMap[key] =
-              Runtime::loadPrecompiledModule(module, objectBytes);
-        }
-    } else {
+    Runtime::ModuleRef compiledModule = findCompiledModule(key);
+    if (compiledModule != nullptr) {
         SPDLOG_DEBUG(
           "Using cached shared compiled module {}/{} - {}", user, func, path);
+        hits++;
+        return compiledModule;
+    }
+
+    std::shared_ptr<IR::Module> module = getSharedModule(user, func, path);
+
+    std::shared_ptr<std::mutex> keyMx = getKeyMutex(compiledModuleMutexes, key);
+    faabric::util::UniqueLock keyLock(*keyMx);
+
+    compiledModule = findCompiledModule(key);
+    if (compiledModule != nullptr) {
+        hits++;
+        return compiledModule;
     }
 
+    misses++;
+    SPDLOG_DEBUG("Loading compiled shared module {}/{} - {}", user, func, path);
+
+    storage::FileLoader& functionLoader = storage::getFileLoader();
+
+    size_t objectBytes;
+    compiledModule = loadCompiledModule(
+      key,
+      *module,
+      [&] { return functionLoader.loadSharedObjectObjectFile(path); },
+      [&] { return functionLoader.loadSharedObjectObjectHash(path); },
+      objectBytes);
+
+    insertCompiledModule(key, compiledModule, objectBytes);
+
+    return compiledModule;
+}
+
+Runtime::ModuleRef IRModuleCache::loadCompiledModule(
+  const std::string& key,
+  IR::Module& module,
+  const std::function<std::vector<uint8_t>()>& loadObjectFile,
+  const std::function<std::vector<uint8_t>()>& loadObjectHash,
+  size_t& objectBytes)
+{
+    std::vector<uint8_t> wasmHash;
     {
         faabric::util::SharedLock lock(mx);
-        return compiledModuleMap[key];
+        wasmHash = wasmHashes.at(key);
+    }
+
+    // Try the local object cache first, which is specific to this build
+    WAVMObjectCache& objectCache = getWAVMObjectCache();
+    std::string cacheKey = objectCache.getKey(wasmHash, module);
+    std::vector<uint8_t> objBytes = objectCache.load(cacheKey);
+
+    // Then the object file from codegen, as long as it was generated from
+    // the same wasm
+    if (objBytes.empty()) {
+        std::vector<uint8_t> objectHash = loadObjectHash();
+        if (objectHash == wasmHash) {
+            objBytes = loadObjectFile();
+        } else if (objectHash.empty()) {
+            SPDLOG_DEBUG("No object file hash for {}", key);
+        } else {
+            SPDLOG_WARN("Object file for {} is stale, ignoring", key);
+        }
+    }
+
+    Runtime::ModuleRef compiledModule;
+    if (!objBytes.empty()) {
+        compiledModule = Runtime::loadPrecompiledModule(module, objBytes);
+    } else {
+        SPDLOG_DEBUG("Compiling {} ({})", key, cacheKey);
+
+        PROF_START(jitCompile)
+        compiledModule = Runtime::compileModule(module);
+        objBytes = Runtime::getObjectCode(compiledModule);
+        PROF_END(jitCompile)
+
+        objectCache.store(cacheKey, objBytes);
     }
+
+    objectBytes = objBytes.size();
+    return compiledModule;
 }
 
-IR::Module& IRModuleCache::getMainModule(const std::string& user,
-                                         const std::string& func)
+std::shared_ptr<IR::Module> IRModuleCache::getMainModule(
+  const std::string& user,
+  const std::string& func)
 {
-
     const std::string key = getModuleKey(user, func, "");
 
-    // Check if initialised
-    if (getModuleCount(key) == 0) {
-        faabric::util::FullLock registryLock(mx);
-        if (moduleMap.count(key) == 0) {
-            SPDLOG_DEBUG("Loading main module {}/{}", user, func);
-
-            storage::FileLoader& functionLoader = storage::getFileLoader();
-
-            faabric::Message msg = faabric::util::messageFactory(user, func);
-            std::vector<uint8_t> wasmBytes =
-              functionLoader.loadFunctionWasm(msg);
-
-            IR::Module& module = getModuleFromMap(key);
-
-            if (faabric::util::isWasm(wasmBytes)) {
-                WASM::LoadError loadError;
-                WASM::loadBinaryModule(
-                  wasmBytes.data(), wasmBytes.size(), module, &loadError);
-            } else {
-                std::vector<WAST::Error> parseErrors;
-                WAST::parseModule((const char*)wasmBytes.data(),
-                                  wasmBytes.size(),
-                                  module,
-                                  parseErrors);
-                WAST::reportParseErrors(
-                  "wast_file", (const char*)wasmBytes.data(), parseErrors);
-            }
-
-            // Force maximum size
-            module.memories.defs[0].type.size.max = (U64)MAX_MEMORY_PAGES;
-
-            // Typescript modules don't seem to define a table
-            if (!module.tables.defs.empty()) {
-                module.tables.defs[0].type.size.max = (U64)MAX_TABLE_SIZE;
-            }
-        }
-    } else {
+    std::shared_ptr<IR::Module> module = findModule(key);
+    if (module != nullptr) {
         SPDLOG_DEBUG("Using cached main module {}/{}", user, func);
+        hits++;
+        return module;
     }
 
-    {
-        faabric::util::SharedLock lock(mx);
-        return getModuleFromMap(key);
+    std::shared_ptr<std::mutex> keyMx = getKeyMutex(moduleMutexes, key);
+    faabric::util::UniqueLock keyLock(*keyMx);
+
+    // Another thread may have loaded the module while we were waiting
+    module = findModule(key);
+    if (module != nullptr) {
+        hits++;
+        return module;
+    }
+
+    misses++;
+    SPDLOG_DEBUG("Loading main module {}/{}", user, func);
+    notifyLoad(key);
+
+    storage::FileLoader& functionLoader = storage::getFileLoader();
+
+    faabric::Message msg = faabric::util::messageFactory(user, func);
+    std::vector<uint8_t> wasmBytes = functionLoader.loadFunctionWasm(msg);
+
+    // Here we switch on module features that must always be used
+    module = std::make_shared<IR::Module>();
+    module->featureSpec.simd = true;
+
+    if (faabric::util::isWasm(wasmBytes)) {
+        WASM::LoadError loadError;
+        WASM::loadBinaryModule(
+          wasmBytes.data(), wasmBytes.size(), *module, &loadError);
+    } else {
+        std::vector<WAST::Error> parseErrors;
+        WAST::parseModule((const char*)wasmBytes.data(),
+                          wasmBytes.size(),
+                          *module,
+                          parseErrors);
+        WAST::reportParseErrors(
+          "wast_file", (const char*)wasmBytes.data(), parseErrors);
     }
+
+    // Force maximum size
+    module->memories.defs[0].type.size.max = (U64)MAX_MEMORY_PAGES;
+
+    // Typescript modules don't seem to define a table
+    if (!module->tables.defs.empty()) {
+        module->tables.defs[0].type.size.max = (U64)MAX_TABLE_SIZE;
+    }
+
+    // Only publish the module once it's fully loaded
+    insertModule(key, module, wasmBytes);
+
+    return module;
 }
 
-IR::Module& IRModuleCache::getSharedModule(const std::string& user,
-                                           const std::string& func,
-                                           const std::string& path)
+std::shared_ptr<IR::Module> IRModuleCache::getSharedModule(
+  const std::string& user,
+  const std::string& func,
+  const std::string& path)
 {
     std::string key = getModuleKey(user, func, path);
 
-    // Check if initialised
-    if (getModuleCount(key) == 0) {
-        faabric::util::FullLock lock(mx);
-        if (moduleMap.count(key) == 0) {
-            SPDLOG_DEBUG("Loading shared module {}/{} - {}", user, func, path);
-
-            storage::FileLoader& functionLoader = storage::getFileLoader();
-
-            std::vector<uint8_t> wasmBytes =
-              functionLoader.loadSharedObjectWasm(path);
-
-            IR::Module& module = getModuleFromMap(key);
-
-            WASM::LoadError loadError;
-            WASM::loadBinaryModule(
-              wasmBytes.data(), wasmBytes.size(), module, &loadError);
-
-            // Check that the module isn't expecting to create any memories or
-            // tables
-            if (!module.tables.defs.empty()) {
-                throw std::runtime_error(
-                  "Dynamic module trying to define tables");
-            }
-
-            if (!module.memories.defs.empty()) {
-                throw std::runtime_error(
-                  "Dynamic module trying to define memories");
-            }
-
-            // TODO - better way to handle this? Modify WAVM?  To keep WAVM
-            // happy, we have to force the incoming dynamic module to accept
-            // the table from the main module. This modifies the shared
-            // reference, therefore we also have to preserve the original
-            // size and make available to callers.
-            this->originalTableSizes[key] =
-              module.tables.imports[0].type.size.min;
-
-            const std::string mainKey = getModuleKey(user, func, "");
-            IR::Module& mainModule = getModuleFromMap(mainKey);
-
-            module.tables.imports[0].type.size.min =
-              (U64)mainModule.tables.defs[0].type.size.min;
-            module.tables.imports[0].type.size.max =
-              (U64)mainModule.tables.defs[0].type.size.max;
-        }
-    } else {
+    std::shared_ptr<IR::Module> module = findModule(key);
+    if (module != nullptr) {
         SPDLOG_DEBUG(
           "Loading cached shared module {}/{} - {}", user, func, path);
+        hits++;
+        return module;
+    }
+
+    // The shared module's table is sized to fit the main module's
+    std::shared_ptr<IR::Module> mainModule = getMainModule(user, func);
+
+    std::shared_ptr<std::mutex> keyMx = getKeyMutex(moduleMutexes, key);
+    faabric::util::UniqueLock keyLock(*keyMx);
+
+    module = findModule(key);
+    if (module != nullptr) {
+        hits++;
+        return module;
+    }
+
+    misses++;
+    SPDLOG_DEBUG("Loading shared module {}/{} - {}", user, func, path);
+    notifyLoad(key);
+
+    storage::FileLoader& functionLoader = storage::getFileLoader();
+
+    std::vector<uint8_t> wasmBytes = functionLoader.loadSharedObjectWasm(path);
+
+    module = std::make_shared<IR::Module>();
+    module->featureSpec.simd = true;
+
+    WASM::LoadError loadError;
+    WASM::loadBinaryModule(
+      wasmBytes.data(), wasmBytes.size(), *module, &loadError);
+
+    // Check that the module isn't expecting to create any memories or
+    // tables
+    if (!module->tables.defs.empty()) {
+        throw std::runtime_error("Dynamic module trying to define tables");
+    }
+
+    if (!module->memories.defs.empty()) {
+        throw std::runtime_error("Dynamic module trying to define memories");
     }
 
+    // TODO - better way to handle this? Modify WAVM?  To keep WAVM
+    // happy, we have to force the incoming dynamic module to accept
+    // the table from the main module. This modifies the shared
+    // reference, therefore we also have to preserve the original
+    // size and make available to callers.
+    int originalTableSize = module->tables.imports[0].type.size.min;
+
+    module->tables.imports[0].type.size.min =
+      (U64)mainModule->tables.defs[0].type.size.min;
+    module->tables.imports[0].type.size.max =
+      (U64)mainModule->tables.defs[0].type.size.max;
+
     {
-        faabric::util::SharedLock lock(mx);
-        return getModuleFromMap(key);
+        faabric::util::FullLock lock(mx);
+        originalTableSizes[key] = originalTableSize;
     }
+
+    insertModule(key, module, wasmBytes);
+
+    return module;
 }
 
 bool IRModuleCache::isModuleCached(const std::string& user,
@@ -298,6 +522,149 @@ bool IRModuleCache::isCompiledModuleCached(const std::string& user,
     return getCompiledModuleCount(key) > 0;
 }
 
+bool IRModuleCache::isObjectCodeAvailable(const std::string& user,
+                                          const std::string& func)
+{
+    if (isCompiledModuleCached(user, func, "")) {
+        return true;
+    }
+
+    // Holding the module stops it being evicted while we check
+    std::shared_ptr<IR::Module> module = getMainModule(user, func);
+    const std::string key = getModuleKey(user, func, "");
+
+    std::vector<uint8_t> wasmHash;
+    {
+        faabric::util::SharedLock lock(mx);
+        wasmHash = wasmHashes.at(key);
+    }
+
+    WAVMObjectCache& objectCache = getWAVMObjectCache();
+    if (objectCache.exists(objectCache.getKey(wasmHash, *module))) {
+        return true;
+    }
+
+    storage::FileLoader& functionLoader = storage::getFileLoader();
+    faabric::Message msg = faabric::util::messageFactory(user, func);
+    return functionLoader.loadFunctionObjectHash(msg) == wasmHash;
+}
+
+bool IRModuleCache::isKeyEvictable(const std::string& key)
+{
+    // Must be called with the cache-wide lock held. Anything referenced
+    // outside the cache (e.g. a compiled module used by a live instance) is
+    // still in use.
+    auto moduleIt = moduleMap.find(key);
+    if (moduleIt != moduleMap.end() && moduleIt->second.use_count() > 1) {
+        return false;
+    }
+
+    auto compiledIt = compiledModuleMap.find(key);
+    if (compiledIt != compiledModuleMap.end() &&
+        compiledIt->second.use_count() > 1) {
+        return false;
+    }
+
+    // Check nothing is being loaded for this key
+    for (auto* mutexMap : { &moduleMutexes, &compiledModuleMutexes }) {
+        auto mxIt = mutexMap->find(key);
+        if (mxIt == mutexMap->end()) {
+            continue;
+        }
+
+        if (!mxIt->second->try_lock()) {
+            return false;
+        }
+        mxIt->second->unlock();
+    }
+
+    return true;
+}
+
+void IRModuleCache::evictToBudget(const std::string& keepKey)
+{
+    size_t maxBytes = getModuleCacheMaxBytes();
+    if (maxBytes == 0) {
+        return;
+    }
+
+    WAVMModuleCache& zygoteCache = getWAVMModuleCache();
+    if (totalBytes + zygoteCache.getTotalBytes() <= maxBytes) {
+        return;
+    }
+
+    faabric::util::FullLock lock(mx);
+
+    for (const auto& key : lru.getKeysOldestFirst()) {
+        if (totalBytes + zygoteCache.getTotalBytes() <= maxBytes) {
+            break;
+        }
+
+        if (key == keepKey || !isKeyEvictable(key)) {
+            continue;
+        }
+
+        size_t freedBytes = moduleBytes[key] + compiledModuleBytes[key];
+        SPDLOG_DEBUG("Evicting IR module {} ({} bytes)", key, freedBytes);
+
+        moduleMap.erase(key);
+        compiledModuleMap.erase(key);
+        originalTableSizes.erase(key);
+        wasmHashes.erase(key);
+        moduleBytes.erase(key);
+        compiledModuleBytes.erase(key);
+        lru.remove(key);
+
+        totalBytes -= freedBytes;
+        evictions++;
+    }
+
+    if (totalBytes + zygoteCache.getTotalBytes() > maxBytes) {
+        SPDLOG_DEBUG("IR cache over budget with nothing evictable ({} > {})",
+                     totalBytes + zygoteCache.getTotalBytes(),
+                     maxBytes);
+    }
+}
+
+size_t IRModuleCache::getTotalBytes()
+{
+    return totalBytes.load(std::memory_order_acquire);
+}
+
+ModuleCacheStats IRModuleCache::getStats()
+{
+    faabric::util::SharedLock lock(mx);
+
+    ModuleCacheStats stats;
+    stats.hits = hits;
+    stats.misses = misses;
+    stats.evictions = evictions;
+    stats.entries = moduleMap.size() + compiledModuleMap.size();
+    stats.bytes = totalBytes;
+
+    return stats;
+}
+
+void IRModuleCache::setLoadCallback(
+  std::function<void(const std::string&)> callback)
+{
+    faabric::util::FullLock lock(mx);
+    loadCallback = std::move(callback);
+}
+
+void IRModuleCache::notifyLoad(const std::string& key)
+{
+    std::function<void(const std::string&)> callback;
+    {
+        faabric::util::SharedLock lock(mx);
+        callback = loadCallback;
+    }
+
+    if (callback) {
+        callback(key);
+    }
+}
+
 void IRModuleCache::clear()
 {
     faabric::util::FullLock lock(mx);
@@ -307,5 +674,18 @@ void IRModuleCache::clear()
     moduleMap.clear();
     compiledModuleMap.clear();
     originalTableSizes.clear();
+    wasmHashes.clear();
+
+    moduleMutexes.clear();
+    compiledModuleMutexes.clear();
+
+    moduleBytes.clear();
+    compiledModuleBytes.clear();
+    totalBytes = 0;
+    lru.clear();
+
+    hits = 0;
+    misses = 0;
+    evictions = 0;
 }
 }
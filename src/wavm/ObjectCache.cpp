@@ -0,0 +1,148 @@
+#include <wavm/ObjectCache.h>
+
+#include <conf/FaasmConfig.h>
+#include <storage/FileLoader.h>
+
+#include <faabric/util/files.h>
+#include <faabric/util/gids.h>
+#include <faabric/util/logging.h>
+
+#include <boost/filesystem.hpp>
+#include <llvm/Config/llvm-config.h>
+
+#ifndef FAASM_WAVM_BUILD_ID
+#define FAASM_WAVM_BUILD_ID "unknown"
+#endif
+
+using namespace WAVM;
+
+namespace wasm {
+
+std::string getWAVMBuildId()
+{
+    return std::string(FAASM_WAVM_BUILD_ID) + "-llvm" + LLVM_VERSION_STRING;
+}
+
+static std::string toHex(const std::vector<uint8_t>& bytes)
+{
+    std::string result;
+    for (uint8_t b : bytes) {
+        result += fmt::format("{:02x}", b);
+    }
+
+    return result;
+}
+
+WAVMObjectCache& getWAVMObjectCache()
+{
+    static WAVMObjectCache cache;
+    return cache;
+}
+
+std::string WAVMObjectCache::getCacheDir()
+{
+    conf::FaasmConfig& conf = conf::getFaasmConfig();
+    return conf.objectFileDir + "/cache";
+}
+
+std::string WAVMObjectCache::getObjectPath(const std::string& key)
+{
+    return getCacheDir() + "/" + key + OBJECT_CACHE_EXT;
+}
+
+std::string WAVMObjectCache::getKey(const std::vector<uint8_t>& wasmHash,
+                                    const IR::Module& module)
+{
+    // Anything that changes the generated code must go into the key
+    const IR::FeatureSpec& features = module.featureSpec;
+    std::string buildInfo = fmt::format("{}|simd={},atomics={},bulk={},refs={}",
+                                        getWAVMBuildId(),
+                                        features.simd,
+                                        features.atomics,
+                                        features.bulkMemoryOperations,
+                                        features.referenceTypes);
+
+    for (const auto& m : module.memories.defs) {
+        buildInfo += fmt::format("|mem={}", m.type.size.max);
+    }
+
+    for (const auto& t : module.tables.defs) {
+        buildInfo += fmt::format("|table={}", t.type.size.max);
+    }
+
+    for (const auto& t : module.tables.imports) {
+        buildInfo += fmt::format(
+          "|tableImport={}-{}", t.type.size.min, t.type.size.max);
+    }
+
+    std::vector<uint8_t> buildInfoBytes(buildInfo.begin(), buildInfo.end());
+    std::vector<uint8_t> buildInfoHash =
+      storage::FileLoader::hashBytes(buildInfoBytes);
+
+    return toHex(wasmHash) + "_" + toHex(buildInfoHash);
+}
+
+std::vector<uint8_t> WAVMObjectCache::load(const std::string& key)
+{
+    std::string objectPath = getObjectPath(key);
+    std::string hashPath = objectPath + HASH_EXT;
+
+    if (!boost::filesystem::exists(objectPath) ||
+        !boost::filesystem::exists(hashPath)) {
+        return {};
+    }
+
+    std::vector<uint8_t> objBytes = faabric::util::readFileToBytes(objectPath);
+    std::vector<uint8_t> hash = faabric::util::readFileToBytes(hashPath);
+
+    if (objBytes.empty() || storage::FileLoader::hashBytes(objBytes) != hash) {
+        SPDLOG_WARN("Discarding invalid cached object {}", objectPath);
+        boost::filesystem::remove(objectPath);
+        boost::filesystem::remove(hashPath);
+        return {};
+    }
+
+    SPDLOG_DEBUG("Loaded cached object {}", objectPath);
+    return objBytes;
+}
+
+bool WAVMObjectCache::exists(const std::string& key)
+{
+    std::string objectPath = getObjectPath(key);
+    return boost::filesystem::exists(objectPath) &&
+           boost::filesystem::exists(objectPath + HASH_EXT);
+}
+
+void WAVMObjectCache::store(const std::string& key,
+                            const std::vector<uint8_t>& objBytes)
+{
+    std::string objectPath = getObjectPath(key);
+    std::string hashPath = objectPath + HASH_EXT;
+
+    try {
+        boost::filesystem::create_directories(getCacheDir());
+
+        // Write to temporary files then rename, so that other processes
+        // sharing the cache never see a partial object
+        std::string suffix =
+          ".tmp" + std::to_string(faabric::util::generateGid());
+        faabric::util::writeBytesToFile(objectPath + suffix, objBytes);
+        faabric::util::writeBytesToFile(
+          hashPath + suffix, storage::FileLoader::hashBytes(objBytes));
+
+        boost::filesystem::rename(hashPath + suffix, hashPath);
+        boost::filesystem::rename(objectPath + suffix, objectPath);
+    } catch (std::exception& e) {
+        // Failing to populate the cache only costs a recompile later
+        SPDLOG_WARN("Failed to cache object {}: {}", objectPath, e.what());
+        return;
+    }
+
+    SPDLOG_DEBUG("Cached object {}", objectPath);
+}
+
+void WAVMObjectCache::clear()
+{
+    boost::filesystem::remove_all(getCacheDir());
+}
+}
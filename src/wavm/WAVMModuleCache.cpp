@@ -16,46 +16,153 @@ WAVMModuleCache& getWAVMModuleCache()
 
 size_t WAVMModuleCache::getTotalCachedModuleCount()
 {
+    faabric::util::SharedLock lock(mx);
     return cachedModuleMap.size();
 }
 
-int WAVMModuleCache::getCachedModuleCount(const std::string& key)
+size_t WAVMModuleCache::getTotalBytes()
 {
-    faabric::util::SharedLock lock(mx);
-    int count = cachedModuleMap.count(key);
-    return count;
+    return totalBytes.load(std::memory_order_acquire);
 }
 
-wasm::WAVMWasmModule& WAVMModuleCache::getCachedModule(faabric::Message& msg)
+std::shared_ptr<wasm::WAVMWasmModule> WAVMModuleCache::getCachedModule(
+  faabric::Message& msg)
 {
     std::string key = faabric::util::funcToString(msg, false);
 
+    {
+        faabric::util::SharedLock lock(mx);
+        auto it = cachedModuleMap.find(key);
+        if (it != cachedModuleMap.end()) {
+            hits++;
+            lru.touch(key);
+            return it->second;
+        }
+    }
+
     // If there's no cached module, we need to create it
-    if (cachedModuleMap.find(key) == cachedModuleMap.end()) {
+    std::shared_ptr<wasm::WAVMWasmModule> module;
+    bool evicted = false;
+    {
         faabric::util::FullLock lock(mx);
 
         // Re-check condition
-        if (cachedModuleMap.find(key) == cachedModuleMap.end()) {
+        auto it = cachedModuleMap.find(key);
+        if (it != cachedModuleMap.end()) {
+            hits++;
+            lru.touch(key);
+            return it->second;
+        }
 
-            SPDLOG_DEBUG(
-              "WAVM module cache initialising {} (tid {})", key, gettid());
+        misses++;
+        SPDLOG_DEBUG(
+          "WAVM module cache initialising {} (tid {})", key, gettid());
 
-            // Instantiate the base module
-            wasm::WAVMWasmModule& module = cachedModuleMap[key];
-            module.bindToFunction(msg, false);
-        }
+        // Instantiate the base module
+        module = std::make_shared<wasm::WAVMWasmModule>();
+        module->bindToFunction(msg, false);
+
+        // The bulk of a zygote's footprint is its linear memory
+        size_t moduleBytes = module->getMemorySizeBytes();
+
+        cachedModuleMap[key] = module;
+        cachedModuleBytes[key] = moduleBytes;
+        totalBytes += moduleBytes;
+        lru.touch(key);
+
+        evicted = evictToBudget(key);
     }
 
-    {
-        // Note that we need a shared lock here to avoid a race condition on
-        // initialising the module
-        faabric::util::SharedLock lock(mx);
-        return cachedModuleMap[key];
+    // Evicted zygotes held on to their compiled modules, which the IR cache
+    // couldn't evict until now
+    if (evicted) {
+        getIRModuleCache().evictToBudget("");
+    }
+
+    return module;
+}
+
+std::shared_ptr<wasm::WAVMWasmModule> WAVMModuleCache::findCachedModule(
+  const faabric::Message& msg)
+{
+    std::string key = faabric::util::funcToString(msg, false);
+
+    faabric::util::SharedLock lock(mx);
+    auto it = cachedModuleMap.find(key);
+    if (it == cachedModuleMap.end()) {
+        return nullptr;
+    }
+
+    lru.touch(key);
+    return it->second;
+}
+
+bool WAVMModuleCache::evictToBudget(const std::string& keepKey)
+{
+    // Note - must be called with the lock held
+    size_t maxBytes = getModuleCacheMaxBytes();
+    if (maxBytes == 0) {
+        return false;
+    }
+
+    bool evicted = false;
+
+    IRModuleCache& irCache = getIRModuleCache();
+    for (const auto& key : lru.getKeysOldestFirst()) {
+        if (totalBytes + irCache.getTotalBytes() <= maxBytes) {
+            break;
+        }
+
+        if (key == keepKey) {
+            continue;
+        }
+
+        // Skip zygotes that are currently referenced elsewhere
+        auto it = cachedModuleMap.find(key);
+        if (it == cachedModuleMap.end() || it->second.use_count() > 1) {
+            continue;
+        }
+
+        size_t freedBytes = cachedModuleBytes[key];
+        SPDLOG_DEBUG("Evicting cached module {} ({} bytes)", key, freedBytes);
+
+        cachedModuleMap.erase(it);
+        cachedModuleBytes.erase(key);
+        lru.remove(key);
+
+        totalBytes -= freedBytes;
+        evictions++;
+        evicted = true;
     }
+
+    return evicted;
+}
+
+ModuleCacheStats WAVMModuleCache::getStats()
+{
+    faabric::util::SharedLock lock(mx);
+
+    ModuleCacheStats stats;
+    stats.hits = hits;
+    stats.misses = misses;
+    stats.evictions = evictions;
+    stats.entries = cachedModuleMap.size();
+    stats.bytes = totalBytes;
+
+    return stats;
 }
 
 void WAVMModuleCache::clear()
 {
+    faabric::util::FullLock lock(mx);
+
     cachedModuleMap.clear();
+    cachedModuleBytes.clear();
+    totalBytes = 0;
+    lru.clear();
+
+    hits = 0;
+    misses = 0;
+    evictions = 0;
 }
 }
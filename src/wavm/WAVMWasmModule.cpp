@@ -1,9 +1,12 @@
 #include "syscalls.h"
 
+#include <algorithm>
 #include <boost/filesystem.hpp>
+#include <cstring>
 #include <stdexcept>
 #include <sys/mman.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include <faabric/util/bytes.h>
 #include <faabric/util/config.h>
@@ -14,6 +17,7 @@
 #include <faabric/util/memory.h>
 #include <faabric/util/timing.h>
 
+#include <conf/FaasmConfig.h>
 #include <storage/SharedFiles.h>
 #include <threads/ThreadState.h>
 #include <wasm/WasmExecutionContext.h>
@@ -82,10 +86,263 @@ void WAVMWasmModule::reset(faabric::Message& msg)
 
     std::string funcStr = faabric::util::funcToString(msg, true);
     SPDLOG_DEBUG("Resetting after {}", funcStr);
-    wasm::WAVMWasmModule& cachedModule =
+    std::shared_ptr<wasm::WAVMWasmModule> cachedModule =
       wasm::getWAVMModuleCache().getCachedModule(msg);
 
-    clone(cachedModule);
+    resetFromZygote(*cachedModule);
+}
+
+void WAVMWasmModule::resetToSnapshotBase(faabric::Message& msg)
+{
+    if (!_isBound) {
+        return;
+    }
+
+    // A sparse restore goes on to overwrite only what changed since the
+    // zygote, so undoing just the regions written is always worth it, rather
+    // than cloning the whole memory
+    std::shared_ptr<wasm::WAVMWasmModule> cachedModule =
+      wasm::getWAVMModuleCache().getCachedModule(msg);
+
+    resetFromZygote(*cachedModule, true);
+}
+
+void WAVMWasmModule::resetFromZygote(WAVMWasmModule& zygote)
+{
+    resetFromZygote(zygote, conf::getFaasmConfig().resetMode == "cow");
+}
+
+void WAVMWasmModule::resetFromZygote(WAVMWasmModule& zygote, bool copyOnWrite)
+{
+    stopLazyRestore();
+
+    if (copyOnWrite && copyOnWriteReset(zygote)) {
+        return;
+    }
+
+    clone(zygote);
+}
+
+int WAVMWasmModule::getZygoteMemoryFd()
+{
+    faabric::util::UniqueLock lock(zygoteMemoryMx);
+
+    if (zygoteMemoryFd >= 0) {
+        return zygoteMemoryFd;
+    }
+
+    PROF_START(wasmZygoteMemFd)
+
+    std::string fdName = boundUser + "_" + boundFunction + "_zygote";
+    size_t nBytes = getMemorySizeBytes();
+
+    int fd = memfd_create(fdName.c_str(), 0);
+    if (fd < 0) {
+        SPDLOG_ERROR("Failed to create zygote memfd for {}: {}",
+                     fdName,
+                     std::strerror(errno));
+        throw std::runtime_error("Failed to create zygote memfd");
+    }
+
+    if (ftruncate(fd, nBytes) != 0) {
+        SPDLOG_ERROR("Failed to size zygote memfd for {} to {}: {}",
+                     fdName,
+                     nBytes,
+                     std::strerror(errno));
+        close(fd);
+        throw std::runtime_error("Failed to size zygote memfd");
+    }
+
+    // Copy the zygote's memory into the file
+    if (nBytes > 0) {
+        void* fdMem =
+          mmap(nullptr, nBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (fdMem == MAP_FAILED) {
+            SPDLOG_ERROR("Failed to map zygote memfd for {}: {}",
+                         fdName,
+                         std::strerror(errno));
+            close(fd);
+            throw std::runtime_error("Failed to map zygote memfd");
+        }
+
+        std::memcpy(fdMem, getMemoryBase(), nBytes);
+        munmap(fdMem, nBytes);
+    }
+
+    zygoteMemoryFd = fd;
+    zygoteMemoryBytes = nBytes;
+
+    PROF_END(wasmZygoteMemFd)
+
+    return zygoteMemoryFd;
+}
+
+void WAVMWasmModule::remapZygoteMemory(int fd,
+                                       size_t zygoteBytes,
+                                       size_t offset,
+                                       size_t length)
+{
+    uint8_t* memBase = getMemoryBase();
+
+    // Map the zygote's memory privately, so that untouched pages are shared
+    // with the zygote and only pages written are copied
+    if (offset < zygoteBytes) {
+        size_t fileLength = std::min(length, zygoteBytes - offset);
+        void* res = mmap(memBase + offset,
+                         fileLength,
+                         PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_FIXED,
+                         fd,
+                         offset);
+        if (res == MAP_FAILED) {
+            SPDLOG_ERROR("Failed to map zygote memory for {}/{}: {}",
+                         boundUser,
+                         boundFunction,
+                         std::strerror(errno));
+            throw std::runtime_error("Failed to map zygote memory");
+        }
+
+        offset += fileLength;
+        length -= fileLength;
+    }
+
+    // Memory grown beyond the zygote is replaced with fresh zero pages
+    if (length > 0) {
+        void* res = mmap(memBase + offset,
+                         length,
+                         PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+                         -1,
+                         0);
+        if (res == MAP_FAILED) {
+            SPDLOG_ERROR("Failed to clear grown memory for {}/{}: {}",
+                         boundUser,
+                         boundFunction,
+                         std::strerror(errno));
+            throw std::runtime_error("Failed to clear grown memory");
+        }
+    }
+}
+
+void WAVMWasmModule::mapZygoteMemory(int fd,
+                                     size_t zygoteBytes,
+                                     size_t currentBytes)
+{
+    remapZygoteMemory(fd, zygoteBytes, 0, currentBytes);
+    zygoteMemoryMapped = true;
+    zygoteMappedBytes = zygoteBytes;
+    adviseHugePages(0, currentBytes, true);
+}
+
+void WAVMWasmModule::shareZygoteMemory(WAVMWasmModule& zygote)
+{
+    // A fresh clone holds a private copy of the zygote's memory. Mapping the
+    // zygote's file over it instead means pages only read (e.g. data
+    // segments) are shared by every instance of the function on this host,
+    // and copied on first write.
+    int fd = zygote.getZygoteMemoryFd();
+    size_t zygoteBytes = zygote.zygoteMemoryBytes;
+    size_t currentBytes = getMemorySizeBytes();
+
+    if (currentBytes < zygoteBytes) {
+        return;
+    }
+
+    PROF_START(wasmShareZygote)
+
+    faabric::util::FullLock lock(moduleMemoryMutex);
+    removeGuardRegions(0, currentBytes);
+    removeFileMappings(0, currentBytes);
+    mapZygoteMemory(fd, zygoteBytes, currentBytes);
+    applyGuardRegions();
+
+    PROF_END(wasmShareZygote)
+}
+
+bool WAVMWasmModule::copyOnWriteReset(WAVMWasmModule& zygote)
+{
+    // We can only reset in place if this module was cloned from the same
+    // zygote, and hasn't done anything that remapping memory can't undo (i.e.
+    // loading dynamic modules or growing the table). Otherwise we clone.
+    if (!_isBound || compartment == nullptr || !zygote._isBound) {
+        return false;
+    }
+
+    if (boundUser != zygote.boundUser ||
+        boundFunction != zygote.boundFunction) {
+        return false;
+    }
+
+    if (lastLoadedDynamicModuleHandle != zygote.lastLoadedDynamicModuleHandle) {
+        return false;
+    }
+
+    if (Runtime::getTableNumElements(defaultTable) !=
+        Runtime::getTableNumElements(zygote.defaultTable)) {
+        return false;
+    }
+
+    int fd = zygote.getZygoteMemoryFd();
+    size_t zygoteBytes = zygote.zygoteMemoryBytes;
+    size_t currentBytes = getMemorySizeBytes();
+
+    if (currentBytes < zygoteBytes) {
+        return false;
+    }
+
+    PROF_START(wasmCowReset)
+
+    {
+        faabric::util::FullLock lock(moduleMemoryMutex);
+
+        // Remapping undoes any protection, so guards are taken from the zygote
+        removeGuardRegions(0, currentBytes);
+        removeFileMappings(0, currentBytes);
+
+        if (zygoteMemoryMapped) {
+            // Only pages written since the last reset need restoring
+            std::vector<std::pair<uint32_t, uint32_t>> dirtyRegions =
+              getPrivatelyWrittenRegions(getMemoryBase(), currentBytes);
+
+            SPDLOG_TRACE("Restoring {} dirty regions for {}/{}",
+                         dirtyRegions.size(),
+                         boundUser,
+                         boundFunction);
+
+            for (const auto& r : dirtyRegions) {
+                remapZygoteMemory(fd, zygoteBytes, r.first, r.second);
+            }
+        } else {
+            mapZygoteMemory(fd, zygoteBytes, currentBytes);
+        }
+    }
+
+    // Mutable globals (e.g. the stack pointer) live in the context
+    std::memcpy(executionContext->runtimeData->mutableGlobals,
+                zygote.executionContext->runtimeData->mutableGlobals,
+                sizeof(executionContext->runtimeData->mutableGlobals));
+
+    // Thread contexts are kept rather than recreated, as they live in this
+    // compartment and would otherwise accumulate. Their only state is the
+    // stack pointer, which unwinds at the end of each call.
+    std::vector<Runtime::Context*> threadContexts = openMPContexts;
+
+    cloneModuleState(zygote);
+
+    {
+        faabric::util::FullLock lock(moduleMemoryMutex);
+        applyGuardRegions();
+    }
+
+    openMPContexts = threadContexts;
+    sharedMemWasmPtrs = zygote.sharedMemWasmPtrs;
+    globalOffsetTableMap = zygote.globalOffsetTableMap;
+    globalOffsetMemoryMap = zygote.globalOffsetMemoryMap;
+    missingGlobalOffsetEntries = zygote.missingGlobalOffsetEntries;
+
+    PROF_END(wasmCowReset)
+
+    return true;
 }
 
 Runtime::Instance* WAVMWasmModule::getEnvModule()
@@ -135,6 +392,8 @@ WAVMWasmModule::WAVMWasmModule(const WAVMWasmModule& other)
 
 void WAVMWasmModule::clone(const WAVMWasmModule& other)
 {
+    stopLazyRestore();
+
     // If bound, we want to reclaim all the memory we've created _before_
     // cloning from the zygote otherwise it's lost forever
     if (_isBound) {
@@ -145,33 +404,18 @@ void WAVMWasmModule::clone(const WAVMWasmModule& other)
         throw std::runtime_error("Binding from unbound module");
     }
 
-    _isBound = other._isBound;
-    boundUser = other.boundUser;
-    boundFunction = other.boundFunction;
-
-    currentBrk = other.currentBrk;
-
-    filesystem = other.filesystem;
-
-    wasmEnvironment = other.wasmEnvironment;
-
-    // Note - we keep the thread stack offsets but not the threads themselves as
-    // each module will have its own thread pool
-    threadPoolSize = other.threadPoolSize;
-    threadStacks = other.threadStacks;
-    openMPContexts = std::vector<Runtime::Context*>(threadPoolSize, nullptr);
-
-    mutexes.clear();
-
-    // Do not copy over any captured stdout
-    stdoutMemFd = 0;
-    stdoutSize = 0;
+    cloneModuleState(other);
 
     if (other._isBound) {
         assert(other.compartment != nullptr);
 
+        // No-access guard regions have to be readable to copy the memory.
+        // This only changes their protection, so is safe on a const module.
+        const_cast<WAVMWasmModule&>(other).exposeGuardRegions();
+
         // Clone compartment
         compartment = Runtime::cloneCompartment(other.compartment);
+        zygoteMemoryMapped = false;
 
         // Clone context
         executionContext =
@@ -189,6 +433,12 @@ void WAVMWasmModule::clone(const WAVMWasmModule& other)
         defaultMemory = Runtime::getDefaultMemory(moduleInstance);
         defaultTable = Runtime::getDefaultTable(moduleInstance);
 
+        // The cloned memory is unprotected, and holds copies of the guards
+        {
+            faabric::util::FullLock lock(moduleMemoryMutex);
+            applyGuardRegions();
+        }
+
         // Reset shared memory variables
         sharedMemWasmPtrs = other.sharedMemWasmPtrs;
 
@@ -207,14 +457,50 @@ void WAVMWasmModule::clone(const WAVMWasmModule& other)
         globalOffsetTableMap = other.globalOffsetTableMap;
         globalOffsetMemoryMap = other.globalOffsetMemoryMap;
         missingGlobalOffsetEntries = other.missingGlobalOffsetEntries;
+
+        syncMemoryQuota();
     }
 }
 
+void WAVMWasmModule::cloneModuleState(const WAVMWasmModule& other)
+{
+    _isBound = other._isBound;
+    boundUser = other.boundUser;
+    boundFunction = other.boundFunction;
+
+    currentBrk = other.currentBrk;
+    freeList = other.freeList;
+    guardRegions = other.guardRegions;
+
+    filesystem = other.filesystem;
+
+    wasmEnvironment = other.wasmEnvironment;
+
+    // Note - we keep the thread stack offsets but not the threads themselves as
+    // each module will have its own thread pool
+    threadPoolSize = other.threadPoolSize;
+    threadStacks = other.threadStacks;
+    openMPContexts = std::vector<Runtime::Context*>(threadPoolSize, nullptr);
+
+    mutexes.clear();
+
+    // Do not copy over any captured stdout
+    stdoutMemFd = 0;
+    stdoutSize = 0;
+}
+
 WAVMWasmModule::~WAVMWasmModule()
 {
-    // Note - the only need for this destructor is to perform the WAVM-related
-    // GC, do not add anything else here.
+    // Note - the only need for this destructor is to stop local OpenMP
+    // threads, perform the WAVM-related GC and release the zygote memfd, do
+    // not add anything else here.
+    shutdownLocalOpenMPThreads();
+
     doWAVMGarbageCollection();
+
+    if (zygoteMemoryFd >= 0) {
+        close(zygoteMemoryFd);
+    }
 }
 
 void WAVMWasmModule::doWAVMGarbageCollection()
@@ -407,7 +693,14 @@ void WAVMWasmModule::doBindToFunctionInternal(faabric::Message& msg,
      */
     if (useCache) {
         wasm::WAVMModuleCache& cache = getWAVMModuleCache();
-        clone(cache.getCachedModule(msg));
+        std::shared_ptr<wasm::WAVMWasmModule> cachedModule =
+          cache.getCachedModule(msg);
+        clone(*cachedModule);
+
+        if (conf::getFaasmConfig().shareZygoteMemory == "on") {
+            shareZygoteMemory(*cachedModule);
+        }
+
         return;
     }
 
@@ -432,9 +725,8 @@ void WAVMWasmModule::doBindToFunctionInternal(faabric::Message& msg,
 
     // We have to set the current brk before executing any code
     currentBrk = getMemorySizeBytes();
-
-    // Set up thread stacks
-    createThreadStacks();
+    adviseHugePages(0, currentBrk);
+    syncMemoryQuota();
 
     // Allocate a pool of OpenMP contexts
     openMPContexts = std::vector<Runtime::Context*>(threadPoolSize, nullptr);
@@ -517,7 +809,7 @@ Runtime::Instance* WAVMWasmModule::createModuleInstance(
 
     // Warning: be very careful here to stick to *references* to the same shared
     // modules rather than creating copies.
-    IR::Module& irModule =
+    std::shared_ptr<IR::Module> irModule =
       moduleRegistry.getModule(boundUser, boundFunction, sharedModulePath);
 
     if (isMainModule) {
@@ -528,7 +820,7 @@ Runtime::Instance* WAVMWasmModule::createModuleInstance(
         wasiModule = Runtime::cloneInstance(getWasiModule(), compartment);
 
         // Make sure the stack top is as expected
-        IR::GlobalDef stackDef = irModule.globals.getDef(0);
+        IR::GlobalDef stackDef = irModule->globals.getDef(0);
         if (!stackDef.type.isMutable) {
             throw std::runtime_error("Found immutable stack top");
         }
@@ -555,7 +847,7 @@ Runtime::Instance* WAVMWasmModule::createModuleInstance(
 
         // Provision the memory for the new module plus two guard regions
         uint32_t memSize = DYNAMIC_MODULE_MEMORY_SIZE + (2 * GUARD_REGION_SIZE);
-        Uptr memOffset = growMemory(memSize);
+        Uptr memOffset = checkMemoryGrow(growMemory(memSize));
         uint32_t memStart = createMemoryGuardRegion(memOffset);
         createMemoryGuardRegion(memStart + DYNAMIC_MODULE_MEMORY_SIZE);
 
@@ -584,10 +876,10 @@ Runtime::Instance* WAVMWasmModule::createModuleInstance(
     }
 
     // Add module to GOT before linking
-    addModuleToGOT(irModule, isMainModule);
+    addModuleToGOT(*irModule, isMainModule);
 
     // Do the linking
-    Runtime::LinkResult linkResult = linkModule(irModule, *this);
+    Runtime::LinkResult linkResult = linkModule(*irModule, *this);
     if (!linkResult.success) {
         SPDLOG_ERROR("Failed to link module");
         throw std::runtime_error("Failed linking module");
@@ -945,38 +1237,136 @@ int32_t WAVMWasmModule::executeOMPThread(int threadPoolIdx,
     }
     Runtime::Context* ctx = openMPContexts.at(threadPoolIdx);
 
-    // Execute the wasm function
+    // Stacks may have been recreated since the context was, e.g. after reset
+    ctx->runtimeData->mutableGlobals[0] = stackTop;
+
+    // Execute the wasm function, then help run the level's remaining tasks
     IR::UntaggedValue returnValue;
-    executeWasmFunction(ctx, funcInstance, invokeArgs, returnValue);
+    try {
+        executeWasmFunction(ctx, funcInstance, invokeArgs, returnValue);
+        finishOpenMPTasks(ctx);
+    } catch (...) {
+        leaveOpenMPTasks(this);
+        throw;
+    }
+    leaveOpenMPTasks(this);
     msg.set_returnvalue(returnValue.i32);
 
     return returnValue.i32;
 }
 
-U32 WAVMWasmModule::mmapFile(U32 fd, U32 length)
+int WAVMWasmModule::getMaxLocalOpenMPThreads()
 {
+    return threadPoolSize - 1;
+}
+
+void WAVMWasmModule::startLocalOpenMPThreads(
+  faabric::Message* parentCall,
+  std::shared_ptr<threads::Level> level,
+  int32_t microtaskPtr)
+{
+    int nThreads = level->numThreads - 1;
+    if (nThreads > getMaxLocalOpenMPThreads()) {
+        SPDLOG_ERROR("Cannot run {} local OpenMP threads with pool size {}",
+                     nThreads,
+                     threadPoolSize);
+        throw std::runtime_error("Too many local OpenMP threads");
+    }
+
+    if (localOpenMPQueues.empty()) {
+        localOpenMPQueues.resize(threadPoolSize);
+    }
+
+    for (int i = 1; i <= nThreads; i++) {
+        if (localOpenMPQueues.at(i) == nullptr) {
+            localOpenMPQueues.at(i) =
+              std::make_unique<faabric::util::Queue<threads::OpenMPTask>>();
+            localOpenMPThreads.emplace_back(
+              &WAVMWasmModule::runLocalOpenMPThread, this, i);
+        }
+
+        auto msg = std::make_shared<faabric::Message>();
+        msg->set_user(parentCall->user());
+        msg->set_function(parentCall->function());
+        msg->set_funcptr(microtaskPtr);
+        msg->set_appindex(level->getGlobalThreadNum(i));
+
+        localOpenMPQueues.at(i)->enqueue(
+          threads::OpenMPTask(parentCall, msg, level));
+    }
+}
+
+int32_t WAVMWasmModule::awaitLocalOpenMPThreads(int nThreads)
+{
+    int32_t firstFailure = 0;
+    for (int i = 0; i < nThreads; i++) {
+        int32_t returnValue = localOpenMPResults.dequeue();
+        if (firstFailure == 0) {
+            firstFailure = returnValue;
+        }
+    }
+
+    return firstFailure;
+}
+
+void WAVMWasmModule::runLocalOpenMPThread(int threadPoolIdx)
+{
+    faabric::util::Queue<threads::OpenMPTask>& queue =
+      *localOpenMPQueues.at(threadPoolIdx);
+
+    while (true) {
+        threads::OpenMPTask task = queue.dequeue();
+        if (task.isShutdown) {
+            break;
+        }
 
-    // Create a new memory region
-    U32 wasmPtr = mmapMemory(length);
-    U32* targetPtr = &Runtime::memoryRef<U32>(defaultMemory, wasmPtr);
+        threads::setCurrentOpenMPLevel(task.nextLevel);
+
+        int32_t returnValue = 1;
+        bool failed = true;
+        try {
+            WasmExecutionContext ctx(this, task.msg.get());
+            uint32_t stackTop = getThreadStack(threadPoolIdx);
+            returnValue = executeOMPThread(threadPoolIdx, stackTop, *task.msg);
+            failed = false;
+        } catch (Runtime::Exception* ex) {
+            SPDLOG_ERROR("Local OpenMP thread {} trapped: {}",
+                         task.msg->appindex(),
+                         Runtime::describeException(ex));
+            Runtime::destroyException(ex);
+        } catch (std::exception& e) {
+            SPDLOG_ERROR("Local OpenMP thread {} failed: {}",
+                         task.msg->appindex(),
+                         e.what());
+        }
+
+        // The rest of the team would otherwise wait for this thread forever
+        if (failed) {
+            task.nextLevel->abort();
+        }
 
-    // Unmap and remap the memory
-    munmap(targetPtr, length);
-    U32* mmappedPtr =
-      (U32*)mmap(targetPtr, length, PROT_READ, MAP_SHARED, fd, 0);
-    if (mmappedPtr == MAP_FAILED) {
-        SPDLOG_ERROR("Failed mmapping file descriptor {} ({} - {})",
-                     fd,
-                     errno,
-                     strerror(errno));
-        throw std::runtime_error("Unable to map file");
+        localOpenMPResults.enqueue(returnValue);
     }
+}
 
-    if (mmappedPtr != targetPtr) {
-        throw std::runtime_error("Unable to map file into required location");
+void WAVMWasmModule::shutdownLocalOpenMPThreads()
+{
+    for (auto& queue : localOpenMPQueues) {
+        if (queue != nullptr) {
+            threads::OpenMPTask shutdownTask(nullptr, nullptr, nullptr);
+            shutdownTask.isShutdown = true;
+            queue->enqueue(shutdownTask);
+        }
     }
 
-    return wasmPtr;
+    for (auto& t : localOpenMPThreads) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+
+    localOpenMPThreads.clear();
+    localOpenMPQueues.clear();
 }
 
 U32 WAVMWasmModule::growMemory(U32 nBytes)
@@ -1026,12 +1416,18 @@ U32 WAVMWasmModule::growMemory(U32 nBytes)
         throw std::runtime_error("Mmap exceeding max");
     }
 
+    if (!chargeMemoryQuota(newPages * WASM_BYTES_PER_PAGE)) {
+        return MEMORY_GROW_FAILED;
+    }
+
     Uptr newMemPageBase;
     Uptr pageChange = newPages - oldPages;
     Runtime::GrowResult result =
       Runtime::growMemory(defaultMemory, pageChange, &newMemPageBase);
 
     if (result != Runtime::GrowResult::success) {
+        syncMemoryQuota();
+
         if (result == Runtime::GrowResult::outOfMemory) {
             SPDLOG_ERROR("Committing new pages failed (errno={} ({})) "
                          "(growing by {} from current {})",
@@ -1067,6 +1463,7 @@ U32 WAVMWasmModule::growMemory(U32 nBytes)
 
     // Get offset of bottom of new range
     auto newMemBase = (U32)(newMemPageBase * WASM_BYTES_PER_PAGE);
+    adviseHugePages(newMemBase, newBytes - oldBytes);
 
     // Set current break to top of the new memory
     currentBrk = getMemorySizeBytes();
@@ -1107,12 +1504,14 @@ uint32_t WAVMWasmModule::shrinkMemory(U32 nBytes)
         throw std::runtime_error("Shrinking by more than current brk");
     }
 
-    // Note - we don't actually free the memory, we just change the brk
+    // Memory stays committed, but its pages are given back to the OS
     U32 oldBrk = currentBrk;
     U32 newBrk = currentBrk - nBytes;
 
     SPDLOG_TRACE("MEM - shrinking memory {} -> {}", oldBrk, newBrk);
+    discardMemory(newBrk, nBytes);
     currentBrk = newBrk;
+    freeList.removeAbove(newBrk);
 
     return oldBrk;
 }
@@ -1141,13 +1540,25 @@ void WAVMWasmModule::unmapMemory(U32 offset, U32 nBytes)
         throw std::runtime_error("munmapping outside memory max");
     }
 
+    faabric::util::FullLock lock(moduleMemoryMutex);
+
+    // Anything above the break is already free
+    if (offset >= currentBrk) {
+        return;
+    }
+    unmapTop = std::min(unmapTop, currentBrk);
+
     if (unmapTop == currentBrk) {
+        // Free memory left at the new top also goes back to the break. The
+        // unmapped range may have had a file mapped into it, so is discarded
+        // rather than reused as is.
         SPDLOG_TRACE("MEM - munmapping top of memory by {}", pageAligned);
-        shrinkMemory(pageAligned);
+        discardMemory(offset, unmapTop - offset);
+        freeList.removeAbove(offset);
+        currentBrk = freeList.trimTop(offset);
     } else {
-        SPDLOG_WARN("MEM - unable to reclaim unmapped memory {} at {}",
-                    pageAligned,
-                    offset);
+        SPDLOG_TRACE("MEM - freeing {} bytes at {}", unmapTop - offset, offset);
+        releaseFreeMemory(offset, unmapTop - offset);
     }
 }
 
@@ -1155,6 +1566,17 @@ U32 WAVMWasmModule::mmapMemory(U32 nBytes)
 {
     // Note - the mmap interface allows non page-aligned values, and rounds up.
     uint32_t pageAligned = roundUpToWasmPageAligned(nBytes);
+
+    // Reuse previously unmapped memory before growing
+    {
+        faabric::util::FullLock lock(moduleMemoryMutex);
+        uint32_t offset;
+        if (claimFreeMemory(pageAligned, offset)) {
+            SPDLOG_TRACE("MEM - reusing {} bytes at {}", pageAligned, offset);
+            return offset;
+        }
+    }
+
     return growMemory(pageAligned);
 }
 
@@ -1178,6 +1600,15 @@ uint8_t* WAVMWasmModule::getMemoryBase()
     return memBase;
 }
 
+std::shared_ptr<WasmModule> WAVMWasmModule::getZygote()
+{
+    // The cached module is the zygote that resets start from. Creating one
+    // just to take a snapshot against it isn't worth it.
+    faabric::Message msg =
+      faabric::util::messageFactory(boundUser, boundFunction);
+    return getWAVMModuleCache().findCachedModule(msg);
+}
+
 bool WAVMWasmModule::resolve(const std::string& moduleName,
                              const std::string& name,
                              IR::ExternType type,
@@ -1395,13 +1826,14 @@ std::map<std::string, std::string> WAVMWasmModule::buildDisassemblyMap()
     std::map<std::string, std::string> output;
 
     IRModuleCache& moduleRegistry = getIRModuleCache();
-    IR::Module& module = moduleRegistry.getModule(boundUser, boundFunction, "");
+    std::shared_ptr<IR::Module> module =
+      moduleRegistry.getModule(boundUser, boundFunction, "");
 
     IR::DisassemblyNames disassemblyNames;
-    getDisassemblyNames(module, disassemblyNames);
+    getDisassemblyNames(*module, disassemblyNames);
 
-    for (Uptr i = 0; i < module.functions.size(); i++) {
-        unsigned long nImports = module.functions.imports.size();
+    for (Uptr i = 0; i < module->functions.size(); i++) {
+        unsigned long nImports = module->functions.imports.size();
         bool isImport = i < nImports;
 
         int nameIdx = isImport ? i : i - nImports;
@@ -1575,7 +2007,10 @@ void WAVMWasmModule::printDebugInfo()
         size_t stackSizeBytes = stackPointer;
         size_t dataSizeBytes = dataEnd - stackPointer;
 
+        size_t residentBytes = getResidentMemoryBytes();
+
         float memSizeMb = ((float)memSizeBytes) / (1024 * 1024);
+        float residentMb = ((float)residentBytes) / (1024 * 1024);
         float heapSizeMb = ((float)heapSizeBytes) / (1024 * 1024);
         float stackSizeMb = ((float)stackSizeBytes) / (1024 * 1024);
         float dataSizeMb = ((float)dataSizeBytes) / (1024 * 1024);
@@ -1588,6 +2023,9 @@ void WAVMWasmModule::printDebugInfo()
         printf("Total memory:       %.3f MiB (%lu bytes)\n",
                memSizeMb,
                memSizeBytes);
+        printf("Resident memory:    %.3f MiB (%lu bytes)\n",
+               residentMb,
+               residentBytes);
         printf("Stack size:         %.3f MiB (%lu bytes)\n",
                stackSizeMb,
                stackSizeBytes);
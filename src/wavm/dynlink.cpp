@@ -79,7 +79,7 @@ WAVM_DEFINE_INTRINSIC_FUNCTION(env, "dlerror", I32, dlerror)
 
     WAVMWasmModule* module = getExecutingWAVMModule();
     uint32_t pageAlignedSize = roundUpToWasmPageAligned(errorMessage.size());
-    uint32_t wasmStrPtr = module->growMemory(pageAlignedSize);
+    uint32_t wasmStrPtr = checkMemoryGrow(module->growMemory(pageAlignedSize));
 
     char* strPtr = &Runtime::memoryRef<char>(module->defaultMemory, wasmStrPtr);
     ::strcpy(strPtr, errorMessage.c_str());
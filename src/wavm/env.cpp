@@ -113,7 +113,8 @@ WAVM_DEFINE_INTRINSIC_FUNCTION(env, "getpwuid", I32, getpwuid, I32 uid)
     size_t newMemSize = dirOffset + fakeDir.size();
 
     size_t pageAlignedSize = roundUpToWasmPageAligned(newMemSize);
-    U32 wasmMemPtr = getExecutingWAVMModule()->growMemory(pageAlignedSize);
+    U32 wasmMemPtr =
+      checkMemoryGrow(getExecutingWAVMModule()->growMemory(pageAlignedSize));
 
     // Work out the pointers to the strings in wasm memory
     U32 namePtr = wasmMemPtr + nameOffset;
@@ -10,6 +10,8 @@
 #include <faabric/util/logging.h>
 #include <faabric/util/timing.h>
 
+#include <cerrno>
+
 using namespace WAVM;
 
 namespace wasm {
@@ -18,6 +20,8 @@ I32 s__madvise(I32 address, I32 numBytes, I32 advice)
 {
     SPDLOG_DEBUG("S - madvise - {} {} {}", address, numBytes, advice);
 
+    getExecutingWAVMModule()->adviseMemory(address, numBytes, advice);
+
     return 0;
 }
 
@@ -62,19 +66,16 @@ std::shared_ptr<faabric::state::StateKeyValue> getStateKV(I32 keyPtr)
     return kv;
 }
 
-I32 doMmap(I32 addr, I32 length, I32 prot, I32 flags, I32 fd, I32 offset)
+/**
+ * Returns -1, i.e. MAP_FAILED, if the memory limits don't allow the mapping
+ */
+I32 doMmap(I32 addr, I32 length, I32 prot, I32 flags, I32 fd, U64 offset)
 {
 
     SPDLOG_DEBUG(
       "S - mmap - {} {} {} {} {} {}", addr, length, prot, flags, fd, offset);
 
-    // Although we are ignoring the offset we should probably
-    // double check when something explicitly requests one
-    if (offset != 0) {
-        SPDLOG_WARN("WARNING: ignoring non-zero mmap offset ({})", offset);
-    }
-
-    // Likewise with the address hint
+    // We always choose where the mapping goes
     if (addr != 0) {
         SPDLOG_WARN("WARNING: ignoring mmap hint at {}", addr);
     }
@@ -85,7 +86,8 @@ I32 doMmap(I32 addr, I32 length, I32 prot, I32 flags, I32 fd, I32 offset)
         // If fd is provided, we're mapping a file into memory
         storage::FileDescriptor& fileDesc =
           module->getFileSystem().getFileDescriptor(fd);
-        return module->mmapFile(fileDesc.getLinuxFd(), length);
+        return module->mmapFile(
+          fileDesc.getLinuxFd(), length, prot, flags, offset);
     } else {
         // Map memory
         return module->mmapMemory(length);
@@ -95,12 +97,19 @@ I32 doMmap(I32 addr, I32 length, I32 prot, I32 flags, I32 fd, I32 offset)
 /**
  * Note that syscall 192 is mmap2, which has the same interface as mmap except
  * that the final argument specifies the offset into the file in 4096-byte units
- * (instead of bytes, as is done by mmap). Given that we ignore the offset we
- * can just treat it like mmap
+ * (instead of bytes, as is done by mmap)
  */
 I32 s__mmap(I32 addr, I32 length, I32 prot, I32 flags, I32 fd, I32 offset)
 {
-    return doMmap(addr, length, prot, flags, fd, offset);
+    I32 result = doMmap(addr, length, prot, flags, fd, (U32)offset);
+    return (U32)result == MEMORY_GROW_FAILED ? -ENOMEM : result;
+}
+
+I32 s__mmap2(I32 addr, I32 length, I32 prot, I32 flags, I32 fd, I32 offset)
+{
+    I32 result =
+      doMmap(addr, length, prot, flags, fd, (U64)(U32)offset * 4096);
+    return (U32)result == MEMORY_GROW_FAILED ? -ENOMEM : result;
 }
 
 WAVM_DEFINE_INTRINSIC_FUNCTION(env,
@@ -114,7 +123,7 @@ WAVM_DEFINE_INTRINSIC_FUNCTION(env,
                                I32 fd,
                                I64 offset)
 {
-    return doMmap(addr, length, prot, flags, fd, (I32)offset);
+    return doMmap(addr, length, prot, flags, fd, (U64)offset);
 }
 
 WAVM_DEFINE_INTRINSIC_FUNCTION(env,
@@ -142,7 +151,7 @@ WAVM_DEFINE_INTRINSIC_FUNCTION(env,
  * - returns -1 if there's an issue and sets errno
  *
  * Note that we assume the address is page-aligned and shrink memory if
- * necessary.
+ * necessary. Growing past the memory limits gives -1.
  */
 WAVM_DEFINE_INTRINSIC_FUNCTION(env, "__sbrk", I32, __sbrk, I32 increment)
 {
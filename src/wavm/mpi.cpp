@@ -1193,7 +1193,7 @@ WAVM_DEFINE_INTRINSIC_FUNCTION(env,
     // Create the new memory region
     WAVMWasmModule* module = getExecutingWAVMModule();
     U32 pageAlignedSize = roundUpToWasmPageAligned(memSize);
-    U32 mappedWasmPtr = module->growMemory(pageAlignedSize);
+    U32 mappedWasmPtr = checkMemoryGrow(module->growMemory(pageAlignedSize));
 
     // Write the result to the wasm memory (note that the argument passed to the
     // function is a pointer to a pointer)
@@ -1237,7 +1237,8 @@ WAVM_DEFINE_INTRINSIC_FUNCTION(env,
     U32 pageAlignedSize = roundUpToWasmPageAligned(memSize);
 
     ContextWrapper ctx;
-    U32 mappedWasmPtr = ctx.module->growMemory(pageAlignedSize);
+    U32 mappedWasmPtr =
+      checkMemoryGrow(ctx.module->growMemory(pageAlignedSize));
 
     // Write the value to wasm memory
     I32* hostCommPtr = &Runtime::memoryRef<I32>(ctx.memory, newCommPtrPtr);
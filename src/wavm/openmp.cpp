@@ -5,7 +5,9 @@
 #include <faabric/proto/faabric.pb.h>
 #include <faabric/scheduler/Scheduler.h>
 #include <faabric/snapshot/SnapshotRegistry.h>
+#include <faabric/state/State.h>
 #include <faabric/state/StateKeyValue.h>
+#include <faabric/util/config.h>
 #include <faabric/util/func.h>
 #include <faabric/util/gids.h>
 #include <faabric/util/locks.h>
@@ -13,10 +15,17 @@
 #include <faabric/util/macros.h>
 #include <faabric/util/timing.h>
 
+#include <conf/FaasmConfig.h>
 #include <threads/ThreadState.h>
+#include <wasm/SparseSnapshot.h>
 #include <wasm/WasmModule.h>
+#include <wasm/openmp.h>
 #include <wavm/WAVMWasmModule.h>
 
+#include <chrono>
+#include <numeric>
+#include <thread>
+
 using namespace WAVM;
 
 namespace wasm {
@@ -197,6 +206,7 @@ WAVM_DEFINE_INTRINSIC_FUNCTION(env,
                                I32 globalTid)
 {
     OMP_FUNC_ARGS("__kmpc_barrier {} {}", loc, globalTid);
+    finishOpenMPTasks(Runtime::getContextFromRuntimeData(contextRuntimeData));
     level->waitOnBarrier();
 }
 
@@ -348,6 +358,24 @@ WAVM_DEFINE_INTRINSIC_FUNCTION(env,
 // FORKING
 // ----------------------------------------------------
 
+static void clearGlobalLoops(const std::shared_ptr<threads::Level>& level);
+
+static void clearTaskArena(const std::shared_ptr<threads::Level>& level,
+                           WAVMWasmModule* module);
+
+/**
+ * Drops the state of a level run on local threads, once they've all finished
+ * after a failure.
+ */
+static void clearLocalLevel(const std::shared_ptr<threads::Level>& level,
+                            WAVMWasmModule* module)
+{
+    clearTaskArena(level, module);
+    clearGlobalLoops(level);
+    level->clearReduction();
+    level->clearSync();
+}
+
 /**
  * The "real" version of this function is implemented in the openmp source at:
  * https://github.com/llvm/llvm-project/blob/main/openmp/runtime/src/kmp_csupport.cpp
@@ -395,10 +423,25 @@ WAVM_DEFINE_INTRINSIC_FUNCTION(env,
 
     // Check if we're only doing single-threaded
     bool isSingleThread = nextLevel->numThreads == 1;
+    int nOtherThreads = nextLevel->numThreads - 1;
+
+    // If the whole team fits on this host, the other threads can run on host
+    // threads sharing this module's memory, so there's no need to snapshot
+    // and schedule them. The module only has one set of local threads, so
+    // nested teams (e.g. forked from a local thread) can't use them.
+    bool isLocal = false;
+    if (!isSingleThread && parentLevel->depth == 0 &&
+        conf::getFaasmConfig().ompLocalFork == "on" &&
+        nOtherThreads <= parentModule->getMaxLocalOpenMPThreads()) {
+        faabric::HostResources res = sch.getThisHostResources();
+        isLocal = res.slots() - res.usedslots() >= nOtherThreads;
+    }
 
     // Take memory snapshot
     std::string snapshotKey;
-    if (!isSingleThread) {
+    if (isLocal) {
+        SPDLOG_DEBUG("Running {} OpenMP threads locally", nOtherThreads);
+    } else if (!isSingleThread) {
         snapshotKey = parentModule->snapshot(false);
         SPDLOG_DEBUG("Created OpenMP snapshot: {}", snapshotKey);
     } else {
@@ -422,8 +465,18 @@ WAVM_DEFINE_INTRINSIC_FUNCTION(env,
     // Note that the spawning thread always executes the first task
     std::shared_ptr<faabric::BatchExecuteRequest> req = nullptr;
     if (!isSingleThread) {
+        nextLevel->prepareReduction();
+    }
+
+    if (isLocal) {
+        std::vector<int> localThreadNums(nextLevel->numThreads);
+        std::iota(localThreadNums.begin(), localThreadNums.end(), 0);
+        nextLevel->getReduction()->setLocalThreads(localThreadNums);
+
+        parentModule->startLocalOpenMPThreads(
+          parentCall, nextLevel, microtaskPtr);
+    } else if (!isSingleThread) {
         // Set up the request
-        int nOtherThreads = nextLevel->numThreads - 1;
         req = faabric::util::batchExecFactory(
           parentCall->user(), parentCall->function(), nOtherThreads);
         req->set_type(faabric::BatchExecuteRequest::THREADS);
@@ -449,7 +502,18 @@ WAVM_DEFINE_INTRINSIC_FUNCTION(env,
         }
 
         // Submit the request
-        sch.callFunctions(req);
+        std::vector<std::string> executedHosts = sch.callFunctions(req);
+
+        // Threads on this host share the master's memory, so take part in
+        // reductions directly, while the others send their partial results
+        std::string thisHost = faabric::util::getSystemConfig().endpointHost;
+        std::vector<int> localThreadNums = { 0 };
+        for (int i = 0; i < (int)executedHosts.size(); i++) {
+            if (executedHosts.at(i) == thisHost) {
+                localThreadNums.push_back(i + 1);
+            }
+        }
+        nextLevel->getReduction()->setLocalThreads(localThreadNums);
     }
 
     // Execute the master task (just invoke the microtask directly).
@@ -469,23 +533,52 @@ WAVM_DEFINE_INTRINSIC_FUNCTION(env,
         {
             wasm::WasmExecutionContext ctx(parentModule, &masterMsg);
 
-            // Execute the task
-            SPDLOG_DEBUG("OpenMP 0: executing OMP thread 0 (master)");
-            WAVM::Runtime::Function* microtaskFunc =
-              parentModule->getFunctionFromPtr(microtaskPtr);
-            parentModule->executeWasmFunction(
-              microtaskFunc, mainArguments, masterThreadResult);
+            try {
+                // Execute the task
+                SPDLOG_DEBUG("OpenMP 0: executing OMP thread 0 (master)");
+                WAVM::Runtime::Function* microtaskFunc =
+                  parentModule->getFunctionFromPtr(microtaskPtr);
+                parentModule->executeWasmFunction(
+                  microtaskFunc, mainArguments, masterThreadResult);
+
+                finishOpenMPTasks(parentModule->executionContext);
+                leaveOpenMPTasks(parentModule);
+            } catch (...) {
+                leaveOpenMPTasks(parentModule);
+
+                // Threads of the team in this process stop waiting for the
+                // master wherever they are
+                nextLevel->abort();
+
+                // Even if the master traps, local threads mustn't carry on
+                // using the module, or leave their results for the next fork
+                threads::setCurrentOpenMPLevel(parentLevel);
+                if (isLocal) {
+                    parentModule->awaitLocalOpenMPThreads(nOtherThreads);
+                    clearLocalLevel(nextLevel, parentModule);
+                }
+
+                throw;
+            }
         }
 
         // Reset the context
         threads::setCurrentOpenMPLevel(parentLevel);
 
+        // Local threads share this module, so must finish before it's used
+        // for anything else
+        if (isLocal &&
+            parentModule->awaitLocalOpenMPThreads(nOtherThreads) != 0) {
+            clearLocalLevel(nextLevel, parentModule);
+            throw std::runtime_error("Local OpenMP thread failed");
+        }
+
         if (masterThreadResult.i32 > 0) {
             throw std::runtime_error("Master OpenMP thread failed");
         }
     }
 
-    if (!isSingleThread) {
+    if (!isSingleThread && !isLocal) {
         // Await all child threads
         for (int i = 0; i < req->messages_size(); i++) {
             sch.awaitThreadResult(req->messages().at(i).id());
@@ -501,9 +594,19 @@ WAVM_DEFINE_INTRINSIC_FUNCTION(env,
         faabric::snapshot::SnapshotRegistry& reg =
           faabric::snapshot::getSnapshotRegistry();
         reg.deleteSnapshot(snapshotKey);
+        releaseSparseSnapshot(snapshotKey);
         PROF_END(DeleteSnapshot)
     }
 
+    // Single-threaded levels can still have allocated tasks
+    clearTaskArena(nextLevel, parentModule);
+
+    if (!isSingleThread) {
+        clearGlobalLoops(nextLevel);
+        nextLevel->clearReduction();
+        nextLevel->clearSync();
+    }
+
     // Reset parent level for next setting of threads
     parentLevel->pushedThreads = -1;
 }
@@ -512,129 +615,6 @@ WAVM_DEFINE_INTRINSIC_FUNCTION(env,
 // FOR LOOP STATIC INIT
 // -------------------------------------------------------
 
-enum sched_type : int
-{
-    sch_lower = 32, /**< lower bound for unordered values */
-    sch_static_chunked = 33,
-    sch_static = 34, /**< static unspecialized */
-};
-
-template<typename T>
-void for_static_init(I32 schedule,
-                     I32* lastIter,
-                     T* lower,
-                     T* upper,
-                     T* stride,
-                     T incr,
-                     T chunk);
-
-template<typename T>
-void for_static_init(I32 schedule,
-                     I32* lastIter,
-                     T* lower,
-                     T* upper,
-                     T* stride,
-                     T incr,
-                     T chunk)
-{
-    // Unsigned version of the given template parameter
-    typedef typename std::make_unsigned<T>::type UT;
-
-    faabric::Message* msg = getExecutingCall();
-    std::shared_ptr<threads::Level> level = threads::getCurrentOpenMPLevel();
-    int localThreadNum = level->getLocalThreadNum(msg);
-
-    if (level->numThreads == 1) {
-        *lastIter = true;
-
-        if (incr > 0) {
-            *stride = *upper - *lower + 1;
-        } else {
-            *stride = -(*lower - *upper + 1);
-        }
-
-        return;
-    }
-
-    UT tripCount;
-    if (incr == 1) {
-        tripCount = *upper - *lower + 1;
-
-    } else if (incr == -1) {
-        tripCount = *lower - *upper + 1;
-
-    } else if (incr > 0) {
-        // Upper-lower can exceed the limit of signed type
-        tripCount = (int)(*upper - *lower) / incr + 1;
-
-    } else {
-        tripCount = (int)(*lower - *upper) / (-incr) + 1;
-    }
-
-    switch (schedule) {
-        case sch_static_chunked: {
-            int span;
-
-            if (chunk < 1) {
-                chunk = 1;
-            }
-
-            span = chunk * incr;
-
-            *stride = span * level->numThreads;
-            *lower = *lower + (span * localThreadNum);
-            *upper = *lower + span - incr;
-
-            *lastIter =
-              (localThreadNum ==
-               ((tripCount - 1) / (unsigned int)chunk) % level->numThreads);
-
-            break;
-        }
-
-        case sch_static: { // (chunk not given)
-            // If we have fewer trip_counts than threads
-            if (tripCount < level->numThreads) {
-                // Warning for future use, not tested at scale
-                SPDLOG_WARN("Small for loop trip count {} {}",
-                            tripCount,
-                            level->numThreads);
-
-                if (localThreadNum < tripCount) {
-                    *upper = *lower = *lower + localThreadNum * incr;
-                } else {
-                    *lower = *upper + incr;
-                }
-
-                *lastIter = (localThreadNum == tripCount - 1);
-
-            } else {
-                // TODO: We only implement below kmp_sch_static_balanced, not
-                // kmp_sch_static_greedy Those are set through KMP_SCHEDULE so
-                // we would need to look out for real code setting this
-                U32 small_chunk = tripCount / level->numThreads;
-                U32 extras = tripCount % level->numThreads;
-
-                *lower +=
-                  incr * (localThreadNum * small_chunk +
-                          (localThreadNum < extras ? localThreadNum : extras));
-
-                *upper = *lower + small_chunk * incr -
-                         (localThreadNum < extras ? 0 : incr);
-
-                *lastIter = (localThreadNum == level->numThreads - 1);
-            }
-
-            *stride = tripCount;
-            break;
-        }
-        default: {
-            throw std::runtime_error(
-              fmt::format("Unimplemented scheduler {}", schedule));
-        }
-    }
-}
-
 /**
  * @param    loc       Source code location
  * @param    gtid      Global thread id of this thread
@@ -739,134 +719,1664 @@ WAVM_DEFINE_INTRINSIC_FUNCTION(env,
 }
 
 // ---------------------------------------------------
-// REDUCTION
+// FOR LOOP DYNAMIC DISPATCH
 // ---------------------------------------------------
 
-int reduceFinished()
+/*
+ * State of the loop a thread is currently taking chunks from. Iterations are
+ * numbered from zero and mapped back onto the loop bounds when handed out.
+ */
+struct DispatchState
+{
+    uint32_t levelId = 0;
+    int nextLoopIdx = 0;
+
+    int loopIdx = -1;
+    int schedule = sch_static;
+    uint64_t lower = 0;
+    int64_t stride = 1;
+    uint64_t tripCount = 0;
+    uint64_t chunk = 1;
+
+    // Static schedules hand out this thread's chunks in turn
+    uint64_t nextStaticChunk = 0;
+
+    // Loops shared by the whole team in one memory use an atomic counter,
+    // while those spanning hosts use a counter in global state
+    std::shared_ptr<threads::SharedLoop> sharedLoop = nullptr;
+    std::shared_ptr<faabric::state::StateKeyValue> globalLoop = nullptr;
+};
+
+static thread_local DispatchState dispatch;
+
+static std::string getGlobalLoopKey(uint32_t levelId, int loopIdx)
+{
+    return fmt::format("omp_loop_{}_{}", levelId, loopIdx);
+}
+
+/**
+ * Whether all threads of the level are in this memory. The reduction records
+ * which threads share the master's memory, and only exists in its process.
+ */
+static bool isLevelInOneMemory(const std::shared_ptr<threads::Level>& level)
+{
+    if (level->numThreads == 1) {
+        return true;
+    }
+
+    std::shared_ptr<threads::Reduction> reduction = level->getReduction();
+    if (reduction == nullptr) {
+        return false;
+    }
+
+    return reduction->getRemoteThreads(level->numThreads).empty();
+}
+
+template<typename T, typename ST>
+void dispatch_init(I32 schedule, T lower, T upper, ST stride, ST chunk)
 {
+    typedef typename std::make_unsigned<T>::type UT;
+
     std::shared_ptr<threads::Level> level = threads::getCurrentOpenMPLevel();
-    faabric::Message* msg = getExecutingCall();
-    int localThreadNum = level->getLocalThreadNum(msg);
 
-    // Notify the master thread that we've done our reduction
-    if (localThreadNum != 0) {
-        level->masterWait(localThreadNum);
+    if (dispatch.levelId != level->id) {
+        dispatch.levelId = level->id;
+        dispatch.nextLoopIdx = 0;
     }
 
-    return 1;
+    if (stride == 0) {
+        throw std::runtime_error("Zero stride in OpenMP loop");
+    }
+
+    uint64_t tripCount;
+    if (stride > 0) {
+        tripCount = upper < lower ? 0 : (UT)(upper - lower) / (UT)stride + 1;
+    } else {
+        tripCount = lower < upper ? 0 : (UT)(lower - upper) / (UT)(-stride) + 1;
+    }
+
+    // A runtime or auto schedule falls back to the default static one
+    schedule &= ~SCHEDULE_MODIFIER_MASK;
+    if (schedule == sch_runtime || schedule == sch_auto) {
+        schedule = sch_static;
+    } else if (schedule == sch_guided_iterative_chunked ||
+               schedule == sch_guided_analytical_chunked) {
+        schedule = sch_guided_chunked;
+    }
+
+    dispatch.loopIdx = dispatch.nextLoopIdx++;
+    dispatch.schedule = schedule;
+    dispatch.lower = (uint64_t)lower;
+    dispatch.stride = stride;
+    dispatch.tripCount = tripCount;
+    dispatch.chunk = chunk < 1 ? 1 : chunk;
+    dispatch.nextStaticChunk = 0;
+    dispatch.sharedLoop = nullptr;
+    dispatch.globalLoop = nullptr;
+
+    switch (schedule) {
+        case sch_static:
+        case sch_static_chunked: {
+            break;
+        }
+        case sch_dynamic_chunked:
+        case sch_guided_chunked: {
+            if (level->numThreads == 1) {
+                // A single thread can take everything
+                dispatch.schedule = sch_static;
+            } else if (isLevelInOneMemory(level)) {
+                dispatch.sharedLoop = level->getSharedLoop(dispatch.loopIdx);
+            } else {
+                // The counter starts at zero, as does new state
+                std::string key = getGlobalLoopKey(level->id, dispatch.loopIdx);
+                dispatch.globalLoop = faabric::state::getGlobalState().getKV(
+                  getExecutingCall()->user(), key, sizeof(uint64_t));
+            }
+            break;
+        }
+        default: {
+            throw std::runtime_error(
+              fmt::format("Unimplemented scheduler {}", schedule));
+        }
+    }
 }
 
 /**
- *  Called to finish off a reduction.
- *  In a nowait scenario, just the master calls this function (the other threads
- *  have continued on).
+ * Size of the next chunk to claim given the iterations remaining, guided
+ * chunks shrinking as the loop progresses.
  */
-void finaliseReduce(bool barrier)
+static uint64_t getChunkSize(uint64_t remaining, int numThreads)
+{
+    uint64_t size = dispatch.chunk;
+    if (dispatch.schedule == sch_guided_chunked) {
+        size = std::max(size, remaining / (2 * (uint64_t)numThreads));
+    }
+
+    return std::min(size, remaining);
+}
+
+static bool claimStaticChunk(const std::shared_ptr<threads::Level>& level,
+                             int localThreadNum,
+                             uint64_t& begin,
+                             uint64_t& end)
+{
+    uint64_t nThreads = level->numThreads;
+    uint64_t tripCount = dispatch.tripCount;
+
+    if (dispatch.schedule == sch_static) {
+        // One balanced block per thread
+        if (dispatch.nextStaticChunk > 0) {
+            return false;
+        }
+        dispatch.nextStaticChunk++;
+
+        uint64_t smallChunk = tripCount / nThreads;
+        uint64_t extras = tripCount % nThreads;
+        uint64_t t = localThreadNum;
+        begin = t * smallChunk + std::min(t, extras);
+        end = begin + smallChunk + (t < extras ? 1 : 0);
+    } else {
+        // Chunks dealt round-robin
+        uint64_t chunkIdx =
+          localThreadNum + nThreads * dispatch.nextStaticChunk++;
+        begin = chunkIdx * dispatch.chunk;
+        end = std::min(begin + dispatch.chunk, tripCount);
+    }
+
+    return begin < end;
+}
+
+static bool claimSharedChunk(int numThreads, uint64_t& begin, uint64_t& end)
+{
+    std::atomic<uint64_t>& next = dispatch.sharedLoop->next;
+    uint64_t tripCount = dispatch.tripCount;
+
+    if (dispatch.schedule == sch_dynamic_chunked) {
+        begin = next.fetch_add(dispatch.chunk);
+        if (begin >= tripCount) {
+            return false;
+        }
+
+        end = std::min(begin + dispatch.chunk, tripCount);
+        return true;
+    }
+
+    // Guided chunk sizes depend on what's left, so are claimed with a CAS
+    begin = next.load();
+    while (true) {
+        if (begin >= tripCount) {
+            return false;
+        }
+
+        end = begin + getChunkSize(tripCount - begin, numThreads);
+        if (next.compare_exchange_weak(begin, end)) {
+            return true;
+        }
+    }
+}
+
+static bool claimGlobalChunk(int numThreads, uint64_t& begin, uint64_t& end)
+{
+    faabric::state::StateKeyValue& kv = *dispatch.globalLoop;
+
+    kv.lockGlobal();
+    kv.pull();
+    kv.get(BYTES(&begin));
+
+    bool claimed = begin < dispatch.tripCount;
+    if (claimed) {
+        end = begin + getChunkSize(dispatch.tripCount - begin, numThreads);
+        kv.set(BYTES(&end));
+        kv.pushFull();
+    }
+
+    kv.unlockGlobal();
+
+    return claimed;
+}
+
+template<typename T, typename ST>
+I32 dispatch_next(I32* lastIter, T* lower, T* upper, ST* stride)
 {
-    std::shared_ptr<threads::Level> level = threads::getCurrentOpenMPLevel();
     faabric::Message* msg = getExecutingCall();
+    std::shared_ptr<threads::Level> level = threads::getCurrentOpenMPLevel();
     int localThreadNum = level->getLocalThreadNum(msg);
 
-    // Master must make sure all other threads are done
-    if (localThreadNum == 0) {
-        level->masterWait(0);
+    if (dispatch.levelId != level->id || dispatch.loopIdx < 0) {
+        throw std::runtime_error("OpenMP dispatch without init");
     }
 
-    // Everyone waits if there's a barrier
-    if (barrier) {
-        PROF_START(FinaliseReduceBarrier)
-        level->waitOnBarrier();
-        PROF_END(FinaliseReduceBarrier)
+    uint64_t begin = 0;
+    uint64_t end = 0;
+    bool claimed;
+    if (dispatch.sharedLoop != nullptr) {
+        claimed = claimSharedChunk(level->numThreads, begin, end);
+    } else if (dispatch.globalLoop != nullptr) {
+        claimed = claimGlobalChunk(level->numThreads, begin, end);
+    } else {
+        claimed = claimStaticChunk(level, localThreadNum, begin, end);
+    }
+
+    if (!claimed) {
+        if (dispatch.sharedLoop != nullptr) {
+            level->finishSharedLoop(dispatch.loopIdx);
+            dispatch.sharedLoop = nullptr;
+        }
+
+        dispatch.globalLoop = nullptr;
+        dispatch.loopIdx = -1;
+        return 0;
+    }
+
+    // Unsigned arithmetic wraps the same way for signed loop bounds
+    uint64_t st = (uint64_t)dispatch.stride;
+    *lower = (T)(dispatch.lower + begin * st);
+    *upper = (T)(dispatch.lower + (end - 1) * st);
+    *stride = (ST)dispatch.stride;
+    *lastIter = end == dispatch.tripCount;
+
+    return 1;
+}
+
+/**
+ * Global state counters of dynamically scheduled loops are removed by the
+ * master, once all the threads of the level have finished.
+ */
+static void clearGlobalLoops(const std::shared_ptr<threads::Level>& level)
+{
+    if (dispatch.levelId != level->id || isLevelInOneMemory(level)) {
+        return;
+    }
+
+    std::string user = getExecutingCall()->user();
+    for (int i = 0; i < dispatch.nextLoopIdx; i++) {
+        faabric::state::getGlobalState().deleteKV(
+          user, getGlobalLoopKey(level->id, i));
     }
 }
 
 /**
- * It seems that in our case, always returning 1 for both kmpc_reduce and
- * kmpc_reduce_nowait gets the right result.
+ * Sets up a loop with the given schedule, bounds, stride and chunk size. The
+ * thread then calls __kmpc_dispatch_next_* to get chunks of it until there
+ * are none left. Dynamic chunks are taken in order from a shared counter,
+ * while guided chunks start large and shrink towards the chunk size.
  *
- * In the OpenMP source we can see a more varied set of return values, but these
- * are for cases we don't yet support:
- * https://github.com/llvm/llvm-project/blob/main/openmp/runtime/src/kmp_csupport.cpp
+ * The guts of the implementation in openmp can be found in
+ * __kmp_dispatch_init in runtime/src/kmp_dispatch.cpp
  */
 WAVM_DEFINE_INTRINSIC_FUNCTION(env,
-                               "__kmpc_reduce",
-                               I32,
-                               __kmpc_reduce,
+                               "__kmpc_dispatch_init_4",
+                               void,
+                               __kmpc_dispatch_init_4,
                                I32 loc,
                                I32 gtid,
-                               I32 numVars,
-                               I32 reduceSize,
-                               I32 reduceData,
-                               I32 reduceFunc,
-                               I32 lockPtr)
+                               I32 schedule,
+                               I32 lower,
+                               I32 upper,
+                               I32 stride,
+                               I32 chunk)
 {
-    OMP_FUNC_ARGS("__kmpc_reduce {} {} {} {} {} {} {}",
+    OMP_FUNC_ARGS("__kmpc_dispatch_init_4 {} {} {} {} {} {} {}",
                   loc,
                   gtid,
-                  numVars,
-                  reduceSize,
-                  reduceData,
-                  reduceFunc,
-                  lockPtr);
+                  schedule,
+                  lower,
+                  upper,
+                  stride,
+                  chunk);
 
-    return reduceFinished();
+    dispatch_init<I32, I32>(schedule, lower, upper, stride, chunk);
 }
 
-/**
- * See __kmpc_reduce
+/*
+ * See __kmpc_dispatch_init_4
  */
 WAVM_DEFINE_INTRINSIC_FUNCTION(env,
-                               "__kmpc_reduce_nowait",
-                               I32,
-                               __kmpc_reduce_nowait,
+                               "__kmpc_dispatch_init_4u",
+                               void,
+                               __kmpc_dispatch_init_4u,
                                I32 loc,
                                I32 gtid,
-                               I32 numVars,
-                               I32 reduceSize,
-                               I32 reduceData,
-                               I32 reduceFunc,
-                               I32 lockPtr)
+                               I32 schedule,
+                               U32 lower,
+                               U32 upper,
+                               I32 stride,
+                               I32 chunk)
 {
-    OMP_FUNC_ARGS("__kmpc_reduce_nowait {} {} {} {} {} {} {}",
+    OMP_FUNC_ARGS("__kmpc_dispatch_init_4u {} {} {} {} {} {} {}",
                   loc,
                   gtid,
-                  numVars,
-                  reduceSize,
-                  reduceData,
-                  reduceFunc,
-                  lockPtr);
+                  schedule,
+                  lower,
+                  upper,
+                  stride,
+                  chunk);
 
-    return reduceFinished();
+    dispatch_init<U32, I32>(schedule, lower, upper, stride, chunk);
 }
 
-/**
- * Finalises a blocking reduce, called by all threads.
+/*
+ * See __kmpc_dispatch_init_4
  */
 WAVM_DEFINE_INTRINSIC_FUNCTION(env,
-                               "__kmpc_end_reduce",
+                               "__kmpc_dispatch_init_8",
                                void,
-                               __kmpc_end_reduce,
+                               __kmpc_dispatch_init_8,
                                I32 loc,
                                I32 gtid,
-                               I32 lck)
+                               I32 schedule,
+                               I64 lower,
+                               I64 upper,
+                               I64 stride,
+                               I64 chunk)
 {
-    OMP_FUNC_ARGS("__kmpc_end_reduce {} {} {}", loc, gtid, lck);
-    finaliseReduce(true);
+    OMP_FUNC_ARGS("__kmpc_dispatch_init_8 {} {} {} {} {} {} {}",
+                  loc,
+                  gtid,
+                  schedule,
+                  lower,
+                  upper,
+                  stride,
+                  chunk);
+
+    dispatch_init<I64, I64>(schedule, lower, upper, stride, chunk);
 }
 
-/**
- * Finalises a non-blocking reduce, called only by the master.
+/*
+ * See __kmpc_dispatch_init_4
  */
 WAVM_DEFINE_INTRINSIC_FUNCTION(env,
-                               "__kmpc_end_reduce_nowait",
+                               "__kmpc_dispatch_init_8u",
                                void,
-                               __kmpc_end_reduce_nowait,
+                               __kmpc_dispatch_init_8u,
                                I32 loc,
                                I32 gtid,
-                               I32 lck)
+                               I32 schedule,
+                               U64 lower,
+                               U64 upper,
+                               I64 stride,
+                               I64 chunk)
 {
-    OMP_FUNC_ARGS("__kmpc_end_reduce_nowait {} {} {}", loc, gtid, lck);
-    finaliseReduce(false);
+    OMP_FUNC_ARGS("__kmpc_dispatch_init_8u {} {} {} {} {} {} {}",
+                  loc,
+                  gtid,
+                  schedule,
+                  lower,
+                  upper,
+                  stride,
+                  chunk);
+
+    dispatch_init<U64, I64>(schedule, lower, upper, stride, chunk);
+}
+
+/**
+ * @param    lastIterPtr Pointer to the "last iteration" flag
+ * @param    lowerPtr    Pointer to the lower bound of the chunk
+ * @param    upperPtr    Pointer to the (inclusive) upper bound of the chunk
+ * @param    stridePtr   Pointer to the stride
+ * @return   1 if there's a chunk to execute, 0 when the loop is finished
+ */
+WAVM_DEFINE_INTRINSIC_FUNCTION(env,
+                               "__kmpc_dispatch_next_4",
+                               I32,
+                               __kmpc_dispatch_next_4,
+                               I32 loc,
+                               I32 gtid,
+                               I32 lastIterPtr,
+                               I32 lowerPtr,
+                               I32 upperPtr,
+                               I32 stridePtr)
+{
+    OMP_FUNC_ARGS("__kmpc_dispatch_next_4 {} {} {} {} {} {}",
+                  loc,
+                  gtid,
+                  lastIterPtr,
+                  lowerPtr,
+                  upperPtr,
+                  stridePtr);
+
+    Runtime::Memory* memoryPtr = getExecutingWAVMModule()->defaultMemory;
+    I32* lastIter = &Runtime::memoryRef<I32>(memoryPtr, lastIterPtr);
+    I32* lower = &Runtime::memoryRef<I32>(memoryPtr, lowerPtr);
+    I32* upper = &Runtime::memoryRef<I32>(memoryPtr, upperPtr);
+    I32* stride = &Runtime::memoryRef<I32>(memoryPtr, stridePtr);
+
+    return dispatch_next<I32, I32>(lastIter, lower, upper, stride);
+}
+
+/*
+ * See __kmpc_dispatch_next_4
+ */
+WAVM_DEFINE_INTRINSIC_FUNCTION(env,
+                               "__kmpc_dispatch_next_4u",
+                               I32,
+                               __kmpc_dispatch_next_4u,
+                               I32 loc,
+                               I32 gtid,
+                               I32 lastIterPtr,
+                               I32 lowerPtr,
+                               I32 upperPtr,
+                               I32 stridePtr)
+{
+    OMP_FUNC_ARGS("__kmpc_dispatch_next_4u {} {} {} {} {} {}",
+                  loc,
+                  gtid,
+                  lastIterPtr,
+                  lowerPtr,
+                  upperPtr,
+                  stridePtr);
+
+    Runtime::Memory* memoryPtr = getExecutingWAVMModule()->defaultMemory;
+    I32* lastIter = &Runtime::memoryRef<I32>(memoryPtr, lastIterPtr);
+    U32* lower = &Runtime::memoryRef<U32>(memoryPtr, lowerPtr);
+    U32* upper = &Runtime::memoryRef<U32>(memoryPtr, upperPtr);
+    I32* stride = &Runtime::memoryRef<I32>(memoryPtr, stridePtr);
+
+    return dispatch_next<U32, I32>(lastIter, lower, upper, stride);
+}
+
+/*
+ * See __kmpc_dispatch_next_4
+ */
+WAVM_DEFINE_INTRINSIC_FUNCTION(env,
+                               "__kmpc_dispatch_next_8",
+                               I32,
+                               __kmpc_dispatch_next_8,
+                               I32 loc,
+                               I32 gtid,
+                               I32 lastIterPtr,
+                               I32 lowerPtr,
+                               I32 upperPtr,
+                               I32 stridePtr)
+{
+    OMP_FUNC_ARGS("__kmpc_dispatch_next_8 {} {} {} {} {} {}",
+                  loc,
+                  gtid,
+                  lastIterPtr,
+                  lowerPtr,
+                  upperPtr,
+                  stridePtr);
+
+    Runtime::Memory* memoryPtr = getExecutingWAVMModule()->defaultMemory;
+    I32* lastIter = &Runtime::memoryRef<I32>(memoryPtr, lastIterPtr);
+    I64* lower = &Runtime::memoryRef<I64>(memoryPtr, lowerPtr);
+    I64* upper = &Runtime::memoryRef<I64>(memoryPtr, upperPtr);
+    I64* stride = &Runtime::memoryRef<I64>(memoryPtr, stridePtr);
+
+    return dispatch_next<I64, I64>(lastIter, lower, upper, stride);
+}
+
+/*
+ * See __kmpc_dispatch_next_4
+ */
+WAVM_DEFINE_INTRINSIC_FUNCTION(env,
+                               "__kmpc_dispatch_next_8u",
+                               I32,
+                               __kmpc_dispatch_next_8u,
+                               I32 loc,
+                               I32 gtid,
+                               I32 lastIterPtr,
+                               I32 lowerPtr,
+                               I32 upperPtr,
+                               I32 stridePtr)
+{
+    OMP_FUNC_ARGS("__kmpc_dispatch_next_8u {} {} {} {} {} {}",
+                  loc,
+                  gtid,
+                  lastIterPtr,
+                  lowerPtr,
+                  upperPtr,
+                  stridePtr);
+
+    Runtime::Memory* memoryPtr = getExecutingWAVMModule()->defaultMemory;
+    I32* lastIter = &Runtime::memoryRef<I32>(memoryPtr, lastIterPtr);
+    U64* lower = &Runtime::memoryRef<U64>(memoryPtr, lowerPtr);
+    U64* upper = &Runtime::memoryRef<U64>(memoryPtr, upperPtr);
+    I64* stride = &Runtime::memoryRef<I64>(memoryPtr, stridePtr);
+
+    return dispatch_next<U64, I64>(lastIter, lower, upper, stride);
+}
+
+/*
+ * Called at the end of each chunk of an ordered loop. Ordered sections aren't
+ * supported, so there's nothing to do.
+ */
+WAVM_DEFINE_INTRINSIC_FUNCTION(env,
+                               "__kmpc_dispatch_fini_4",
+                               void,
+                               __kmpc_dispatch_fini_4,
+                               I32 loc,
+                               I32 gtid)
+{
+    OMP_FUNC_ARGS("__kmpc_dispatch_fini_4 {} {}", loc, gtid);
+}
+
+WAVM_DEFINE_INTRINSIC_FUNCTION(env,
+                               "__kmpc_dispatch_fini_8",
+                               void,
+                               __kmpc_dispatch_fini_8,
+                               I32 loc,
+                               I32 gtid)
+{
+    OMP_FUNC_ARGS("__kmpc_dispatch_fini_8 {} {}", loc, gtid);
+}
+
+// ---------------------------------------------------
+// REDUCTION
+// ---------------------------------------------------
+
+// Partial results from other hosts are copied to this alignment in the
+// master's memory, enough for any type
+#define REDUCE_DATA_ALIGN 16
+
+// How long the master waits for a partial result from another host
+#define REDUCE_PARTIAL_TIMEOUT_MS 60000
+
+// Round of the last reduction by this thread, and the level it was in
+static thread_local uint32_t reduceLevelId = 0;
+static thread_local int reduceRound = -1;
+
+static int nextReduceRound(const std::shared_ptr<threads::Level>& level)
+{
+    if (reduceLevelId != level->id) {
+        reduceLevelId = level->id;
+        reduceRound = -1;
+    }
+
+    return ++reduceRound;
+}
+
+static std::string getReducePartialKey(
+  const std::shared_ptr<threads::Level>& level,
+  int round,
+  int localThreadNum)
+{
+    return fmt::format("omp_reduce_{}_{}_{}", level->id, round, localThreadNum);
+}
+
+/**
+ * Calls the compiler-generated function that combines the reduction variables
+ * pointed to by the second array of pointers into those of the first.
+ */
+static void callReduceFunc(WAVMWasmModule* module,
+                           Runtime::Context* ctx,
+                           I32 reduceFunc,
+                           I32 lhsData,
+                           I32 rhsData)
+{
+    Runtime::Function* func = module->getFunctionFromPtr(reduceFunc);
+    std::vector<IR::UntaggedValue> args = { lhsData, rhsData };
+    IR::UntaggedValue result;
+    module->executeWasmFunction(ctx, func, args, result);
+}
+
+/**
+ * Threads in another host's copy of memory can't combine their variables with
+ * the master's, so send them to it through state. We aren't told the sizes of
+ * the variables, but the thread's private copies are in its stack frame, so we
+ * send everything from the lowest of them up to the top of its stack. Lists
+ * with variable-length sections hold their sizes too, so can't be sent.
+ *
+ * The data goes in one key, then a header with each variable's offset into it,
+ * the data's address and size, and a byte marking the header as written.
+ */
+static void sendReducePartial(Runtime::ContextRuntimeData* contextRuntimeData,
+                              const std::shared_ptr<threads::Level>& level,
+                              int round,
+                              int localThreadNum,
+                              I32 numVars,
+                              I32 reduceSize,
+                              I32 reduceData)
+{
+    WAVMWasmModule* module = getExecutingWAVMModule();
+    Runtime::Memory* memoryPtr = module->defaultMemory;
+
+    if (reduceSize != numVars * (I32)sizeof(U32)) {
+        SPDLOG_ERROR("Reduction of {} variables ({} bytes) can't span hosts",
+                     numVars,
+                     reduceSize);
+        throw std::runtime_error("Variable-length reduction spans hosts");
+    }
+
+    Runtime::Context* ctx =
+      Runtime::getContextFromRuntimeData(contextRuntimeData);
+    U32 stackPointer = ctx->runtimeData->mutableGlobals[0].u32;
+    U32 stackTop = module->getThreadStackTop(stackPointer);
+
+    U32* varPtrs = Runtime::memoryArrayPtr<U32>(memoryPtr, reduceData, numVars);
+    U32 dataPtr = stackTop;
+    for (int i = 0; i < numVars; i++) {
+        if (varPtrs[i] < stackPointer || varPtrs[i] > stackTop) {
+            SPDLOG_ERROR("Reduction variable {} at {} not on stack ({}-{})",
+                         i,
+                         varPtrs[i],
+                         stackPointer,
+                         stackTop);
+            throw std::runtime_error("Reduction variable not on stack");
+        }
+
+        dataPtr = std::min(dataPtr, varPtrs[i]);
+    }
+
+    U32 dataSize = stackTop + 1 - dataPtr;
+
+    std::string user = getExecutingCall()->user();
+    std::string key = getReducePartialKey(level, round, localThreadNum);
+    faabric::state::State& state = faabric::state::getGlobalState();
+
+    auto dataKv = state.getKV(user, key + "_data", dataSize);
+    dataKv->set(Runtime::memoryArrayPtr<U8>(memoryPtr, dataPtr, dataSize));
+    dataKv->pushFull();
+
+    std::vector<U32> header(numVars + 2);
+    for (int i = 0; i < numVars; i++) {
+        header.at(i) = varPtrs[i] - dataPtr;
+    }
+    header.at(numVars) = dataPtr;
+    header.at(numVars + 1) = dataSize;
+
+    size_t headerBytes = header.size() * sizeof(U32);
+    std::vector<uint8_t> partial(headerBytes + 1, 0);
+    std::memcpy(partial.data(), header.data(), headerBytes);
+    partial.back() = 1;
+
+    auto kv = state.getKV(user, key, partial.size());
+    kv->set(partial.data());
+    kv->pushFull();
+}
+
+/**
+ * Combines the partial results sent by threads on other hosts into the
+ * master's reduction variables.
+ */
+static void mergeReducePartials(const std::shared_ptr<threads::Level>& level,
+                                const std::vector<int>& remoteThreadNums,
+                                int round,
+                                Runtime::Context* ctx,
+                                I32 numVars,
+                                I32 reduceData,
+                                I32 reduceFunc)
+{
+    if (remoteThreadNums.empty()) {
+        return;
+    }
+
+    PROF_START(MergeReducePartials)
+
+    WAVMWasmModule* module = getExecutingWAVMModule();
+    Runtime::Memory* memoryPtr = module->defaultMemory;
+    std::string user = getExecutingCall()->user();
+    faabric::state::State& state = faabric::state::getGlobalState();
+
+    size_t headerBytes = (numVars + 2) * sizeof(U32);
+    std::vector<uint8_t> partial(headerBytes + 1, 0);
+    for (int threadNum : remoteThreadNums) {
+        std::string key = getReducePartialKey(level, round, threadNum);
+        auto kv = state.getKV(user, key, partial.size());
+
+        // Wait for the thread to send its values
+        auto startTime = std::chrono::steady_clock::now();
+        while (true) {
+            kv->pull();
+            kv->get(partial.data());
+            if (partial.back() != 0) {
+                break;
+            }
+
+            auto waited = std::chrono::steady_clock::now() - startTime;
+            if (waited > std::chrono::milliseconds(REDUCE_PARTIAL_TIMEOUT_MS)) {
+                SPDLOG_ERROR("Timed out waiting for reduction from thread {}",
+                             threadNum);
+                throw std::runtime_error("Timed out waiting for reduction");
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        std::vector<U32> header(numVars + 2);
+        std::memcpy(header.data(), partial.data(), headerBytes);
+        U32 dataPtr = header.at(numVars);
+        U32 dataSize = header.at(numVars + 1);
+
+        // The data needs to be in wasm memory, behind an array of pointers
+        // like the one the compiler gives us. It keeps its alignment.
+        uint32_t ptrsBytes = numVars * sizeof(U32);
+        uint32_t dataOffset =
+          (ptrsBytes + REDUCE_DATA_ALIGN - 1) / REDUCE_DATA_ALIGN *
+            REDUCE_DATA_ALIGN +
+          dataPtr % REDUCE_DATA_ALIGN;
+        uint32_t scratchBytes = dataOffset + dataSize;
+        uint32_t scratch = checkMemoryGrow(module->mmapMemory(scratchBytes));
+
+        U32* scratchPtrs =
+          Runtime::memoryArrayPtr<U32>(memoryPtr, scratch, numVars);
+        for (int i = 0; i < numVars; i++) {
+            scratchPtrs[i] = scratch + dataOffset + header.at(i);
+        }
+
+        auto dataKv = state.getKV(user, key + "_data", dataSize);
+        dataKv->pull();
+        dataKv->get(Runtime::memoryArrayPtr<U8>(
+          memoryPtr, scratch + dataOffset, dataSize));
+
+        callReduceFunc(module, ctx, reduceFunc, reduceData, scratch);
+
+        module->unmapMemory(scratch, scratchBytes);
+        state.deleteKV(user, key + "_data");
+        state.deleteKV(user, key);
+    }
+
+    PROF_END(MergeReducePartials)
+}
+
+/**
+ * Threads sharing the master's memory combine their data in a tree with the
+ * compiler-provided reduce function. The master combines any partial results
+ * from other hosts, then returns 1 so that it alone writes the result to the
+ * shared variables. The others return 0 once their data has been consumed,
+ * or, for a blocking reduction, once the master has finished.
+ */
+static I32 doReduce(Runtime::ContextRuntimeData* contextRuntimeData,
+                    I32 numVars,
+                    I32 reduceSize,
+                    I32 reduceData,
+                    I32 reduceFunc,
+                    bool blocking)
+{
+    std::shared_ptr<threads::Level> level = threads::getCurrentOpenMPLevel();
+    faabric::Message* msg = getExecutingCall();
+    int localThreadNum = level->getLocalThreadNum(msg);
+
+    if (level->numThreads == 1) {
+        return 1;
+    }
+
+    int round = nextReduceRound(level);
+    std::shared_ptr<threads::Reduction> reduction = level->getReduction();
+
+    if (reduction == nullptr) {
+        sendReducePartial(contextRuntimeData,
+                          level,
+                          round,
+                          localThreadNum,
+                          numVars,
+                          reduceSize,
+                          reduceData);
+        return 0;
+    }
+
+    WAVMWasmModule* module = getExecutingWAVMModule();
+    Runtime::Context* ctx =
+      Runtime::getContextFromRuntimeData(contextRuntimeData);
+
+    int rank = reduction->getRank(localThreadNum);
+    int nLocal = reduction->getLocalThreads().size();
+
+    for (int stride = 1; stride < nLocal; stride *= 2) {
+        if (rank % (2 * stride) != 0) {
+            // Hand our data to the parent, which must be done with it before
+            // it goes out of scope
+            reduction->arrive(round, rank, reduceData);
+            if (blocking) {
+                reduction->awaitRelease(round);
+            } else {
+                reduction->awaitConsumed(round, rank);
+            }
+
+            reduction->finish(round);
+            return 0;
+        }
+
+        int childRank = rank + stride;
+        if (childRank < nLocal) {
+            I32 childData = reduction->awaitArrival(round, childRank);
+            callReduceFunc(module, ctx, reduceFunc, reduceData, childData);
+            reduction->markConsumed(round, childRank);
+        }
+    }
+
+    mergeReducePartials(level,
+                        reduction->getRemoteThreads(level->numThreads),
+                        round,
+                        ctx,
+                        numVars,
+                        reduceData,
+                        reduceFunc);
+
+    // A blocking reduction finishes when the master calls end_reduce
+    if (!blocking) {
+        reduction->finish(round);
+    }
+
+    return 1;
+}
+
+/**
+ * Called by the master once it has written the result of a blocking
+ * reduction, releasing the other threads.
+ */
+static void finaliseReduce()
+{
+    std::shared_ptr<threads::Level> level = threads::getCurrentOpenMPLevel();
+    if (level->numThreads == 1) {
+        return;
+    }
+
+    std::shared_ptr<threads::Reduction> reduction = level->getReduction();
+    if (reduction == nullptr) {
+        return;
+    }
+
+    reduction->release(reduceRound);
+    reduction->finish(reduceRound);
+}
+
+/**
+ * Return values follow the OpenMP runtime, 1 meaning the calling thread writes
+ * the result to the shared variables (and calls the matching end_reduce), and
+ * 0 meaning there's nothing more to do. We never return 2 (atomic reduction).
+ * https://github.com/llvm/llvm-project/blob/main/openmp/runtime/src/kmp_csupport.cpp
+ */
+WAVM_DEFINE_INTRINSIC_FUNCTION(env,
+                               "__kmpc_reduce",
+                               I32,
+                               __kmpc_reduce,
+                               I32 loc,
+                               I32 gtid,
+                               I32 numVars,
+                               I32 reduceSize,
+                               I32 reduceData,
+                               I32 reduceFunc,
+                               I32 lockPtr)
+{
+    OMP_FUNC_ARGS("__kmpc_reduce {} {} {} {} {} {} {}",
+                  loc,
+                  gtid,
+                  numVars,
+                  reduceSize,
+                  reduceData,
+                  reduceFunc,
+                  lockPtr);
+
+    return doReduce(
+      contextRuntimeData, numVars, reduceSize, reduceData, reduceFunc, true);
+}
+
+/**
+ * See __kmpc_reduce
+ */
+WAVM_DEFINE_INTRINSIC_FUNCTION(env,
+                               "__kmpc_reduce_nowait",
+                               I32,
+                               __kmpc_reduce_nowait,
+                               I32 loc,
+                               I32 gtid,
+                               I32 numVars,
+                               I32 reduceSize,
+                               I32 reduceData,
+                               I32 reduceFunc,
+                               I32 lockPtr)
+{
+    OMP_FUNC_ARGS("__kmpc_reduce_nowait {} {} {} {} {} {} {}",
+                  loc,
+                  gtid,
+                  numVars,
+                  reduceSize,
+                  reduceData,
+                  reduceFunc,
+                  lockPtr);
+
+    return doReduce(
+      contextRuntimeData, numVars, reduceSize, reduceData, reduceFunc, false);
+}
+
+/**
+ * Finalises a blocking reduce, called only by the master.
+ */
+WAVM_DEFINE_INTRINSIC_FUNCTION(env,
+                               "__kmpc_end_reduce",
+                               void,
+                               __kmpc_end_reduce,
+                               I32 loc,
+                               I32 gtid,
+                               I32 lck)
+{
+    OMP_FUNC_ARGS("__kmpc_end_reduce {} {} {}", loc, gtid, lck);
+    finaliseReduce();
+}
+
+/**
+ * Finalises a non-blocking reduce, called only by the master, which has
+ * nothing left to do.
+ */
+WAVM_DEFINE_INTRINSIC_FUNCTION(env,
+                               "__kmpc_end_reduce_nowait",
+                               void,
+                               __kmpc_end_reduce_nowait,
+                               I32 loc,
+                               I32 gtid,
+                               I32 lck)
+{
+    OMP_FUNC_ARGS("__kmpc_end_reduce_nowait {} {} {}", loc, gtid, lck);
+}
+
+// ---------------------------------------------------
+// TASKS
+// ---------------------------------------------------
+
+// Fields of kmp_task_t, which the compiler lays out at the start of each task
+#define TASK_SHAREDS_IDX 0
+#define TASK_ROUTINE_IDX 1
+#define TASK_PART_ID_IDX 2
+#define TASK_DESTRUCTORS_IDX 3
+#define TASK_HEADER_WORDS 4
+
+// Bits of kmp_tasking_flags_t used here
+#define TASK_FLAG_FINAL (1 << 1)
+#define TASK_FLAG_DESTRUCTORS (1 << 3)
+
+// Tasks are carved out of slabs mapped into the wasm memory
+#define TASK_SLAB_BYTES (1024 * 1024)
+#define TASK_ALIGN_BYTES 16
+
+/*
+ * Allocates the memory for the tasks of a level in the wasm memory, reusing
+ * freed blocks of the same size.
+ */
+class TaskArena
+{
+  public:
+    I32 allocate(WAVMWasmModule* module, U32 nBytes, I32 flags)
+    {
+        nBytes = roundUpToTaskAlign(nBytes);
+
+        std::unique_lock<std::mutex> lock(mx);
+
+        I32 taskPtr;
+        std::vector<I32>& reusable = freeBlocks[nBytes];
+        if (!reusable.empty()) {
+            taskPtr = reusable.back();
+            reusable.pop_back();
+        } else if (nBytes > TASK_SLAB_BYTES) {
+            // Oversized tasks get a slab to themselves
+            taskPtr = checkMemoryGrow(module->mmapMemory(nBytes));
+            slabs.emplace_back(taskPtr, nBytes);
+        } else {
+            if (slabNext + nBytes > slabEnd) {
+                slabNext = checkMemoryGrow(module->mmapMemory(TASK_SLAB_BYTES));
+                slabEnd = slabNext + TASK_SLAB_BYTES;
+                slabs.emplace_back(slabNext, TASK_SLAB_BYTES);
+            }
+
+            taskPtr = slabNext;
+            slabNext += nBytes;
+        }
+
+        blocks[taskPtr] = { nBytes, flags };
+
+        return taskPtr;
+    }
+
+    I32 getFlags(I32 taskPtr)
+    {
+        std::unique_lock<std::mutex> lock(mx);
+        return getBlock(taskPtr).flags;
+    }
+
+    // Slabs can be unmapped as soon as they're empty if nothing can be
+    // waiting to run in them
+    void free(WAVMWasmModule* module, I32 taskPtr, bool releaseIfEmpty)
+    {
+        std::unique_lock<std::mutex> lock(mx);
+
+        Block& block = getBlock(taskPtr);
+        freeBlocks[block.bytes].push_back(taskPtr);
+        blocks.erase(taskPtr);
+
+        if (releaseIfEmpty && blocks.empty()) {
+            doRelease(module);
+        }
+    }
+
+    void release(WAVMWasmModule* module)
+    {
+        std::unique_lock<std::mutex> lock(mx);
+        doRelease(module);
+    }
+
+  private:
+    struct Block
+    {
+        U32 bytes;
+        I32 flags;
+    };
+
+    std::mutex mx;
+
+    std::vector<std::pair<U32, U32>> slabs;
+    U32 slabNext = 0;
+    U32 slabEnd = 0;
+
+    std::unordered_map<I32, Block> blocks;
+    std::unordered_map<U32, std::vector<I32>> freeBlocks;
+
+    static U32 roundUpToTaskAlign(U32 nBytes)
+    {
+        return (nBytes + TASK_ALIGN_BYTES - 1) & ~(TASK_ALIGN_BYTES - 1);
+    }
+
+    Block& getBlock(I32 taskPtr)
+    {
+        auto it = blocks.find(taskPtr);
+        if (it == blocks.end()) {
+            SPDLOG_ERROR("Unknown OpenMP task {}", taskPtr);
+            throw std::runtime_error("Unknown OpenMP task");
+        }
+
+        return it->second;
+    }
+
+    void doRelease(WAVMWasmModule* module)
+    {
+        for (const auto& [offset, nBytes] : slabs) {
+            module->unmapMemory(offset, nBytes);
+        }
+
+        slabs.clear();
+        slabNext = 0;
+        slabEnd = 0;
+        blocks.clear();
+        freeBlocks.clear();
+    }
+};
+
+// Arenas of levels whose tasks can run on any thread, released by the master
+static std::mutex taskArenasMx;
+static std::unordered_map<uint32_t, std::shared_ptr<TaskArena>> taskArenas;
+
+// Arenas of levels whose tasks only run on the thread that creates them,
+// released when the thread leaves the level
+static thread_local std::unordered_map<uint32_t, std::shared_ptr<TaskArena>>
+  privateTaskArenas;
+
+/*
+ * Tasking state of the level a thread is currently in, looked up once per
+ * level. Tasks are only deferred when the whole team shares this memory,
+ * otherwise the thread that creates a task runs it straight away. The arena
+ * is only looked up once the level has a task.
+ */
+struct TaskingState
+{
+    bool initialised = false;
+    uint32_t levelId = 0;
+    bool deferred = false;
+    std::shared_ptr<threads::TaskPool> pool = nullptr;
+    std::shared_ptr<TaskArena> arena = nullptr;
+};
+
+static thread_local TaskingState tasking;
+
+/*
+ * The task a thread is running, the bottom one being its implicit task
+ */
+struct TaskFrame
+{
+    std::shared_ptr<threads::TaskCounter> children =
+      std::make_shared<threads::TaskCounter>();
+
+    // Group this task was created in, and the taskgroups opened inside it
+    std::shared_ptr<threads::TaskCounter> parentGroup = nullptr;
+    std::vector<std::shared_ptr<threads::TaskCounter>> groups;
+
+    // Tasks created inside a final task run straight away
+    bool final = false;
+
+    std::shared_ptr<threads::TaskCounter> getGroup()
+    {
+        return groups.empty() ? parentGroup : groups.back();
+    }
+};
+
+static thread_local std::vector<TaskFrame> taskFrames;
+
+static TaskingState& getTaskingState(
+  const std::shared_ptr<threads::Level>& level)
+{
+    if (tasking.initialised && tasking.levelId == level->id) {
+        return tasking;
+    }
+
+    tasking.initialised = true;
+    tasking.levelId = level->id;
+    tasking.deferred = level->depth > 0 && level->numThreads > 1 &&
+                       isLevelInOneMemory(level);
+    tasking.pool = tasking.deferred ? level->getTaskPool() : nullptr;
+    tasking.arena = nullptr;
+
+    return tasking;
+}
+
+static std::shared_ptr<TaskArena> getTaskArena(
+  const std::shared_ptr<threads::Level>& level,
+  TaskingState& state)
+{
+    if (state.arena != nullptr) {
+        return state.arena;
+    }
+
+    if (state.deferred) {
+        faabric::util::UniqueLock lock(taskArenasMx);
+        std::shared_ptr<TaskArena>& arena = taskArenas[level->id];
+        if (arena == nullptr) {
+            arena = std::make_shared<TaskArena>();
+        }
+        state.arena = arena;
+    } else {
+        std::shared_ptr<TaskArena>& arena = privateTaskArenas[level->id];
+        if (arena == nullptr) {
+            arena = std::make_shared<TaskArena>();
+        }
+        state.arena = arena;
+    }
+
+    return state.arena;
+}
+
+static TaskFrame& getCurrentTaskFrame()
+{
+    if (taskFrames.empty()) {
+        taskFrames.emplace_back();
+    }
+
+    return taskFrames.back();
+}
+
+/**
+ * Starts a task's frame from the state of the task that created it, which
+ * isn't necessarily the one running on this thread.
+ */
+static void pushTaskFrame(const threads::ExplicitTask& task, I32 flags)
+{
+    // Make sure the thread's implicit task is at the bottom
+    getCurrentTaskFrame();
+
+    TaskFrame frame;
+    frame.parentGroup = task.group;
+    frame.final = task.parentFinal || (flags & TASK_FLAG_FINAL) != 0;
+
+    taskFrames.push_back(std::move(frame));
+}
+
+/**
+ * Runs the task's destructors if it has any, then frees it.
+ */
+static void completeTask(const std::shared_ptr<threads::Level>& level,
+                         Runtime::Context* ctx,
+                         I32 globalThreadNum,
+                         I32 taskPtr,
+                         bool runDestructors)
+{
+    WAVMWasmModule* module = getExecutingWAVMModule();
+    TaskingState& state = getTaskingState(level);
+    std::shared_ptr<TaskArena> arena = getTaskArena(level, state);
+    bool deferred = state.deferred;
+
+    I32 flags = arena->getFlags(taskPtr);
+    if (runDestructors && (flags & TASK_FLAG_DESTRUCTORS) != 0) {
+        U32* header = Runtime::memoryArrayPtr<U32>(
+          module->defaultMemory, taskPtr, TASK_HEADER_WORDS);
+        Runtime::Function* func =
+          module->getFunctionFromPtr(header[TASK_DESTRUCTORS_IDX]);
+        std::vector<IR::UntaggedValue> args = { globalThreadNum, taskPtr };
+        IR::UntaggedValue result;
+        module->executeWasmFunction(ctx, func, args, result);
+    }
+
+    arena->free(module, taskPtr, !deferred);
+}
+
+/**
+ * Calls the compiler-generated task entry, which takes the thread's global
+ * id and the task.
+ */
+static void runTask(const std::shared_ptr<threads::Level>& level,
+                    Runtime::Context* ctx,
+                    I32 globalThreadNum,
+                    const threads::ExplicitTask& task)
+{
+    WAVMWasmModule* module = getExecutingWAVMModule();
+    TaskingState& state = getTaskingState(level);
+    I32 taskPtr = task.taskPtr;
+
+    pushTaskFrame(task, getTaskArena(level, state)->getFlags(taskPtr));
+
+    try {
+        U32* header = Runtime::memoryArrayPtr<U32>(
+          module->defaultMemory, taskPtr, TASK_HEADER_WORDS);
+        Runtime::Function* func =
+          module->getFunctionFromPtr(header[TASK_ROUTINE_IDX]);
+        std::vector<IR::UntaggedValue> args = { globalThreadNum, taskPtr };
+        IR::UntaggedValue result;
+        module->executeWasmFunction(ctx, func, args, result);
+    } catch (...) {
+        // Don't leave the task's memory behind if it fails
+        taskFrames.pop_back();
+        completeTask(level, ctx, globalThreadNum, taskPtr, false);
+        throw;
+    }
+
+    taskFrames.pop_back();
+    completeTask(level, ctx, globalThreadNum, taskPtr, true);
+}
+
+/**
+ * Runs queued tasks of the level, this thread's own first, until there's
+ * nothing left to wait for.
+ */
+template<typename Done>
+static void runTasksUntil(const std::shared_ptr<threads::Level>& level,
+                          Runtime::Context* ctx,
+                          Done isDone)
+{
+    TaskingState& state = getTaskingState(level);
+    if (!state.deferred) {
+        return;
+    }
+
+    // Running tasks can replace the thread's tasking state
+    std::shared_ptr<threads::TaskPool> pool = state.pool;
+
+    faabric::Message* msg = getExecutingCall();
+    int localThreadNum = level->getLocalThreadNum(msg);
+    int globalThreadNum = level->getGlobalThreadNum(msg);
+
+    threads::ExplicitTask task;
+    while (!isDone()) {
+        if (pool->pop(localThreadNum, task)) {
+            runTask(level, ctx, globalThreadNum, task);
+            pool->finish(task);
+        } else {
+            // A failed thread may never finish the tasks we're waiting on
+            level->checkAborted();
+            std::this_thread::yield();
+        }
+    }
+}
+
+/**
+ * Waits for the tasks counted by the given counter, e.g. the children of the
+ * current task.
+ */
+static void awaitTasks(const std::shared_ptr<threads::Level>& level,
+                       Runtime::Context* ctx,
+                       std::shared_ptr<threads::TaskCounter> counter)
+{
+    runTasksUntil(level, ctx, [&counter] {
+        return counter->count.load(std::memory_order_acquire) == 0;
+    });
+}
+
+/**
+ * Queues a task on this thread's deque, from which any thread of the level
+ * can take it. Tasks run straight away when they can't be deferred, i.e. the
+ * team spans more than one memory, the thread's deque is full, or the
+ * current task is final.
+ */
+static void deferOrRunTask(const std::shared_ptr<threads::Level>& level,
+                           Runtime::Context* ctx,
+                           I32 taskPtr)
+{
+    faabric::Message* msg = getExecutingCall();
+    TaskingState& state = getTaskingState(level);
+    TaskFrame& frame = getCurrentTaskFrame();
+
+    threads::ExplicitTask task;
+    task.taskPtr = taskPtr;
+    task.siblings = frame.children;
+    task.group = frame.getGroup();
+    task.parentFinal = frame.final;
+
+    if (state.deferred && !frame.final &&
+        state.pool->push(level->getLocalThreadNum(msg), task)) {
+        return;
+    }
+
+    runTask(level, ctx, level->getGlobalThreadNum(msg), task);
+}
+
+/**
+ * Every task created in a parallel region has to finish by the next barrier,
+ * or the end of the region, so the threads of the level run them until there
+ * are none left.
+ */
+void finishOpenMPTasks(Runtime::Context* ctx)
+{
+    std::shared_ptr<threads::Level> level = threads::getCurrentOpenMPLevel();
+    TaskingState& state = getTaskingState(level);
+    if (!state.deferred) {
+        return;
+    }
+
+    std::shared_ptr<threads::TaskPool> pool = state.pool;
+    runTasksUntil(level, ctx, [&pool] { return pool->getOutstanding() == 0; });
+}
+
+/**
+ * Releases the tasks only this thread could run in the current level, and
+ * forgets the level's tasking state.
+ */
+void leaveOpenMPTasks(WAVMWasmModule* module)
+{
+    std::shared_ptr<threads::Level> level = threads::getCurrentOpenMPLevel();
+
+    auto it = privateTaskArenas.find(level->id);
+    if (it != privateTaskArenas.end()) {
+        std::shared_ptr<TaskArena> arena = it->second;
+        privateTaskArenas.erase(it);
+        arena->release(module);
+    }
+
+    if (tasking.initialised && tasking.levelId == level->id) {
+        tasking = TaskingState();
+    }
+}
+
+/**
+ * Tasks any thread of the level could run are released along with the level
+ * by the master, once all its threads have finished.
+ */
+static void clearTaskArena(const std::shared_ptr<threads::Level>& level,
+                           WAVMWasmModule* module)
+{
+    std::shared_ptr<TaskArena> arena;
+    {
+        faabric::util::UniqueLock lock(taskArenasMx);
+        auto it = taskArenas.find(level->id);
+        if (it == taskArenas.end()) {
+            return;
+        }
+
+        arena = it->second;
+        taskArenas.erase(it);
+    }
+
+    arena->release(module);
+}
+
+/**
+ * Allocates a task, which the compiler then fills in with the task's private
+ * variables, and pointers to its shared ones. The shared pointers go after the
+ * task itself.
+ *
+ * @param flags kmp_tasking_flags_t, e.g. whether the task is final
+ * @param sizeofTask size of kmp_task_t plus the task's private variables
+ * @param sizeofShareds size of the pointers to the task's shared variables
+ * @param taskEntry function pointer to the task's routine
+ * @return the task
+ */
+WAVM_DEFINE_INTRINSIC_FUNCTION(env,
+                               "__kmpc_omp_task_alloc",
+                               I32,
+                               __kmpc_omp_task_alloc,
+                               I32 loc,
+                               I32 gtid,
+                               I32 flags,
+                               I32 sizeofTask,
+                               I32 sizeofShareds,
+                               I32 taskEntry)
+{
+    OMP_FUNC_ARGS("__kmpc_omp_task_alloc {} {} {} {} {} {}",
+                  loc,
+                  gtid,
+                  flags,
+                  sizeofTask,
+                  sizeofShareds,
+                  taskEntry);
+
+    WAVMWasmModule* module = getExecutingWAVMModule();
+    TaskingState& state = getTaskingState(level);
+
+    U32 sharedsOffset =
+      (sizeofTask + TASK_ALIGN_BYTES - 1) & ~(TASK_ALIGN_BYTES - 1);
+    I32 taskPtr = getTaskArena(level, state)->allocate(
+      module, sharedsOffset + sizeofShareds, flags);
+
+    U32* header = Runtime::memoryArrayPtr<U32>(
+      module->defaultMemory, taskPtr, TASK_HEADER_WORDS);
+    header[TASK_SHAREDS_IDX] = sizeofShareds > 0 ? taskPtr + sharedsOffset : 0;
+    header[TASK_ROUTINE_IDX] = taskEntry;
+    header[TASK_PART_ID_IDX] = 0;
+
+    return taskPtr;
+}
+
+/**
+ * Defers a task if possible, see deferOrRunTask.
+ *
+ * @return 0, i.e. TASK_CURRENT_NOT_QUEUED
+ */
+WAVM_DEFINE_INTRINSIC_FUNCTION(env,
+                               "__kmpc_omp_task",
+                               I32,
+                               __kmpc_omp_task,
+                               I32 loc,
+                               I32 gtid,
+                               I32 taskPtr)
+{
+    OMP_FUNC_ARGS("__kmpc_omp_task {} {} {}", loc, gtid, taskPtr);
+
+    deferOrRunTask(level,
+                   Runtime::getContextFromRuntimeData(contextRuntimeData),
+                   taskPtr);
+
+    return 0;
+}
+
+/**
+ * Dependencies aren't tracked per address. Instead, a task with dependencies
+ * degrades to a taskwait followed by creating the task, i.e. it waits for all
+ * the tasks created before it by the same task, whatever their dependencies.
+ * This respects any dependency between them, but serialises independent
+ * tasks around it.
+ */
+WAVM_DEFINE_INTRINSIC_FUNCTION(env,
+                               "__kmpc_omp_task_with_deps",
+                               I32,
+                               __kmpc_omp_task_with_deps,
+                               I32 loc,
+                               I32 gtid,
+                               I32 taskPtr,
+                               I32 nDeps,
+                               I32 depList,
+                               I32 nDepsNoalias,
+                               I32 noaliasDepList)
+{
+    OMP_FUNC_ARGS("__kmpc_omp_task_with_deps {} {} {} {} {} {} {}",
+                  loc,
+                  gtid,
+                  taskPtr,
+                  nDeps,
+                  depList,
+                  nDepsNoalias,
+                  noaliasDepList);
+
+    Runtime::Context* ctx =
+      Runtime::getContextFromRuntimeData(contextRuntimeData);
+    awaitTasks(level, ctx, getCurrentTaskFrame().children);
+    deferOrRunTask(level, ctx, taskPtr);
+
+    return 0;
+}
+
+/**
+ * Waits for the dependencies of an undeferred task. As with
+ * __kmpc_omp_task_with_deps, this is a taskwait.
+ */
+WAVM_DEFINE_INTRINSIC_FUNCTION(env,
+                               "__kmpc_omp_wait_deps",
+                               void,
+                               __kmpc_omp_wait_deps,
+                               I32 loc,
+                               I32 gtid,
+                               I32 nDeps,
+                               I32 depList,
+                               I32 nDepsNoalias,
+                               I32 noaliasDepList)
+{
+    OMP_FUNC_ARGS("__kmpc_omp_wait_deps {} {} {} {} {} {}",
+                  loc,
+                  gtid,
+                  nDeps,
+                  depList,
+                  nDepsNoalias,
+                  noaliasDepList);
+
+    Runtime::Context* ctx =
+      Runtime::getContextFromRuntimeData(contextRuntimeData);
+    awaitTasks(level, ctx, getCurrentTaskFrame().children);
+}
+
+/**
+ * Called before the compiler runs an undeferred task (e.g. with a false if
+ * clause) itself.
+ */
+WAVM_DEFINE_INTRINSIC_FUNCTION(env,
+                               "__kmpc_omp_task_begin_if0",
+                               void,
+                               __kmpc_omp_task_begin_if0,
+                               I32 loc,
+                               I32 gtid,
+                               I32 taskPtr)
+{
+    OMP_FUNC_ARGS("__kmpc_omp_task_begin_if0 {} {} {}", loc, gtid, taskPtr);
+
+    // The current task creates and runs this one
+    TaskFrame& parent = getCurrentTaskFrame();
+    threads::ExplicitTask task;
+    task.taskPtr = taskPtr;
+    task.group = parent.getGroup();
+    task.parentFinal = parent.final;
+
+    TaskingState& state = getTaskingState(level);
+    pushTaskFrame(task, getTaskArena(level, state)->getFlags(taskPtr));
+}
+
+/**
+ * Called once the compiler has run an undeferred task.
+ */
+WAVM_DEFINE_INTRINSIC_FUNCTION(env,
+                               "__kmpc_omp_task_complete_if0",
+                               void,
+                               __kmpc_omp_task_complete_if0,
+                               I32 loc,
+                               I32 gtid,
+                               I32 taskPtr)
+{
+    OMP_FUNC_ARGS("__kmpc_omp_task_complete_if0 {} {} {}", loc, gtid, taskPtr);
+
+    taskFrames.pop_back();
+    completeTask(level,
+                 Runtime::getContextFromRuntimeData(contextRuntimeData),
+                 globalThreadNum,
+                 taskPtr,
+                 true);
+}
+
+/**
+ * Waits for the children of the current task, running queued tasks meanwhile.
+ *
+ * @return 0, i.e. TASK_CURRENT_NOT_QUEUED
+ */
+WAVM_DEFINE_INTRINSIC_FUNCTION(env,
+                               "__kmpc_omp_taskwait",
+                               I32,
+                               __kmpc_omp_taskwait,
+                               I32 loc,
+                               I32 gtid)
+{
+    OMP_FUNC_ARGS("__kmpc_omp_taskwait {} {}", loc, gtid);
+
+    Runtime::Context* ctx =
+      Runtime::getContextFromRuntimeData(contextRuntimeData);
+    awaitTasks(level, ctx, getCurrentTaskFrame().children);
+
+    return 0;
+}
+
+/**
+ * Lets the thread run another task, if there's one queued.
+ */
+WAVM_DEFINE_INTRINSIC_FUNCTION(env,
+                               "__kmpc_omp_taskyield",
+                               I32,
+                               __kmpc_omp_taskyield,
+                               I32 loc,
+                               I32 gtid,
+                               I32 endPart)
+{
+    OMP_FUNC_ARGS("__kmpc_omp_taskyield {} {} {}", loc, gtid, endPart);
+
+    TaskingState& state = getTaskingState(level);
+    if (!state.deferred) {
+        return 0;
+    }
+
+    std::shared_ptr<threads::TaskPool> pool = state.pool;
+    threads::ExplicitTask task;
+    if (pool->pop(localThreadNum, task)) {
+        runTask(level,
+                Runtime::getContextFromRuntimeData(contextRuntimeData),
+                globalThreadNum,
+                task);
+        pool->finish(task);
+    }
+
+    return 0;
+}
+
+/**
+ * Starts a taskgroup, which waits for all the tasks created inside it, and
+ * their descendants.
+ */
+WAVM_DEFINE_INTRINSIC_FUNCTION(env,
+                               "__kmpc_taskgroup",
+                               void,
+                               __kmpc_taskgroup,
+                               I32 loc,
+                               I32 gtid)
+{
+    OMP_FUNC_ARGS("__kmpc_taskgroup {} {}", loc, gtid);
+
+    getCurrentTaskFrame().groups.push_back(
+      std::make_shared<threads::TaskCounter>());
+}
+
+/**
+ * See __kmpc_taskgroup
+ */
+WAVM_DEFINE_INTRINSIC_FUNCTION(env,
+                               "__kmpc_end_taskgroup",
+                               void,
+                               __kmpc_end_taskgroup,
+                               I32 loc,
+                               I32 gtid)
+{
+    OMP_FUNC_ARGS("__kmpc_end_taskgroup {} {}", loc, gtid);
+
+    if (getCurrentTaskFrame().groups.empty()) {
+        SPDLOG_ERROR("Ending taskgroup with none open (thread {})",
+                     localThreadNum);
+        throw std::runtime_error("Ending taskgroup with none open");
+    }
+
+    std::shared_ptr<threads::TaskCounter> group =
+      getCurrentTaskFrame().groups.back();
+
+    Runtime::Context* ctx =
+      Runtime::getContextFromRuntimeData(contextRuntimeData);
+    awaitTasks(level, ctx, group);
+
+    getCurrentTaskFrame().groups.pop_back();
 }
 
 // ----------------------------------------------
@@ -318,6 +318,13 @@ int32_t s__mmap(int32_t addr,
                 int32_t fd,
                 int32_t offset);
 
+int32_t s__mmap2(int32_t addr,
+                 int32_t length,
+                 int32_t prot,
+                 int32_t flags,
+                 int32_t fd,
+                 int32_t offset);
+
 int32_t s__mprotect(int32_t addrPtr, int32_t len, int32_t prot);
 
 int32_t s__nanosleep(int32_t reqPtr, int32_t remPtr);
@@ -7,6 +7,7 @@
 #include <faabric/util/func.h>
 #include <faabric/util/logging.h>
 #include <threads/ThreadState.h>
+#include <wasm/SparseSnapshot.h>
 #include <wasm/WasmModule.h>
 #include <wasm/chaining.h>
 #include <wavm/WAVMWasmModule.h>
@@ -137,6 +138,17 @@ WAVM_DEFINE_INTRINSIC_FUNCTION(env,
     // If we're done with executing threads, remove the snapshot
     if (thisModule->chainedThreads.empty()) {
         SPDLOG_DEBUG("Finished with snapshot: {}", currentSnapshotKey);
+
+        // Sparse snapshots are kept alive here until deleted, including on
+        // the hosts they were pushed to
+        if (isSparseSnapshotKey(currentSnapshotKey)) {
+            sch.broadcastSnapshotDelete(*getExecutingCall(),
+                                        currentSnapshotKey);
+            faabric::snapshot::getSnapshotRegistry().deleteSnapshot(
+              currentSnapshotKey);
+            releaseSparseSnapshot(currentSnapshotKey);
+        }
+
         currentSnapshotKey = "";
     }
 
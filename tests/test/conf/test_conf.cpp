@@ -28,6 +28,20 @@ TEST_CASE("Test default faasm config initialisation", "[conf]")
     REQUIRE(conf.wasmVm == "wavm");
 
     REQUIRE(conf.chainedCallTimeout == 300000);
+    REQUIRE(conf.moduleCacheMaxMb == 0);
+    REQUIRE(conf.resetMode == "clone");
+    REQUIRE(conf.warmPoolMaxSize == 0);
+    REQUIRE(conf.warmPoolWindowMs == 1000);
+    REQUIRE(conf.tieredCompilation == "off");
+    REQUIRE(conf.hugePages == "off");
+    REQUIRE(conf.guardMode == "readonly");
+    REQUIRE(conf.snapshotMode == "full");
+    REQUIRE(conf.restoreMode == "eager");
+    REQUIRE(conf.shareZygoteMemory == "off");
+    REQUIRE(conf.ompLocalFork == "off");
+    REQUIRE(conf.functionMemoryLimitMb == 0);
+    REQUIRE(conf.userMemoryLimitMb == 0);
+    REQUIRE(conf.memorySoftLimitPercent == 80);
 }
 
 TEST_CASE("Test overriding faasm config initialisation", "[conf]")
@@ -44,6 +58,20 @@ TEST_CASE("Test overriding faasm config initialisation", "[conf]")
     std::string wasmVm = setEnvVar("WASM_VM", "blah");
 
     std::string chainedTimeout = setEnvVar("CHAINED_CALL_TIMEOUT", "9999");
+    std::string moduleCacheMax = setEnvVar("MODULE_CACHE_MAX_MB", "512");
+    std::string resetMode = setEnvVar("RESET_MODE", "cow");
+    std::string warmPoolMax = setEnvVar("WARM_POOL_MAX_SIZE", "4");
+    std::string warmPoolWindow = setEnvVar("WARM_POOL_WINDOW_MS", "250");
+    std::string tieredComp = setEnvVar("TIERED_COMPILATION", "on");
+    std::string hugePages = setEnvVar("HUGE_PAGES", "on");
+    std::string guardMode = setEnvVar("GUARD_MODE", "noaccess");
+    std::string snapshotMode = setEnvVar("SNAPSHOT_MODE", "sparse");
+    std::string restoreMode = setEnvVar("RESTORE_MODE", "lazy");
+    std::string shareZygote = setEnvVar("SHARE_ZYGOTE_MEMORY", "on");
+    std::string ompLocalFork = setEnvVar("OMP_LOCAL_FORK", "on");
+    std::string funcMemLimit = setEnvVar("FUNCTION_MEMORY_LIMIT_MB", "256");
+    std::string userMemLimit = setEnvVar("USER_MEMORY_LIMIT_MB", "1024");
+    std::string memSoftLimit = setEnvVar("MEMORY_SOFT_LIMIT_PCT", "50");
 
     std::string faasmLocalDir = setEnvVar("FAASM_LOCAL_DIR", "/tmp/blah");
 
@@ -59,6 +87,20 @@ TEST_CASE("Test overriding faasm config initialisation", "[conf]")
     REQUIRE(conf.captureStdout == "on");
     REQUIRE(conf.wasmVm == "blah");
     REQUIRE(conf.chainedCallTimeout == 9999);
+    REQUIRE(conf.moduleCacheMaxMb == 512);
+    REQUIRE(conf.resetMode == "cow");
+    REQUIRE(conf.warmPoolMaxSize == 4);
+    REQUIRE(conf.warmPoolWindowMs == 250);
+    REQUIRE(conf.tieredCompilation == "on");
+    REQUIRE(conf.hugePages == "on");
+    REQUIRE(conf.guardMode == "noaccess");
+    REQUIRE(conf.snapshotMode == "sparse");
+    REQUIRE(conf.restoreMode == "lazy");
+    REQUIRE(conf.shareZygoteMemory == "on");
+    REQUIRE(conf.ompLocalFork == "on");
+    REQUIRE(conf.functionMemoryLimitMb == 256);
+    REQUIRE(conf.userMemoryLimitMb == 1024);
+    REQUIRE(conf.memorySoftLimitPercent == 50);
     REQUIRE(conf.functionDir == "/tmp/blah/wasm");
     REQUIRE(conf.objectFileDir == "/tmp/blah/object");
     REQUIRE(conf.runtimeFilesDir == "/tmp/blah/runtime_root");
@@ -77,6 +119,20 @@ TEST_CASE("Test overriding faasm config initialisation", "[conf]")
     setEnvVar("WASM_VM", wasmVm);
 
     setEnvVar("CHAINED_CALL_TIMEOUT", chainedTimeout);
+    setEnvVar("MODULE_CACHE_MAX_MB", moduleCacheMax);
+    setEnvVar("RESET_MODE", resetMode);
+    setEnvVar("WARM_POOL_MAX_SIZE", warmPoolMax);
+    setEnvVar("WARM_POOL_WINDOW_MS", warmPoolWindow);
+    setEnvVar("TIERED_COMPILATION", tieredComp);
+    setEnvVar("HUGE_PAGES", hugePages);
+    setEnvVar("GUARD_MODE", guardMode);
+    setEnvVar("SNAPSHOT_MODE", snapshotMode);
+    setEnvVar("RESTORE_MODE", restoreMode);
+    setEnvVar("SHARE_ZYGOTE_MEMORY", shareZygote);
+    setEnvVar("OMP_LOCAL_FORK", ompLocalFork);
+    setEnvVar("FUNCTION_MEMORY_LIMIT_MB", funcMemLimit);
+    setEnvVar("USER_MEMORY_LIMIT_MB", userMemLimit);
+    setEnvVar("MEMORY_SOFT_LIMIT_PCT", memSoftLimit);
 
     setEnvVar("FAASM_LOCAL_DIR", faasmLocalDir);
 }
@@ -0,0 +1,136 @@
+#include <catch2/catch.hpp>
+
+#include "utils.h"
+
+#include <conf/FaasmConfig.h>
+#include <faaslet/Faaslet.h>
+#include <faaslet/TieredCompiler.h>
+#include <wamr/WAMRWasmModule.h>
+#include <wavm/IRModuleCache.h>
+#include <wavm/WAVMWasmModule.h>
+
+#include <faabric/util/func.h>
+
+#include <boost/filesystem.hpp>
+
+namespace tests {
+TEST_CASE("Test tiered compilation", "[faaslet]")
+{
+    cleanSystem();
+
+    conf::FaasmConfig& conf = conf::getFaasmConfig();
+    std::string origObjDir = conf.objectFileDir;
+
+    // Point at an empty object dir so that there's no object code
+    conf.objectFileDir = "/tmp/obj_tiered";
+    boost::filesystem::remove_all(conf.objectFileDir);
+    wasm::getIRModuleCache().clear();
+
+    faabric::Message msg = faabric::util::messageFactory("demo", "echo");
+    faaslet::TieredCompiler& compiler = faaslet::getTieredCompiler();
+
+    SECTION("Tiering off")
+    {
+        conf.tieredCompilation = "off";
+        REQUIRE(!compiler.shouldUseBaseline(msg));
+
+        faaslet::Faaslet f(msg);
+        REQUIRE(dynamic_cast<wasm::WAVMWasmModule*>(f.module.get()) !=
+                nullptr);
+    }
+
+    SECTION("Tiering on")
+    {
+        conf.tieredCompilation = "on";
+        REQUIRE(compiler.shouldUseBaseline(msg));
+
+        // Snapshot restores need the optimised tier
+        faabric::Message snapMsg = msg;
+        snapMsg.set_snapshotkey("foobar");
+        REQUIRE(!compiler.shouldUseBaseline(snapMsg));
+
+        // Faaslet starts on the baseline tier
+        faaslet::Faaslet f(msg);
+        REQUIRE(dynamic_cast<wasm::WAMRWasmModule*>(f.module.get()) !=
+                nullptr);
+        REQUIRE(f.module->isBound());
+
+        // Once the optimised tier is ready, the Faaslet switches on reset
+        compiler.waitForOptimisations();
+        REQUIRE(compiler.getOptimisingCount() == 0);
+        REQUIRE(compiler.isOptimised(msg));
+        REQUIRE(!compiler.shouldUseBaseline(msg));
+
+        f.reset(msg);
+        REQUIRE(dynamic_cast<wasm::WAVMWasmModule*>(f.module.get()) !=
+                nullptr);
+        REQUIRE(f.module->isBound());
+
+        // Object code is now cached, so the baseline isn't needed even when
+        // the in-memory cache is cleared
+        wasm::getIRModuleCache().clear();
+        REQUIRE(!compiler.shouldUseBaseline(msg));
+    }
+
+    SECTION("Executing on baseline tier")
+    {
+        conf.tieredCompilation = "on";
+
+        faaslet::Faaslet f(msg);
+        REQUIRE(dynamic_cast<wasm::WAMRWasmModule*>(f.module.get()) !=
+                nullptr);
+
+        std::string inputData = "baseline tier";
+        msg.set_inputdata(inputData);
+
+        REQUIRE(f.module->executeFunction(msg) == 0);
+        REQUIRE(msg.outputdata() == inputData);
+
+        compiler.waitForOptimisations();
+    }
+
+    SECTION("Switching tiers after eviction")
+    {
+        conf.tieredCompilation = "on";
+
+        faaslet::Faaslet f(msg);
+        REQUIRE(dynamic_cast<wasm::WAMRWasmModule*>(f.module.get()) !=
+                nullptr);
+
+        // Drop the compiled module and the compiler's own record of it, as
+        // though it had been evicted, leaving only the object code
+        compiler.waitForOptimisations();
+        compiler.clear();
+        wasm::getIRModuleCache().clear();
+        REQUIRE(!wasm::getIRModuleCache().isCompiledModuleCached(
+          msg.user(), msg.function(), ""));
+
+        REQUIRE(compiler.isOptimised(msg));
+
+        f.reset(msg);
+        REQUIRE(dynamic_cast<wasm::WAVMWasmModule*>(f.module.get()) !=
+                nullptr);
+    }
+
+    SECTION("Imports missing from baseline tier")
+    {
+        conf.tieredCompilation = "on";
+
+        // OpenMP intrinsics are only implemented in WAVM
+        faabric::Message ompMsg =
+          faabric::util::messageFactory("omp", "simple_critical");
+        REQUIRE(!compiler.shouldUseBaseline(ompMsg));
+
+        faaslet::Faaslet f(ompMsg);
+        REQUIRE(dynamic_cast<wasm::WAVMWasmModule*>(f.module.get()) !=
+                nullptr);
+    }
+
+    compiler.clear();
+    wasm::getIRModuleCache().clear();
+    boost::filesystem::remove_all(conf.objectFileDir);
+
+    conf.objectFileDir = origObjDir;
+    conf.tieredCompilation = "off";
+}
+}
@@ -0,0 +1,66 @@
+#include <catch2/catch.hpp>
+
+#include "utils.h"
+
+#include <conf/FaasmConfig.h>
+#include <faaslet/FaasletPool.h>
+
+#include <faabric/util/func.h>
+
+namespace tests {
+TEST_CASE("Test warm Faaslet pool", "[faaslet]")
+{
+    cleanSystem();
+
+    conf::FaasmConfig& conf = conf::getFaasmConfig();
+    conf.warmPoolMaxSize = 2;
+    conf.warmPoolWindowMs = 60000;
+
+    faabric::Message msg = faabric::util::messageFactory("demo", "echo");
+    std::string funcStr = faabric::util::funcToString(msg, false);
+
+    faaslet::FaasletPool pool;
+
+    // Nothing warm before the function has been seen
+    REQUIRE(pool.take(msg) == nullptr);
+    REQUIRE(pool.getTargetSize(funcStr) == 1);
+    REQUIRE(pool.getWarmCount(funcStr) == 0);
+
+    pool.warm();
+    REQUIRE(pool.getWarmCount(funcStr) == 1);
+
+    // Take the warm Faaslet and check it's ready to execute
+    std::shared_ptr<faaslet::Faaslet> faaslet = pool.take(msg);
+    REQUIRE(faaslet != nullptr);
+    REQUIRE(faaslet->module->isBound());
+    REQUIRE(pool.getWarmCount(funcStr) == 0);
+
+    // Target is capped at the max size
+    pool.take(msg);
+    pool.take(msg);
+    REQUIRE(pool.getTargetSize(funcStr) == 2);
+
+    pool.warm();
+    REQUIRE(pool.getWarmCount(funcStr) == 2);
+
+    SECTION("Pool shrinks when calls stop")
+    {
+        conf.warmPoolWindowMs = 0;
+        REQUIRE(pool.getTargetSize(funcStr) == 0);
+
+        pool.warm();
+        REQUIRE(pool.getWarmCount(funcStr) == 0);
+    }
+
+    SECTION("Clearing pool")
+    {
+        pool.clear();
+        REQUIRE(pool.getWarmCount(funcStr) == 0);
+        REQUIRE(pool.getTargetSize(funcStr) == 0);
+    }
+
+    faaslet->releaseIsolation();
+    pool.clear();
+    conf.reset();
+}
+}
@@ -0,0 +1,102 @@
+#include <catch2/catch.hpp>
+
+#include <faabric/util/files.h>
+#include <faabric/util/func.h>
+
+#include <boost/filesystem.hpp>
+
+#include <conf/FaasmConfig.h>
+#include <conf/function_utils.h>
+#include <storage/CodegenScheduler.h>
+
+using namespace storage;
+
+namespace tests {
+
+TEST_CASE("Test codegen scheduler deduplicates identical wasm", "[storage]")
+{
+    faabric::Message echoMsg = faabric::util::messageFactory("demo", "echo");
+    faabric::Message x2Msg = faabric::util::messageFactory("demo", "x2");
+    std::vector<uint8_t> echoWasm =
+      faabric::util::readFileToBytes(conf::getFunctionFile(echoMsg));
+    std::vector<uint8_t> x2Wasm =
+      faabric::util::readFileToBytes(conf::getFunctionFile(x2Msg));
+
+    // Override the storage directories
+    conf::FaasmConfig& conf = conf::getFaasmConfig();
+    std::string origFuncDir = conf.functionDir;
+    std::string origObjDir = conf.objectFileDir;
+    conf.functionDir = "/tmp/func";
+    conf.objectFileDir = "/tmp/obj";
+
+    boost::filesystem::remove_all(conf.functionDir);
+    boost::filesystem::remove_all(conf.objectFileDir);
+
+    // Write the same wasm under two names, plus a different one
+    std::vector<std::pair<std::string, std::vector<uint8_t>>> funcs = {
+        { "echo", echoWasm },
+        { "echo_copy", echoWasm },
+        { "x2", x2Wasm },
+    };
+    for (auto& [func, wasm] : funcs) {
+        boost::filesystem::create_directories(conf.functionDir + "/demo/" +
+                                              func);
+        faabric::util::writeBytesToFile(
+          conf.functionDir + "/demo/" + func + "/function.wasm", wasm);
+    }
+
+    int nThreads = 0;
+    SECTION("Single thread") { nThreads = 1; }
+
+    SECTION("Multiple threads") { nThreads = 3; }
+
+    CodegenScheduler scheduler(nThreads);
+    scheduler.addUser("demo");
+    REQUIRE(scheduler.getTaskCount() == 3);
+
+    std::vector<CodegenResult> results = scheduler.run();
+    REQUIRE(results.size() == 3);
+    REQUIRE(scheduler.getTaskCount() == 0);
+
+    int nDeduplicated = 0;
+    for (const auto& r : results) {
+        REQUIRE(!r.failed);
+        REQUIRE(!r.skipped);
+        REQUIRE(r.peakRssKb > 0);
+
+        if (r.deduplicated) {
+            nDeduplicated++;
+            REQUIRE(r.function.rfind("echo", 0) == 0);
+        }
+
+        faabric::Message msg =
+          faabric::util::messageFactory("demo", r.function);
+        REQUIRE(boost::filesystem::exists(conf::getFunctionObjectFile(msg)));
+    }
+
+    REQUIRE(nDeduplicated == 1);
+
+    // Both copies of echo share the same object code
+    faabric::Message copyMsg =
+      faabric::util::messageFactory("demo", "echo_copy");
+    REQUIRE(faabric::util::readFileToBytes(
+              conf::getFunctionObjectFile(echoMsg)) ==
+            faabric::util::readFileToBytes(
+              conf::getFunctionObjectFile(copyMsg)));
+
+    // Running again should skip everything
+    scheduler.addUser("demo");
+    results = scheduler.run();
+    REQUIRE(results.size() == 3);
+    for (const auto& r : results) {
+        REQUIRE(r.skipped);
+        REQUIRE(!r.deduplicated);
+    }
+
+    boost::filesystem::remove_all(conf.functionDir);
+    boost::filesystem::remove_all(conf.objectFileDir);
+
+    conf.functionDir = origFuncDir;
+    conf.objectFileDir = origObjDir;
+}
+}
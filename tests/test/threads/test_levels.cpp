@@ -8,6 +8,8 @@
 
 #include <threads/ThreadState.h>
 
+#include <thread>
+
 using namespace threads;
 
 namespace tests {
@@ -161,6 +163,136 @@ TEST_CASE("Test level barrier", "[threads]")
     }
 }
 
+TEST_CASE("Test aborting a level", "[threads]")
+{
+    cleanSystem();
+
+    int nThreads = 4;
+    Level lvl(nThreads);
+    lvl.prepareReduction();
+    std::shared_ptr<Reduction> reduction = lvl.getReduction();
+    reduction->setLocalThreads({ 0, 1, 2, 3 });
+
+    // The master holds the critical section and never arrives anywhere else
+    lvl.lockCritical();
+
+    // The other threads block in a barrier, the critical section and a
+    // reduction respectively
+    std::atomic<int> nAborted = 0;
+    std::vector<std::thread> workers;
+    workers.emplace_back([&lvl, &nAborted] {
+        try {
+            lvl.waitOnBarrier();
+        } catch (std::runtime_error& e) {
+            nAborted++;
+        }
+    });
+
+    workers.emplace_back([&lvl, &nAborted] {
+        try {
+            lvl.lockCritical();
+        } catch (std::runtime_error& e) {
+            nAborted++;
+        }
+    });
+
+    workers.emplace_back([&reduction, &nAborted] {
+        try {
+            reduction->awaitRelease(0);
+        } catch (std::runtime_error& e) {
+            nAborted++;
+        }
+    });
+
+    // Let them start waiting, though they throw either way
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    lvl.abort();
+
+    for (auto& t : workers) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+
+    REQUIRE(nAborted == nThreads - 1);
+    REQUIRE_THROWS(lvl.waitOnBarrier());
+    REQUIRE_THROWS(reduction->awaitArrival(0, 1));
+    REQUIRE_THROWS(lvl.checkAborted());
+
+    lvl.unlockCritical();
+    lvl.clearReduction();
+    lvl.clearSync();
+}
+
+TEST_CASE("Test barrier timing out", "[threads]")
+{
+    // The other thread of the team is elsewhere and never arrives
+    AbortFlag aborted;
+    Barrier barrier(2, aborted, 100);
+
+    REQUIRE_THROWS(barrier.wait());
+}
+
+TEST_CASE("Test repeated level barriers and nested critical sections",
+          "[threads]")
+{
+    cleanSystem();
+
+    int nThreads = 8;
+    int nRounds = 200;
+    Level lvlA(nThreads);
+
+    std::vector<uint8_t> serialised = lvlA.serialise();
+    std::shared_ptr<faabric::BatchExecuteRequest> req =
+      faabric::util::batchExecFactory("demo", "echo", 1);
+    req->set_contextdata(serialised.data(), serialised.size());
+
+    std::atomic<int> round = 0;
+    std::atomic<bool> failed = false;
+    int counter = 0;
+
+    // The same barrier is reused every round, so no thread may leave a round
+    // before all have seen the round number
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nThreads; i++) {
+        threads.emplace_back([i, nRounds, &req, &round, &failed, &counter] {
+            std::shared_ptr<Level> lvlB = levelFromBatchRequest(req);
+
+            for (int r = 0; r < nRounds; r++) {
+                lvlB->lockCritical();
+                lvlB->lockCritical();
+                counter++;
+                lvlB->unlockCritical();
+                lvlB->unlockCritical();
+
+                if (i == 0) {
+                    round = r;
+                }
+
+                lvlB->waitOnBarrier();
+
+                if (round != r) {
+                    failed = true;
+                }
+
+                lvlB->waitOnBarrier();
+            }
+        });
+    }
+
+    for (auto& t : threads) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+
+    REQUIRE(!failed);
+    REQUIRE(counter == nThreads * nRounds);
+
+    // Unlocking a critical section not held is an error
+    REQUIRE_THROWS(lvlA.unlockCritical());
+}
+
 TEST_CASE("Test nowait barrier", "[threads]")
 {
     cleanSystem();
@@ -215,4 +347,148 @@ TEST_CASE("Test nowait barrier", "[threads]")
         }
     }
 }
+
+TEST_CASE("Test level reduction placement", "[threads]")
+{
+    cleanSystem();
+
+    Level lvlA(5);
+    REQUIRE(lvlA.getReduction() == nullptr);
+
+    lvlA.prepareReduction();
+    std::shared_ptr<Reduction> reduction = lvlA.getReduction();
+    REQUIRE(reduction != nullptr);
+
+    reduction->setLocalThreads({ 3, 0, 1 });
+
+    std::vector<int> expectedLocal = { 0, 1, 3 };
+    std::vector<int> expectedRemote = { 2, 4 };
+    REQUIRE(reduction->getLocalThreads() == expectedLocal);
+    REQUIRE(reduction->getRemoteThreads(5) == expectedRemote);
+    REQUIRE(reduction->getRank(3) == 2);
+    REQUIRE_THROWS(reduction->getRank(2));
+
+    // Threads elsewhere see no reduction once it's cleared
+    lvlA.clearReduction();
+    REQUIRE(lvlA.getReduction() == nullptr);
+}
+
+TEST_CASE("Test clearing level sync after remote threads", "[threads]")
+{
+    cleanSystem();
+
+    Level lvl(3);
+    lvl.startRemoteThread();
+    lvl.startRemoteThread();
+
+    // The sync objects stay until the last thread here finishes
+    std::shared_ptr<TaskPool> pool = lvl.getTaskPool();
+    lvl.finishRemoteThread();
+    REQUIRE(lvl.getTaskPool() == pool);
+
+    lvl.finishRemoteThread();
+    REQUIRE(lvl.getTaskPool() != pool);
+
+    lvl.clearSync();
+}
+
+TEST_CASE("Test level shared loops", "[threads]")
+{
+    cleanSystem();
+
+    Level lvl(3);
+    std::shared_ptr<SharedLoop> loopA = lvl.getSharedLoop(0);
+    std::shared_ptr<SharedLoop> loopB = lvl.getSharedLoop(1);
+    REQUIRE(loopA != loopB);
+    REQUIRE(lvl.getSharedLoop(0) == loopA);
+
+    loopA->next += 10;
+    REQUIRE(lvl.getSharedLoop(0)->next == 10);
+
+    // Loop stays until every thread is finished with it
+    lvl.finishSharedLoop(0);
+    lvl.finishSharedLoop(0);
+    REQUIRE(lvl.getSharedLoop(0) == loopA);
+
+    lvl.finishSharedLoop(0);
+    REQUIRE(lvl.getSharedLoop(0) != loopA);
+    REQUIRE(lvl.getSharedLoop(0)->next == 0);
+    REQUIRE(lvl.getSharedLoop(1) == loopB);
+}
+
+TEST_CASE("Test level task pool", "[threads]")
+{
+    cleanSystem();
+
+    int nThreads = 4;
+    Level lvl(nThreads);
+    std::shared_ptr<TaskPool> pool = lvl.getTaskPool();
+    REQUIRE(lvl.getTaskPool() == pool);
+
+    auto children = std::make_shared<TaskCounter>();
+    auto group = std::make_shared<TaskCounter>();
+
+    // Thread 0 queues tasks, the newest half in a group
+    int nTasks = 10;
+    for (int i = 0; i < nTasks; i++) {
+        ExplicitTask task;
+        task.taskPtr = i;
+        task.siblings = children;
+        task.group = i >= nTasks / 2 ? group : nullptr;
+        REQUIRE(pool->push(0, task));
+    }
+
+    REQUIRE(pool->getOutstanding() == nTasks);
+    REQUIRE(children->count == nTasks);
+    REQUIRE(group->count == nTasks / 2);
+
+    // The owner takes its newest task, while others steal the oldest
+    ExplicitTask task;
+    REQUIRE(pool->pop(0, task));
+    REQUIRE(task.taskPtr == nTasks - 1);
+    pool->finish(task);
+
+    REQUIRE(pool->pop(2, task));
+    REQUIRE(task.taskPtr == 0);
+    pool->finish(task);
+
+    REQUIRE(pool->getOutstanding() == nTasks - 2);
+    REQUIRE(children->count == nTasks - 2);
+    REQUIRE(group->count == nTasks / 2 - 1);
+
+    // All threads run what's left
+    std::vector<std::thread> threads;
+    std::atomic<int> sum = 0;
+    for (int t = 0; t < nThreads; t++) {
+        threads.emplace_back([t, &pool, &sum] {
+            ExplicitTask task;
+            while (pool->pop(t, task)) {
+                sum += task.taskPtr;
+                pool->finish(task);
+            }
+        });
+    }
+
+    for (auto& t : threads) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+
+    // Tasks 1 to n - 2 remain
+    REQUIRE(sum == (nTasks - 1) * (nTasks - 2) / 2);
+    REQUIRE(pool->getOutstanding() == 0);
+    REQUIRE(children->count == 0);
+    REQUIRE(group->count == 0);
+    REQUIRE(!pool->pop(1, task));
+
+    // Full deques push back on the caller
+    ExplicitTask extra;
+    int nPushed = 0;
+    while (pool->push(3, extra)) {
+        nPushed++;
+    }
+    REQUIRE(nPushed > 0);
+    REQUIRE(pool->getOutstanding() == nPushed);
+}
 }
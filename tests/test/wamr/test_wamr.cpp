@@ -1,9 +1,13 @@
 #include "utils.h"
 
 #include <catch2/catch.hpp>
+#include <cstring>
 #include <faabric/util/config.h>
 #include <faabric/util/func.h>
 #include <wamr/WAMRWasmModule.h>
+#include <wasm/WasmExecutionContext.h>
+
+#include <aot_runtime.h>
 
 using namespace wasm;
 
@@ -57,4 +61,131 @@ TEST_CASE("Test executing chain function with WAMR", "[wamr]")
 {
     executeWithWamrPool("demo", "chain");
 }
+
+TEST_CASE("Test executing pthreads with WAMR", "[wamr]")
+{
+    executeWithWamrPool("demo", "threads_local");
+}
+
+TEST_CASE("Test executing OpenMP with WAMR", "[wamr]")
+{
+    std::string func;
+
+    SECTION("Critical") { func = "simple_critical"; }
+
+    SECTION("Reduction") { func = "reduction_integral"; }
+
+    SECTION("Static for") { func = "for_static_schedule"; }
+
+    executeWithWamrPool("omp", func);
+}
+
+TEST_CASE("Test guest memory grow on WAMR thread instance", "[wamr]")
+{
+    faabric::Message call = faabric::util::messageFactory("demo", "echo");
+
+    wasm::WAMRWasmModule module(2);
+    module.bindToFunction(call);
+
+    size_t initialSize = module.getMemorySizeBytes();
+
+    // Run the grow as the guest would, i.e. with the thread's instance
+    auto* threadInstance =
+      reinterpret_cast<AOTModuleInstance*>(module.getThreadInstance(1));
+    {
+        WasmExecutionContext ctx(&module, &call);
+        REQUIRE(aot_enlarge_memory(threadInstance, 3));
+    }
+
+    size_t expectedSize = initialSize + 3 * WASM_BYTES_PER_PAGE;
+    REQUIRE(module.getMemorySizeBytes() == expectedSize);
+
+    // Both the main instance and the other thread instances see the new size
+    auto* otherInstance =
+      reinterpret_cast<AOTModuleInstance*>(module.getThreadInstance(0));
+    for (auto* instance : { threadInstance, otherInstance }) {
+        auto* mem = ((AOTMemoryInstance**)instance->memories.ptr)[0];
+        REQUIRE(mem->memory_data_size == expectedSize);
+    }
+}
+
+TEST_CASE("Test WAMR module cache", "[wamr]")
+{
+    WAMRWasmModule::clearCaches();
+
+    faabric::Message call = faabric::util::messageFactory("demo", "echo");
+
+    wasm::WAMRWasmModule moduleA;
+    moduleA.bindToFunction(call);
+    REQUIRE(getWAMRModuleCache().getTotalCachedModuleCount() == 1);
+
+    // Second instance shares the loaded module
+    wasm::WAMRWasmModule moduleB;
+    moduleB.bindToFunction(call);
+    REQUIRE(getWAMRModuleCache().getTotalCachedModuleCount() == 1);
+
+    // Modules not using the cache don't add to it
+    wasm::WAMRWasmModule moduleC;
+    moduleC.bindToFunction(call, false);
+    REQUIRE(getWAMRModuleCache().getTotalCachedModuleCount() == 1);
+
+    // Instances still work after the cache is cleared
+    WAMRWasmModule::clearCaches();
+    REQUIRE(getWAMRModuleCache().getTotalCachedModuleCount() == 0);
+
+    call.set_inputdata("hello");
+    REQUIRE(moduleB.executeFunction(call) == 0);
+    REQUIRE(call.outputdata() == "hello");
+}
+
+TEST_CASE("Test WAMR reset", "[wamr]")
+{
+    faabric::Message call = faabric::util::messageFactory("demo", "echo");
+
+    wasm::WAMRWasmModule module;
+    module.bindToFunction(call);
+
+    size_t initialSize = module.getMemorySizeBytes();
+    uint32_t initialBrk = module.getCurrentBrk();
+
+    // Take a copy of the original memory
+    uint8_t* memBase = module.wasmPointerToNative(0);
+    std::vector<uint8_t> memBefore(memBase, memBase + initialSize);
+
+    // Run once, then dirty the memory and grow it
+    call.set_inputdata("first");
+    REQUIRE(module.executeFunction(call) == 0);
+    REQUIRE(call.outputdata() == "first");
+
+    uint32_t grownOffset = module.growMemory(10 * WASM_BYTES_PER_PAGE);
+    std::memset(module.wasmPointerToNative(grownOffset), 7, 100);
+    std::memset(memBase + 10, 7, 100);
+
+    int nResets = 0;
+    SECTION("Single reset") { nResets = 1; }
+
+    SECTION("Repeated resets") { nResets = 3; }
+
+    for (int i = 0; i < nResets; i++) {
+        module.reset(call);
+
+        // Memory restored, growth kept but zeroed and reusable
+        REQUIRE(module.getCurrentBrk() == initialBrk);
+        std::vector<uint8_t> memAfter(memBase, memBase + initialSize);
+        REQUIRE(memAfter == memBefore);
+        REQUIRE(module.getMemorySizeBytes() >= initialSize);
+        REQUIRE(*module.wasmPointerToNative(grownOffset) == 0);
+
+        REQUIRE(module.growMemory(10 * WASM_BYTES_PER_PAGE) == grownOffset);
+        std::memset(module.wasmPointerToNative(grownOffset), 7, 100);
+        std::memset(memBase + 10, 7, 100);
+    }
+
+    // Reset module still executes
+    module.reset(call);
+    faabric::Message callB = faabric::util::messageFactory("demo", "echo");
+    callB.set_inputdata("second");
+    REQUIRE(module.executeFunction(callB) == 0);
+    REQUIRE(callB.outputdata() == "second");
+}
 }
@@ -53,8 +53,8 @@ std::string mainData = "PyBool_Type";
 std::string dataA = "PyArray_API";
 std::string dataB = "__pyx_module_is_main_numpy__random__mtrand";
 int mainDataOffset = 4862212;
-int dataAOffset = 16231136;
-int dataBOffset = 21692416;
+int dataAOffset = 9415392;
+int dataBOffset = 14876672;
 
 // NOTE - we don't get perfect pakcing of the indexing, so each module has
 // an arbitrary extra offset.
@@ -204,11 +204,6 @@ TEST_CASE("Test GOT population", "[wasm]")
 {
     cleanSystem();
 
-    // Note - we want to set a fixed thread pool size here as this determines
-    // the location of data in the wasm memory
-    faabric::util::SystemConfig& conf = faabric::util::getSystemConfig();
-    conf.overrideCpuCount = 2;
-
     conf::FaasmConfig& faasmConf = conf::getFaasmConfig();
     faasmConf.pythonPreload = "off";
 
@@ -264,7 +259,6 @@ TEST_CASE("Test GOT population", "[wasm]")
     REQUIRE(expectedIdxB > tableSizeAfterA);
     REQUIRE(expectedIdxB < tableSizeAfterB);
 
-    conf.reset();
     faasmConf.reset();
 }
 
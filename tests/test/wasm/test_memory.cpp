@@ -1,15 +1,19 @@
 #include "utils.h"
 #include <catch2/catch.hpp>
 
+#include <conf/FaasmConfig.h>
 #include <faabric/util/bytes.h>
 #include <faabric/util/config.h>
 #include <faabric/util/func.h>
+#include <wasm/MemoryFreeList.h>
+#include <wasm/MemoryQuota.h>
 #include <wavm/WAVMWasmModule.h>
 
 #include <faabric/util/files.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 using namespace WAVM;
 
@@ -35,7 +39,8 @@ TEST_CASE("Test mmapping a file", "[wasm]")
     fstat(fd, &sb);
     size_t bufferSize = sb.st_size;
 
-    U32 mappedWasmPtr = module.mmapFile(fd, bufferSize);
+    U32 mappedWasmPtr =
+      module.mmapFile(fd, bufferSize, PROT_READ, MAP_SHARED, 0);
     U8* hostPtr = &Runtime::memoryRef<U8>(module.defaultMemory, mappedWasmPtr);
 
     // Get a section of bytes from the start
@@ -53,6 +58,63 @@ TEST_CASE("Test mmapping a file", "[wasm]")
     REQUIRE(expected == actual);
 }
 
+TEST_CASE("Test mmapping a file window privately", "[wasm]")
+{
+    cleanSystem();
+
+    faabric::Message call = faabric::util::messageFactory("demo", "echo");
+
+    wasm::WAVMWasmModule module;
+    module.bindToFunction(call);
+
+    // Write a file with a different byte in each host page
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    std::vector<uint8_t> fileBytes(3 * pageSize);
+    for (size_t i = 0; i < fileBytes.size(); i++) {
+        fileBytes.at(i) = (uint8_t)(i / pageSize + 1);
+    }
+
+    std::string fileName = "/tmp/mmap_window_test";
+    faabric::util::writeBytesToFile(fileName, fileBytes);
+    int fd = open(fileName.c_str(), O_RDWR);
+    REQUIRE(fd > 0);
+
+    // Offsets must be page-aligned
+    REQUIRE_THROWS(module.mmapFile(
+      fd, pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, pageSize + 1));
+
+    // Map the middle page, then write to it
+    uint32_t wasmPtr = module.mmapFile(
+      fd, pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, pageSize);
+    uint8_t* hostPtr = module.wasmPointerToNative(wasmPtr);
+
+    std::vector<uint8_t> expected(pageSize, 2);
+    REQUIRE(std::vector<uint8_t>(hostPtr, hostPtr + pageSize) == expected);
+
+    std::fill(hostPtr, hostPtr + pageSize, 9);
+    close(fd);
+
+    // Private writes don't reach the file
+    REQUIRE(faabric::util::readFileToBytes(fileName) == fileBytes);
+
+    // Dropping the pages reads back the file rather than zeroes
+    module.adviseMemory(wasmPtr, WASM_BYTES_PER_PAGE, MADV_DONTNEED);
+    REQUIRE(std::vector<uint8_t>(hostPtr, hostPtr + pageSize) == expected);
+
+    // Once unmapped, the memory is reused as fresh zeroed memory
+    module.unmapMemory(wasmPtr, pageSize);
+    uint32_t reusedPtr = module.mmapMemory(pageSize);
+    REQUIRE(reusedPtr == wasmPtr);
+
+    uint8_t* reusedHostPtr = module.wasmPointerToNative(reusedPtr);
+    std::vector<uint8_t> zeroes(WASM_BYTES_PER_PAGE, 0);
+    REQUIRE(std::vector<uint8_t>(reusedHostPtr,
+                                 reusedHostPtr + WASM_BYTES_PER_PAGE) ==
+            zeroes);
+
+    remove(fileName.c_str());
+}
+
 TEST_CASE("Test memory growth and shrinkage", "[wasm]")
 {
     cleanSystem();
@@ -129,11 +191,14 @@ TEST_CASE("Test memory growth and shrinkage", "[wasm]")
     REQUIRE(newMemSize == oldMemSize);
     REQUIRE(newBrk == oldMemSize - shrinkB);
 
-    // Check unmapping elsewhere cannot reclaim memory
+    // Check unmapping elsewhere leaves the brk, but is reused by mmap
     uint32_t shrinkC = 3 * WASM_BYTES_PER_PAGE;
     oldMemSize = module.getMemorySizeBytes();
     oldBrk = module.getCurrentBrk();
-    unmapOffset = oldMemSize - (2 * WASM_BYTES_PER_PAGE) - shrinkB;
+    unmapOffset = oldBrk - (2 * WASM_BYTES_PER_PAGE) - shrinkC;
+
+    uint8_t* unmapPtr = module.wasmPointerToNative(unmapOffset);
+    std::fill(unmapPtr, unmapPtr + shrinkC, 5);
 
     module.unmapMemory(unmapOffset, shrinkC);
 
@@ -142,6 +207,382 @@ TEST_CASE("Test memory growth and shrinkage", "[wasm]")
 
     REQUIRE(newMemSize == oldMemSize);
     REQUIRE(newBrk == oldBrk);
+
+    memOffset = module.mmapMemory(WASM_BYTES_PER_PAGE);
+    REQUIRE(memOffset == unmapOffset);
+    REQUIRE(module.getCurrentBrk() == oldBrk);
+
+    // Reused memory must be zeroed
+    std::vector<uint8_t> expectedZeroes(WASM_BYTES_PER_PAGE, 0);
+    std::vector<uint8_t> actual(unmapPtr, unmapPtr + WASM_BYTES_PER_PAGE);
+    REQUIRE(actual == expectedZeroes);
+
+    // Check unmapping the top coalesces with free memory below it
+    module.unmapMemory(unmapOffset, WASM_BYTES_PER_PAGE);
+    module.unmapMemory(unmapOffset + shrinkC, 2 * WASM_BYTES_PER_PAGE);
+
+    REQUIRE(module.getMemorySizeBytes() == oldMemSize);
+    REQUIRE(module.getCurrentBrk() == unmapOffset);
+}
+
+TEST_CASE("Test shrinking and madvise release memory", "[wasm]")
+{
+    cleanSystem();
+
+    faabric::Message call = faabric::util::messageFactory("demo", "echo");
+    wasm::WAVMWasmModule module;
+    module.bindToFunction(call);
+
+    uint32_t nBytes = 100 * WASM_BYTES_PER_PAGE;
+    size_t residentBefore = module.getResidentMemoryBytes();
+
+    // Touch newly grown memory to make it resident
+    uint32_t offset = module.growMemory(nBytes);
+    uint8_t* ptr = module.wasmPointerToNative(offset);
+    std::fill(ptr, ptr + nBytes, 1);
+    REQUIRE(module.getResidentMemoryBytes() >= residentBefore + nBytes);
+
+    // Shrinking gives the pages back, leaving the memory committed
+    size_t memSize = module.getMemorySizeBytes();
+    module.shrinkMemory(nBytes);
+    REQUIRE(module.getMemorySizeBytes() == memSize);
+    REQUIRE(module.getResidentMemoryBytes() < residentBefore + nBytes);
+
+    // Growing again hands out zeroed memory
+    offset = module.growMemory(nBytes);
+    ptr = module.wasmPointerToNative(offset);
+    std::vector<uint8_t> expectedZeroes(nBytes, 0);
+    REQUIRE(std::vector<uint8_t>(ptr, ptr + nBytes) == expectedZeroes);
+
+    // Madvise only gives up whole wasm pages within the range
+    std::fill(ptr, ptr + nBytes, 1);
+    size_t residentFull = module.getResidentMemoryBytes();
+    module.adviseMemory(offset + 1, 3 * WASM_BYTES_PER_PAGE, MADV_DONTNEED);
+    REQUIRE(ptr[0] == 1);
+    REQUIRE(ptr[WASM_BYTES_PER_PAGE] == 0);
+    REQUIRE(ptr[3 * WASM_BYTES_PER_PAGE] == 1);
+
+    // Other advice is ignored
+    module.adviseMemory(offset, nBytes, MADV_WILLNEED);
+    REQUIRE(ptr[0] == 1);
+
+    module.adviseMemory(offset, nBytes, MADV_DONTNEED);
+    REQUIRE(std::vector<uint8_t>(ptr, ptr + nBytes) == expectedZeroes);
+    REQUIRE(module.getResidentMemoryBytes() < residentFull);
+
+    // Guard regions in the range are left in place
+    std::fill(ptr, ptr + nBytes, 1);
+    uint32_t guardOffset = offset + WASM_BYTES_PER_PAGE;
+    module.createMemoryGuardRegion(guardOffset);
+    module.adviseMemory(offset, nBytes, MADV_DONTNEED);
+
+    REQUIRE(module.getGuardRegions().count(guardOffset) == 1);
+    REQUIRE(ptr[0] == 0);
+    REQUIRE(ptr[WASM_BYTES_PER_PAGE] == 1);
+    REQUIRE(ptr[WASM_BYTES_PER_PAGE + GUARD_REGION_SIZE] == 0);
+}
+
+TEST_CASE("Test huge pages leave wasm memory semantics unchanged", "[wasm]")
+{
+    cleanSystem();
+
+    conf::FaasmConfig& conf = conf::getFaasmConfig();
+    std::string originalHugePages = conf.hugePages;
+    conf.hugePages = "on";
+
+    faabric::Message call = faabric::util::messageFactory("demo", "echo");
+    wasm::WAVMWasmModule module;
+    module.bindToFunction(call);
+
+    // Growth is still in wasm pages, and grown memory is zeroed
+    uint32_t memSize = module.getMemorySizeBytes();
+    uint32_t nBytes = 3 * WASM_BYTES_PER_PAGE;
+    uint32_t offset = module.growMemory(nBytes);
+    REQUIRE(offset == memSize);
+    REQUIRE(module.getMemorySizeBytes() == memSize + nBytes);
+
+    uint8_t* ptr = module.wasmPointerToNative(offset);
+    std::vector<uint8_t> expectedZeroes(nBytes, 0);
+    REQUIRE(std::vector<uint8_t>(ptr, ptr + nBytes) == expectedZeroes);
+
+    // Discarded memory is zeroed again
+    std::fill(ptr, ptr + nBytes, 1);
+    module.adviseMemory(offset, nBytes, MADV_DONTNEED);
+    REQUIRE(std::vector<uint8_t>(ptr, ptr + nBytes) == expectedZeroes);
+
+    REQUIRE(module.executeFunction(call) == 0);
+
+    conf.hugePages = originalHugePages;
+}
+
+TEST_CASE("Test reading mapping stats for memory", "[wasm]")
+{
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t nBytes = 4 * pageSize;
+
+    void* mem = mmap(nullptr,
+                     nBytes,
+                     PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS,
+                     -1,
+                     0);
+    REQUIRE(mem != MAP_FAILED);
+    uint8_t* ptr = (uint8_t*)mem;
+
+    REQUIRE(wasm::getMappedStatBytes(ptr, nBytes, "Size") >= nBytes);
+
+    std::fill(ptr, ptr + nBytes, 1);
+    REQUIRE(wasm::getMappedStatBytes(ptr, nBytes, "Anonymous") >= nBytes);
+
+    munmap(mem, nBytes);
+}
+
+TEST_CASE("Test no-access guard regions", "[wasm]")
+{
+    cleanSystem();
+
+    conf::FaasmConfig& conf = conf::getFaasmConfig();
+    std::string originalGuardMode = conf.guardMode;
+    conf.guardMode = "noaccess";
+
+    faabric::Message call = faabric::util::messageFactory("demo", "echo");
+    wasm::WAVMWasmModule module;
+    module.bindToFunction(call);
+
+    uint32_t nBytes = GUARD_REGION_SIZE + WASM_BYTES_PER_PAGE;
+    uint32_t offset = module.growMemory(nBytes);
+    uint8_t* guardPtr = module.wasmPointerToNative(offset);
+    std::fill(guardPtr, guardPtr + GUARD_REGION_SIZE, 1);
+
+    // Guard gives back the memory it covers
+    uint32_t guardEnd = module.createMemoryGuardRegion(offset);
+    REQUIRE(guardEnd == offset + GUARD_REGION_SIZE);
+
+    std::map<uint32_t, uint32_t> expectedGuards = {
+        { offset, GUARD_REGION_SIZE }
+    };
+    REQUIRE(module.getGuardRegions() == expectedGuards);
+    REQUIRE(wasm::getResidentBytes(guardPtr, GUARD_REGION_SIZE) == 0);
+
+    // Clones have the guard without backing it
+    wasm::WAVMWasmModule clone(module);
+    REQUIRE(clone.getGuardRegions() == expectedGuards);
+    uint8_t* cloneGuardPtr = clone.wasmPointerToNative(offset);
+    REQUIRE(wasm::getResidentBytes(cloneGuardPtr, GUARD_REGION_SIZE) == 0);
+
+    // Snapshotting can read the guard, which reads as zeroes
+    std::string snapKey = module.snapshot();
+    REQUIRE(guardPtr[0] == 0);
+    REQUIRE(wasm::getResidentBytes(guardPtr, GUARD_REGION_SIZE) == 0);
+
+    clone.restore(snapKey);
+    REQUIRE(clone.getGuardRegions() == expectedGuards);
+
+    // Shrinking over the guard turns it back into ordinary memory
+    module.shrinkMemory(nBytes);
+    REQUIRE(module.getGuardRegions().empty());
+
+    offset = module.growMemory(nBytes);
+    uint8_t* ptr = module.wasmPointerToNative(offset);
+    std::fill(ptr, ptr + nBytes, 2);
+    REQUIRE(ptr[0] == 2);
+
+    conf.guardMode = originalGuardMode;
+}
+
+TEST_CASE("Test instances share zygote memory pages", "[wasm]")
+{
+    cleanSystem();
+
+    conf::FaasmConfig& conf = conf::getFaasmConfig();
+    std::string originalShare = conf.shareZygoteMemory;
+    conf.shareZygoteMemory = "on";
+
+    faabric::Message call = faabric::util::messageFactory("demo", "echo");
+    wasm::WAVMWasmModule moduleA;
+    wasm::WAVMWasmModule moduleB;
+    moduleA.bindToFunction(call);
+    moduleB.bindToFunction(call);
+
+    // Neither instance has a private copy of the zygote's memory
+    REQUIRE(moduleA.getDirtyRegions().empty());
+    REQUIRE(moduleB.getDirtyRegions().empty());
+    REQUIRE(moduleA.getResidentMemoryBytes() == 0);
+
+    // Reading leaves pages shared
+    uint8_t* ptrA = moduleA.wasmPointerToNative(0);
+    uint8_t* ptrB = moduleB.wasmPointerToNative(0);
+    REQUIRE(ptrA[0] == ptrB[0]);
+    REQUIRE(moduleA.getDirtyRegions().empty());
+
+    // Writes are private to the instance
+    uint8_t original = ptrB[0];
+    ptrA[0] = original + 1;
+    REQUIRE(ptrB[0] == original);
+
+    std::vector<std::pair<uint32_t, uint32_t>> expectedDirty = {
+        { 0, (uint32_t)sysconf(_SC_PAGESIZE) }
+    };
+    REQUIRE(moduleA.getDirtyRegions() == expectedDirty);
+    REQUIRE(moduleB.getDirtyRegions().empty());
+
+    REQUIRE(moduleB.executeFunction(call) == 0);
+
+    conf.shareZygoteMemory = originalShare;
+}
+
+TEST_CASE("Test thread stacks not created on bind", "[wasm]")
+{
+    cleanSystem();
+
+    faabric::Message call = faabric::util::messageFactory("demo", "echo");
+
+    wasm::WAVMWasmModule moduleA(1);
+    moduleA.bindToFunction(call);
+
+    wasm::WAVMWasmModule moduleB(8);
+    moduleB.bindToFunction(call);
+
+    // Memory doesn't depend on the thread pool size until threads execute
+    REQUIRE(moduleA.getMemorySizeBytes() == moduleB.getMemorySizeBytes());
+    REQUIRE(moduleA.getCurrentBrk() == moduleB.getCurrentBrk());
+}
+
+TEST_CASE("Test memory free list", "[wasm]")
+{
+    wasm::MemoryFreeList freeList;
+    uint32_t page = WASM_BYTES_PER_PAGE;
+    uint32_t offset = 0;
+
+    REQUIRE(!freeList.allocate(page, offset));
+
+    // Adjacent regions are coalesced
+    freeList.free(2 * page, page);
+    freeList.free(6 * page, 2 * page);
+    freeList.free(3 * page, page);
+    REQUIRE(freeList.getRegionCount() == 2);
+    REQUIRE(freeList.getFreeBytes() == 4 * page);
+
+    freeList.free(4 * page, 2 * page);
+    REQUIRE(freeList.getRegionCount() == 1);
+    REQUIRE(freeList.getFreeBytes() == 6 * page);
+
+    // Allocation takes the lowest fit, splitting the region
+    REQUIRE(freeList.allocate(page, offset));
+    REQUIRE(offset == 2 * page);
+    REQUIRE(freeList.getFreeBytes() == 5 * page);
+
+    REQUIRE(!freeList.allocate(6 * page, offset));
+
+    // Only a region ending at the break is trimmed
+    REQUIRE(freeList.trimTop(10 * page) == 10 * page);
+    REQUIRE(freeList.trimTop(8 * page) == 3 * page);
+    REQUIRE(freeList.getRegionCount() == 0);
+
+    // Regions above a break are dropped, and straddling ones truncated
+    freeList.free(page, page);
+    freeList.free(4 * page, 4 * page);
+    freeList.removeAbove(6 * page);
+    REQUIRE(freeList.getFreeBytes() == 3 * page);
+
+    freeList.clear();
+    REQUIRE(freeList.getFreeBytes() == 0);
+}
+
+TEST_CASE("Test memory quota limits", "[wasm]")
+{
+    conf::FaasmConfig& conf = conf::getFaasmConfig();
+    int originalFuncLimit = conf.functionMemoryLimitMb;
+    int originalUserLimit = conf.userMemoryLimitMb;
+    int originalSoftLimit = conf.memorySoftLimitPercent;
+
+    conf.functionMemoryLimitMb = 10;
+    conf.userMemoryLimitMb = 15;
+    conf.memorySoftLimitPercent = 50;
+
+    wasm::MemoryQuota quota;
+    size_t oneMb = ONE_MB_BYTES;
+
+    // Function soft limit at 5MB, hard at 10MB
+    REQUIRE(quota.charge("foo", "bar", 4 * oneMb) == wasm::QUOTA_OK);
+    REQUIRE(quota.charge("foo", "bar", 2 * oneMb) == wasm::QUOTA_SOFT_LIMIT);
+    REQUIRE(quota.charge("foo", "bar", 5 * oneMb) == wasm::QUOTA_HARD_LIMIT);
+    REQUIRE(quota.getFunctionBytes("foo", "bar") == 6 * oneMb);
+
+    // User limit covers all its functions
+    REQUIRE(quota.charge("foo", "baz", 9 * oneMb) == wasm::QUOTA_HARD_LIMIT);
+    REQUIRE(quota.charge("foo", "baz", 4 * oneMb) == wasm::QUOTA_SOFT_LIMIT);
+    REQUIRE(quota.getUserBytes("foo") == 10 * oneMb);
+
+    // Other users are unaffected
+    REQUIRE(quota.charge("other", "bar", 4 * oneMb) == wasm::QUOTA_OK);
+    REQUIRE(quota.getHostBytes() == 14 * oneMb);
+
+    // Unenforced charges always succeed
+    REQUIRE(quota.charge("foo", "bar", 5 * oneMb, false) ==
+            wasm::QUOTA_HARD_LIMIT);
+    REQUIRE(quota.getFunctionBytes("foo", "bar") == 11 * oneMb);
+
+    quota.release("foo", "bar", 11 * oneMb);
+    quota.release("foo", "baz", 4 * oneMb);
+    REQUIRE(quota.getUserBytes("foo") == 0);
+    REQUIRE(quota.getHostBytes() == 4 * oneMb);
+
+    // Reclaiming hands over to the reclaimer
+    std::string reclaimedUser;
+    quota.setReclaimer(
+      [&reclaimedUser](const std::string& user, const std::string&) {
+          reclaimedUser = user;
+      });
+    quota.reclaim("foo", "bar");
+    REQUIRE(reclaimedUser == "foo");
+
+    conf.functionMemoryLimitMb = originalFuncLimit;
+    conf.userMemoryLimitMb = originalUserLimit;
+    conf.memorySoftLimitPercent = originalSoftLimit;
+}
+
+TEST_CASE("Test memory growth limited by quota", "[wasm]")
+{
+    cleanSystem();
+
+    conf::FaasmConfig& conf = conf::getFaasmConfig();
+    int originalFuncLimit = conf.functionMemoryLimitMb;
+
+    faabric::Message call = faabric::util::messageFactory("demo", "echo");
+    wasm::MemoryQuota& quota = wasm::getMemoryQuota();
+    size_t quotaBefore = quota.getFunctionBytes("demo", "echo");
+
+    {
+        wasm::WAVMWasmModule module;
+        module.bindToFunction(call);
+
+        // Module's memory is charged to the function
+        size_t memSize = module.getMemorySizeBytes();
+        REQUIRE(quota.getFunctionBytes("demo", "echo") ==
+                quotaBefore + memSize);
+
+        // Limit to just above what's in use
+        size_t limitMb = (quotaBefore + memSize) / ONE_MB_BYTES + 2;
+        conf.functionMemoryLimitMb = limitMb;
+
+        // Growth within the limit succeeds
+        module.growMemory(ONE_MB_BYTES);
+        REQUIRE(quota.getFunctionBytes("demo", "echo") ==
+                quotaBefore + memSize + ONE_MB_BYTES);
+
+        // Growth over the limit fails, leaving the memory as it was
+        REQUIRE(module.growMemory(4 * ONE_MB_BYTES) == MEMORY_GROW_FAILED);
+        REQUIRE(module.mmapMemory(4 * ONE_MB_BYTES) == MEMORY_GROW_FAILED);
+        REQUIRE(module.getMemorySizeBytes() == memSize + ONE_MB_BYTES);
+        REQUIRE(quota.getFunctionBytes("demo", "echo") ==
+                quotaBefore + memSize + ONE_MB_BYTES);
+    }
+
+    // Charge is released with the module
+    REQUIRE(quota.getFunctionBytes("demo", "echo") == quotaBefore);
+
+    conf.functionMemoryLimitMb = originalFuncLimit;
 }
 
 TEST_CASE("Test mmap/munmap", "[faaslet]")
@@ -2,7 +2,9 @@
 
 #include "utils.h"
 
+#include <conf/FaasmConfig.h>
 #include <faabric/proto/faabric.pb.h>
+#include <faabric/runner/FaabricMain.h>
 #include <faabric/scheduler/Scheduler.h>
 #include <faabric/snapshot/SnapshotRegistry.h>
 #include <faabric/util/config.h>
@@ -34,6 +36,124 @@ TEST_CASE("Test static for scheduling", "[wasm][openmp]")
     doOmpTestLocal("for_static_schedule");
 }
 
+TEST_CASE("Test dynamic and guided for scheduling", "[wasm][openmp]")
+{
+    cleanSystem();
+
+    faabric::util::SystemConfig& conf = faabric::util::getSystemConfig();
+    int32_t initialCpu = conf.overrideCpuCount;
+    conf.overrideCpuCount = 15;
+
+    conf::FaasmConfig& faasmConf = conf::getFaasmConfig();
+
+    std::string function;
+    SECTION("Local threads")
+    {
+        faasmConf.ompLocalFork = "on";
+
+        SECTION("Dynamic") { function = "for_dynamic_schedule"; }
+
+        SECTION("Guided") { function = "for_guided_schedule"; }
+    }
+
+    SECTION("Snapshot and schedule")
+    {
+        faasmConf.ompLocalFork = "off";
+
+        SECTION("Dynamic") { function = "for_dynamic_schedule"; }
+
+        SECTION("Guided") { function = "for_guided_schedule"; }
+    }
+
+    faabric::Message msg = faabric::util::messageFactory("omp", function);
+    execFuncWithPool(msg, false, OMP_TEST_TIMEOUT_MS);
+
+    conf.overrideCpuCount = initialCpu;
+    faasmConf.reset();
+}
+
+TEST_CASE("Test tasks with and without local threads", "[wasm][openmp]")
+{
+    cleanSystem();
+
+    faabric::util::SystemConfig& conf = faabric::util::getSystemConfig();
+    int32_t initialCpu = conf.overrideCpuCount;
+    conf.overrideCpuCount = 15;
+
+    conf::FaasmConfig& faasmConf = conf::getFaasmConfig();
+
+    std::string function;
+    SECTION("Local threads")
+    {
+        faasmConf.ompLocalFork = "on";
+
+        SECTION("Task") { function = "task_basic"; }
+
+        SECTION("Taskwait") { function = "taskwait"; }
+
+        SECTION("Taskgroup") { function = "taskgroup"; }
+    }
+
+    SECTION("Snapshot and schedule")
+    {
+        faasmConf.ompLocalFork = "off";
+
+        SECTION("Task") { function = "task_basic"; }
+
+        SECTION("Taskwait") { function = "taskwait"; }
+
+        SECTION("Taskgroup") { function = "taskgroup"; }
+    }
+
+    faabric::Message msg = faabric::util::messageFactory("omp", function);
+    execFuncWithPool(msg, false, OMP_TEST_TIMEOUT_MS);
+
+    conf.overrideCpuCount = initialCpu;
+    faasmConf.reset();
+}
+
+TEST_CASE("Test OpenMP thread failing before a barrier", "[wasm][openmp]")
+{
+    cleanSystem();
+
+    faabric::util::SystemConfig& conf = faabric::util::getSystemConfig();
+    int32_t initialCpu = conf.overrideCpuCount;
+    conf.overrideCpuCount = 15;
+
+    conf::FaasmConfig& faasmConf = conf::getFaasmConfig();
+    std::string originalNsMode = faasmConf.netNsMode;
+    faasmConf.netNsMode = "off";
+
+    SECTION("Local threads") { faasmConf.ompLocalFork = "on"; }
+
+    SECTION("Snapshot and schedule") { faasmConf.ompLocalFork = "off"; }
+
+    faabric::scheduler::Scheduler& sch = faabric::scheduler::getScheduler();
+    sch.shutdown();
+    sch.addHostToGlobalSet();
+
+    auto fac = std::make_shared<faaslet::FaasletFactory>();
+    faabric::runner::FaabricMain m(fac);
+    m.startRunner();
+
+    // A non-master thread traps before the barrier, which mustn't leave the
+    // rest of the team waiting for it
+    faabric::Message msg =
+      faabric::util::messageFactory("omp", "barrier_thread_trap");
+    sch.callFunction(msg);
+
+    faabric::Message result =
+      sch.getFunctionResult(msg.id(), OMP_TEST_TIMEOUT_MS);
+    REQUIRE(result.type() != faabric::Message_MessageType_EMPTY);
+    REQUIRE(result.returnvalue() > 0);
+
+    m.shutdown();
+
+    faasmConf.netNsMode = originalNsMode;
+    conf.overrideCpuCount = initialCpu;
+    faasmConf.reset();
+}
+
 TEST_CASE("Test OMP header API functions", "[wasm][openmp]")
 {
     doOmpTestLocal("header_api_support");
@@ -99,6 +219,68 @@ TEST_CASE("Test openmp Pi calculation", "[wasm][openmp]")
     doOmpTestLocal("mt_pi");
 }
 
+TEST_CASE("Test OpenMP fork with and without local threads", "[wasm][openmp]")
+{
+    cleanSystem();
+
+    faabric::util::SystemConfig& conf = faabric::util::getSystemConfig();
+    int32_t initialCpu = conf.overrideCpuCount;
+    conf.overrideCpuCount = 15;
+
+    conf::FaasmConfig& faasmConf = conf::getFaasmConfig();
+
+    SECTION("Local threads") { faasmConf.ompLocalFork = "on"; }
+
+    SECTION("Snapshot and schedule") { faasmConf.ompLocalFork = "off"; }
+
+    faabric::Message msg =
+      faabric::util::messageFactory("omp", "simple_critical");
+    execFuncWithPool(msg, false, OMP_TEST_TIMEOUT_MS);
+
+    conf.overrideCpuCount = initialCpu;
+    faasmConf.reset();
+}
+
+TEST_CASE("Test reductions with and without local threads", "[wasm][openmp]")
+{
+    cleanSystem();
+
+    faabric::util::SystemConfig& conf = faabric::util::getSystemConfig();
+    int32_t initialCpu = conf.overrideCpuCount;
+    conf.overrideCpuCount = 15;
+
+    conf::FaasmConfig& faasmConf = conf::getFaasmConfig();
+
+    std::string function;
+    SECTION("Local threads")
+    {
+        faasmConf.ompLocalFork = "on";
+
+        SECTION("Simple") { function = "simple_reduce"; }
+
+        SECTION("Custom") { function = "custom_reduce"; }
+
+        SECTION("Complex") { function = "complex_reduce"; }
+    }
+
+    SECTION("Snapshot and schedule")
+    {
+        faasmConf.ompLocalFork = "off";
+
+        SECTION("Simple") { function = "simple_reduce"; }
+
+        SECTION("Custom") { function = "custom_reduce"; }
+
+        SECTION("Complex") { function = "complex_reduce"; }
+    }
+
+    faabric::Message msg = faabric::util::messageFactory("omp", function);
+    execFuncWithPool(msg, false, OMP_TEST_TIMEOUT_MS);
+
+    conf.overrideCpuCount = initialCpu;
+    faasmConf.reset();
+}
+
 TEST_CASE("Test getting and setting num threads", "[wasm][openmp]")
 {
     doOmpTestLocal("setting_num_threads");
@@ -4,9 +4,15 @@
 
 #include <boost/filesystem.hpp>
 
+#include <conf/FaasmConfig.h>
+#include <faabric/snapshot/SnapshotRegistry.h>
 #include <faabric/util/func.h>
+#include <wasm/LazyRestore.h>
+#include <wasm/SparseSnapshot.h>
 #include <wavm/WAVMWasmModule.h>
 
+#include <unistd.h>
+
 using namespace wasm;
 
 namespace tests {
@@ -92,4 +98,169 @@ TEST_CASE("Test snapshot and restore for wasm module", "[wasm][snapshot]")
     int returnValueC = moduleC.executeFunction(m);
     REQUIRE(returnValueC == 0);
 }
+
+TEST_CASE("Test sparse snapshot regions", "[wasm][snapshot]")
+{
+    uint32_t pageSize = sysconf(_SC_PAGESIZE);
+    std::vector<uint8_t> base(4 * pageSize, 1);
+    std::vector<uint8_t> memory(6 * pageSize, 0);
+    std::copy(base.begin(), base.end(), memory.begin());
+
+    // Change a page within the base and one beyond it
+    memory[pageSize + 10] = 5;
+    memory[5 * pageSize] = 7;
+
+    // Changes to skipped pages are ignored
+    memory[3 * pageSize] = 9;
+    std::vector<std::pair<uint32_t, uint32_t>> skipRegions = {
+        { 3 * pageSize, pageSize }
+    };
+
+    std::vector<std::pair<uint32_t, uint32_t>> regions =
+      getChangedRegions(memory.data(),
+                        memory.size(),
+                        base.data(),
+                        base.size(),
+                        skipRegions);
+
+    std::vector<std::pair<uint32_t, uint32_t>> expectedRegions = {
+        { pageSize, pageSize },
+        { 5 * pageSize, pageSize },
+    };
+    REQUIRE(regions == expectedRegions);
+
+    std::vector<uint8_t> data = serialiseSparseSnapshot(
+      memory.data(), memory.size(), base.size(), regions);
+    REQUIRE(data.size() < 3 * pageSize);
+
+    SparseSnapshotHeader header =
+      readSparseSnapshotHeader(data.data(), data.size());
+    REQUIRE(header.memorySize == memory.size());
+    REQUIRE(header.baseSize == base.size());
+    REQUIRE(header.nRegions == 2);
+
+    // Applying to the base gives back the memory, bar the skipped page
+    std::vector<uint8_t> restored(6 * pageSize, 0);
+    std::copy(base.begin(), base.end(), restored.begin());
+    applySparseSnapshot(data.data(), data.size(), restored.data());
+
+    memory[3 * pageSize] = 1;
+    REQUIRE(restored == memory);
+
+    // Corrupt snapshots are rejected
+    data[0] = 0;
+    REQUIRE_THROWS(readSparseSnapshotHeader(data.data(), data.size()));
+}
+
+TEST_CASE("Test sparse snapshot and restore for wasm module",
+          "[wasm][snapshot]")
+{
+    cleanSystem();
+
+    conf::FaasmConfig& conf = conf::getFaasmConfig();
+    std::string originalSnapshotMode = conf.snapshotMode;
+    std::string originalResetMode = conf.resetMode;
+    conf.snapshotMode = "sparse";
+
+    // Sparse restores remap from the zygote in either reset mode
+    SECTION("Clone reset") { conf.resetMode = "clone"; }
+
+    SECTION("Copy-on-write reset") { conf.resetMode = "cow"; }
+
+    faabric::Message m = faabric::util::messageFactory("demo", "echo");
+
+    wasm::WAVMWasmModule moduleA;
+    moduleA.bindToFunction(m);
+
+    uint32_t memSize = 10 * WASM_BYTES_PER_PAGE;
+    uint32_t wasmPtr = moduleA.growMemory(memSize);
+    uint8_t* nativePtr = moduleA.wasmPointerToNative(wasmPtr);
+    nativePtr[0] = 1;
+    nativePtr[5 * WASM_BYTES_PER_PAGE] = 2;
+
+    size_t storedBefore = getStoredSparseSnapshotCount();
+    std::string snapKey = moduleA.snapshot(false);
+    REQUIRE(isSparseSnapshotKey(snapKey));
+    REQUIRE(getStoredSparseSnapshotCount() == storedBefore + 1);
+
+    // Only the changed pages are held
+    faabric::snapshot::SnapshotRegistry& reg =
+      faabric::snapshot::getSnapshotRegistry();
+    faabric::util::SnapshotData data = reg.getSnapshot(snapKey);
+    REQUIRE(data.size < memSize);
+
+    // Restoring undoes changes made to the other module
+    wasm::WAVMWasmModule moduleB;
+    moduleB.bindToFunction(m);
+    moduleB.growMemory(2 * memSize);
+    moduleB.wasmPointerToNative(wasmPtr)[1] = 3;
+
+    WAVM::Runtime::Compartment* compartmentBefore = moduleB.compartment;
+    moduleB.restore(snapKey);
+    REQUIRE(moduleB.compartment == compartmentBefore);
+
+    uint32_t brk = moduleA.getCurrentBrk();
+    REQUIRE(moduleB.getCurrentBrk() == brk);
+    REQUIRE(std::memcmp(moduleA.wasmPointerToNative(0),
+                        moduleB.wasmPointerToNative(0),
+                        brk) == 0);
+
+    int returnValue = moduleB.executeFunction(m);
+    REQUIRE(returnValue == 0);
+
+    reg.deleteSnapshot(snapKey);
+    releaseSparseSnapshot(snapKey);
+    REQUIRE(getStoredSparseSnapshotCount() == storedBefore);
+
+    conf.snapshotMode = originalSnapshotMode;
+    conf.resetMode = originalResetMode;
+}
+
+TEST_CASE("Test lazy snapshot restore for wasm module", "[wasm][snapshot]")
+{
+    cleanSystem();
+    clearHotPages();
+
+    conf::FaasmConfig& conf = conf::getFaasmConfig();
+    std::string originalRestoreMode = conf.restoreMode;
+    conf.restoreMode = "lazy";
+
+    faabric::Message m = faabric::util::messageFactory("demo", "echo");
+
+    wasm::WAVMWasmModule moduleA;
+    moduleA.bindToFunction(m);
+
+    uint32_t memSize = 10 * WASM_BYTES_PER_PAGE;
+    uint32_t wasmPtr = moduleA.growMemory(memSize);
+    uint8_t* nativePtr = moduleA.wasmPointerToNative(wasmPtr);
+    std::fill(nativePtr, nativePtr + memSize, 4);
+
+    std::string snapKey = moduleA.snapshot();
+
+    // Without userfaultfd this falls back to mapping the snapshot
+    wasm::WAVMWasmModule moduleB;
+    moduleB.bindToFunction(m);
+    moduleB.restore(snapKey);
+
+    uint32_t brk = moduleA.getCurrentBrk();
+    REQUIRE(moduleB.getCurrentBrk() == brk);
+    REQUIRE(std::memcmp(moduleA.wasmPointerToNative(0),
+                        moduleB.wasmPointerToNative(0),
+                        brk) == 0);
+
+    if (moduleB.isRestoringLazily()) {
+        // Pages touched are recorded to be prefetched next time
+        moduleB.restore(snapKey);
+        REQUIRE(!getHotPages("demo/echo").empty());
+
+        REQUIRE(std::memcmp(moduleA.wasmPointerToNative(0),
+                            moduleB.wasmPointerToNative(0),
+                            brk) == 0);
+    }
+
+    int returnValue = moduleB.executeFunction(m);
+    REQUIRE(returnValue == 0);
+
+    conf.restoreMode = originalRestoreMode;
+}
 }
@@ -5,8 +5,11 @@
 #include <faabric/util/config.h>
 #include <faabric/util/func.h>
 
+#include <conf/FaasmConfig.h>
 #include <wavm/WAVMWasmModule.h>
 
+#include <cstring>
+
 using namespace WAVM;
 
 namespace tests {
@@ -146,6 +149,87 @@ TEST_CASE("Test reclaiming memory", "[wasm]")
     REQUIRE(pagesAfter == initialPages);
 }
 
+TEST_CASE("Test copy-on-write reset", "[wasm]")
+{
+    cleanSystem();
+
+    conf::FaasmConfig& conf = conf::getFaasmConfig();
+
+    faabric::Message call = faabric::util::messageFactory("demo", "x2");
+
+    std::string expectedMode;
+    SECTION("Clone") { expectedMode = "clone"; }
+
+    SECTION("Copy-on-write") { expectedMode = "cow"; }
+
+    conf.resetMode = expectedMode;
+
+    wasm::WAVMWasmModule module;
+    module.bindToFunction(call);
+
+    std::shared_ptr<wasm::WAVMWasmModule> zygote =
+      wasm::getWAVMModuleCache().getCachedModule(call);
+    size_t zygoteBytes = zygote->getMemorySizeBytes();
+    uint32_t zygoteBrk = zygote->getCurrentBrk();
+
+    // Dirty some of the zygote's memory and grow past it
+    uint8_t* memBase = module.getMemoryBase();
+    std::vector<uint8_t> zygoteMem(zygote->getMemoryBase(),
+                                   zygote->getMemoryBase() + zygoteBytes);
+    std::memset(memBase + WASM_BYTES_PER_PAGE, 7, WASM_BYTES_PER_PAGE);
+
+    uint32_t grownOffset = module.growMemory(WASM_BYTES_PER_PAGE);
+    std::memset(memBase + grownOffset, 7, WASM_BYTES_PER_PAGE);
+
+    executeX2(module);
+
+    module.reset(call);
+
+    // Check memory is back to the zygote's
+    REQUIRE(module.getCurrentBrk() == zygoteBrk);
+    std::vector<uint8_t> memAfter(module.getMemoryBase(),
+                                  module.getMemoryBase() + zygoteBytes);
+    REQUIRE(memAfter == zygoteMem);
+
+    // Any memory left from growth must be zeroed
+    if (module.getMemorySizeBytes() > zygoteBytes) {
+        uint8_t* grownPtr = module.getMemoryBase() + grownOffset;
+        std::vector<uint8_t> grownAfter(grownPtr,
+                                        grownPtr + WASM_BYTES_PER_PAGE);
+        REQUIRE(grownAfter == std::vector<uint8_t>(WASM_BYTES_PER_PAGE, 0));
+    }
+
+    // Check repeat executions and resets work
+    executeX2(module);
+    module.reset(call);
+    executeX2(module);
+    module.reset(call);
+
+    if (expectedMode == "cow") {
+        // Once mapped from the zygote, only written pages are dirty
+        REQUIRE(module.getDirtyRegions().empty());
+
+        uint32_t dirtyOffset = 2 * WASM_BYTES_PER_PAGE;
+        module.getMemoryBase()[dirtyOffset] = 7;
+
+        std::vector<std::pair<uint32_t, uint32_t>> dirtyRegions =
+          module.getDirtyRegions();
+        REQUIRE(dirtyRegions.size() == 1);
+        REQUIRE(dirtyRegions.at(0).first <= dirtyOffset);
+        REQUIRE(dirtyRegions.at(0).first + dirtyRegions.at(0).second >
+                dirtyOffset);
+
+        module.reset(call);
+
+        REQUIRE(module.getDirtyRegions().empty());
+        REQUIRE(module.getMemoryBase()[dirtyOffset] == zygoteMem[dirtyOffset]);
+    } else {
+        REQUIRE_THROWS(module.getDirtyRegions());
+    }
+
+    conf.reset();
+}
+
 TEST_CASE("Test disassemble module", "[wasm]")
 {
     cleanSystem();
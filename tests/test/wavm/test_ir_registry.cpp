@@ -3,11 +3,16 @@
 #include <faabric/util/bytes.h>
 #include <faabric/util/files.h>
 #include <faabric/util/func.h>
+#include <faabric/util/macros.h>
 
 #include <conf/function_utils.h>
 #include <storage/FileLoader.h>
 #include <wavm/IRModuleCache.h>
 
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 namespace tests {
 void checkObjCode(const Runtime::ModuleRef moduleRef, const std::string& path)
 {
@@ -30,9 +35,11 @@ TEST_CASE("Test main module caching", "[wasm]")
     faabric::Message msgB = faabric::util::messageFactory(user, funcB);
 
     // Get once via both means
-    IR::Module& moduleRefA1 = registry.getModule(user, funcA, "");
+    std::shared_ptr<IR::Module> moduleRefA1 =
+      registry.getModule(user, funcA, "");
     Runtime::ModuleRef objRefA1 = registry.getCompiledModule(user, funcA, "");
-    IR::Module& moduleRefB1 = registry.getModule(user, funcB, "");
+    std::shared_ptr<IR::Module> moduleRefB1 =
+      registry.getModule(user, funcB, "");
     Runtime::ModuleRef objRefB1 = registry.getCompiledModule(user, funcB, "");
 
     // Check they are reported as cached
@@ -42,31 +49,33 @@ TEST_CASE("Test main module caching", "[wasm]")
     REQUIRE(registry.isCompiledModuleCached(user, funcB, ""));
 
     // And again
-    IR::Module& moduleRefA2 = registry.getModule(user, funcA, "");
+    std::shared_ptr<IR::Module> moduleRefA2 =
+      registry.getModule(user, funcA, "");
     Runtime::ModuleRef objRefA2 = registry.getCompiledModule(user, funcA, "");
-    IR::Module& moduleRefB2 = registry.getModule(user, funcB, "");
+    std::shared_ptr<IR::Module> moduleRefB2 =
+      registry.getModule(user, funcB, "");
     Runtime::ModuleRef objRefB2 = registry.getCompiledModule(user, funcB, "");
 
     // Sanity check the modules
-    REQUIRE(!moduleRefA1.exports.empty());
-    REQUIRE(!moduleRefB1.exports.empty());
-    REQUIRE(moduleRefA1.memories.defs[0].type.size.max == MAX_MEMORY_PAGES);
-    REQUIRE(moduleRefA1.tables.defs[0].type.size.max == MAX_TABLE_SIZE);
+    REQUIRE(!moduleRefA1->exports.empty());
+    REQUIRE(!moduleRefB1->exports.empty());
+    REQUIRE(moduleRefA1->memories.defs[0].type.size.max == MAX_MEMORY_PAGES);
+    REQUIRE(moduleRefA1->tables.defs[0].type.size.max == MAX_TABLE_SIZE);
 
     // Check features are as expected
-    REQUIRE(moduleRefA1.featureSpec.simd);
-    REQUIRE(moduleRefA2.featureSpec.simd);
-    REQUIRE(moduleRefB1.featureSpec.simd);
-    REQUIRE(moduleRefB2.featureSpec.simd);
+    REQUIRE(moduleRefA1->featureSpec.simd);
+    REQUIRE(moduleRefA2->featureSpec.simd);
+    REQUIRE(moduleRefB1->featureSpec.simd);
+    REQUIRE(moduleRefB2->featureSpec.simd);
 
     // Check references are equal
-    REQUIRE(std::addressof(moduleRefA1) == std::addressof(moduleRefA2));
+    REQUIRE(moduleRefA1.get() == moduleRefA2.get());
     REQUIRE(objRefA1 == objRefA2);
-    REQUIRE(std::addressof(moduleRefB1) == std::addressof(moduleRefB2));
+    REQUIRE(moduleRefB1.get() == moduleRefB2.get());
     REQUIRE(objRefB1 == objRefB2);
 
     // Check different module references are different
-    REQUIRE(std::addressof(moduleRefA1) != std::addressof(moduleRefB1));
+    REQUIRE(moduleRefA1.get() != moduleRefB1.get());
     REQUIRE(objRefA1 != objRefB1);
 
     const std::string objPathA = conf::getFunctionObjectFile(msgA);
@@ -93,9 +102,9 @@ TEST_CASE("Test shared library caching", "[wasm]")
                         "site-packages/numpy/linalg/_umath_linalg.so";
 
     // Once
-    IR::Module& refA1 = registry.getModule(user, func, pathA);
+    std::shared_ptr<IR::Module> refA1 = registry.getModule(user, func, pathA);
     Runtime::ModuleRef objRefA1 = registry.getCompiledModule(user, func, pathA);
-    IR::Module& refB1 = registry.getModule(user, func, pathB);
+    std::shared_ptr<IR::Module> refB1 = registry.getModule(user, func, pathB);
     Runtime::ModuleRef objRefB1 = registry.getCompiledModule(user, func, pathB);
 
     // Check they are reported as cached
@@ -105,29 +114,29 @@ TEST_CASE("Test shared library caching", "[wasm]")
     REQUIRE(registry.isCompiledModuleCached(user, func, pathB));
 
     // Again
-    IR::Module& refA2 = registry.getModule(user, func, pathA);
+    std::shared_ptr<IR::Module> refA2 = registry.getModule(user, func, pathA);
     Runtime::ModuleRef objRefA2 = registry.getCompiledModule(user, func, pathA);
-    IR::Module& refB2 = registry.getModule(user, func, pathB);
+    std::shared_ptr<IR::Module> refB2 = registry.getModule(user, func, pathB);
     Runtime::ModuleRef objRefB2 = registry.getCompiledModule(user, func, pathB);
 
     // Sanity checks
-    REQUIRE(!refA1.exports.empty());
-    REQUIRE(!refB1.exports.empty());
+    REQUIRE(!refA1->exports.empty());
+    REQUIRE(!refB1->exports.empty());
 
     // Check features enabled
-    REQUIRE(refA1.featureSpec.simd);
-    REQUIRE(refA2.featureSpec.simd);
-    REQUIRE(refB1.featureSpec.simd);
-    REQUIRE(refB2.featureSpec.simd);
+    REQUIRE(refA1->featureSpec.simd);
+    REQUIRE(refA2->featureSpec.simd);
+    REQUIRE(refB1->featureSpec.simd);
+    REQUIRE(refB2->featureSpec.simd);
 
     // Check references are equal
-    REQUIRE(std::addressof(refA1) == std::addressof(refA2));
+    REQUIRE(refA1.get() == refA2.get());
     REQUIRE(objRefA1 == objRefA2);
-    REQUIRE(std::addressof(refB1) == std::addressof(refB2));
+    REQUIRE(refB1.get() == refB2.get());
     REQUIRE(objRefB1 == objRefB2);
 
     // Check different module references are different
-    REQUIRE(std::addressof(refA1) != std::addressof(refB1));
+    REQUIRE(refA1.get() != refB1.get());
     REQUIRE(objRefA1 != objRefB1);
 
     // Check object code loaded matches file
@@ -167,4 +176,76 @@ TEST_CASE("Test IR cache clearing", "[wasm]")
     REQUIRE(!registry.isModuleCached(user, func, libPath));
     REQUIRE(!registry.isCompiledModuleCached(user, func, libPath));
 }
+
+TEST_CASE("Test loading distinct modules in parallel", "[wasm]")
+{
+    wasm::IRModuleCache& registry = wasm::getIRModuleCache();
+    registry.clear();
+
+    std::string user = "demo";
+    std::vector<std::string> funcs = { "echo", "x2", "hello", "dummy" };
+
+    // Each load waits for another key to start loading, which can only
+    // happen if loads of different keys aren't serialised
+    std::mutex loadMx;
+    std::condition_variable loadCv;
+    int nStarted = 0;
+    int nInFlight = 0;
+    int maxInFlight = 0;
+    registry.setLoadCallback([&](const std::string& key) {
+        UNUSED(key);
+
+        std::unique_lock<std::mutex> lock(loadMx);
+        nStarted++;
+        nInFlight++;
+        maxInFlight = std::max(maxInFlight, nInFlight);
+        loadCv.notify_all();
+
+        loadCv.wait_for(lock, std::chrono::seconds(5), [&nStarted] {
+            return nStarted >= 2;
+        });
+        nInFlight--;
+    });
+
+    // Load all at once, with several threads requesting each function
+    int nThreadsPerFunc = 3;
+    std::vector<Runtime::ModuleRef> results(funcs.size() * nThreadsPerFunc);
+    std::vector<std::thread> threads;
+
+    for (size_t i = 0; i < results.size(); i++) {
+        threads.emplace_back([&registry, &results, &funcs, &user, i] {
+            const std::string& f = funcs.at(i % funcs.size());
+            registry.getModule(user, f, "");
+            results.at(i) = registry.getCompiledModule(user, f, "");
+        });
+    }
+
+    for (auto& t : threads) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+
+    registry.setLoadCallback(nullptr);
+
+    // Check each function was only loaded once, and distinct functions got
+    // distinct modules
+    for (size_t i = 0; i < results.size(); i++) {
+        REQUIRE(results.at(i) != nullptr);
+        REQUIRE(results.at(i) == results.at(i % funcs.size()));
+
+        if (i > 0 && i < funcs.size()) {
+            REQUIRE(results.at(i) != results.at(i - 1));
+        }
+    }
+
+    for (const auto& f : funcs) {
+        REQUIRE(registry.isModuleCached(user, f, ""));
+        REQUIRE(registry.isCompiledModuleCached(user, f, ""));
+    }
+
+    // Loading in parallel should not be serialised behind a single lock
+    REQUIRE(nStarted == (int)funcs.size());
+    REQUIRE(maxInFlight >= 2);
+}
 }
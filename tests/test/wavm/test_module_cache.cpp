@@ -6,6 +6,8 @@
 #include <faabric/util/func.h>
 #include <faabric/util/macros.h>
 
+#include <conf/FaasmConfig.h>
+
 #include <wavm/WAVMWasmModule.h>
 
 namespace tests {
@@ -29,18 +31,126 @@ TEST_CASE("Test creating cached WAVM modules", "[wasm]")
     msgA.set_inputdata(BYTES(input), 3 * sizeof(int));
 
     wasm::WAVMModuleCache& registry = wasm::getWAVMModuleCache();
-    wasm::WasmModule& moduleA = registry.getCachedModule(msgA);
-    wasm::WasmModule& moduleB = registry.getCachedModule(msgB);
+    std::shared_ptr<wasm::WAVMWasmModule> moduleA =
+      registry.getCachedModule(msgA);
+    std::shared_ptr<wasm::WAVMWasmModule> moduleB =
+      registry.getCachedModule(msgB);
 
     // Check modules are the same
-    REQUIRE(std::addressof(moduleA) == std::addressof(moduleB));
-    REQUIRE(moduleA.isBound());
+    REQUIRE(moduleA.get() == moduleB.get());
+    REQUIRE(moduleA->isBound());
 
     // Execute the function normally and make sure cached module is not used
     faaslet::Faaslet faaslet(msgA);
     int returnValue = faaslet.executeTask(0, 0, req);
     REQUIRE(returnValue == 0);
 
-    REQUIRE(std::addressof(moduleA) != std::addressof(*faaslet.module));
+    REQUIRE(moduleA.get() != faaslet.module.get());
+}
+
+TEST_CASE("Test cached WAVM module eviction", "[wasm]")
+{
+    cleanSystem();
+
+    conf::FaasmConfig& conf = conf::getFaasmConfig();
+    int originalMaxMb = conf.moduleCacheMaxMb;
+
+    wasm::WAVMModuleCache& registry = wasm::getWAVMModuleCache();
+    wasm::IRModuleCache& irRegistry = wasm::getIRModuleCache();
+
+    faabric::Message msgA = faabric::util::messageFactory("demo", "echo");
+    faabric::Message msgB = faabric::util::messageFactory("demo", "x2");
+    faabric::Message msgC = faabric::util::messageFactory("demo", "hello");
+
+    SECTION("Unbounded cache")
+    {
+        conf.moduleCacheMaxMb = 0;
+
+        registry.getCachedModule(msgA);
+        registry.getCachedModule(msgB);
+        registry.getCachedModule(msgC);
+        registry.getCachedModule(msgA);
+
+        wasm::ModuleCacheStats stats = registry.getStats();
+        REQUIRE(stats.entries == 3);
+        REQUIRE(stats.misses == 3);
+        REQUIRE(stats.hits == 1);
+        REQUIRE(stats.evictions == 0);
+        REQUIRE(stats.bytes == registry.getTotalBytes());
+        REQUIRE(stats.bytes > 0);
+    }
+
+    SECTION("Bounded cache")
+    {
+        // Budget is smaller than a single module so everything not in use is
+        // evicted
+        conf.moduleCacheMaxMb = 1;
+
+        std::shared_ptr<wasm::WAVMWasmModule> moduleA =
+          registry.getCachedModule(msgA);
+        registry.getCachedModule(msgB);
+        registry.getCachedModule(msgC);
+
+        wasm::ModuleCacheStats stats = registry.getStats();
+        REQUIRE(stats.misses == 3);
+        REQUIRE(stats.evictions > 0);
+
+        // Module still in use must not have been evicted
+        std::shared_ptr<wasm::WAVMWasmModule> moduleA2 =
+          registry.getCachedModule(msgA);
+        REQUIRE(moduleA.get() == moduleA2.get());
+        REQUIRE(moduleA2->isBound());
+
+        // Evicted modules are recreated on demand
+        std::shared_ptr<wasm::WAVMWasmModule> moduleB =
+          registry.getCachedModule(msgB);
+        REQUIRE(moduleB->isBound());
+        REQUIRE(registry.getStats().misses == 4);
+    }
+
+    conf.moduleCacheMaxMb = originalMaxMb;
+    registry.clear();
+    irRegistry.clear();
+}
+
+TEST_CASE("Test evicting zygotes frees their compiled modules", "[wasm]")
+{
+    cleanSystem();
+
+    conf::FaasmConfig& conf = conf::getFaasmConfig();
+    int originalMaxMb = conf.moduleCacheMaxMb;
+
+    wasm::WAVMModuleCache& registry = wasm::getWAVMModuleCache();
+    wasm::IRModuleCache& irRegistry = wasm::getIRModuleCache();
+
+    faabric::Message msgA = faabric::util::messageFactory("demo", "echo");
+    faabric::Message msgB = faabric::util::messageFactory("demo", "x2");
+    faabric::Message msgC = faabric::util::messageFactory("demo", "hello");
+
+    // Work out what one function takes, zygote and modules together
+    conf.moduleCacheMaxMb = 0;
+    registry.getCachedModule(msgA);
+    size_t functionBytes =
+      registry.getTotalBytes() + irRegistry.getTotalBytes();
+    registry.clear();
+    irRegistry.clear();
+
+    // Leave room for one function and a half, so loading more only fits if
+    // the compiled modules of evicted zygotes go too
+    size_t oneMb = 1024 * 1024;
+    conf.moduleCacheMaxMb = (int)((functionBytes * 3 / 2 + oneMb - 1) / oneMb);
+    size_t maxBytes = conf.moduleCacheMaxMb * oneMb;
+
+    registry.getCachedModule(msgA);
+    registry.getCachedModule(msgB);
+    registry.getCachedModule(msgC);
+
+    REQUIRE(registry.getStats().evictions > 0);
+    REQUIRE(irRegistry.getStats().evictions > 0);
+    REQUIRE(registry.getTotalBytes() + irRegistry.getTotalBytes() <= maxBytes);
+
+    conf.moduleCacheMaxMb = originalMaxMb;
+    registry.clear();
+    irRegistry.clear();
 }
 }
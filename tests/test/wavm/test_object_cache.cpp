@@ -0,0 +1,113 @@
+#include <catch2/catch.hpp>
+
+#include "utils.h"
+
+#include <faabric/util/files.h>
+#include <faabric/util/func.h>
+
+#include <storage/FileLoader.h>
+#include <wavm/IRModuleCache.h>
+#include <wavm/ObjectCache.h>
+
+#include <boost/filesystem.hpp>
+
+using namespace WAVM;
+
+namespace tests {
+TEST_CASE("Test object cache keys", "[wasm]")
+{
+    wasm::WAVMObjectCache& cache = wasm::getWAVMObjectCache();
+
+    std::vector<uint8_t> hashA = { 0, 1, 2, 3 };
+    std::vector<uint8_t> hashB = { 0, 1, 2, 4 };
+
+    IR::Module moduleA;
+    moduleA.featureSpec.simd = true;
+
+    IR::Module moduleB;
+    moduleB.featureSpec.simd = false;
+
+    std::string keyA = cache.getKey(hashA, moduleA);
+    REQUIRE(keyA == cache.getKey(hashA, moduleA));
+    REQUIRE(keyA.rfind("00010203_", 0) == 0);
+
+    REQUIRE(keyA != cache.getKey(hashB, moduleA));
+    REQUIRE(keyA != cache.getKey(hashA, moduleB));
+}
+
+TEST_CASE("Test storing and loading cached objects", "[wasm]")
+{
+    cleanSystem();
+
+    wasm::WAVMObjectCache& cache = wasm::getWAVMObjectCache();
+    cache.clear();
+
+    std::string key = "foo";
+    std::vector<uint8_t> objBytes = { 5, 4, 3, 2, 1 };
+
+    REQUIRE(cache.load(key).empty());
+
+    cache.store(key, objBytes);
+    REQUIRE(cache.load(key) == objBytes);
+
+    // Corrupt the object and check it's discarded
+    std::string objPath = cache.getCacheDir() + "/" + key + OBJECT_CACHE_EXT;
+    faabric::util::writeBytesToFile(objPath, { 1, 1, 1 });
+
+    REQUIRE(cache.load(key).empty());
+    REQUIRE(!boost::filesystem::exists(objPath));
+
+    cache.clear();
+}
+
+TEST_CASE("Test stale object files are not loaded", "[wasm]")
+{
+    cleanSystem();
+
+    wasm::WAVMObjectCache& objectCache = wasm::getWAVMObjectCache();
+    objectCache.clear();
+
+    wasm::IRModuleCache& registry = wasm::getIRModuleCache();
+    registry.clear();
+
+    storage::FileLoader& loader = storage::getFileLoader();
+    faabric::Message msg = faabric::util::messageFactory("demo", "echo");
+    std::vector<uint8_t> originalHash = loader.loadFunctionObjectHash(msg);
+    std::vector<uint8_t> wasmHash =
+      storage::FileLoader::hashBytes(loader.loadFunctionWasm(msg));
+
+    std::shared_ptr<IR::Module> module = registry.getModule("demo", "echo", "");
+    std::string cacheKey = objectCache.getKey(wasmHash, *module);
+
+    SECTION("Valid object file")
+    {
+        registry.getCompiledModule("demo", "echo", "");
+
+        // Object file used as-is, nothing compiled
+        REQUIRE(objectCache.load(cacheKey).empty());
+    }
+
+    SECTION("Stale object file")
+    {
+        loader.uploadFunctionObjectHash(msg, { 1, 2, 3 });
+
+        Runtime::ModuleRef compiled =
+          registry.getCompiledModule("demo", "echo", "");
+        REQUIRE(compiled != nullptr);
+
+        // Module compiled and cached
+        std::vector<uint8_t> cachedBytes = objectCache.load(cacheKey);
+        REQUIRE(cachedBytes == Runtime::getObjectCode(compiled));
+
+        // Check cached object used after restart
+        registry.clear();
+        Runtime::ModuleRef reloaded =
+          registry.getCompiledModule("demo", "echo", "");
+        REQUIRE(Runtime::getObjectCode(reloaded) == cachedBytes);
+    }
+
+    loader.uploadFunctionObjectHash(msg, originalHash);
+    registry.clear();
+    objectCache.clear();
+}
+}